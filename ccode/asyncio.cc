@@ -0,0 +1,248 @@
+//    Copyright (C) Mike Rieker, Beverly, MA USA
+//    www.outerworldapps.com
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; version 2 of the License.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    EXPECT it to FAIL when someone's HeALTh or PROpeRTy is at RISk.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    http://www.gnu.org/licenses/gpl-2.0.html
+
+// Asynchronous file i/o so daemons can read the next block whilst dma'ing the current one
+// Uses io_uring if the kernel supports it, else falls back to a couple worker threads
+// can force worker threads with envar z11noiouring
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define HAVEIOURING 1
+#endif
+#endif
+
+#include "asyncio.h"
+#include "shmstats.h"
+#include "z11util.h"
+
+#define NENTRIES 16         // io_uring submission queue size
+#define NTHREADS 2          // worker threads if not using io_uring
+
+AsyncIO::AsyncIO (char const *progname)
+{
+    this->progname = progname;
+
+    ringfd   = -1;
+    nthreads = 0;
+    qhead    = NULL;
+    qtail    = &qhead;
+    if (pthread_cond_init (&cond, NULL) != 0) ABORT ();
+    if (pthread_mutex_init (&mutex, NULL) != 0) ABORT ();
+
+    if ((getenv ("z11noiouring") == NULL) && ! ringsetup ()) {
+        fprintf (stderr, "%s: io_uring not available, using threads\n", progname);
+    }
+}
+
+// start reading or writing
+// - req->fd,write,buf,size,off,func,param filled in
+void AsyncIO::submit (AIOReq *req)
+{
+    req->done    = false;
+    req->pooled  = (ringfd < 0) || (req->func != NULL);
+    req->startns = shmstats_nowns ();
+
+    if (! req->pooled) {
+        ringsubmit (req);
+        return;
+    }
+
+    // queue to worker threads, starting them if first time through
+    req->next = NULL;
+    if (pthread_mutex_lock (&mutex) != 0) ABORT ();
+    if (nthreads == 0) {
+        for (nthreads = 0; nthreads < NTHREADS; nthreads ++) {
+            pthread_t tid;
+            if (pthread_create (&tid, NULL, workerwrap, this) != 0) ABORT ();
+        }
+    }
+    *qtail = req;
+    qtail  = &req->next;
+    if (pthread_cond_broadcast (&cond) != 0) ABORT ();
+    if (pthread_mutex_unlock (&mutex) != 0) ABORT ();
+}
+
+// wait for request to complete
+//  returns same as pread()/pwrite()
+int AsyncIO::wait (AIOReq *req)
+{
+    if (req->pooled) {
+        if (pthread_mutex_lock (&mutex) != 0) ABORT ();
+        while (! req->done) {
+            if (pthread_cond_wait (&cond, &mutex) != 0) ABORT ();
+        }
+        if (pthread_mutex_unlock (&mutex) != 0) ABORT ();
+    } else {
+        ringreap (false);
+        while (! req->done) ringreap (true);
+    }
+    if (req->rc < 0) errno = req->err;
+    return req->rc;
+}
+
+void *AsyncIO::workerwrap (void *zhis)
+{
+    ((AsyncIO *) zhis)->worker ();
+    return NULL;
+}
+
+// worker thread - do requests from queue
+void AsyncIO::worker ()
+{
+    if (pthread_mutex_lock (&mutex) != 0) ABORT ();
+    while (true) {
+        AIOReq *req = qhead;
+        if (req == NULL) {
+            if (pthread_cond_wait (&cond, &mutex) != 0) ABORT ();
+            continue;
+        }
+        if ((qhead = req->next) == NULL) qtail = &qhead;
+        if (pthread_mutex_unlock (&mutex) != 0) ABORT ();
+
+        int rc = (req->func != NULL) ? req->func (req) :
+            req->write ? pwrite (req->fd, req->buf, req->size, req->off) :
+                         pread (req->fd, req->buf, req->size, req->off);
+        int err = errno;
+        shmstats_since (SHMSTATS_FIONS, req->startns);
+
+        if (pthread_mutex_lock (&mutex) != 0) ABORT ();
+        req->rc   = rc;
+        req->err  = err;
+        req->done = true;
+        if (pthread_cond_broadcast (&cond) != 0) ABORT ();
+    }
+}
+
+#ifdef HAVEIOURING
+
+// set up io_uring
+//  returns true: success, requests go to ring
+//         false: kernel doesn't support it, requests go to worker threads
+bool AsyncIO::ringsetup ()
+{
+    struct io_uring_params params;
+    memset (&params, 0, sizeof params);
+    int fd = syscall (__NR_io_uring_setup, NENTRIES, &params);
+    if (fd < 0) return false;
+
+    uint32_t sqsize = params.sq_off.array + params.sq_entries * sizeof (uint32_t);
+    uint32_t cqsize = params.cq_off.cqes + params.cq_entries * sizeof (struct io_uring_cqe);
+    uint8_t *sqring = (uint8_t *) mmap (NULL, sqsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    uint8_t *cqring = (uint8_t *) mmap (NULL, cqsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    sqes = mmap (NULL, params.sq_entries * sizeof (struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if ((sqring == MAP_FAILED) || (cqring == MAP_FAILED) || (sqes == MAP_FAILED)) {
+        fprintf (stderr, "%s: error mapping io_uring: %m\n", progname);
+        close (fd);
+        return false;
+    }
+
+    sqmask  = *(uint32_t *) (sqring + params.sq_off.ring_mask);
+    sqtail  =  (uint32_t *) (sqring + params.sq_off.tail);
+    sqarray =  (uint32_t *) (sqring + params.sq_off.array);
+    cqmask  = *(uint32_t *) (cqring + params.cq_off.ring_mask);
+    cqhead  =  (uint32_t *) (cqring + params.cq_off.head);
+    cqtail  =  (uint32_t *) (cqring + params.cq_off.tail);
+    cqes    =  cqring + params.cq_off.cqes;
+    ringfd  = fd;
+    return true;
+}
+
+// put read or write request on submission queue and tell kernel about it
+// - caller waits for each request before it has NENTRIES outstanding
+void AsyncIO::ringsubmit (AIOReq *req)
+{
+    req->iov.iov_base = req->buf;
+    req->iov.iov_len  = req->size;
+
+    uint32_t tail = *sqtail;
+    uint32_t index = tail & sqmask;
+    struct io_uring_sqe *sqe = &((struct io_uring_sqe *) sqes)[index];
+    memset (sqe, 0, sizeof *sqe);
+    sqe->opcode    = req->write ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd        = req->fd;
+    sqe->off       = req->off;
+    sqe->addr      = (uint64_t) (uintptr_t) &req->iov;
+    sqe->len       = 1;
+    sqe->user_data = (uint64_t) (uintptr_t) req;
+    sqarray[index] = index;
+    __atomic_store_n (sqtail, tail + 1, __ATOMIC_RELEASE);
+
+    while (syscall (__NR_io_uring_enter, ringfd, 1, 0, 0, NULL, 0) < 0) {
+        if (errno != EINTR) {
+            fprintf (stderr, "%s: error submitting io_uring request: %m\n", progname);
+            ABORT ();
+        }
+    }
+}
+
+// mark completed requests done
+//  input:
+//   block = wait for at least one to complete
+void AsyncIO::ringreap (bool block)
+{
+    if (block && (syscall (__NR_io_uring_enter, ringfd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0) && (errno != EINTR)) {
+        fprintf (stderr, "%s: error waiting for io_uring completion: %m\n", progname);
+        ABORT ();
+    }
+
+    uint32_t head = *cqhead;
+    uint32_t tail = __atomic_load_n (cqtail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &((struct io_uring_cqe *) cqes)[head&cqmask];
+        AIOReq *req = (AIOReq *) (uintptr_t) cqe->user_data;
+        shmstats_since (SHMSTATS_FIONS, req->startns);
+        req->rc   = (cqe->res < 0) ? -1 : cqe->res;
+        req->err  = - cqe->res;
+        req->done = true;
+        head ++;
+    }
+    __atomic_store_n (cqhead, head, __ATOMIC_RELEASE);
+}
+
+#else
+
+bool AsyncIO::ringsetup ()
+{
+    return false;
+}
+
+void AsyncIO::ringsubmit (AIOReq *req)
+{
+    ABORT ();
+}
+
+void AsyncIO::ringreap (bool block)
+{
+    ABORT ();
+}
+
+#endif
@@ -0,0 +1,85 @@
+//    Copyright (C) Mike Rieker, Beverly, MA USA
+//    www.outerworldapps.com
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; version 2 of the License.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    EXPECT it to FAIL when someone's HeALTh or PROpeRTy is at RISk.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    http://www.gnu.org/licenses/gpl-2.0.html
+
+// Library for overlapping file i/o with dma
+
+#ifndef _ASYNCIO_H
+#define _ASYNCIO_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+struct AIOReq {
+    int fd;                 // file to read or write
+    bool write;             // false: pread(); true: pwrite()
+    void *buf;              // buffer to read into or write from
+    uint32_t size;          // number of bytes
+    uint64_t off;           // position in file
+    int (*func) (AIOReq *req);  // if not NULL, called instead of doing pread()/pwrite() on fd
+    void *param;            // for func's use
+
+    // filled in by AsyncIO
+    int rc;                 // result same as pread()/pwrite()
+    int err;                // errno if rc < 0
+    bool volatile done;     // completed
+    bool pooled;            // queued to worker threads (not io_uring)
+    uint64_t startns;       // when submitted, for stats
+    AIOReq *next;           // next in queue
+    struct iovec iov;       // io_uring read/write buffer
+};
+
+// submit i/o to be done in background, uses io_uring if kernel has it, else worker threads
+// - one thread at a time submits and waits for a given AsyncIO
+struct AsyncIO {
+    AsyncIO (char const *progname);
+
+    void submit (AIOReq *req);
+    int wait (AIOReq *req);
+
+private:
+    char const *progname;
+
+    // io_uring
+    int ringfd;             // -1 if not using io_uring
+    uint32_t sqmask;
+    uint32_t cqmask;
+    uint32_t *sqarray;
+    uint32_t volatile *sqtail;
+    uint32_t volatile *cqhead;
+    uint32_t volatile *cqtail;
+    void *sqes;
+    void *cqes;
+
+    // worker threads
+    int nthreads;           // 0 until first pooled request
+    AIOReq *qhead;
+    AIOReq **qtail;
+    pthread_cond_t cond;
+    pthread_mutex_t mutex;
+
+    bool ringsetup ();
+    void ringsubmit (AIOReq *req);
+    void ringreap (bool block);
+    static void *workerwrap (void *zhis);
+    void worker ();
+};
+
+#endif
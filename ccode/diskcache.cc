@@ -0,0 +1,318 @@
+//    Copyright (C) Mike Rieker, Beverly, MA USA
+//    www.outerworldapps.com
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; version 2 of the License.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    EXPECT it to FAIL when someone's HeALTh or PROpeRTy is at RISk.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    http://www.gnu.org/licenses/gpl-2.0.html
+
+// Write-back sector cache for disk drive daemons
+// The pdp sees writes complete as soon as they are in memory
+// A flusher thread writes them to the file, coalescing adjacent sectors
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "diskcache.h"
+#include "z11util.h"
+
+#define GATHERMS 100            // wait this long for more writes before flushing
+#define MAXIOVS 1024            // max sectors written with one pwritev()
+
+//  input:
+//   progname = daemon name for error messages
+//   drsel = drive number for error messages
+//   secsize = sector size in bytes, all i/o is whole sectors
+//   maxdirty = max number of bytes in cache before pdp has to wait for flushing
+DiskCache::DiskCache (char const *progname, int drsel, uint32_t secsize, uint32_t maxdirty)
+{
+    this->progname = progname;
+    this->drsel    = drsel;
+    this->secsize  = secsize;
+
+    fd       = -1;
+    ovly     = NULL;
+    werrno   = 0;
+    flushgen = 0;
+    ndirty   = 0;
+    busy     = false;
+    flushreq = false;
+
+    nslots  = maxdirty / secsize;
+    if (nslots < 1) nslots = 1;
+    nhashes = nslots * 2;
+    hashes  = (int *) malloc (nhashes * sizeof *hashes);
+    slots   = (Slot *) malloc (nslots * sizeof *slots);
+    flushlist = (int *) malloc (nslots * sizeof *flushlist);
+    datas   = (uint8_t *) malloc ((size_t) nslots * secsize);
+    if ((hashes == NULL) || (slots == NULL) || (datas == NULL) || (flushlist == NULL)) ABORT ();
+
+    for (uint32_t i = 0; i < nhashes; i ++) hashes[i] = -1;
+    for (uint32_t i = 0; i < nslots; i ++) slots[i].next = i + 1;
+    slots[nslots-1].next = -1;
+    freeslot = 0;
+
+    if (pthread_cond_init (&cond, NULL) != 0) ABORT ();
+    if (pthread_mutex_init (&mutex, NULL) != 0) ABORT ();
+
+    pthread_t tid;
+    if (pthread_create (&tid, NULL, flusherwrap, this) != 0) ABORT ();
+}
+
+// set file the cache is for
+// cache must be flushed before changing files
+void DiskCache::setfd (int fd, DiskOverlay *ovly)
+{
+    if (pthread_mutex_lock (&mutex) != 0) ABORT ();
+    ASSERT (ndirty == 0);
+    this->fd   = fd;
+    this->ovly = ovly;
+    werrno   = 0;
+    if (pthread_mutex_unlock (&mutex) != 0) ABORT ();
+}
+
+// read from file, getting any sectors that haven't been written yet from cache
+// - offset must be on a sector boundary, size need not be
+//  returns same as pread()
+int DiskCache::pread (void *buf, uint32_t size, uint64_t off)
+{
+    ASSERT (off % secsize == 0);
+
+    if (pthread_mutex_lock (&mutex) != 0) ABORT ();
+    int rc;
+    while (true) {
+        uint32_t gen = flushgen;
+        if (pthread_mutex_unlock (&mutex) != 0) ABORT ();
+        rc = (ovly != NULL) ? ovly->pread (buf, size, off) : ::pread (fd, buf, size, off);
+        if (pthread_mutex_lock (&mutex) != 0) ABORT ();
+
+        // if flusher removed something from cache whilst we were reading,
+        // we might have read the file before it wrote the sector, so read again
+        if (gen == flushgen) break;
+    }
+
+    // overlay whatever is in cache
+    if ((rc > 0) && (ndirty > 0)) {
+        uint32_t secno = off / secsize;
+        for (uint32_t i = 0; i * secsize < (uint32_t) rc; i ++) {
+            int slot = *findslot (secno + i);
+            if (slot >= 0) {
+                uint32_t len = rc - i * secsize;
+                if (len > secsize) len = secsize;
+                memcpy ((uint8_t *) buf + i * secsize, datas + (size_t) slot * secsize, len);
+            }
+        }
+    }
+    if (pthread_mutex_unlock (&mutex) != 0) ABORT ();
+    return rc;
+}
+
+// write to cache, waiting for flusher if cache is full
+// - offset and size must be whole sectors
+//  returns size
+int DiskCache::pwrite (void const *buf, uint32_t size, uint64_t off)
+{
+    ASSERT ((size % secsize == 0) && (off % secsize == 0));
+
+    uint32_t secno = off / secsize;
+    if (pthread_mutex_lock (&mutex) != 0) ABORT ();
+    for (uint32_t i = 0; i < size / secsize;) {
+        int *link = findslot (secno + i);
+        int slot  = *link;
+
+        // can't change sector while flusher is writing it
+        if ((slot >= 0) && slots[slot].flushing) {
+            if (pthread_cond_wait (&cond, &mutex) != 0) ABORT ();
+            continue;
+        }
+
+        // not in cache, get a free slot, waiting for flusher if none
+        if (slot < 0) {
+            slot = freeslot;
+            if (slot < 0) {
+                flushreq = true;
+                if (pthread_cond_broadcast (&cond) != 0) ABORT ();
+                if (pthread_cond_wait (&cond, &mutex) != 0) ABORT ();
+                continue;
+            }
+            freeslot = slots[slot].next;
+            slots[slot].secno    = secno + i;
+            slots[slot].next     = -1;
+            slots[slot].flushing = false;
+            *link = slot;
+            if (ndirty ++ == 0) {
+                if (pthread_cond_broadcast (&cond) != 0) ABORT ();
+            }
+        }
+
+        memcpy (datas + (size_t) slot * secsize, (uint8_t const *) buf + i * secsize, secsize);
+        i ++;
+    }
+    if (pthread_mutex_unlock (&mutex) != 0) ABORT ();
+    return size;
+}
+
+// write everything in cache to the file and wait for it to get to disk
+//  returns 0: success
+//        < 0: negative errno of a failed write since last flush()
+int DiskCache::flush ()
+{
+    if (pthread_mutex_lock (&mutex) != 0) ABORT ();
+    while ((ndirty > 0) || busy) {
+        flushreq = true;
+        if (pthread_cond_broadcast (&cond) != 0) ABORT ();
+        if (pthread_cond_wait (&cond, &mutex) != 0) ABORT ();
+    }
+    int rc = - werrno;
+    werrno = 0;
+    if ((fd >= 0) && (((ovly != NULL) ? ovly->sync () : fdatasync (fd)) < 0) && (errno != EINVAL)) {
+        rc = - errno;
+        fprintf (stderr, "%s: [%d] error syncing file: %m\n", progname, drsel);
+    }
+    if (pthread_mutex_unlock (&mutex) != 0) ABORT ();
+    return rc;
+}
+
+// find the link to the slot for the given sector
+//  output:
+//   returns pointer to link, *link = slot number or -1 if not in cache
+int *DiskCache::findslot (uint32_t secno)
+{
+    int *link = &hashes[secno%nhashes];
+    while (*link >= 0) {
+        if (slots[*link].secno == secno) break;
+        link = &slots[*link].next;
+    }
+    return link;
+}
+
+void *DiskCache::flusherwrap (void *zhis)
+{
+    ((DiskCache *) zhis)->flusher ();
+    return NULL;
+}
+
+// write dirty sectors to the file
+void DiskCache::flusher ()
+{
+    if (pthread_mutex_lock (&mutex) != 0) ABORT ();
+    while (true) {
+
+        // wait for something to write
+        while (ndirty == 0) {
+            flushreq = false;
+            if (pthread_cond_wait (&cond, &mutex) != 0) ABORT ();
+        }
+
+        // give the pdp a chance to write more so we can write it all in one go
+        // ...unless someone is waiting for us
+        if (! flushreq) {
+            struct timespec timeout;
+            if (clock_gettime (CLOCK_REALTIME, &timeout) < 0) ABORT ();
+            timeout.tv_nsec += GATHERMS * 1000000;
+            if (timeout.tv_nsec >= 1000000000) {
+                timeout.tv_nsec -= 1000000000;
+                timeout.tv_sec ++;
+            }
+            while (! flushreq) {
+                int rc = pthread_cond_timedwait (&cond, &mutex, &timeout);
+                if (rc == ETIMEDOUT) break;
+                if (rc != 0) ABORT ();
+            }
+        }
+
+        flushit ();
+        flushreq = false;
+        if (pthread_cond_broadcast (&cond) != 0) ABORT ();
+    }
+}
+
+int DiskCache::cmpslots (void const *a, void const *b, void *zslots)
+{
+    uint32_t sa = ((DiskCache::Slot const *) zslots)[*(int const *)a].secno;
+    uint32_t sb = ((DiskCache::Slot const *) zslots)[*(int const *)b].secno;
+    return (sa < sb) ? -1 : (sa > sb);
+}
+
+// write all dirty sectors to file, coalescing adjacent ones
+// - called with mutex locked, unlocks during writing
+void DiskCache::flushit ()
+{
+    // get list of dirty slots sorted by sector number
+    // mark them being flushed so pwrite() won't modify them
+    int nlist = 0;
+    int *list = flushlist;
+    for (uint32_t h = 0; h < nhashes; h ++) {
+        for (int slot = hashes[h]; slot >= 0; slot = slots[slot].next) {
+            slots[slot].flushing = true;
+            list[nlist++] = slot;
+        }
+    }
+    ASSERT ((uint32_t) nlist == ndirty);
+    busy = true;
+    int wfd = fd;
+    DiskOverlay *wovly = ovly;
+    if (pthread_mutex_unlock (&mutex) != 0) ABORT ();
+
+    qsort_r (list, nlist, sizeof list[0], cmpslots, slots);
+
+    // write runs of consecutive sectors
+    int werr = 0;
+    for (int i = 0; i < nlist;) {
+        struct iovec iovs[MAXIOVS];
+        int niov = 0;
+        do {
+            iovs[niov].iov_base = datas + (size_t) list[i+niov] * secsize;
+            iovs[niov].iov_len  = secsize;
+            niov ++;
+        } while ((i + niov < nlist) && (niov < MAXIOVS) && (slots[list[i+niov]].secno == slots[list[i]].secno + niov));
+
+        uint64_t off = (uint64_t) slots[list[i]].secno * secsize;
+        int rc = (wovly != NULL) ? wovly->pwritev (iovs, niov, off) : ::pwritev (wfd, iovs, niov, off);
+        if (rc != (int) (niov * secsize)) {
+            if (rc < 0) {
+                werr = errno;
+                fprintf (stderr, "%s: [%d] error writing at %llu: %m\n", progname, drsel, (unsigned long long) off);
+            } else {
+                werr = EIO;
+                fprintf (stderr, "%s: [%d] only wrote %d bytes of %u at %llu\n", progname, drsel, rc, niov * secsize, (unsigned long long) off);
+            }
+        }
+        i += niov;
+    }
+
+    // remove them all from cache
+    if (pthread_mutex_lock (&mutex) != 0) ABORT ();
+    if (werr != 0) werrno = werr;
+    for (int i = 0; i < nlist; i ++) {
+        int slot  = list[i];
+        int *link = findslot (slots[slot].secno);
+        ASSERT (*link == slot);
+        *link = slots[slot].next;
+        slots[slot].next = freeslot;
+        freeslot = slot;
+    }
+    ndirty  -= nlist;
+    flushgen ++;
+    busy = false;
+}
@@ -0,0 +1,73 @@
+//    Copyright (C) Mike Rieker, Beverly, MA USA
+//    www.outerworldapps.com
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; version 2 of the License.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    EXPECT it to FAIL when someone's HeALTh or PROpeRTy is at RISk.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    http://www.gnu.org/licenses/gpl-2.0.html
+
+#ifndef _DISKCACHE_H
+#define _DISKCACHE_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "diskovly.h"
+
+// write-back cache of sectors for a disk drive
+// writes go to memory and get written to the file by a flusher thread
+struct DiskCache {
+    DiskCache (char const *progname, int drsel, uint32_t secsize, uint32_t maxdirty);
+
+    void setfd (int fd, DiskOverlay *ovly = NULL);
+    int pread (void *buf, uint32_t size, uint64_t off);
+    int pwrite (void const *buf, uint32_t size, uint64_t off);
+    int flush ();
+
+private:
+    struct Slot {
+        uint32_t secno;         // sector number in file
+        int next;               // next in hash chain or free list
+        bool flushing;          // being written to file by flusher
+    };
+
+    char const *progname;
+    int drsel;
+    int fd;
+    DiskOverlay *ovly;          // file is an overlay, do i/o through this
+    int freeslot;               // first free slot
+    int werrno;                 // errno from failed write to file, 0 if none
+    int *flushlist;             // slots being written by flusher
+    int *hashes;                // first slot for each hash chain
+    Slot *slots;                // info about each sector in cache
+    uint8_t *datas;             // data for each sector in cache
+    uint32_t flushgen;          // incremented whenever sectors are removed from cache
+    uint32_t ndirty;            // number of dirty sectors
+    uint32_t nhashes;
+    uint32_t nslots;
+    uint32_t secsize;
+    bool busy;                  // flusher is writing sectors to file
+    bool flushreq;              // flush requested, don't wait to gather more writes
+    pthread_cond_t cond;
+    pthread_mutex_t mutex;
+
+    int *findslot (uint32_t secno);
+    void flushit ();
+    static int cmpslots (void const *a, void const *b, void *zslots);
+    static void *flusherwrap (void *zhis);
+    void flusher ();
+};
+
+#endif
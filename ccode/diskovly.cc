@@ -0,0 +1,476 @@
+//    Copyright (C) Mike Rieker, Beverly, MA USA
+//    www.outerworldapps.com
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; version 2 of the License.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    EXPECT it to FAIL when someone's HeALTh or PROpeRTy is at RISk.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    http://www.gnu.org/licenses/gpl-2.0.html
+
+// Copy-on-write overlay disk images
+// An overlay file holds just the blocks written since it was created,
+// reads of other blocks fall through to the image it overlays.
+// The image beneath can itself be an overlay, so freezing an overlay
+// and putting a new one on top makes an instant snapshot, and
+// re-creating the top overlay rolls back to the snapshot.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "diskovly.h"
+#include "z11util.h"
+
+static int lockfile (int fd, short type);
+
+// create (or empty out) an overlay file
+//  input:
+//   ovlyname = name of overlay file to create
+//   basename = name of image file it overlays (plain image or another overlay)
+//   blksize  = bytes per block (disk sector size)
+//  output:
+//   returns < 0: errno
+//          else: successful
+int DiskOverlay::create (char const *ovlyname, char const *basename, uint32_t blksize)
+{
+    OvlyHdr hdr;
+    memset (&hdr, 0, sizeof hdr);
+    memcpy (hdr.magic, OVLY_MAGIC, sizeof hdr.magic);
+    hdr.blksize = blksize;
+
+    // overlay file needs the absolute path of the base
+    char *basepath = realpath (basename, NULL);
+    if (basepath == NULL) {
+        int rc = - errno;
+        fprintf (stderr, "DiskOverlay::create: failed to expand %s: %m\n", basename);
+        return rc;
+    }
+    if (strlen (basepath) >= sizeof hdr.basename) {
+        fprintf (stderr, "DiskOverlay::create: filename too long %s\n", basepath);
+        free (basepath);
+        return -ERANGE;
+    }
+    strcpy (hdr.basename, basepath);
+    free (basepath);
+
+    // base can't be loaded read/write anywhere cuz it must not change from now on
+    int basefd = open (hdr.basename, O_RDONLY);
+    if (basefd < 0) {
+        int rc = - errno;
+        fprintf (stderr, "DiskOverlay::create: error opening %s: %m\n", hdr.basename);
+        return rc;
+    }
+    int rc = lockfile (basefd, F_RDLCK);
+    if (rc < 0) {
+        fprintf (stderr, "DiskOverlay::create: %s is loaded read/write\n", hdr.basename);
+        close (basefd);
+        return rc;
+    }
+
+    // overlay starts out same size as base
+    OvlyHdr basehdr;
+    struct stat basestat;
+    if (fstat (basefd, &basestat) < 0) ABORT ();
+    if ((::pread (basefd, &basehdr, sizeof basehdr, 0) == (int) sizeof basehdr) &&
+            (memcmp (basehdr.magic, OVLY_MAGIC, sizeof basehdr.magic) == 0)) {
+        if (basehdr.blksize != blksize) {
+            fprintf (stderr, "DiskOverlay::create: %s block size %u, need %u\n", hdr.basename, basehdr.blksize, blksize);
+            close (basefd);
+            return -EINVAL;
+        }
+        hdr.nblocks = basehdr.nblocks;
+    } else {
+        hdr.nblocks = (basestat.st_size + blksize - 1) / blksize;
+    }
+
+    // open overlay, making sure it isn't loaded and isn't the base
+    int fd = open (ovlyname, O_RDWR | O_CREAT, 0666);
+    if (fd < 0) {
+        rc = - errno;
+        fprintf (stderr, "DiskOverlay::create: error creating %s: %m\n", ovlyname);
+        close (basefd);
+        return rc;
+    }
+    struct stat ovlystat;
+    if (fstat (fd, &ovlystat) < 0) ABORT ();
+    if ((ovlystat.st_dev == basestat.st_dev) && (ovlystat.st_ino == basestat.st_ino)) {
+        fprintf (stderr, "DiskOverlay::create: %s cannot overlay itself\n", ovlyname);
+        rc = -EINVAL;
+    } else {
+        rc = lockfile (fd, F_WRLCK);
+        if (rc < 0) fprintf (stderr, "DiskOverlay::create: %s is loaded\n", ovlyname);
+    }
+
+    // discard any old contents and write new header, bitmap and data are sparse
+    if ((rc >= 0) && ((ftruncate (fd, 0) < 0) ||
+            (::pwrite (fd, &hdr, sizeof hdr, 0) != (int) sizeof hdr) ||
+            (ftruncate (fd, OVLY_DATAOFF) < 0))) {
+        rc = (errno == 0) ? -EIO : - errno;
+        fprintf (stderr, "DiskOverlay::create: error writing %s: %m\n", ovlyname);
+    }
+
+    close (fd);
+    close (basefd);
+    return rc;
+}
+
+// see if a disk image file is an overlay and open the images beneath it
+//  input:
+//   progname = daemon name for error messages
+//   fd = disk image file as loaded in drive
+//   readonly = drive is write-locked
+//  output:
+//   returns < 0: errno
+//             0: plain image file, *ovly_r = NULL
+//             1: overlay, *ovly_r = overlay
+int DiskOverlay::attach (char const *progname, int fd, bool readonly, DiskOverlay **ovly_r)
+{
+    *ovly_r = NULL;
+
+    OvlyHdr hdr;
+    if ((::pread (fd, &hdr, sizeof hdr, 0) != (int) sizeof hdr) ||
+            (memcmp (hdr.magic, OVLY_MAGIC, sizeof hdr.magic) != 0)) return 0;
+
+    DiskOverlay *ovly = new DiskOverlay ();
+    ovly->progname = progname;
+    ovly->readonly = readonly;
+    ovly->blksize  = hdr.blksize;
+    ovly->nblocks  = hdr.nblocks;
+    ovly->fds[0]   = fd;
+    ovly->dataoffs[0] = OVLY_DATAOFF;
+    ovly->nlayers  = 1;
+
+    uint32_t nblockss[OVLY_MAXLAYERS];
+    nblockss[0] = hdr.nblocks;
+    int rc = 1;
+
+    // open image files beneath until we get to a plain one
+    // they must stay as they are so lock them against being loaded read/write
+    while (true) {
+        if (ovly->nlayers >= OVLY_MAXLAYERS) {
+            fprintf (stderr, "%s: more than %d overlays deep at %s\n", progname, OVLY_MAXLAYERS, hdr.basename);
+            rc = -ELOOP;
+            goto done;
+        }
+        int lfd = open (hdr.basename, O_RDONLY);
+        if (lfd < 0) {
+            rc = - errno;
+            fprintf (stderr, "%s: error opening %s: %m\n", progname, hdr.basename);
+            goto done;
+        }
+        int layer = ovly->nlayers ++;
+        ovly->fds[layer] = lfd;
+        ovly->dataoffs[layer] = 0;
+        rc = lockfile (lfd, F_RDLCK);
+        if (rc < 0) {
+            fprintf (stderr, "%s: error locking %s: %s\n", progname, hdr.basename, strerror (- rc));
+            goto done;
+        }
+        rc = 1;
+        char lname[sizeof hdr.basename];
+        strcpy (lname, hdr.basename);
+        if ((::pread (lfd, &hdr, sizeof hdr, 0) != (int) sizeof hdr) ||
+                (memcmp (hdr.magic, OVLY_MAGIC, sizeof hdr.magic) != 0)) break;
+        if (hdr.blksize != ovly->blksize) {
+            fprintf (stderr, "%s: %s block size %u, need %u\n", progname, lname, hdr.blksize, ovly->blksize);
+            rc = -EINVAL;
+            goto done;
+        }
+        ovly->dataoffs[layer] = OVLY_DATAOFF;
+        nblockss[layer] = hdr.nblocks;
+    }
+
+    // read bitmaps and fill in which layer has each block
+    // ...working up from the bottom so the topmost layer wins
+    // anything not in an overlay comes from the plain image
+    for (int layer = ovly->nlayers - 1; -- layer >= 0;) {
+        uint32_t nbytes = (nblockss[layer] + 7) / 8;
+        if (nbytes > OVLY_MAPSIZE) nbytes = OVLY_MAPSIZE;
+        uint8_t *bm = (layer == 0) ? ovly->bitmap : (uint8_t *) malloc (nbytes);
+        if (bm == NULL) ABORT ();
+        int rcr = ::pread (ovly->fds[layer], bm, nbytes, OVLY_HDRSIZE);
+        if (rcr < 0) {
+            rc = - errno;
+            fprintf (stderr, "%s: error reading overlay bitmap: %m\n", progname);
+        } else {
+            if ((uint32_t) rcr < nbytes) memset (bm + rcr, 0, nbytes - rcr);
+            if (ovly->growowners (nblockss[layer]) < 0) rc = -EFBIG;
+            for (uint32_t i = 0; i < nblockss[layer]; i ++) {
+                if (bm[i/8] & (1U << (i % 8))) ovly->owners[i] = layer;
+            }
+        }
+        if (layer != 0) free (bm);
+        if (rc < 0) goto done;
+    }
+    if (ovly->growowners (ovly->nblocks) < 0) rc = -EFBIG;
+
+done:;
+    if (rc < 0) delete ovly;
+    else *ovly_r = ovly;
+    return rc;
+}
+
+DiskOverlay::DiskOverlay ()
+{
+    nlayers     = 0;
+    allocblocks = 0;
+    owners      = NULL;
+    bitmap      = (uint8_t *) calloc (OVLY_MAPSIZE, 1);
+    if (bitmap == NULL) ABORT ();
+    if (pthread_mutex_init (&mutex, NULL) != 0) ABORT ();
+}
+
+// top file belongs to caller, close the ones beneath
+DiskOverlay::~DiskOverlay ()
+{
+    for (int layer = 1; layer < nlayers; layer ++) close (fds[layer]);
+    free (bitmap);
+    free (owners);
+    pthread_mutex_destroy (&mutex);
+}
+
+// make sure image is at least the given size
+//  returns < 0: errno
+//          else: successful
+int DiskOverlay::setsize (uint64_t size)
+{
+    uint64_t nblks = (size + blksize - 1) / blksize;
+    if (nblks <= nblocks) return 0;
+    if (readonly) return 0;
+    if (nblks > OVLY_MAPSIZE * 8) return -EFBIG;
+
+    if (pthread_mutex_lock (&mutex) != 0) ABORT ();
+    int rc = growowners (nblks);
+    if (rc >= 0) {
+        uint32_t newnblocks = nblks;
+        if (::pwrite (fds[0], &newnblocks, sizeof newnblocks, offsetof (OvlyHdr, nblocks)) != (int) sizeof newnblocks) {
+            rc = (errno == 0) ? -EIO : - errno;
+            fprintf (stderr, "%s: error extending overlay: %m\n", progname);
+        } else {
+            nblocks = newnblocks;
+        }
+    }
+    if (pthread_mutex_unlock (&mutex) != 0) ABORT ();
+    return rc;
+}
+
+// read from image
+// - gets each block from the topmost layer that has it
+// - reads past end of a layer's file as zeroes
+//  returns same as pread()
+int DiskOverlay::pread (void *buf, uint32_t size, uint64_t off)
+{
+    uint64_t eof = (uint64_t) nblocks * blksize;
+    if (off >= eof) return 0;
+    if (size > eof - off) size = eof - off;
+
+    uint8_t *p = (uint8_t *) buf;
+    for (uint32_t done = 0; done < size;) {
+
+        // gather run of blocks all in the same layer
+        uint64_t o = off + done;
+        uint32_t blkno = o / blksize;
+        int layer = owners[blkno];
+        uint32_t len = (blkno + 1) * (uint64_t) blksize - o;
+        while ((done + len < size) && (owners[++blkno] == layer)) len += blksize;
+        if (len > size - done) len = size - done;
+
+        int rc = ::pread (fds[layer], p + done, len, dataoffs[layer] + o);
+        if (rc < 0) return rc;
+        if ((uint32_t) rc < len) memset (p + done + rc, 0, len - rc);
+        done += len;
+    }
+    return size;
+}
+
+// write to image
+// - blocks always get written to top layer
+// - partially written blocks are first copied up from layer beneath
+//  returns same as pwrite()
+int DiskOverlay::pwrite (void const *buf, uint32_t size, uint64_t off)
+{
+    if (readonly) {
+        errno = EROFS;
+        return -1;
+    }
+    if (off + size > (uint64_t) nblocks * blksize) {
+        errno = EFBIG;
+        return -1;
+    }
+
+    uint8_t const *p = (uint8_t const *) buf;
+    uint32_t done = 0;
+
+    if (pthread_mutex_lock (&mutex) != 0) ABORT ();
+
+    // partial first block
+    uint32_t boff = off % blksize;
+    if (boff != 0) {
+        uint32_t len = blksize - boff;
+        if (len > size) len = size;
+        if (copyup (off / blksize, p, boff, len) < 0) goto err;
+        done = len;
+    }
+
+    // whole blocks in middle
+    if (size - done >= blksize) {
+        uint32_t len = (size - done) / blksize * blksize;
+        int rc = ::pwrite (fds[0], p + done, len, OVLY_DATAOFF + off + done);
+        if (rc != (int) len) {
+            if (rc >= 0) errno = EIO;
+            goto err;
+        }
+        if (markowned ((off + done) / blksize, len / blksize) < 0) goto err;
+        done += len;
+    }
+
+    // partial last block
+    if (done < size) {
+        if (copyup ((off + done) / blksize, p + done, 0, size - done) < 0) goto err;
+    }
+
+    if (pthread_mutex_unlock (&mutex) != 0) ABORT ();
+    return size;
+
+err:;
+    int e = errno;
+    if (pthread_mutex_unlock (&mutex) != 0) ABORT ();
+    errno = e;
+    return -1;
+}
+
+// write whole blocks to image from iovec
+//  returns same as pwritev()
+int DiskOverlay::pwritev (struct iovec const *iovs, int niov, uint64_t off)
+{
+    uint32_t size = 0;
+    for (int i = 0; i < niov; i ++) size += iovs[i].iov_len;
+
+    if (readonly || (off % blksize != 0) || (size % blksize != 0) || (off + size > (uint64_t) nblocks * blksize)) {
+        uint8_t *buf = (uint8_t *) malloc (size);
+        if (buf == NULL) ABORT ();
+        uint32_t len = 0;
+        for (int i = 0; i < niov; i ++) {
+            memcpy (buf + len, iovs[i].iov_base, iovs[i].iov_len);
+            len += iovs[i].iov_len;
+        }
+        int rc = pwrite (buf, size, off);
+        free (buf);
+        return rc;
+    }
+
+    if (pthread_mutex_lock (&mutex) != 0) ABORT ();
+    int rc = ::pwritev (fds[0], iovs, niov, OVLY_DATAOFF + off);
+    if ((rc == (int) size) && (markowned (off / blksize, size / blksize) < 0)) rc = -1;
+    int e = errno;
+    if (pthread_mutex_unlock (&mutex) != 0) ABORT ();
+    errno = e;
+    return rc;
+}
+
+// write top layer to disk
+//  returns same as fdatasync()
+int DiskOverlay::sync ()
+{
+    return readonly ? 0 : fdatasync (fds[0]);
+}
+
+// make owners[] big enough for the given number of blocks
+// new blocks come from the plain image at the bottom
+int DiskOverlay::growowners (uint32_t nblks)
+{
+    if (nblks > allocblocks) {
+        uint8_t *newowners = (uint8_t *) realloc (owners, nblks);
+        if (newowners == NULL) return -ENOMEM;
+        memset (newowners + allocblocks, nlayers - 1, nblks - allocblocks);
+        owners = newowners;
+        allocblocks = nblks;
+    }
+    return 0;
+}
+
+// write part of a block, copying the rest of it from beneath if not already in top layer
+// - call with mutex locked
+int DiskOverlay::copyup (uint32_t blkno, void const *buf, uint32_t boff, uint32_t size)
+{
+    uint64_t blkoff = (uint64_t) blkno * blksize;
+    if (owners[blkno] == 0) {
+        int rc = ::pwrite (fds[0], buf, size, OVLY_DATAOFF + blkoff + boff);
+        if (rc == (int) size) return 0;
+        if (rc >= 0) errno = EIO;
+        return -1;
+    }
+
+    uint8_t blkbuf[blksize];
+    if (pread (blkbuf, blksize, blkoff) < 0) return -1;
+    memcpy (blkbuf + boff, buf, size);
+    int rc = ::pwrite (fds[0], blkbuf, blksize, OVLY_DATAOFF + blkoff);
+    if (rc != (int) blksize) {
+        if (rc >= 0) errno = EIO;
+        return -1;
+    }
+    return markowned (blkno, 1);
+}
+
+// blocks were written to top layer, update in-memory map and bitmap in the file
+// - call with mutex locked
+int DiskOverlay::markowned (uint32_t blkno, uint32_t nblks)
+{
+    uint32_t lobyte = OVLY_MAPSIZE;
+    uint32_t hibyte = 0;
+    for (uint32_t i = blkno; i < blkno + nblks; i ++) {
+        if (owners[i] != 0) {
+            owners[i] = 0;
+            bitmap[i/8] |= 1U << (i % 8);
+            if (lobyte > i / 8) lobyte = i / 8;
+            hibyte = i / 8;
+        }
+    }
+
+    // write changed part of bitmap after the data so the file never says it has a block it doesn't
+    if (lobyte <= hibyte) {
+        uint32_t len = hibyte + 1 - lobyte;
+        int rc = ::pwrite (fds[0], bitmap + lobyte, len, OVLY_HDRSIZE + lobyte);
+        if (rc != (int) len) {
+            if (rc >= 0) errno = EIO;
+            fprintf (stderr, "%s: error writing overlay bitmap: %m\n", progname);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// lock first page of file like shmms loadfile() does
+//  returns < 0: errno
+//          else: successful
+static int lockfile (int fd, short type)
+{
+    struct flock flockit;
+    memset (&flockit, 0, sizeof flockit);
+    flockit.l_type   = type;
+    flockit.l_whence = SEEK_SET;
+    flockit.l_len    = 4096;
+    if (fcntl (fd, F_OFD_SETLK, &flockit) < 0) {
+        return ((errno == EACCES) || (errno == EAGAIN)) ? -EBUSY : - errno;
+    }
+    return 0;
+}
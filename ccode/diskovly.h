@@ -0,0 +1,80 @@
+//    Copyright (C) Mike Rieker, Beverly, MA USA
+//    www.outerworldapps.com
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; version 2 of the License.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    EXPECT it to FAIL when someone's HeALTh or PROpeRTy is at RISk.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    http://www.gnu.org/licenses/gpl-2.0.html
+
+// Library for copy-on-write overlay disk image files
+
+#ifndef _DISKOVLY_H
+#define _DISKOVLY_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+// overlay file layout:
+//  [0:4095] = header
+//  [4096:OVLY_DATAOFF-1] = bitmap, one bit per block, set if block is in this file
+//  [OVLY_DATAOFF:...] = sparse block data, block n at OVLY_DATAOFF+n*blksize
+#define OVLY_MAGIC "z11ovly1"
+#define OVLY_HDRSIZE 4096
+#define OVLY_MAPSIZE (1024*1024)
+#define OVLY_DATAOFF (OVLY_HDRSIZE+OVLY_MAPSIZE)
+#define OVLY_MAXLAYERS 32
+
+struct OvlyHdr {
+    char magic[8];          // OVLY_MAGIC
+    uint32_t blksize;       // bytes per block
+    uint32_t nblocks;       // size of image in blocks
+    char basename[OVLY_HDRSIZE-16];  // absolute path of image this overlays
+};
+
+// an overlay file and the chain of images beneath it
+// reads come from the topmost file that has the block, writes go to the top file
+struct DiskOverlay {
+    static int create (char const *ovlyname, char const *basename, uint32_t blksize);
+    static int attach (char const *progname, int fd, bool readonly, DiskOverlay **ovly_r);
+
+    ~DiskOverlay ();
+
+    int setsize (uint64_t size);
+    int pread (void *buf, uint32_t size, uint64_t off);
+    int pwrite (void const *buf, uint32_t size, uint64_t off);
+    int pwritev (struct iovec const *iovs, int niov, uint64_t off);
+    int sync ();
+
+private:
+    char const *progname;
+    bool readonly;
+    int nlayers;                        // number of files, [0] = top overlay, [nlayers-1] = plain image
+    int fds[OVLY_MAXLAYERS];            // fd of each file ([0] is caller's)
+    uint64_t dataoffs[OVLY_MAXLAYERS];  // where block 0 is in each file
+    uint32_t allocblocks;               // number of entries in owners[]
+    uint32_t blksize;
+    uint32_t nblocks;                   // size of image in blocks
+    uint8_t *bitmap;                    // top file's bitmap (OVLY_MAPSIZE bytes)
+    uint8_t *owners;                    // which layer has each block
+    pthread_mutex_t mutex;
+
+    DiskOverlay ();
+    int growowners (uint32_t nblks);
+    int copyup (uint32_t blkno, void const *buf, uint32_t boff, uint32_t size);
+    int markowned (uint32_t blkno, uint32_t nblks);
+};
+
+#endif
@@ -22,12 +22,19 @@
 #define _ZGINTDEFS_H
 
 #define ZGIOCTL_WFI 7489330     // must match kernel module
+#define ZGIOCTL_WFITO 7489331   // same as ZGIOCTL_WFI but times out after ZGWFITO_MS
+#define ZGWFITO_MS 10
 #define ZG_INTENABS 0x1A        // regarmintena in zynq.v
 #define ZG_INTFLAGS 0x1B        // regarmintreq in zynq.v
 #define ZGINT_RL  0x00000001U   // rl11.v interrupt
 #define ZGINT_TM  0x00000002U   // tm11.v interrupt
 #define ZGINT_XE  0x00000004U   // xe11.v interrupt
 #define ZGINT_RH  0x00000008U   // rh11.v interrupt
+#define ZGINT_KY  0x00000010U   // ky11.v dma done
+#define ZGINT_DZ  0x00000020U   // dz11.v interrupt
+#define ZGINT_DL  0x00000040U   // dl11.v interrupt
+#define ZGINT_PR  0x00000080U   // pc11.v reader interrupt
+#define ZGINT_PP  0x00000100U   // pc11.v punch interrupt
 #define ZGINT_ARM 0x40000000U   // arm interrupts itself (km probing)
 #define ZGINT_REQ 0x80000000U   // composite request (in ZG_INTFLAGS)
 
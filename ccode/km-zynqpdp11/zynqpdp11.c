@@ -201,7 +201,8 @@ static long zg_ioctl (struct file *filp, unsigned int cmd, unsigned long arg)
 {
     //FoCtx *foctx = filp->private_data;
     switch (cmd) {
-        case ZGIOCTL_WFI: {
+        case ZGIOCTL_WFI:
+        case ZGIOCTL_WFITO: {
             unsigned long intena;
             spin_lock_irqsave (&isrlock, intena);
             if (! (pageknladdress[ZG_INTFLAGS] & arg)) {
@@ -221,7 +222,8 @@ static long zg_ioctl (struct file *filp, unsigned int cmd, unsigned long arg)
                 spin_unlock_irqrestore (&isrlock, intena);
 
                 if (! signal_pending (current)) {
-                    schedule ();
+                    if (cmd == ZGIOCTL_WFITO) schedule_timeout (msecs_to_jiffies (ZGWFITO_MS));
+                                         else schedule ();
                 }
 
                 spin_lock_irqsave (&isrlock, intena);
@@ -128,8 +128,9 @@ PinDef const pindefs[] = {
 
     { "bm_enablo",       DEV_BM, 1,    BM_ENABLO,         0, true  },
     { "bm_enabhi",       DEV_BM, 2,    BM2_ENABHI,        0, true  },
-    { "bm_armfunc",      DEV_BM, 3,    0xE0000000,        0, true  },
-    { "bm_armaddr",      DEV_BM, 3,    0x0003FFFF,        0, true  },
+    { "bm_armfunc",      DEV_BM, 3,    BM3_ARMFUNC,       0, true  },
+    { "bm_armainc",      DEV_BM, 3,    BM3_ARMAINC,       0, true  },
+    { "bm_armaddr",      DEV_BM, 3,    BM3_ARMADDR,       0, true  },
     { "bm_delay",        DEV_BM, 4,    0xE0000000,        0, false },
     { "bm_armdata",      DEV_BM, 4,    0x0000FFFF,        0, true  },
     { "bm_armperr",      DEV_BM, 4,    0x00030000,        0, true  },
@@ -164,6 +165,13 @@ PinDef const pindefs[] = {
     { "ky_dmadata",      DEV_KY, 4,    KY4_DMADATA,       0, true  },
     { "ky_snapreg",      DEV_KY, 4,    KY4_SNAPREG,       0, false },
     { "ky_dmalock",      DEV_KY, 5,    KY5_DMALOCK,       0, true  },
+    { "ky_bbusy",        DEV_KY, 6,    KY6_BBUSY,         0, true  },
+    { "ky_bwrite",       DEV_KY, 6,    KY6_BWRITE,        0, true  },
+    { "ky_bnoinc",       DEV_KY, 6,    KY6_BNOINC,        0, true  },
+    { "ky_btimo",        DEV_KY, 6,    KY6_BTIMO,         0, false },
+    { "ky_bperr",        DEV_KY, 6,    KY6_BPERR,         0, false },
+    { "ky_bfill",        DEV_KY, 6,    KY6_BFILL,         0, false },
+    { "ky_bcount",       DEV_KY, 6,    KY6_BCOUNT,        0, true  },
 
     { "dl_rcsr",         DEV_DL, 1,    0x0000FFFF,        0, true  },
     { "dl_rbuf",         DEV_DL, 1,    0xFFFF0000,        0, true  },
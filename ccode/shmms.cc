@@ -31,6 +31,7 @@
 #include "futex.h"
 #include "shmms.h"
 #include "z11defs.h"
+#include "z11inst.h"
 #include "z11util.h"
 
 static int mypid;
@@ -43,9 +44,9 @@ static uint32_t volatile *tmat;
 
 static ShmMS *getshmms (int ctlid);
 static int msunload (ShmMS *shmms, int drive);
-static int mswaitidle (ShmMS *shmms);
+static int mswaitidle (ShmMS *shmms, bool resume = false);
 static int mswaitdone (ShmMS *shmms);
-static int mslock (ShmMS *shmms);
+static int mslock (ShmMS *shmms, bool resume = false);
 static void lockmutex (ShmMS *shmms);
 static int forkserver (ShmMS *shmms);
 static void msunlk (ShmMS *shmms);
@@ -54,7 +55,8 @@ static void msunlk (ShmMS *shmms);
 //  1) if filename empty, unload any existing file
 //  2) set/clear readonly bit for the drive
 //  3) if filename given, load in drive
-int shmms_load (int ctlid, int drive, bool readonly, char const *filename)
+//  resume = restoring a checkpoint, the drive already has this volume mounted at curposn
+int shmms_load (int ctlid, int drive, bool readonly, char const *filename, bool resume, uint32_t curposn)
 {
     if ((drive < 0) || (drive >= SHMMS_NDRIVES)) ABORT ();
 
@@ -82,8 +84,9 @@ int shmms_load (int ctlid, int drive, bool readonly, char const *filename)
     }
 
     // lock shared page and wait for it to be idle
+    // if resuming and server has to be started, tell it not to reset drive status
     ShmMS *shmms = getshmms (ctlid);
-    int rc = mswaitidle (shmms);
+    int rc = mswaitidle (shmms, resume);
 
     // fnbuf == NULL means keep the same file loaded (probably just changing readonly status)
     // fnbuf == "" means unload any file that's in there
@@ -110,6 +113,8 @@ int shmms_load (int ctlid, int drive, bool readonly, char const *filename)
                 memcpy (dr->filename, fnbuf, ++ fnlen);
                 if (++ dr->fnseq == 0) ++ dr->fnseq; // 0 reserved for initial condition
             }
+            dr->resume = resume;
+            if (resume) dr->curposn = curposn;
 
             // unlock, wait for done, then re-lock
             rc = mswaitdone (shmms);
@@ -207,6 +212,31 @@ int shmms_stat (int ctlid, int drive, char *buff, int size, uint32_t *curpos_r)
     return statbits;
 }
 
+// write any cached data to the files
+//  returns < 0: errno
+//          else: successful (or server isn't running so nothing is cached)
+int shmms_sync (int ctlid)
+{
+    ShmMS *shmms = getshmms (ctlid);
+
+    // don't start server up just to sync it
+    int svrpid = shmms->svrpid;
+    if ((svrpid == 0) || ((kill (svrpid, 0) < 0) && (errno == ESRCH))) return 0;
+
+    int rc = mswaitidle (shmms);
+    if (rc >= 0) {
+        shmms->cmdpid  = getpid ();
+        shmms->command = SHMMSCMD_SYNC;
+        rc = mswaitdone (shmms);
+        if (rc >= 0) {
+            rc = shmms->negerr;
+            shmms->command = SHMMSCMD_IDLE;
+            msunlk (shmms);
+        }
+    }
+    return rc;
+}
+
 // point to shared memory for the given controller
 //  input:
 //   ctlid = SHMMS_CTLID_RH : use RH controller
@@ -240,6 +270,7 @@ static ShmMS *getshmms (int ctlid)
     // if shared mem not open yet, open it
     ShmMS *shmms = *ptr;
     if (shmms == NULL) {
+        shmname = z11instname (shmname);
         int shmfd = shm_open (shmname, O_RDWR | O_CREAT, 0666);
         if (shmfd < 0) {
             fprintf (stderr, "mslock: error opening %s: %m\n", shmname);
@@ -271,10 +302,11 @@ static int msunload (ShmMS *shmms, int drive)
 }
 
 // lock RH/RL/TM shared memory and wait for it to be idle
-static int mswaitidle (ShmMS *shmms)
+//  resume = passed to mslock()
+static int mswaitidle (ShmMS *shmms, bool resume)
 {
     for (int i = 1000; i < 2000; i ++) {
-        int rc = mslock (shmms);
+        int rc = mslock (shmms, resume);
         if (rc < 0) return rc;
 
         // if stuck in DONE state back to a process that is gone, mark it idle
@@ -322,7 +354,8 @@ static int mswaitdone (ShmMS *shmms)
 
 // lock RH/RL/TM shared memory
 // spawn z11rh/rl/tm if it isn't running
-static int mslock (ShmMS *shmms)
+//  resume = restoring a checkpoint, tell a spawned server to leave fpga drive status as is
+static int mslock (ShmMS *shmms, bool resume)
 {
     if (mypid == 0) mypid = getpid ();
 
@@ -342,6 +375,8 @@ static int mslock (ShmMS *shmms)
         }
 
         // server not running, start it
+        // it picks up resume flag whilst we still have the mutex locked
+        shmms->resume = resume;
         int rc = forkserver (shmms);
         if (rc < 0) {
             msunlk (shmms);
@@ -440,10 +475,11 @@ static int forkserver (ShmMS *shmms)
     for (int i = 3; i < 1024; i ++) close (i);
 
     // create log file
-    char logname[strlen(z11name)+84];
+    char const *loginst = z11instname (z11name);
+    char logname[strlen(loginst)+84];
     time_t nowbin = time (NULL);
     struct tm nowtm = *gmtime (&nowbin);
-    snprintf (logname, sizeof logname, "/tmp%s.%04d%02d%02d%02d%02d%02d.log", z11name,
+    snprintf (logname, sizeof logname, "/tmp%s.%04d%02d%02d%02d%02d%02d.log", loginst,
         nowtm.tm_year + 1900, nowtm.tm_mon + 1, nowtm.tm_mday,
         nowtm.tm_hour, nowtm.tm_min, nowtm.tm_sec);
     int logfd = open (logname, O_CREAT | O_WRONLY, 0666);
@@ -468,8 +504,13 @@ static int forkserver (ShmMS *shmms)
     close (logfd);
 
     // run the daemon program
+    // pass instance along so it opens the same shared memory
+    char const *inst = getenv ("Z11INSTANCE");
+    char *instenv = (char *) alloca ((inst == NULL) ? 1 : strlen (inst) + 13);
+    if (inst != NULL) sprintf (instenv, "Z11INSTANCE=%s", inst);
     char const *args[] = { exebuf, NULL };
-    execve (exebuf, (char *const *) args, NULL);
+    char const *envs[] = { instenv, NULL };
+    execve (exebuf, (char *const *) args, (char *const *) ((inst == NULL) ? NULL : envs));
     fprintf (stderr, "mslock: error spawning %s: %m\n", exebuf);
     ABORT ();
     return 0;
@@ -492,11 +533,15 @@ static int loadfile (ShmMS *shmms, char const *z11name, int drivesel,
     int (*fileloaded) (void *param, int drivesel, int fd),
     void *param);
 
-ShmMS *shmms_svr_initialize (bool resetit, char const *shmmsname, char const *z11name)
+// open shared memory and mark us as the server for it
+//  resume_r = where to return resume flag set by client that started us (cleared in shared memory)
+//  returns with shared memory mutex locked
+ShmMS *shmms_svr_initialize (bool resetit, char const *shmmsname, char const *z11name, bool *resume_r)
 {
     mypid = getpid ();
 
     // open shared memory, create if not there
+    shmmsname = z11instname (shmmsname);
     int shmfd = shm_open (shmmsname, O_RDWR | O_CREAT, 0666);
     if (shmfd < 0) {
         fprintf (stderr, "%s: error creating %s: %m\n", z11name, shmmsname);
@@ -530,6 +575,10 @@ ShmMS *shmms_svr_initialize (bool resetit, char const *shmmsname, char const *z1
     fprintf (stderr, "%s: new %s process %d\n", z11name, z11name, mypid);
     shmms->svrpid = mypid;
 
+    // client that started us up might be restoring a checkpoint
+    if (resume_r != NULL) *resume_r = shmms->resume;
+    shmms->resume = false;
+
     // we don't know about any loaded files so say drives are empty
     // ...unless there is an outstanding load request for a drive
     for (int i = 0; i < SHMMS_NDRIVES; i ++) {
@@ -545,7 +594,7 @@ void shmms_svr_proccmds (ShmMS *shmms, char const *z11name,
     int (*setdrivetype) (void *param, int drivesel),
     int (*fileloaded) (void *param, int drivesel, int fd),
     void (*unloadfile) (void *param, int drivesel),
-    void *param)
+    void *param, int (*syncfiles) (void *param))
 {
     while (true) {
 
@@ -562,6 +611,7 @@ void shmms_svr_proccmds (ShmMS *shmms, char const *z11name,
                 unloadfile (param, driveno);
                 int rc = loadfile (shmms, z11name, driveno, setdrivetype, fileloaded, param);
                 shmms_svr_mutexlock (shmms);
+                dr->resume = false;
                 if (rc >= 0) {
                     shmms->negerr = 0;
                 } else {
@@ -585,6 +635,17 @@ void shmms_svr_proccmds (ShmMS *shmms, char const *z11name,
                 break;
             }
 
+            // something requesting cached writes be written to files
+            case SHMMSCMD_SYNC: {
+                shmms_svr_mutexunlk (shmms);
+                int rc = (syncfiles == NULL) ? 0 : syncfiles (param);
+                shmms_svr_mutexlock (shmms);
+                shmms->negerr  = rc;
+                shmms->command = SHMMSCMD_DONE;
+                if (futex (&shmms->command, FUTEX_WAKE, 1000000000, NULL, NULL, 0) < 0) ABORT ();
+                break;
+            }
+
             // nothing to do, wait
             default: {
                 shmms_svr_mutexunlk (shmms);
@@ -44,6 +44,7 @@
 #define SHMMSCMD_LOAD  1    // load drive with filename,readonly
 #define SHMMSCMD_UNLD  9    // unload drive
 #define SHMMSCMD_DONE 17    // done loading/unloading
+#define SHMMSCMD_SYNC 18    // write all cached data to files
 
 #define SHMMS_FNSIZE 480    // make sure it all fits on one page
 #define SHMMS_NDRIVES 8
@@ -54,6 +55,7 @@ struct ShmMSDrive {
     uint32_t curposn;       // current position
     bool readonly;          // write protected
     bool rl01;              // is an RL01 (or RP04)
+    bool resume;            // load is restoring a checkpoint: same volume, keep curposn
     uint8_t fnseq;          // incremented each change in filename
     char filename[SHMMS_FNSIZE];  // "" for unloaded, else filename loaded
 };
@@ -65,18 +67,20 @@ struct ShmMS {
     int command;        // command to be processed by z11rh/rl/tm
     int negerr;         // negative errno for load commands (0 if success)
     int ndrives;        // actual number of drives supported by z11rh/rl/tm
+    bool resume;        // server starting up for checkpoint restore, leave fpga drive status as is
     ShmMSDrive drives[SHMMS_NDRIVES];
 };
 
-int shmms_load (int ctlid, int drive, bool readonly, char const *filename);
+int shmms_load (int ctlid, int drive, bool readonly, char const *filename, bool resume = false, uint32_t curposn = 0);
 int shmms_stat (int ctlid, int drive, char *buff, int size, uint32_t *curpos_r);
+int shmms_sync (int ctlid);
 
-ShmMS *shmms_svr_initialize (bool resetit, char const *shmmsname, char const *z11name);
+ShmMS *shmms_svr_initialize (bool resetit, char const *shmmsname, char const *z11name, bool *resume_r = NULL);
 void shmms_svr_proccmds (ShmMS *shmms, char const *z11name,
     int (*setdrivetype) (void *param, int drivesel),
     int (*fileloaded) (void *param, int drivesel, int fd),
     void (*unloadfile) (void *param, int drivesel),
-    void *param);
+    void *param, int (*syncfiles) (void *param) = NULL);
 void shmms_svr_mutexlock (ShmMS *shmms);
 void shmms_svr_mutexunlk (ShmMS *shmms);
 
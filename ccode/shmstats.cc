@@ -0,0 +1,140 @@
+//    Copyright (C) Mike Rieker, Beverly, MA USA
+//    www.outerworldapps.com
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; version 2 of the License.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    EXPECT it to FAIL when someone's HeALTh or PROpeRTy is at RISk.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    http://www.gnu.org/licenses/gpl-2.0.html
+
+// Timing statistics published by the daemons in shared memory
+// Daemons call shmstats_init() at startup, then the inline functions
+// in shmstats.h add to the histograms with relaxed atomics.
+// z11stats and z11ctrl's stats command read them.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "shmstats.h"
+#include "strprintf.h"
+#include "z11inst.h"
+#include "z11util.h"
+
+ShmStatsDev *shmstats_dev;
+
+static char const *const devnames[SHMSTATS_NDEVS] = { "rh", "rl", "tm", "xe", "dl", "dz", "pc" };
+static char const *const histnames[SHMSTATS_NHISTS] = { "command", "dma/word", "file i/o", "dma lock" };
+
+static ShmStats *shmstats;
+
+// map the stats shared memory, creating it if necessary
+ShmStats *shmstats_map ()
+{
+    if (shmstats == NULL) {
+        char const *shmname = z11instname (SHMSTATS_NAME);
+        int shmfd = shm_open (shmname, O_RDWR | O_CREAT, 0666);
+        if (shmfd < 0) {
+            fprintf (stderr, "shmstats_map: error opening %s: %m\n", shmname);
+            ABORT ();
+        }
+        if (ftruncate (shmfd, sizeof *shmstats) < 0) {
+            fprintf (stderr, "shmstats_map: error setting %s size: %m\n", shmname);
+            ABORT ();
+        }
+        ShmStats *ss = (ShmStats *) mmap (NULL, sizeof *shmstats, PROT_READ | PROT_WRITE, MAP_SHARED, shmfd, 0);
+        if (ss == MAP_FAILED) ABORT ();
+        close (shmfd);
+        shmstats = ss;
+    }
+    return shmstats;
+}
+
+// daemon is starting up, publish its stats under the given device
+// - can be disabled with envar z11nostats
+void shmstats_init (int devidx)
+{
+    ASSERT ((devidx >= 0) && (devidx < SHMSTATS_NDEVS));
+    if (getenv ("z11nostats") != NULL) return;
+    ShmStatsDev *dev = &shmstats_map ()->devs[devidx];
+    dev->pid = getpid ();
+    shmstats_dev = dev;
+}
+
+// get device index from name
+//  returns < 0: unknown
+//          else: SHMSTATS_xx
+int shmstats_lookup (char const *name)
+{
+    for (int devidx = 0; devidx < SHMSTATS_NDEVS; devidx ++) {
+        if (strcasecmp (name, devnames[devidx]) == 0) return devidx;
+    }
+    return -1;
+}
+
+// zero the stats for a device
+void shmstats_reset (int devidx)
+{
+    ShmStatsDev *dev = &shmstats_map ()->devs[devidx];
+    __atomic_store_n (&dev->bytesin,  0, __ATOMIC_RELAXED);
+    __atomic_store_n (&dev->bytesout, 0, __ATOMIC_RELAXED);
+    for (int h = 0; h < SHMSTATS_NHISTS; h ++) {
+        ShmStatsHist *hist = &dev->hists[h];
+        __atomic_store_n (&hist->count, 0, __ATOMIC_RELAXED);
+        __atomic_store_n (&hist->total, 0, __ATOMIC_RELAXED);
+        __atomic_store_n (&hist->max,   0, __ATOMIC_RELAXED);
+        for (int b = 0; b < SHMSTATS_NBUCKETS; b ++) {
+            __atomic_store_n (&hist->buckets[b], 0, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// get upper limit of bucket containing the given fraction of the values
+static uint64_t percentile (ShmStatsHist const *hist, uint64_t count, int pct)
+{
+    uint64_t want = (count * pct + 99) / 100;
+    uint64_t seen = 0;
+    for (int b = 0; b < SHMSTATS_NBUCKETS; b ++) {
+        seen += hist->buckets[b];
+        if (seen >= want) return (b == 0) ? 0 : (1ULL << b) - 1;
+    }
+    return hist->max;
+}
+
+// format a device's stats as text
+// - nanosecond values shown as microseconds except dma/word
+void shmstats_format (std::string *str, int devidx)
+{
+    ShmStatsDev const *dev = &shmstats_map ()->devs[devidx];
+
+    strprintf (str, "%s: pid %d  in %llu bytes  out %llu bytes\n", devnames[devidx], dev->pid,
+        (unsigned long long) dev->bytesin, (unsigned long long) dev->bytesout);
+
+    for (int h = 0; h < SHMSTATS_NHISTS; h ++) {
+        ShmStatsHist const *hist = &dev->hists[h];
+        uint64_t count = hist->count;
+        if (count == 0) continue;
+        double div = (h == SHMSTATS_DMANS) ? 1.0 : 1000.0;
+        char const *units = (h == SHMSTATS_DMANS) ? "ns" : "us";
+        strprintf (str, "  %-8s  count %10llu  avg %9.1f  p50 %9.1f  p90 %9.1f  p99 %9.1f  max %9.1f %s\n",
+            histnames[h], (unsigned long long) count, hist->total / div / count,
+            percentile (hist, count, 50) / div, percentile (hist, count, 90) / div,
+            percentile (hist, count, 99) / div, hist->max / div, units);
+    }
+}
@@ -0,0 +1,115 @@
+//    Copyright (C) Mike Rieker, Beverly, MA USA
+//    www.outerworldapps.com
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; version 2 of the License.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    EXPECT it to FAIL when someone's HeALTh or PROpeRTy is at RISk.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    http://www.gnu.org/licenses/gpl-2.0.html
+
+// Library for publishing daemon timing statistics in shared memory
+
+#ifndef _SHMSTATS_H
+#define _SHMSTATS_H
+
+#include <stdint.h>
+#include <string>
+#include <time.h>
+
+#define SHMSTATS_NAME "/shm_zturn11_stats"
+
+// devices
+#define SHMSTATS_RH 0
+#define SHMSTATS_RL 1
+#define SHMSTATS_TM 2
+#define SHMSTATS_XE 3
+#define SHMSTATS_DL 4
+#define SHMSTATS_DZ 5
+#define SHMSTATS_PC 6
+#define SHMSTATS_NDEVS 7
+
+// histograms
+#define SHMSTATS_CMDNS 0    // command from pdp to completion, nanoseconds
+#define SHMSTATS_DMANS 1    // dma block transfer, nanoseconds per word
+#define SHMSTATS_FIONS 2    // file or network i/o, nanoseconds
+#define SHMSTATS_LOKNS 3    // waiting for dma lock, nanoseconds
+#define SHMSTATS_NHISTS 4
+
+#define SHMSTATS_NBUCKETS 40    // bucket[i] counts values 2**(i-1) .. 2**i-1
+
+struct ShmStatsHist {
+    uint64_t count;
+    uint64_t total;
+    uint64_t max;
+    uint64_t buckets[SHMSTATS_NBUCKETS];
+};
+
+struct ShmStatsDev {
+    int pid;                // last process to publish stats for the device
+    uint64_t bytesin;       // bytes moved into pdp (file reads, received packets, keyboard chars)
+    uint64_t bytesout;      // bytes moved out of pdp (file writes, transmitted packets, printed chars)
+    ShmStatsHist hists[SHMSTATS_NHISTS];
+};
+
+struct ShmStats {
+    ShmStatsDev devs[SHMSTATS_NDEVS];
+};
+
+extern ShmStatsDev *shmstats_dev;
+
+ShmStats *shmstats_map ();
+void shmstats_init (int devidx);
+int shmstats_lookup (char const *name);
+void shmstats_reset (int devidx);
+void shmstats_format (std::string *str, int devidx);
+
+// get current time for timing something
+static inline uint64_t shmstats_nowns ()
+{
+    if (shmstats_dev == NULL) return 0;
+    struct timespec nowts;
+    clock_gettime (CLOCK_MONOTONIC, &nowts);
+    return nowts.tv_sec * 1000000000ULL + nowts.tv_nsec;
+}
+
+// add value to histogram for this process' device
+static inline void shmstats_value (int histidx, uint64_t value)
+{
+    if (shmstats_dev == NULL) return;
+    ShmStatsHist *hist = &shmstats_dev->hists[histidx];
+    int bucket = (value == 0) ? 0 : 64 - __builtin_clzll (value);
+    if (bucket >= SHMSTATS_NBUCKETS) bucket = SHMSTATS_NBUCKETS - 1;
+    __atomic_fetch_add (&hist->buckets[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add (&hist->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add (&hist->total, value, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n (&hist->max, __ATOMIC_RELAXED);
+    while ((value > max) && ! __atomic_compare_exchange_n (&hist->max, &max, value, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) { }
+}
+
+// add time since startns (from shmstats_nowns()) to histogram
+static inline void shmstats_since (int histidx, uint64_t startns)
+{
+    if (shmstats_dev == NULL) return;
+    shmstats_value (histidx, shmstats_nowns () - startns);
+}
+
+// count bytes moved
+static inline void shmstats_bytes (uint64_t in, uint64_t out)
+{
+    if (shmstats_dev == NULL) return;
+    if (in  != 0) __atomic_fetch_add (&shmstats_dev->bytesin,  in,  __ATOMIC_RELAXED);
+    if (out != 0) __atomic_fetch_add (&shmstats_dev->bytesout, out, __ATOMIC_RELAXED);
+}
+
+#endif
@@ -21,19 +21,25 @@
 // Library for processing tape-drive style I/O
 
 #include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "asyncio.h"
 #include "futex.h"
 #include "shmms.h"
+#include "shmstats.h"
 #include "tapelib.h"
+#include "tapezip.h"
 #include "z11util.h"
 
 // rewind:  (150 inch / second) * (800 chars / inch) = 120,000 chars / second = 8.33uS / char
@@ -50,6 +56,17 @@
 #define RDWUSPERCHR (SKPUSPERCHR-2)
 #define RDWUSPERGAP SKPUSPERGAP
 
+// read-ahead buffer size, two per drive
+// - consecutive buffers overlap by the largest possible record
+#define RASIZE (1024*1024)
+#define RAMAXREC (65536+8)
+
+// number of bytes a record occupies on the tape, including leading and trailing lengths
+static inline uint32_t recsize (uint32_t reclen)
+{
+    return (reclen == 0) ? 4 : ((reclen + 1) & -2) + 8;
+}
+
 // controller-level constructor
 //  input:
 //   shmms = mass-storage shared memory pointer
@@ -57,6 +74,7 @@ TapeCtrlr::TapeCtrlr (ShmMS *shmms, char const *progname)
 {
     this->shmms = shmms;
     this->progname = progname;
+    this->aio = new AsyncIO (progname);
     for (int i = 0; i < SHMMS_NDRIVES; i ++) {
         this->drives[i].ctor (this, i);
     }
@@ -72,6 +90,7 @@ void TapeCtrlr::startio ()
 
 void *TapeCtrlr::iothreadwrap (void *zhis)
 {
+    z11page->setdmaprio (DMAPRI_DISK);
     ((TapeCtrlr *) zhis)->iothread ();
     return NULL;
 }
@@ -123,11 +142,18 @@ int TapeCtrlr::fileloaded (void *zhis, int drivesel, int fd)
     TapeCtrlr *tc = (TapeCtrlr *) zhis;
     TapeDrive *td = &tc->drives[drivesel];
     ShmMSDrive *dr = td->dr;
+    int rc = TapeZip::attach (tc->progname, dr->filename, fd, dr->readonly, &td->tz);
+    if (rc < 0) {
+        errno = - rc;
+        return rc;
+    }
     td->fd = fd;
+    if (dr->resume) strcpy (td->fn, dr->filename);     // checkpoint restore, keep position
     if (strcmp (td->fn, dr->filename) != 0) {
         strcpy (td->fn, dr->filename);
         dr->curposn = 0;
     }
+    td->idxbuild ();
     tc->updstbits ();
     return fd;
 }
@@ -137,6 +163,11 @@ void TapeCtrlr::unloadfile (void *zhis, int drivesel)
 {
     TapeCtrlr *tc = (TapeCtrlr *) zhis;
     TapeDrive *td = &tc->drives[drivesel];
+    td->raflush ();
+    td->idxsave ();
+    td->idxfree ();
+    delete td->tz;
+    td->tz = NULL;
     td->fn[0] = 0;
     close (td->fd);
     td->fd = -1;
@@ -152,11 +183,24 @@ void TapeDrive::ctor (TapeCtrlr *ctrlr, uint32_t drsel)
     this->unload = false;
     this->fn[0]  = 0;
     this->fd     = -1;
+    this->tz     = NULL;
     this->dr     = &ctrlr->shmms->drives[drsel];
     this->ctrlr  = ctrlr;
     this->drsel  = drsel;
     this->dr->rewendsat = 0;
 
+    this->recs     = NULL;
+    this->nrecs    = 0;
+    this->maxrecs  = 0;
+    this->recidx   = 0;
+    this->idxend   = 0;
+    this->idxdirty = false;
+
+    this->dmawords = NULL;
+    this->wrbytes  = NULL;
+
+    memset (this->ras, 0, sizeof this->ras);
+
     pthread_t tmid;
     int rc = pthread_create (&tmid, NULL, timerthread, this);
     if (rc != 0) ABORT ();
@@ -219,52 +263,77 @@ void TapeDrive::waitrewind ()
 //   mtma = incremented
 int TapeDrive::readfwd (uint16_t &mtbc, uint32_t &mtma)
 {
-    // read record length before data
-    uint32_t reclen  = 0;
-    uint32_t reclen2 = 0;
-    int rc = pread (fd, &reclen, sizeof reclen, dr->curposn);
-    if (rc != (int) sizeof reclen) { readerror (rc, sizeof reclen); return -1; }
-    dr->curposn += sizeof reclen;
+    // get record from read-ahead buffer
+    uint64_t startns = shmstats_nowns ();
+    uint8_t const *rec;
+    int avail = rafetch (dr->curposn, rec);
+    if (avail < (int) sizeof (uint32_t)) { readerror (avail, sizeof (uint32_t)); return -1; }
+
+    uint32_t reclen;
+    memcpy (&reclen, rec, sizeof reclen);
 
     // delay for read/write
     if (! ctrlr->fastio) usleep (reclen * RDWUSPERCHR + RDWUSPERGAP);
 
     // if zero, hit a tape mark
-    if (reclen == 0) return 0;
+    if (reclen == 0) {
+        idxappend (dr->curposn, 0);
+        dr->curposn += sizeof reclen;
+        return 0;
+    }
 
-    // read data
+    // make sure all the data and length after data are there
     if (reclen > 65536) ABORT ();
-    uint8_t buf[reclen];
-    rc = pread (fd, buf, reclen, dr->curposn);
-    if (rc != (int) reclen) { readerror (rc, reclen); return -1; }
-    dr->curposn += (reclen + 1) & -2;
+    int recbytes = recsize (reclen);
+    if (avail < recbytes) {
+        dr->curposn += sizeof reclen;
+        readerror (avail, recbytes);
+        return -1;
+    }
 
-    // read record length after data, should match length before data
-    rc = pread (fd, &reclen2, sizeof reclen2, dr->curposn);
-    if (rc != (int) sizeof reclen2) { readerror (rc, sizeof reclen2); return -1; }
+    // record length after data should match length before data
+    uint32_t reclen2;
+    memcpy (&reclen2, rec + recbytes - sizeof reclen2, sizeof reclen2);
     if (reclen2 != reclen) {
+        dr->curposn += recbytes - sizeof reclen2;
         readerror2 (reclen, reclen2);
         return -2;
     }
-    dr->curposn += sizeof reclen2;
+    uint8_t const *buf = rec + sizeof reclen;
+    idxappend (dr->curposn, reclen);
+    dr->curposn += recbytes;
+    shmstats_since (SHMSTATS_FIONS, startns);
+    shmstats_bytes (reclen, 0);
 
     // write data to dma buffer
+    // - odd leading byte, block of whole words, odd trailing byte
+    uint32_t bcleft = 65536 - mtbc;
+    uint32_t nbytes = (reclen < bcleft) ? reclen : bcleft;
     uint32_t i = 0;
-    do {
-        if ((mtbc <= 0xFFFEU) && ! (mtma & 1) && (reclen - i >= 2)) {
-            uint16_t word = buf[i] | ((uint16_t) buf[i+1] << 8);
-            if (! z11page->dmawrite (mtma, word)) { dmaerror (mtma); return -3; }
-            mtbc += 2;
-            mtma += 2;
-            i += 2;
-        } else {
-            if (! z11page->dmawbyte (mtma, buf[i])) { dmaerror (mtma); return -3; }
-            mtbc ++;
-            mtma ++;
-            i ++;
+    if (mtma & 1) {
+        if (! z11page->dmawbyte (mtma, buf[i])) { dmaerror (mtma); return -3; }
+        mtbc ++;
+        mtma = (mtma + 1) & 0777777;
+        i ++;
+    }
+    uint32_t nwds = (nbytes - i) / 2;
+    if (nwds > 0) {
+        if ((dmawords == NULL) && ((dmawords = (uint16_t *) malloc (32768 * sizeof *dmawords)) == NULL)) ABORT ();
+        for (uint32_t j = 0; j < nwds; j ++) {
+            dmawords[j] = buf[i+j*2] | ((uint16_t) buf[i+j*2+1] << 8);
         }
-        mtma &= 0777777;
-    } while ((mtbc != 0) && (i < reclen));
+        uint32_t rd = z11page->dmawriteblock (mtma, nwds, dmawords);
+        mtbc += nwds * 2;
+        mtma  = (mtma + nwds * 2) & 0777777;
+        i    += nwds * 2;
+        if (rd != 0) { dmaerror (mtma); return -3; }
+    }
+    if (i < nbytes) {
+        if (! z11page->dmawbyte (mtma, buf[i])) { dmaerror (mtma); return -3; }
+        mtbc ++;
+        mtma = (mtma + 1) & 0777777;
+        i ++;
+    }
     return (i < reclen) ? 2 : 1;
 }
 
@@ -281,39 +350,61 @@ int TapeDrive::readfwd (uint16_t &mtbc, uint32_t &mtma)
 int TapeDrive::wrdata (uint16_t &mtbc, uint32_t &mtma)
 {
     // read data from dma buffer
+    // - odd leading byte, block of whole words, odd trailing byte
     uint32_t reclen = 65536 - mtbc;
-    uint8_t buf[reclen];
+    if ((wrbytes == NULL) && ((wrbytes = (uint8_t *) malloc (65536)) == NULL)) ABORT ();
+    uint8_t *buf = wrbytes;
     uint32_t i = 0;
-    do {
+    if (mtma & 1) {
         uint16_t word;
         if (z11page->dmaread (mtma & 0777776, &word) != 0) { dmaerror (mtma); return -3; }
-        if ((mtbc <= 0xFFFEU) && ! (mtma & 1)) {
-            buf[i++] = word;
-            buf[i++] = word >> 8;
-            mtbc += 2;
-            mtma += 2;
-        } else {
-            buf[i++] = (mtma & 1) ? (word >> 8) : word;
-            mtbc ++;
-            mtma ++;
+        buf[i++] = word >> 8;
+        mtbc ++;
+        mtma = (mtma + 1) & 0777777;
+    }
+    uint32_t nwds = (reclen - i) / 2;
+    if (nwds > 0) {
+        if ((dmawords == NULL) && ((dmawords = (uint16_t *) malloc (32768 * sizeof *dmawords)) == NULL)) ABORT ();
+        uint32_t rd = z11page->dmareadblock (mtma, nwds, dmawords);
+        for (uint32_t j = 0; j < nwds; j ++) {
+            buf[i++] = dmawords[j];
+            buf[i++] = dmawords[j] >> 8;
         }
-        mtma &= 0777777;
-    } while (mtbc != 0);
+        mtbc += nwds * 2;
+        mtma  = (mtma + nwds * 2) & 0777777;
+        if (rd != 0) { dmaerror (mtma); return -3; }
+    }
+    if (i < reclen) {
+        uint16_t word;
+        if (z11page->dmaread (mtma, &word) != 0) { dmaerror (mtma); return -3; }
+        buf[i++] = word;
+        mtbc ++;
+        mtma = (mtma + 1) & 0777777;
+    }
+
+    // anything on tape after this point is lost
+    uint32_t posn = dr->curposn;
+    raflush ();
+    idxtrunc (posn);
 
     // write record length before data
-    int rc = pwrite (fd, &reclen, sizeof reclen, dr->curposn);
+    uint64_t startns = shmstats_nowns ();
+    int rc = tpwrite (&reclen, sizeof reclen, dr->curposn);
     if (rc != (int) sizeof reclen) { writerror (rc, sizeof reclen); return -4; }
     dr->curposn += sizeof reclen;
 
     // write data
-    rc = pwrite (fd, buf, reclen, dr->curposn);
+    rc = tpwrite (buf, reclen, dr->curposn);
     if (rc != (int) reclen) { writerror (rc, reclen); return -4; }
     dr->curposn += (reclen + 1) & -2;
 
     // write record length after data
-    rc = pwrite (fd, &reclen, sizeof reclen, dr->curposn);
+    rc = tpwrite (&reclen, sizeof reclen, dr->curposn);
     if (rc != (int) sizeof reclen) { writerror (rc, sizeof reclen); return -4; }
     dr->curposn += sizeof reclen;
+    idxappend (posn, reclen);
+    shmstats_since (SHMSTATS_FIONS, startns);
+    shmstats_bytes (0, reclen);
 
     // delay for read/write
     if (! ctrlr->fastio) usleep (reclen * RDWUSPERCHR + RDWUSPERGAP);
@@ -325,8 +416,11 @@ int TapeDrive::wrdata (uint16_t &mtbc, uint32_t &mtma)
 int TapeDrive::wrmark ()
 {
     uint32_t mark = 0;
-    int rc = pwrite (fd, &mark, sizeof mark, dr->curposn);
+    raflush ();
+    idxtrunc (dr->curposn);
+    int rc = tpwrite (&mark, sizeof mark, dr->curposn);
     if (rc != (int) sizeof mark) { writerror (rc, sizeof mark); return -4; }
+    idxappend (dr->curposn, 0);
     dr->curposn += sizeof mark;
 
     // delay for read/write
@@ -335,59 +429,382 @@ int TapeDrive::wrmark ()
     return 0;
 }
 
-// skip forward the given number of records, stopping on tape mark if found
-int TapeDrive::skipfwd ()
+// skip forward over records, stopping on tape mark if found
+// - skips one record, or in fastio mode as many as mtbrc allows
+//  output:
+//   returns -1: file read error
+//            0: record(s) skipped
+//            1: tape mark skipped
+//   mtbrc = incremented for each record and tape mark skipped
+int TapeDrive::skipfwd (uint16_t &mtbrc)
 {
-    // get record length being skipped
-    uint32_t reclen;
-    int rc = pread (fd, &reclen, sizeof reclen, dr->curposn);
-    if (rc != (int) sizeof reclen) { readerror (rc, sizeof reclen); return -1; }
-    dr->curposn += sizeof reclen;
+    do {
 
-    // delay for skip
-    // unlock during delay so gui can update during repeated skips
-    if (! ctrlr->fastio) {
-        ctrlr->unlkit ();
-        usleep (reclen * SKPUSPERCHR + SKPUSPERGAP);
-        ctrlr->lockit ();
-    }
+        // get record length being skipped from index, else read it from tape
+        uint32_t reclen;
+        int idx = idxfind (dr->curposn);
+        if (idx >= 0) {
+            reclen = recs[idx].reclen;
+        } else {
+            int rc = tpread (&reclen, sizeof reclen, dr->curposn);
+            if (rc != (int) sizeof reclen) { readerror (rc, sizeof reclen); return -1; }
+            idxappend (dr->curposn, reclen);
+        }
 
-    // check for tape mark
-    if (reclen == 0) return 1;
+        // delay for skip
+        // unlock during delay so gui can update during repeated skips
+        if (! ctrlr->fastio) {
+            ctrlr->unlkit ();
+            usleep (reclen * SKPUSPERCHR + SKPUSPERGAP);
+            ctrlr->lockit ();
+        }
+
+        // increment over the lengths and data
+        dr->curposn += recsize (reclen);
+        mtbrc ++;
 
-    // increment over the data and length after data
-    dr->curposn += ((reclen + 1) & -2) + sizeof reclen;
+        // check for tape mark
+        if (reclen == 0) return 1;
+    } while (ctrlr->fastio && (mtbrc != 0));
     return 0;
 }
 
-// reverse skip the given number of records, stopping on tape mark if found
-int TapeDrive::skiprev ()
+// skip reverse over records, stopping on tape mark if found
+// - skips one record, or in fastio mode as many as mtbrc allows
+//  output:
+//   returns -1: file read error
+//            0: record(s) skipped
+//            1: tape mark skipped
+//            2: hit beginning of tape
+//   mtbrc = incremented for each record and tape mark skipped
+int TapeDrive::skiprev (uint16_t &mtbrc)
 {
-    // check for beginning of tape
-    if (dr->curposn == 0) return 2;
+    do {
 
-    // read record length in reverse
-    uint32_t reclen;
-    dr->curposn -= sizeof reclen;
-    int rc = pread (fd, &reclen, sizeof reclen, dr->curposn);
-    if (rc != (int) sizeof reclen) { readerror (rc, sizeof reclen); return -1; }
+        // check for beginning of tape
+        if (dr->curposn == 0) return 2;
 
-    // delay for skip
-    // unlock during delay so gui can update during repeated skips
-    if (! ctrlr->fastio) {
-        ctrlr->unlkit ();
-        usleep (reclen * SKPUSPERCHR + SKPUSPERGAP);
-        ctrlr->lockit ();
-    }
+        // get record length from index, else read length after data from tape
+        uint32_t reclen;
+        int idx = idxfindend (dr->curposn);
+        if (idx >= 0) {
+            reclen = recs[idx].reclen;
+        } else {
+            int rc = tpread (&reclen, sizeof reclen, dr->curposn - sizeof reclen);
+            if (rc != (int) sizeof reclen) {
+                dr->curposn -= sizeof reclen;
+                readerror (rc, sizeof reclen);
+                return -1;
+            }
+        }
 
-    // check for tape mark
-    if (reclen == 0) return 1;
+        // delay for skip
+        // unlock during delay so gui can update during repeated skips
+        if (! ctrlr->fastio) {
+            ctrlr->unlkit ();
+            usleep (reclen * SKPUSPERCHR + SKPUSPERGAP);
+            ctrlr->lockit ();
+        }
+
+        // decrement over the lengths and data
+        dr->curposn -= recsize (reclen);
+        mtbrc ++;
 
-    // decrement over the data and length before data
-    dr->curposn -= ((reclen + 1) & -2) + sizeof reclen;
+        // check for tape mark
+        if (reclen == 0) return 1;
+    } while (ctrlr->fastio && (mtbrc != 0));
     return 0;
 }
 
+//////////////////
+//  Read-ahead  //
+//////////////////
+
+// get pointer to tape contents at the given position
+//  output:
+//   returns < 0: read error, errno set
+//          else: number of bytes available at ptr, at least RAMAXREC unless hit end of file
+//   ptr = points to tape contents at posn
+// - reading of whatever follows is started in the background
+int TapeDrive::rafetch (uint32_t posn, uint8_t const *&ptr)
+{
+    // if a read-ahead in progress covers the position, wait for it
+    for (int b = 0; b < 2; b ++) {
+        if (ras[b].busy && (posn >= ras[b].posn) && (posn - ras[b].posn < RASIZE)) rawait (b);
+    }
+
+    // see if either buffer has a whole record at the position
+    int b;
+    for (b = 0; b < 2; b ++) {
+        TapeRA *ra = &ras[b];
+        if (ra->valid && (posn >= ra->posn)) {
+            uint32_t off = posn - ra->posn;
+            if (ra->eof ? (off <= ra->len) : (off + RAMAXREC <= ra->len)) break;
+        }
+    }
+
+    // if not, read it now
+    if (b == 2) {
+        b = ras[0].busy ? 1 : 0;
+        rawait (b);
+        rastart (b, posn);
+        if (rawait (b) < 0) return -1;
+    }
+
+    // start reading what comes after this buffer
+    // - overlaps this buffer by the largest record so any record fits entirely in one or the other
+    int o = 1 - b;
+    if (! ras[b].eof && ! ras[o].busy) {
+        uint32_t next = ras[b].posn + ras[b].len - RAMAXREC;
+        if (! ras[o].valid || (ras[o].posn != next)) rastart (o, next);
+    }
+
+    uint32_t off = posn - ras[b].posn;
+    ptr = ras[b].buf + off;
+    return ras[b].len - off;
+}
+
+// start reading into a read-ahead buffer
+void TapeDrive::rastart (int b, uint32_t posn)
+{
+    TapeRA *ra = &ras[b];
+    if (ra->buf == NULL) {
+        if (posix_memalign ((void **) &ra->buf, 4096, RASIZE) != 0) ABORT ();
+    }
+    memset (&ra->req, 0, sizeof ra->req);
+    ra->req.fd   = fd;
+    ra->req.buf  = ra->buf;
+    ra->req.size = RASIZE;
+    ra->req.off  = posn;
+    if (tz != NULL) {
+        ra->req.func  = rafunc;
+        ra->req.param = tz;
+    }
+    ra->posn  = posn;
+    ra->busy  = true;
+    ra->valid = false;
+    ctrlr->aio->submit (&ra->req);
+}
+
+// read compressed tape into read-ahead buffer, called in AsyncIO worker thread
+int TapeDrive::rafunc (AIOReq *req)
+{
+    return ((TapeZip *) req->param)->pread (req->buf, req->size, req->off);
+}
+
+// wait for read into read-ahead buffer to complete
+//  returns < 0: read error, errno set
+//          else: number of bytes read
+int TapeDrive::rawait (int b)
+{
+    TapeRA *ra = &ras[b];
+    if (! ra->busy) return ra->valid ? ra->len : 0;
+    int rc = ctrlr->aio->wait (&ra->req);
+    ra->busy = false;
+    if (rc >= 0) {
+        ra->len   = rc;
+        ra->eof   = (rc < RASIZE);
+        ra->valid = true;
+    }
+    return rc;
+}
+
+// tape about to be written or unloaded, discard read-ahead data
+void TapeDrive::raflush ()
+{
+    for (int b = 0; b < 2; b ++) {
+        rawait (b);
+        ras[b].valid = false;
+    }
+}
+
+//////////////////
+//  Tape index  //
+//////////////////
+
+// build index of records on tape just loaded
+// - use sidecar file if it matches the tape file, otherwise scan the tape file
+void TapeDrive::idxbuild ()
+{
+    raflush ();
+    idxfree ();
+
+    uint64_t filesize, mtimens;
+    tstat (&filesize, &mtimens);
+
+    // try the sidecar file
+    char idxname[SHMMS_FNSIZE+4];
+    snprintf (idxname, sizeof idxname, "%s.idx", fn);
+    bool valid = false;
+    int idxfd = open (idxname, O_RDONLY);
+    if (idxfd >= 0) {
+        TapeIdxHdr hdr;
+        if ((read (idxfd, &hdr, sizeof hdr) == (int) sizeof hdr) &&
+                (memcmp (hdr.magic, TAPEIDX_MAGIC, sizeof hdr.magic) == 0) &&
+                (hdr.filesize == filesize) && (hdr.mtimens == mtimens)) {
+            maxrecs = hdr.nrecs + 1024;
+            recs = (TapeRec *) malloc (maxrecs * sizeof *recs);
+            if (recs == NULL) ABORT ();
+            int nbytes = hdr.nrecs * sizeof *recs;
+            if (read (idxfd, recs, nbytes) == nbytes) {
+
+                // make sure records are contiguous from beginning of tape
+                valid = true;
+                for (uint32_t i = 0; i < hdr.nrecs; i ++) {
+                    if ((recs[i].posn != idxend) || (recs[i].reclen > 65536)) {
+                        valid = false;
+                        break;
+                    }
+                    idxend += recsize (recs[i].reclen);
+                }
+                if (valid) nrecs = hdr.nrecs;
+            }
+        }
+        close (idxfd);
+        if (! valid) {
+            fprintf (stderr, "%s: [%u] ignoring stale index %s\n", ctrlr->progname, drsel, idxname);
+            idxfree ();
+        }
+    }
+
+    // no good sidecar, scan the tape file up to end or first bad record
+    if (! valid) {
+        while ((uint64_t) idxend + sizeof (uint32_t) <= filesize) {
+            uint32_t reclen, reclen2;
+            if (tpread (&reclen, sizeof reclen, idxend) != (int) sizeof reclen) break;
+            if (reclen > 65536) break;
+            if (reclen != 0) {
+                uint64_t endposn = (uint64_t) idxend + recsize (reclen);
+                if ((endposn > filesize) || (endposn > 0xFFFFFFFFULL)) break;
+                if (tpread (&reclen2, sizeof reclen2, endposn - sizeof reclen2) != (int) sizeof reclen2) break;
+                if (reclen2 != reclen) break;
+            }
+            idxappend (idxend, reclen);
+        }
+        idxdirty = true;
+        idxsave ();
+    }
+}
+
+// write index to sidecar file so next load of the tape does not have to scan it
+// - failure is harmless, it just means the tape gets scanned next time
+void TapeDrive::idxsave ()
+{
+    if (! idxdirty || (fd < 0)) return;
+
+    uint64_t filesize, mtimens;
+    tstat (&filesize, &mtimens);
+
+    TapeIdxHdr hdr;
+    memset (&hdr, 0, sizeof hdr);
+    memcpy (hdr.magic, TAPEIDX_MAGIC, sizeof hdr.magic);
+    hdr.filesize = filesize;
+    hdr.mtimens  = mtimens;
+    hdr.nrecs    = nrecs;
+
+    char idxname[SHMMS_FNSIZE+4];
+    snprintf (idxname, sizeof idxname, "%s.idx", fn);
+    int idxfd = open (idxname, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (idxfd < 0) return;
+    struct iovec iov[2];
+    iov[0].iov_base = &hdr;
+    iov[0].iov_len  = sizeof hdr;
+    iov[1].iov_base = recs;
+    iov[1].iov_len  = nrecs * sizeof *recs;
+    if (writev (idxfd, iov, 2) != (int) (iov[0].iov_len + iov[1].iov_len)) {
+        close (idxfd);
+        unlink (idxname);
+        return;
+    }
+    close (idxfd);
+    idxdirty = false;
+}
+
+// tape being unloaded, free index
+void TapeDrive::idxfree ()
+{
+    free (recs);
+    recs     = NULL;
+    nrecs    = 0;
+    maxrecs  = 0;
+    recidx   = 0;
+    idxend   = 0;
+    idxdirty = false;
+}
+
+// find index entry for record starting at given position
+//  returns < 0: not in index
+//         else: index of entry
+// - checks near the last lookup first so sequential access does not search
+int TapeDrive::idxfind (uint32_t posn)
+{
+    if (posn >= idxend) return -1;
+    uint32_t lo = 0;
+    uint32_t hi = nrecs;
+    for (uint32_t i = (recidx > 0) ? recidx - 1 : 0; (i < nrecs) && (i <= recidx + 1); i ++) {
+        if (recs[i].posn == posn) {
+            recidx = i;
+            return i;
+        }
+    }
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (recs[mid].posn < posn) lo = mid + 1;
+        else hi = mid;
+    }
+    if ((lo >= nrecs) || (recs[lo].posn != posn)) return -1;
+    recidx = lo;
+    return lo;
+}
+
+// find index entry for record ending at given position
+//  returns < 0: not in index
+//         else: index of entry
+int TapeDrive::idxfindend (uint32_t posn)
+{
+    if ((posn == 0) || (posn > idxend)) return -1;
+    if (posn == idxend) {
+        recidx = nrecs - 1;
+        return recidx;
+    }
+    int idx = idxfind (posn);
+    if (idx <= 0) return -1;
+    recidx = -- idx;
+    return idx;
+}
+
+// add a record to end of index
+// - ignored if record does not start right at the end of the index or has a bad length
+void TapeDrive::idxappend (uint32_t posn, uint32_t reclen)
+{
+    if ((posn != idxend) || (reclen > 65536)) return;
+    if (nrecs >= maxrecs) {
+        maxrecs = maxrecs * 2 + 1024;
+        recs = (TapeRec *) realloc (recs, maxrecs * sizeof *recs);
+        if (recs == NULL) ABORT ();
+    }
+    recs[nrecs].posn   = posn;
+    recs[nrecs].reclen = reclen;
+    recidx  = nrecs ++;
+    idxend += recsize (reclen);
+    idxdirty = true;
+}
+
+// about to write at given position, remove any records at or beyond that point from index
+// - also removes the sidecar file as it no longer matches the tape
+void TapeDrive::idxtrunc (uint32_t posn)
+{
+    while ((nrecs > 0) && (recs[nrecs-1].posn + recsize (recs[nrecs-1].reclen) > posn)) -- nrecs;
+    idxend = (nrecs > 0) ? recs[nrecs-1].posn + recsize (recs[nrecs-1].reclen) : 0;
+    if (recidx > nrecs) recidx = nrecs;
+    if (! idxdirty) {
+        char idxname[SHMMS_FNSIZE+4];
+        snprintf (idxname, sizeof idxname, "%s.idx", fn);
+        unlink (idxname);
+        idxdirty = true;
+    }
+}
+
 // wait for changes in dr->rewendsat
 // when time is up, clear rewind in progress and unload tape or set tape unit ready
 void *TapeDrive::timerthread (void *zhis)
@@ -437,6 +854,30 @@ void *TapeDrive::timerthread (void *zhis)
     }
 }
 
+// read and write tape image, either plain or compressed
+int TapeDrive::tpread (void *buf, uint32_t size, uint32_t posn)
+{
+    return (tz != NULL) ? tz->pread (buf, size, posn) : pread (fd, buf, size, posn);
+}
+
+int TapeDrive::tpwrite (void const *buf, uint32_t size, uint32_t posn)
+{
+    return (tz != NULL) ? tz->pwrite (buf, size, posn) : pwrite (fd, buf, size, posn);
+}
+
+// get size and modification time of tape image
+void TapeDrive::tstat (uint64_t *size_r, uint64_t *mtimens_r)
+{
+    if (tz != NULL) {
+        tz->stat (size_r, mtimens_r);
+    } else {
+        struct stat statbuf;
+        if (fstat (fd, &statbuf) < 0) ABORT ();
+        *size_r    = statbuf.st_size;
+        *mtimens_r = statbuf.st_mtim.tv_sec * 1000000000ULL + statbuf.st_mtim.tv_nsec;
+    }
+}
+
 void TapeDrive::readerror (int rc, int nbytes)
 {
     if (rc < 0) {
@@ -23,13 +23,36 @@
 
 #include <stdint.h>
 
+#include "asyncio.h"
 #include "shmms.h"
+#include "tapezip.h"
+
+#define TAPEIDX_MAGIC "z11tidx1"
 
 struct TapeCtrlr;
 
+// record index entry
+// - one per record or tape mark, in order of position on the tape
+struct TapeRec {
+    uint32_t posn;                  // byte offset of leading record length
+    uint32_t reclen;                // record length, 0 for tape mark
+};
+
+// header at beginning of index sidecar file (<tapefile>.idx)
+// - followed by nrecs TapeRec's
+// - only valid if size and modification time still match the tape file
+struct TapeIdxHdr {
+    char magic[8];
+    uint64_t filesize;
+    uint64_t mtimens;
+    uint32_t nrecs;
+    uint32_t spare;
+};
+
 struct TapeDrive {
     char fn[SHMMS_FNSIZE];
     int fd;
+    TapeZip *tz;                    // NULL if plain tape image
     ShmMSDrive *dr;
     TapeCtrlr *ctrlr;
     uint32_t drsel;
@@ -40,14 +63,53 @@ struct TapeDrive {
     int readfwd (uint16_t &mtbc, uint32_t &mtma);
     int wrdata (uint16_t &mtbc, uint32_t &mtma);
     int wrmark ();
-    int skipfwd ();
-    int skiprev ();
+    int skipfwd (uint16_t &mtbrc);
+    int skiprev (uint16_t &mtbrc);
+    void idxbuild ();
+    void idxsave ();
+    void idxfree ();
+    void raflush ();
 
     static void *timerthread (void *zhis);
 
 private:
     bool unload;
 
+    TapeRec *recs;                  // index of records from beginning of tape
+    uint32_t nrecs;                 // number of entries in recs[]
+    uint32_t maxrecs;               // number allocated in recs[]
+    uint32_t recidx;                // entry probably at or near dr->curposn
+    uint32_t idxend;                // tape position just past recs[nrecs-1]
+    bool idxdirty;                  // recs[] differs from sidecar file
+
+    uint16_t *dmawords;             // 32768 words for block dma, allocated on first use
+    uint8_t *wrbytes;               // 65536 bytes of record being written, allocated on first use
+
+    // read-ahead buffers, used alternately
+    struct TapeRA {
+        uint8_t *buf;               // RASIZE bytes, allocated on first use
+        AIOReq req;                 // read into buf
+        uint32_t posn;              // tape position of buf[0]
+        uint32_t len;               // number of valid bytes in buf
+        bool busy;                  // req in progress
+        bool valid;                 // buf holds len bytes from posn
+        bool eof;                   // buf reaches end of file
+    } ras[2];
+
+    int rafetch (uint32_t posn, uint8_t const *&ptr);
+    void rastart (int b, uint32_t posn);
+    int rawait (int b);
+    static int rafunc (AIOReq *req);
+
+    int tpread (void *buf, uint32_t size, uint32_t posn);
+    int tpwrite (void const *buf, uint32_t size, uint32_t posn);
+    void tstat (uint64_t *size_r, uint64_t *mtimens_r);
+
+    int idxfind (uint32_t posn);
+    int idxfindend (uint32_t posn);
+    void idxappend (uint32_t posn, uint32_t reclen);
+    void idxtrunc (uint32_t posn);
+
     void readerror (int rc, int nbytes);
     void readerror2 (uint32_t reclen, uint32_t reclen2);
     void writerror (int rc, int nbytes);
@@ -58,6 +120,7 @@ struct TapeCtrlr {
     bool fastio;
     char const *progname;
     ShmMS *shmms;
+    AsyncIO *aio;                            // background read-ahead
     TapeDrive drives[SHMMS_NDRIVES];
     uint32_t tapelen;                        // number bytes in reel of tape
 
@@ -0,0 +1,398 @@
+//    Copyright (C) Mike Rieker, Beverly, MA USA
+//    www.outerworldapps.com
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; version 2 of the License.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    EXPECT it to FAIL when someone's HeALTh or PROpeRTy is at RISk.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    http://www.gnu.org/licenses/gpl-2.0.html
+
+// Compressed tape images
+// The plain tape image is compressed in fixed-size blocks, each block
+// being a separate gzip member, so any part of the tape can be read by
+// decompressing just the block(s) holding it.  Writes go to an
+// uncompressed journal file that holds the tape from the first written
+// position on.  Compacting (z11tapz) folds the journal back in.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "tapezip.h"
+#include "z11util.h"
+
+static bool isblkhdr (uint8_t const *hdr);
+static uint32_t getle32 (uint8_t const *p);
+
+// see if a tape image file is compressed and open its journal if any
+//  input:
+//   progname = daemon name for error messages
+//   filename = name of tape image file
+//   fd = tape image file as loaded in drive
+//   readonly = drive is write-locked
+//  output:
+//   returns < 0: errno
+//             0: plain image file, *tz_r = NULL
+//             1: compressed, *tz_r = compressed image
+int TapeZip::attach (char const *progname, char const *filename, int fd, bool readonly, TapeZip **tz_r)
+{
+    *tz_r = NULL;
+
+    uint8_t hdr[TZ_HDRSIZE];
+    if ((::pread (fd, hdr, sizeof hdr, 0) != (int) sizeof hdr) || ! isblkhdr (hdr)) return 0;
+
+    TapeZip *tz = new TapeZip ();
+    tz->progname = progname;
+    tz->zfd      = fd;
+    tz->readonly = readonly;
+
+    struct stat statbuf;
+    if (fstat (fd, &statbuf) < 0) ABORT ();
+    tz->zsize    = statbuf.st_size;
+    tz->zmtimens = statbuf.st_mtim.tv_sec * 1000000000ULL + statbuf.st_mtim.tv_nsec;
+
+    // find all the blocks by hopping from one header to the next
+    uint32_t allocblocks = 0;
+    uint64_t off = 0;
+    int rc = 1;
+    while (off < tz->zsize) {
+        uint32_t csize = 0;
+        if ((::pread (fd, hdr, sizeof hdr, off) == (int) sizeof hdr) && isblkhdr (hdr)) csize = getle32 (hdr + 16);
+        if ((csize < TZ_HDRSIZE + 8) || (csize > TZ_MAXCSIZE) || (off + csize > tz->zsize)) {
+            fprintf (stderr, "%s: bad compressed block header at %llu in %s\n", progname, (unsigned long long) off, filename);
+            rc = -EINVAL;
+            goto done;
+        }
+        if (tz->nblocks + 1 >= allocblocks) {
+            allocblocks = allocblocks * 2 + 256;
+            tz->blkoffs = (uint64_t *) realloc (tz->blkoffs, allocblocks * sizeof *tz->blkoffs);
+            if (tz->blkoffs == NULL) ABORT ();
+        }
+        tz->blkoffs[tz->nblocks++] = off;
+        off += csize;
+    }
+    tz->blkoffs[tz->nblocks] = off;
+    tz->curblk = tz->nblocks;
+
+    // all blocks are full size except maybe the last, gzip trailer has its size
+    {
+        uint8_t isize[4];
+        if (::pread (fd, isize, sizeof isize, tz->zsize - sizeof isize) != (int) sizeof isize) {
+            rc = (errno == 0) ? -EIO : - errno;
+            fprintf (stderr, "%s: error reading %s: %m\n", progname, filename);
+            goto done;
+        }
+        uint32_t lastsize = getle32 (isize);
+        if ((lastsize == 0) || (lastsize > TZ_BLKSIZE)) {
+            fprintf (stderr, "%s: bad last block size %u in %s\n", progname, lastsize, filename);
+            rc = -EINVAL;
+            goto done;
+        }
+        tz->plainsize = (uint64_t) (tz->nblocks - 1) * TZ_BLKSIZE + lastsize;
+        tz->jnlbase   = tz->plainsize;
+    }
+
+    // open journal if there is one, it must have been made for this exact compressed file
+    tz->jnlname = (char *) malloc (strlen (filename) + 5);
+    if (tz->jnlname == NULL) ABORT ();
+    sprintf (tz->jnlname, "%s.jnl", filename);
+    tz->jnlfd = open (tz->jnlname, readonly ? O_RDONLY : O_RDWR);
+    if (tz->jnlfd < 0) {
+        if (errno != ENOENT) {
+            rc = - errno;
+            fprintf (stderr, "%s: error opening %s: %m\n", progname, tz->jnlname);
+        }
+    } else {
+        TZJnlHdr jnlhdr;
+        if ((::pread (tz->jnlfd, &jnlhdr, sizeof jnlhdr, 0) != (int) sizeof jnlhdr) ||
+                (memcmp (jnlhdr.magic, TZ_JNLMAGIC, sizeof jnlhdr.magic) != 0) ||
+                (jnlhdr.zsize != tz->zsize) || (jnlhdr.zmtimens != tz->zmtimens)) {
+            fprintf (stderr, "%s: journal %s was not made for %s\n", progname, tz->jnlname, filename);
+            rc = -ESTALE;
+        } else {
+            tz->jnlbase = jnlhdr.jnlbase;
+        }
+    }
+
+done:;
+    if (rc < 0) {
+        delete tz;
+        return rc;
+    }
+    *tz_r = tz;
+    return rc;
+}
+
+// write compressed tape image
+//  input:
+//   outfd  = file to write compressed image to
+//   rdfunc = reads plain tape image, returns bytes read, 0 at end, < 0 on error with errno set
+//   level  = zlib compression level
+//  output:
+//   returns < 0: errno
+//          else: number of plain tape bytes compressed
+int64_t TapeZip::compress (int outfd, int (*rdfunc) (void *param, void *buf, uint32_t size, uint64_t off), void *param, int level)
+{
+    uint8_t *inbuf  = (uint8_t *) malloc (TZ_BLKSIZE);
+    uint8_t *outbuf = (uint8_t *) malloc (TZ_MAXCSIZE);
+    if ((inbuf == NULL) || (outbuf == NULL)) ABORT ();
+
+    uint64_t off = 0;
+    uint64_t outoff = 0;
+    int64_t rc = 0;
+    while (true) {
+
+        // get next block of plain tape
+        uint32_t len = 0;
+        while (len < TZ_BLKSIZE) {
+            int rrc = rdfunc (param, inbuf + len, TZ_BLKSIZE - len, off + len);
+            if (rrc < 0) { rc = - errno; goto done; }
+            if (rrc == 0) break;
+            len += rrc;
+        }
+        if (len == 0) break;
+
+        // compress it with the extra subfield giving compressed size
+        uint8_t extra[8] = { 'Z', 'T', 4, 0, 0, 0, 0, 0 };
+        gz_header gzhdr;
+        memset (&gzhdr, 0, sizeof gzhdr);
+        gzhdr.os        = 3;
+        gzhdr.extra     = extra;
+        gzhdr.extra_len = sizeof extra;
+        z_stream zs;
+        memset (&zs, 0, sizeof zs);
+        if (deflateInit2 (&zs, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) ABORT ();
+        if (deflateSetHeader (&zs, &gzhdr) != Z_OK) ABORT ();
+        zs.next_in   = inbuf;
+        zs.avail_in  = len;
+        zs.next_out  = outbuf;
+        zs.avail_out = TZ_MAXCSIZE;
+        int zrc = deflate (&zs, Z_FINISH);
+        uint32_t csize = zs.total_out;
+        deflateEnd (&zs);
+        if ((zrc != Z_STREAM_END) || ! isblkhdr (outbuf)) ABORT ();
+        outbuf[16] = csize;
+        outbuf[17] = csize >> 8;
+        outbuf[18] = csize >> 16;
+        outbuf[19] = csize >> 24;
+
+        int wrc = ::pwrite (outfd, outbuf, csize, outoff);
+        if (wrc != (int) csize) { rc = (wrc < 0) ? - errno : -EIO; goto done; }
+        off    += len;
+        outoff += csize;
+        if (len < TZ_BLKSIZE) break;
+    }
+    rc = off;
+
+done:;
+    free (inbuf);
+    free (outbuf);
+    return rc;
+}
+
+TapeZip::TapeZip ()
+{
+    progname  = NULL;
+    jnlname   = NULL;
+    zfd       = -1;
+    jnlfd     = -1;
+    readonly  = true;
+    zsize     = 0;
+    zmtimens  = 0;
+    plainsize = 0;
+    jnlbase   = 0;
+    nblocks   = 0;
+    blkoffs   = NULL;
+    curblk    = 0;
+    curlen    = 0;
+    curbuf    = (uint8_t *) malloc (TZ_BLKSIZE);
+    zbuf      = (uint8_t *) malloc (TZ_MAXCSIZE);
+    if ((curbuf == NULL) || (zbuf == NULL)) ABORT ();
+    if (pthread_mutex_init (&mutex, NULL) != 0) ABORT ();
+}
+
+// close journal, caller closes compressed file
+TapeZip::~TapeZip ()
+{
+    if (jnlfd >= 0) close (jnlfd);
+    free (jnlname);
+    free (blkoffs);
+    free (curbuf);
+    free (zbuf);
+    pthread_mutex_destroy (&mutex);
+}
+
+// read from tape image
+//  returns same as pread()
+int TapeZip::pread (void *buf, uint32_t size, uint64_t off)
+{
+    uint8_t *ptr = (uint8_t *) buf;
+    int rc = 0;
+    int err = 0;
+
+    if (pthread_mutex_lock (&mutex) != 0) ABORT ();
+    while (size > 0) {
+
+        // journal has everything from jnlbase on
+        if (off >= jnlbase) {
+            if (jnlfd < 0) break;
+            int jrc = ::pread (jnlfd, ptr, size, TZ_JNLDATA + off - jnlbase);
+            if (jrc < 0) err = errno;
+            else rc += jrc;
+            break;
+        }
+
+        // anything before that is in compressed blocks
+        if (loadblock (off / TZ_BLKSIZE) < 0) {
+            err = errno;
+            break;
+        }
+        uint32_t boff = off % TZ_BLKSIZE;
+        if (boff >= curlen) break;
+        uint32_t len = curlen - boff;
+        if (len > size) len = size;
+        if (len > jnlbase - off) len = jnlbase - off;
+        memcpy (ptr, curbuf + boff, len);
+        ptr  += len;
+        off  += len;
+        size -= len;
+        rc   += len;
+    }
+    if (pthread_mutex_unlock (&mutex) != 0) ABORT ();
+
+    // error only if nothing was read, like pread()
+    if ((rc == 0) && (err != 0)) {
+        errno = err;
+        return -1;
+    }
+    return rc;
+}
+
+// write to tape image
+// - goes to journal, starting a new one if writing before the current one
+//  returns same as pwrite()
+int TapeZip::pwrite (void const *buf, uint32_t size, uint64_t off)
+{
+    if (readonly) {
+        errno = EROFS;
+        return -1;
+    }
+
+    int rc = 0;
+    if (pthread_mutex_lock (&mutex) != 0) ABORT ();
+    if ((jnlfd < 0) || (off < jnlbase)) {
+        rc = openjnl (off);
+    }
+    if (rc >= 0) rc = ::pwrite (jnlfd, buf, size, TZ_JNLDATA + off - jnlbase);
+    int err = errno;
+    if (pthread_mutex_unlock (&mutex) != 0) ABORT ();
+    errno = err;
+    return rc;
+}
+
+// get size and modification time of the tape image as a whole
+void TapeZip::stat (uint64_t *size_r, uint64_t *mtimens_r)
+{
+    *size_r    = plainsize;
+    *mtimens_r = zmtimens;
+    if (jnlfd >= 0) {
+        struct stat statbuf;
+        if (fstat (jnlfd, &statbuf) < 0) ABORT ();
+        uint64_t jnlmtimens = statbuf.st_mtim.tv_sec * 1000000000ULL + statbuf.st_mtim.tv_nsec;
+        *size_r = jnlbase + ((statbuf.st_size > TZ_JNLDATA) ? statbuf.st_size - TZ_JNLDATA : 0);
+        if (*mtimens_r < jnlmtimens) *mtimens_r = jnlmtimens;
+    }
+}
+
+// make sure the given block is decompressed in curbuf
+//  returns < 0: error, errno set
+//          else: successful, curlen = 0 if beyond end of tape
+int TapeZip::loadblock (uint32_t blkno)
+{
+    if (blkno == curblk) return 0;
+    curblk = nblocks;
+    curlen = 0;
+    if (blkno >= nblocks) return 0;
+
+    uint32_t csize = blkoffs[blkno+1] - blkoffs[blkno];
+    int rc = ::pread (zfd, zbuf, csize, blkoffs[blkno]);
+    if (rc != (int) csize) {
+        if (rc >= 0) errno = EIO;
+        return -1;
+    }
+
+    z_stream zs;
+    memset (&zs, 0, sizeof zs);
+    if (inflateInit2 (&zs, 15 + 16) != Z_OK) ABORT ();
+    zs.next_in   = zbuf;
+    zs.avail_in  = csize;
+    zs.next_out  = curbuf;
+    zs.avail_out = TZ_BLKSIZE;
+    int zrc = inflate (&zs, Z_FINISH);
+    uint32_t len = zs.total_out;
+    inflateEnd (&zs);
+    if (zrc != Z_STREAM_END) {
+        fprintf (stderr, "%s: error %d decompressing block %u\n", progname, zrc, blkno);
+        errno = EIO;
+        return -1;
+    }
+    curblk = blkno;
+    curlen = len;
+    return 0;
+}
+
+// start new journal, discarding old one
+// jnlbase is left as is if it fails
+int TapeZip::openjnl (uint64_t newbase)
+{
+    if (jnlfd < 0) {
+        jnlfd = open (jnlname, O_RDWR | O_CREAT, 0666);
+        if (jnlfd < 0) {
+            fprintf (stderr, "%s: error creating %s: %m\n", progname, jnlname);
+            return -1;
+        }
+    }
+    TZJnlHdr jnlhdr;
+    memset (&jnlhdr, 0, sizeof jnlhdr);
+    memcpy (jnlhdr.magic, TZ_JNLMAGIC, sizeof jnlhdr.magic);
+    jnlhdr.jnlbase  = newbase;
+    jnlhdr.zsize    = zsize;
+    jnlhdr.zmtimens = zmtimens;
+    if ((ftruncate (jnlfd, TZ_JNLDATA) < 0) || (::pwrite (jnlfd, &jnlhdr, sizeof jnlhdr, 0) != (int) sizeof jnlhdr)) {
+        if (errno == 0) errno = EIO;
+        fprintf (stderr, "%s: error writing %s: %m\n", progname, jnlname);
+        return -1;
+    }
+    jnlbase = newbase;
+    return 0;
+}
+
+// see if it looks like one of our gzip member headers
+static bool isblkhdr (uint8_t const *hdr)
+{
+    return (hdr[0] == 0x1F) && (hdr[1] == 0x8B) && (hdr[2] == Z_DEFLATED) && (hdr[3] == 4) &&
+        (hdr[10] == 8) && (hdr[11] == 0) && (hdr[12] == 'Z') && (hdr[13] == 'T') && (hdr[14] == 4) && (hdr[15] == 0);
+}
+
+static uint32_t getle32 (uint8_t const *p)
+{
+    return p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
@@ -0,0 +1,86 @@
+//    Copyright (C) Mike Rieker, Beverly, MA USA
+//    www.outerworldapps.com
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; version 2 of the License.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    EXPECT it to FAIL when someone's HeALTh or PROpeRTy is at RISk.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    http://www.gnu.org/licenses/gpl-2.0.html
+
+// Library for compressed tape image files
+
+#ifndef _TAPEZIP_H
+#define _TAPEZIP_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+// compressed tape file layout:
+//  sequence of gzip members, each holding TZ_BLKSIZE bytes of the plain tape image (last one can be shorter)
+//  each member header has an extra subfield 'Z','T' giving the member's total compressed size
+//  so the blocks can be found without decompressing anything
+//  'gunzip < x.tap > plain.tap' gives the plain tape image
+#define TZ_BLKSIZE (256*1024)
+#define TZ_HDRSIZE 20           // gzip header through end of 'Z','T' subfield
+#define TZ_MAXCSIZE (TZ_BLKSIZE+TZ_BLKSIZE/16+1024)
+
+// journal file layout (<tapefile>.jnl):
+//  [0:4095] = header
+//  [4096:...] = plain tape contents starting at jnlbase
+// tape contents before jnlbase come from the compressed file
+#define TZ_JNLMAGIC "z11tjnl1"
+#define TZ_JNLDATA 4096
+
+struct TZJnlHdr {
+    char magic[8];          // TZ_JNLMAGIC
+    uint64_t jnlbase;       // tape position of first byte in journal
+    uint64_t zsize;         // compressed file size and modification time
+    uint64_t zmtimens;      // ...journal only valid for that file
+};
+
+// compressed tape image with uncompressed journal for writes
+struct TapeZip {
+    static int attach (char const *progname, char const *filename, int fd, bool readonly, TapeZip **tz_r);
+    static int64_t compress (int outfd, int (*rdfunc) (void *param, void *buf, uint32_t size, uint64_t off), void *param, int level);
+
+    ~TapeZip ();
+
+    int pread (void *buf, uint32_t size, uint64_t off);
+    int pwrite (void const *buf, uint32_t size, uint64_t off);
+    void stat (uint64_t *size_r, uint64_t *mtimens_r);
+
+private:
+    char const *progname;
+    char *jnlname;                      // journal file name
+    int zfd;                            // compressed file (caller's)
+    int jnlfd;                          // journal file, -1 if none yet
+    bool readonly;
+    uint64_t zsize;                     // compressed file size
+    uint64_t zmtimens;                  // compressed file modification time
+    uint64_t plainsize;                 // size of plain tape image in compressed file
+    uint64_t jnlbase;                   // tape position of start of journal (plainsize if none)
+    uint32_t nblocks;                   // number of compressed blocks
+    uint64_t *blkoffs;                  // file offset of each block, [nblocks] = end of last
+    uint32_t curblk;                    // block number in curbuf, nblocks if none
+    uint32_t curlen;                    // number of bytes in curbuf
+    uint8_t *curbuf;                    // most recently decompressed block
+    uint8_t *zbuf;                      // compressed block read buffer
+    pthread_mutex_t mutex;
+
+    TapeZip ();
+    int loadblock (uint32_t blkno);
+    int openjnl (uint64_t newbase);
+};
+
+#endif
@@ -36,9 +36,11 @@
 #include <unistd.h>
 
 #include "disassem.h"
+#include "diskovly.h"
 #include "pintable.h"
 #include "readprompt.h"
 #include "shmms.h"
+#include "shmstats.h"
 #include "tclmain.h"
 #include "z11util.h"
 
@@ -53,17 +55,20 @@ struct MSCDat {
     uint32_t posdiv;
     char type1[5];
     char type0[5];
+    uint32_t secsize;   // bytes per sector (0 if not a disk)
 };
 
 static MSCDat const ctlidrh = { "rh", 7, SHMMS_CTLID_RH,
     "[cylinder] [fault] [file] [readonly] [ready] [type]",
     "cylinder", 1,      // curpos is cylinder
-    "RP04", "RP06" };
+    "RP04", "RP06",
+    512 };
 
 static MSCDat const ctlidrl = { "rl", 3, SHMMS_CTLID_RL,
     "[cylinder] [fault] [file] [readonly] [ready] [type]",
     "cylinder", 128,    // curpos is 0000.0000.0000.0000.cccc.cccc.chss.ssss
-    "RL01", "RL02" };
+    "RL01", "RL02",
+    256 };
 
 static MSCDat const ctlidtm = { "tm", 7, SHMMS_CTLID_TM,
     "[bytes] [file] [readonly] [ready]",
@@ -82,7 +87,10 @@ static Tcl_ObjCmdProc cmd_msunload;
 static Tcl_ObjCmdProc cmd_pin;
 static Tcl_ObjCmdProc cmd_readchar;
 static Tcl_ObjCmdProc cmd_snapregs;
+static Tcl_ObjCmdProc cmd_stats;
+static Tcl_ObjCmdProc cmd_sync;
 static Tcl_ObjCmdProc cmd_unlkdma;
+static Tcl_ObjCmdProc cmd_verisave;
 static Tcl_ObjCmdProc cmd_waitint;
 static Tcl_ObjCmdProc cmd_xestart;
 
@@ -102,10 +110,13 @@ static TclFunDef const fundefs[] = {
     { cmd_msstat,    (ClientData) &ctlidrl, "rlstat",   "get RL drive status" },
     { cmd_msunload,  (ClientData) &ctlidrl, "rlunload", "unload file from RL drive" },
     { cmd_snapregs,  NULL, "snapregs",  "snapshot registers while running" },
+    { cmd_stats,     NULL, "stats",     "get device daemon timing statistics" },
+    { cmd_sync,      NULL, "sync",      "write cached disk data to image files" },
     { cmd_msload,    (ClientData) &ctlidtm, "tmload",   "load file in TM drive" },
     { cmd_msstat,    (ClientData) &ctlidtm, "tmstat",   "get TM drive status" },
     { cmd_msunload,  (ClientData) &ctlidtm, "tmunload", "unload file from TM drive" },
     { cmd_unlkdma,   NULL, "unlkdma",   "unlock access to DMA registers" },
+    { cmd_verisave,  NULL, "verisave",  "save verimain model state to file" },
     { cmd_waitint,   NULL, "waitint",   "wait for interrupt" },
     { cmd_xestart,   NULL, "xestart",   "make sure xe i/o daemon is running" },
     { NULL, NULL, NULL, NULL }
@@ -408,15 +419,26 @@ static int cmd_msload (ClientData clientdata, Tcl_Interp *interp, int objc, Tcl_
         char const *stri = Tcl_GetString (objv[1]);
         if (strcasecmp (stri, "help") == 0) {
             puts ("");
-            printf ("  %sload [-create | -readonly] <drive> <filename>\n", mscdat->lcid);
+            printf ("  %sload [-create | -readonly] [-resume <%s>] <drive> <filename>\n", mscdat->lcid, mscdat->poskw);
+            puts ("    -resume : restoring a checkpoint, drive already has this volume mounted");
+            if (mscdat->secsize != 0) {
+                printf ("  %sload -overlay <basefile> [-readonly] <drive> <filename>\n", mscdat->lcid);
+                puts ("    create <filename> as empty copy-on-write overlay of <basefile> then load it");
+                puts ("    <basefile> may itself be an overlay, and must not be written to thereafter");
+                puts ("    re-creating an overlay discards everything written to it (rollback)");
+                puts ("    layering a new overlay on the current one freezes it (snapshot)");
+            }
             puts ("");
             return TCL_OK;
         }
     }
     bool create = false;
     bool readonly = false;
+    bool resume = false;
+    char const *basename = NULL;
     char const *filename = NULL;
     int drive = -1;
+    int resumepos = 0;
     for (int i = 0; ++ i < objc;) {
         char const *stri = Tcl_GetString (objv[i]);
         if (strcasecmp (stri, "-create") == 0) {
@@ -429,6 +451,24 @@ static int cmd_msload (ClientData clientdata, Tcl_Interp *interp, int objc, Tcl_
             readonly = true;
             continue;
         }
+        if ((strcasecmp (stri, "-overlay") == 0) && (mscdat->secsize != 0)) {
+            if (++ i >= objc) {
+                Tcl_SetResultF (interp, "missing base filename after -overlay");
+                return TCL_ERROR;
+            }
+            basename = Tcl_GetString (objv[i]);
+            continue;
+        }
+        if (strcasecmp (stri, "-resume") == 0) {
+            if (++ i >= objc) {
+                Tcl_SetResultF (interp, "missing %s after -resume", mscdat->poskw);
+                return TCL_ERROR;
+            }
+            int rc = Tcl_GetIntFromObj (interp, objv[i], &resumepos);
+            if (rc != TCL_OK) return rc;
+            resume = true;
+            continue;
+        }
         if (stri[0] == '-') {
             Tcl_SetResultF (interp, "unknown option %s", stri);
             return TCL_ERROR;
@@ -460,7 +500,17 @@ static int cmd_msload (ClientData clientdata, Tcl_Interp *interp, int objc, Tcl_
         }
         close (fd);
     }
-    int rc = shmms_load (mscdat->ctlid, drive, readonly, filename);
+    if (basename != NULL) {
+
+        // unload drive in case it has the overlay file loaded (rolling back)
+        int rc = shmms_load (mscdat->ctlid, drive, false, "", resume);
+        if (rc >= 0) rc = DiskOverlay::create (filename, basename, mscdat->secsize);
+        if (rc < 0) {
+            Tcl_SetResultF (interp, "%s", strerror (- rc));
+            return TCL_ERROR;
+        }
+    }
+    int rc = shmms_load (mscdat->ctlid, drive, readonly, filename, resume, resumepos * mscdat->posdiv);
     if (rc < 0) {
         Tcl_SetResultF (interp, "%s", strerror (- rc));
         return TCL_ERROR;
@@ -824,12 +874,130 @@ static int cmd_snapregs (ClientData clientdata, Tcl_Interp *interp, int objc, Tc
     return TCL_ERROR;
 }
 
+// get timing statistics published by device daemons
+static int cmd_stats (ClientData clientdata, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    bool devs[SHMSTATS_NDEVS];
+    bool gotdev = false;
+    bool reset = false;
+    memset (devs, 0, sizeof devs);
+    for (int i = 0; ++ i < objc;) {
+        char const *stri = Tcl_GetString (objv[i]);
+        if (strcasecmp (stri, "help") == 0) {
+            puts ("");
+            puts ("  stats [-reset] [<device>...]");
+            puts ("    get timing statistics for device daemons");
+            puts ("    <device> = dl, dz, pc, rh, rl, tm, xe (default all that have run)");
+            puts ("    -reset = zero the statistics after getting them");
+            puts ("");
+            return TCL_OK;
+        }
+        if (strcasecmp (stri, "-reset") == 0) {
+            reset = true;
+            continue;
+        }
+        int devidx = shmstats_lookup (stri);
+        if (devidx < 0) {
+            Tcl_SetResultF (interp, "unknown device %s", stri);
+            return TCL_ERROR;
+        }
+        devs[devidx] = true;
+        gotdev = true;
+    }
+
+    ShmStats *shmstats = shmstats_map ();
+    std::string str;
+    for (int devidx = 0; devidx < SHMSTATS_NDEVS; devidx ++) {
+        if (gotdev ? devs[devidx] : (shmstats->devs[devidx].pid != 0)) {
+            shmstats_format (&str, devidx);
+            if (reset) shmstats_reset (devidx);
+        }
+    }
+    Tcl_SetResult (interp, strdup (str.c_str ()), (void (*) (char *)) free);
+    return TCL_OK;
+}
+
+// write disk write-back caches to image files
+// - so image files can be safely copied without unloading
+static int cmd_sync (ClientData clientdata, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    if (objc == 2) {
+        char const *stri = Tcl_GetString (objv[1]);
+        if (strcasecmp (stri, "help") == 0) {
+            puts ("");
+            puts ("  sync - write all cached RH and RL disk data to image files");
+            puts ("");
+            return TCL_OK;
+        }
+    }
+    if (objc != 1) {
+        Tcl_SetResultF (interp, "bad number of arguments");
+        return TCL_ERROR;
+    }
+    int rc = shmms_sync (SHMMS_CTLID_RH);
+    if (rc >= 0) rc = shmms_sync (SHMMS_CTLID_RL);
+    if (rc < 0) {
+        Tcl_SetResultF (interp, "%s", strerror (- rc));
+        return TCL_ERROR;
+    }
+    return TCL_OK;
+}
+
 static int cmd_unlkdma (ClientData clientdata, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
 {
     z11page->dmaunlk ();
     return TCL_OK;
 }
 
+// save verimain model state
+static int cmd_verisave (ClientData clientdata, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    if (objc == 2) {
+        char const *stri = Tcl_GetString (objv[1]);
+        if (strcasecmp (stri, "help") == 0) {
+            puts ("");
+            puts ("  verisave <filename> - save verimain model state to file");
+            puts ("    restart with ./verimain -restore <filename>");
+            puts ("    see ckpsave for saving disk and tape state along with it");
+            puts ("");
+            return TCL_OK;
+        }
+    }
+    if (objc != 2) {
+        Tcl_SetResultF (interp, "bad number of arguments");
+        return TCL_ERROR;
+    }
+#if defined VERISIM
+
+    // verimain opens the file so give it an absolute path
+    char const *fn = Tcl_GetString (objv[1]);
+    char *cwd = NULL;
+    if (fn[0] != '/') {
+        cwd = getcwd (NULL, 0);
+        if (cwd == NULL) {
+            Tcl_SetResultF (interp, "%m");
+            return TCL_ERROR;
+        }
+    }
+    char fnbuf[(cwd==NULL)?1:(strlen(cwd)+strlen(fn)+2)];
+    if (cwd != NULL) {
+        sprintf (fnbuf, "%s/%s", cwd, fn);
+        free (cwd);
+        fn = fnbuf;
+    }
+
+    int rc = verisim_save (fn);
+    if (rc < 0) {
+        Tcl_SetResultF (interp, "%s", strerror (- rc));
+        return TCL_ERROR;
+    }
+    return TCL_OK;
+#else
+    Tcl_SetResultF (interp, "only valid for verisim");
+    return TCL_ERROR;
+#endif
+}
+
 // wait for interrupt from fpga
 static int cmd_waitint (ClientData clientdata, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
 {
@@ -8,6 +8,8 @@ proc helpini {} {
     puts "               bmrdword addr - read word from fpga memory"
     puts "          bmwrbyte addr data - write byte to fpga memory"
     puts "          bmwrword addr data - write word to fpga memory"
+    puts "              ckprestore dir - reload drives saved by ckpsave and resume processor"
+    puts "                 ckpsave dir - checkpoint verimain model, disks and tapes to directory"
     puts "                  clearlow4k - clear low 4KB memory"
     puts "                  dumpiopage - dump contents of i/o page"
     puts "               dumpmem lo hi - dump memory from lo to hi address"
@@ -127,6 +129,91 @@ proc bmwrword {addr data {pe 0}} {
     }
 }
 
+# restore drives saved by ckpsave then let processor continue
+# verimain must have been started with -restore dir/model.vlt
+proc ckprestore {dir} {
+    source [file join $dir restore.tcl]
+}
+
+# checkpoint verisim model along with disk and tape drives
+# restart with:
+#   ./verimain -restore dir/model.vlt
+#   ./z11ctrl script that does: ckprestore dir
+# - processor is paused at end of a bus cycle and drives are let go idle
+#   so disk images are consistent with model memory and controller state
+# - writable disk images and tapes are copied to dir
+#   disks restore as overlays on the copies so the checkpoint can be restored repeatedly
+# - read-only drives are reloaded from their original files
+proc ckpsave {dir} {
+    if {[pin fpgamode] != 1} {
+        error "ckpsave: requires fpgamode 1 (sim)"
+    }
+    file mkdir $dir
+
+    # pause processor at end of next bus cycle (or if waiting, when it next wakes)
+    pin set stepenable 1
+    for {set i 0} {! [pin stephalted] && ! [ishalted]} {incr i} {
+        if {$i > 1000} {
+            pin set stepenable 0
+            error "ckpsave: processor did not pause"
+        }
+        after 10
+    }
+
+    # let any i/o in progress finish then write cached data to image files
+    set ctls {}
+    if {[pin rh_enable]} {lappend ctls rh 8 cylinder}
+    if {[pin rl_enable]} {lappend ctls rl 4 cylinder}
+    if {[pin tm_enable]} {lappend ctls tm 8 bytes}
+    foreach {ctl ndrives poskw} $ctls {
+        for {set d 0} {$d < $ndrives} {incr d} {
+            for {set i 0} {[${ctl}stat $d file] != "" && ! [${ctl}stat $d ready]} {incr i} {
+                if {$i > 1000} {
+                    pin set stepenable 0
+                    error "ckpsave: $ctl drive $d did not go idle"
+                }
+                after 10
+            }
+        }
+    }
+    sync
+
+    # copy drive contents and write script to load them back
+    set rs [open [file join $dir restore.tcl] w]
+    puts $rs "# written by ckpsave [clock format [clock seconds]]"
+    puts $rs "set ckpdir \[file dirname \[file normalize \[info script\]\]\]"
+    foreach {ctl ndrives poskw} $ctls {
+        for {set d 0} {$d < $ndrives} {incr d} {
+            lassign [${ctl}stat $d file readonly $poskw] fn ro pos
+            if {$fn == ""} continue
+            if {$ro} {
+                puts $rs "${ctl}load -readonly -resume $pos $d \"$fn\""
+            } elseif {$ctl == "tm"} {
+                # compressed (TapeZip) tapes keep writes in a .jnl file that is only valid
+                # for a tape with the same size and modification time, so copy both with cp -p
+                exec cp -p $fn [file join $dir $ctl$d.tap]
+                file delete [file join $dir $ctl$d.tap.jnl]
+                puts $rs "file delete \$ckpdir/$ctl$d.run.jnl"
+                puts $rs "exec cp -p \$ckpdir/$ctl$d.tap \$ckpdir/$ctl$d.run"
+                if {[file exists $fn.jnl]} {
+                    exec cp -p $fn.jnl [file join $dir $ctl$d.tap.jnl]
+                    puts $rs "exec cp -p \$ckpdir/$ctl$d.tap.jnl \$ckpdir/$ctl$d.run.jnl"
+                }
+                puts $rs "${ctl}load -resume $pos $d \$ckpdir/$ctl$d.run"
+            } else {
+                file copy -force $fn [file join $dir $ctl$d.img]
+                puts $rs "${ctl}load -overlay \$ckpdir/$ctl$d.img -resume $pos $d \$ckpdir/$ctl$d.run"
+            }
+        }
+    }
+    puts $rs "pin set stepenable 0"
+    close $rs
+
+    # save model with processor still paused so restore starts out paused
+    verisave [file join $dir model.vlt]
+    pin set stepenable 0
+}
+
 # clear low 4KB memory
 proc clearlow4k {} {
     for {set a 0} {$a < 4096} {incr a 2} {
@@ -153,12 +153,25 @@
 
 #define BM_ENABLO     0xFFFFFFFFU
 #define BM2_ENABHI    0x3FFFFFFFU
+#define BM3_ARMFUNC   0xE0000000U
+#define BM3_ARMAINC   0x10000000U
+#define BM3_ARMADDR   0x0003FFFFU
+#define BM4_ARMPERR   0x00030000U
+#define BM4_ARMDATA   0x0000FFFFU
 #define BM5_CTLREG    0xFFFF0000U
 #define BM5_CTLENAB   0x00000010U
 #define BM5_CTLADDR   0x0000000FU
 #define BM6_BRJAME    0x00100000U
 #define BM6_BRJAMA    0x000F0000U
 #define BM6_BRENAB    0x0000FFFFU
+#define BM7_ARMBUSY   0x80000000U
+#define BM7_ARMPERR   0x00030000U
+#define BM7_ARMDATA   0x0000FFFFU
+
+#define BM3_ARMFUNC0  (BM3_ARMFUNC  & - BM3_ARMFUNC)
+#define BM3_ARMADDR0  (BM3_ARMADDR  & - BM3_ARMADDR)
+#define BM4_ARMDATA0  (BM4_ARMDATA  & - BM4_ARMDATA)
+#define BM7_ARMDATA0  (BM7_ARMDATA  & - BM7_ARMDATA)
 
 #define KY_LIGHTS     0xFFFF0000U   // 777570 light register
 #define KY_SWITCHES   0x0000FFFFU   // 777570 switch register
@@ -188,12 +201,27 @@
 #define KY4_SNAPREG   0xFFFF0000U
 #define KY4_DMADATA   0x0000FFFFU
 #define KY5_DMALOCK   0xFFFFFFFFU
+#define KY6_BBUSY     0x80000000U   // burst in progress
+#define KY6_BWRITE    0x40000000U   // burst does DATO cycles (else DATI)
+#define KY6_BNOINC    0x20000000U   // burst does not increment address
+#define KY6_BTIMO     0x10000000U   // burst stopped by dma timeout
+#define KY6_BPERR     0x08000000U   // burst stopped by dma parity error
+#define KY6_BFILL     0x07FC0000U   // number of words in burst fifo
+#define KY6_BCOUNT    0x0001FFFFU   // number of words remaining in burst
+#define KY7_BFILL     0x01FF0000U   // number of words in burst fifo before pop
+#define KY7_BDATA     0x0000FFFFU   // burst fifo data
+
+#define KY_BFIFOSIZE  256           // number of words in burst fifo
 
 #define KY3_DMASTATE0 (KY3_DMASTATE & - KY3_DMASTATE)
 #define KY3_DMACTRL0  (KY3_DMACTRL  & - KY3_DMACTRL)
 #define KY3_DMAADDR0  (KY3_DMAADDR  & - KY3_DMAADDR)
 #define KY4_SNAPREG0  (KY4_SNAPREG  & - KY4_SNAPREG)
 #define KY4_DMADATA0  (KY4_DMADATA  & - KY4_DMADATA)
+#define KY6_BFILL0    (KY6_BFILL    & - KY6_BFILL)
+#define KY6_BCOUNT0   (KY6_BCOUNT   & - KY6_BCOUNT)
+#define KY7_BFILL0    (KY7_BFILL    & - KY7_BFILL)
+#define KY7_BDATA0    (KY7_BDATA    & - KY7_BDATA)
 
 #define RH1_MOLS 0xFF000000U
 #define RH1_WRLS 0x00FF0000U
@@ -20,19 +20,24 @@
 
 // Performs TTY I/O (DL-11) for the PDP-11 Zynq I/O board
 
+// sleeps in ppoll() until the fpga interrupts saying the pdp has a char to print,
+// a char is due at the -cps rate, or there is keyboard input
+// printer chars are collected in outbuf and written out together
+
 #include <errno.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/time.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "shmstats.h"
 #include "z11defs.h"
 #include "z11util.h"
 
@@ -48,6 +53,8 @@
 #define DL3_PORT  0x0003FFFFU
 #define DL3_PORT0 0x00000001U
 
+#define FLUSHNS 10000000    // write printer chars at most this long after pdp prints them
+
 struct LookFor {
     char const *promptstr;  // prompt string
     char replystr[32];      // reply string
@@ -71,10 +78,17 @@ static char const monthnames[12][4] = { "JAN", "FEB", "MAR", "APR", "MAY", "JUN"
 static bool nokb;
 static bool upcase;
 static bool volatile ctrlcflag;
+static FILE *logfile;
+static int intfd;
+static int outlen;
 static struct termios term_original;
 static uint32_t cps = 960;
 static uint32_t volatile *dlat;
+static uint8_t outbuf[4096];
+static Z11Page *z11p;
 
+static void flushoutput ();
+static uint64_t getnowns ();
 static bool finddl (void *param, uint32_t volatile *dlat);
 static void sigrunhand (int signum);
 
@@ -116,8 +130,8 @@ int main (int argc, char **argv)
                 return 1;
             }
             cps = strtoul (argv[i], &p, 0);
-            if ((*p != 0) || (cps == 0) || (cps > 1000)) {
-                fprintf (stderr, "-cps value %s must be integer in range 1..1000\n", argv[i]);
+            if ((*p != 0) || (cps == 0) || (cps > 100000)) {
+                fprintf (stderr, "-cps value %s must be integer in range 1..100000\n", argv[i]);
                 return 1;
             }
             continue;
@@ -165,22 +179,22 @@ int main (int argc, char **argv)
         }
     }
 
-    FILE *logfile = NULL;
+    // log file gets flushed along with stdout
     if (logname != NULL) {
         logfile = fopen (logname, "w");
         if (logfile == NULL) {
             fprintf (stderr, "error creating %s: %m\n", logname);
             return 1;
         }
-        setlinebuf (logfile);
     }
 
-    Z11Page z11p;
-    dlat = z11p.findev ("DL", finddl, &port, true, killit);
+    z11p = new Z11Page ();
+    dlat = z11p->findev ("DL", finddl, &port, true, killit);
+    shmstats_init (SHMSTATS_DL);
     ZWR(dlat[3], DL3_ENAB);     // enable board to process io instructions
 
     bool stdintty, stdoutty;
-    uint64_t nowus;
+    uint64_t nowns;
     uint64_t readnextkbat;
     uint64_t readnextprat;
 
@@ -202,13 +216,14 @@ int main (int argc, char **argv)
         if (signal (SIGQUIT, sigrunhand) != SIG_DFL) ABORT ();
     }
 
-    struct timeval nowtv;
-    if (gettimeofday (&nowtv, NULL) < 0) ABORT ();
-    nowus = nowtv.tv_sec * 1000000ULL + nowtv.tv_usec;
+    // intfd becomes readable on fpga interrupt after we arm it, signals still interrupt ppoll() below
+    intfd = z11p->intfdinit (ZGINT_DL);
+
+    nowns = getnowns ();
 
     stdoutty = isatty (STDOUT_FILENO) > 0;
-    readnextprat = nowus + 1111111 / cps;
-    readnextkbat = nokb ? 0xFFFFFFFFFFFFFFFFULL : readnextprat;
+    readnextprat = nowns + 1111111111 / cps;
+    readnextkbat = readnextprat;
 
     // set up looking for rsts/rsx date/time prompts
     LookFor *lookfors[4];
@@ -226,64 +241,68 @@ int main (int argc, char **argv)
         lookfors[nlookfors++] = new LookForXXDPDate ();
     }
 
+    bool armed = false;
+    int inlen = 0;
+    int inpos = 0;
+    uint8_t inbuf[256];
+    uint64_t flushat = 0;
+
     // keep processing until control-backslash
     // control-C is recognized only if -nokb mode
     while (! ctrlcflag) {
-        if (gettimeofday (&nowtv, NULL) < 0) ABORT ();
-        nowus = nowtv.tv_sec * 1000000ULL + nowtv.tv_usec;
-        usleep (1000 - nowus % 1000);
-        if (gettimeofday (&nowtv, NULL) < 0) ABORT ();
-        nowus = nowtv.tv_sec * 1000000ULL + nowtv.tv_usec;
+        nowns = getnowns ();
+        uint64_t wakens = 0xFFFFFFFFFFFFFFFFULL;
 
         // maybe see if PDP has a character to print
-        if (nowus >= readnextprat) {
-            uint32_t xreg = ZRD(dlat[2]);
-            if (! (xreg & DL2_XRDY)) {
+        bool waitpr = false;
+        uint32_t xreg = ZRD(dlat[2]);
+        if (! (xreg & DL2_XRDY)) {
+            if (nowns < readnextprat) {
+                waitpr = true;
+                wakens = readnextprat;
+            } else {
 
                 // tell PDP it can print another char
                 ZWR(dlat[2], xreg | DL2_XRDY);
 
-                // print character to stdout
+                // queue character for stdout
                 uint8_t prchar = (xreg & mask) / DL2_XBUF0;
+                if (outlen == 0) flushat = nowns + FLUSHNS;
                 if ((prchar == 7) && stdoutty) {
-                    int rc = write (STDOUT_FILENO, "<BEL>", 5);
-                    if (rc < 5) ABORT ();
+                    memcpy (outbuf + outlen, "<BEL>", 5);
+                    outlen += 5;
                 } else {
-                    int rc = write (STDOUT_FILENO, &prchar, 1);
-                    if (rc <= 0) ABORT ();
+                    outbuf[outlen++] = prchar;
                 }
                 if (logfile != NULL) fputc (prchar, logfile);
+                shmstats_bytes (0, 1);
 
-                // check for another char to print after 1000000/cps usec
-                readnextprat = nowus + 1000000 / cps;
+                // check for another char to print after 1000000000/cps nsec
+                // allow catching up if we woke a little late
+                if (nowns - readnextprat > 1000000000 / cps) readnextprat = nowns;
+                readnextprat += 1000000000 / cps;
 
                 // check for date/time prompt
                 for (int lfi = 0; lfi < nlookfors; lfi ++) {
                     if (lookfors[lfi]->GotPRChar (prchar)) {
                         // halt second until sending first reply character
-                        readnextkbat = nowus + 500000;
+                        readnextkbat = nowns + 500000000;
                     }
                 }
             }
         }
 
         // maybe there is a character from keyboard to pass to PDP
-        if (nowus >= readnextkbat) {
-            struct pollfd polls[1] = { STDIN_FILENO, POLLIN, 0 };
-            int rc = nokb ? 0 : poll (polls, 1, 0);
-            if ((rc < 0) && (errno != EINTR)) ABORT ();
-            if ((rc > 0) && (polls[0].revents & POLLIN)) {
-
-                // stdin char ready, read and pass along to pdp
-                // but exit if it is a ctrl-backslash
-                uint8_t kbchar;
-                rc = read (STDIN_FILENO, &kbchar, 1);
-                if ((rc == 0) && ! stdintty) break;
-                if (rc <= 0) ABORT ();
-                if ((kbchar == '\\' - '@') && stdintty) break;
-                if (upcase && (kbchar >= 'a') && (kbchar <= 'z')) kbchar -= 'a' - 'A';
+        bool kbpend = inpos < inlen;
+        for (int lfi = 0; ! kbpend && (lfi < nlookfors); lfi ++) {
+            kbpend = lookfors[lfi]->GetKBChar () != 0;
+        }
+        if (kbpend && (nowns >= readnextkbat)) {
+            if (inpos < inlen) {
+                uint8_t kbchar = inbuf[inpos++];
                 ZWR(dlat[1], (ZRD(dlat[1]) & ~ DL1_RBUF) | DL1_RRDY | DL1_RBUF0 * kbchar);
-                readnextkbat = nowus + 1000000 / cps;
+                shmstats_bytes (1, 0);
+                readnextkbat = nowns + 1000000000 / cps;
             }
 
             // maybe send next char of rsx date/time reply
@@ -292,13 +311,77 @@ int main (int argc, char **argv)
                     uint8_t kbchar = lookfors[lfi]->GetKBChar ();
                     if (kbchar != 0) {
                         ZWR(dlat[1], (ZRD(dlat[1]) & ~ DL1_RBUF) | DL1_RRDY | DL1_RBUF0 * kbchar);
-                        readnextkbat = nowus + 250000;
+                        readnextkbat = nowns + 250000000;
                     }
                 }
             }
+            kbpend = inpos < inlen;
+            for (int lfi = 0; ! kbpend && (lfi < nlookfors); lfi ++) {
+                kbpend = lookfors[lfi]->GetKBChar () != 0;
+            }
+        }
+        if (kbpend && (wakens > readnextkbat)) wakens = readnextkbat;
+
+        // write printer chars if they have been waiting long enough or buffer is getting full
+        if ((outlen > 0) && ((nowns >= flushat) || (outlen > (int) sizeof outbuf / 2))) {
+            flushoutput ();
+        }
+        if ((outlen > 0) && (wakens > flushat)) wakens = flushat;
+
+        // if no printer char being held off, have fpga wake us when the pdp prints something
+        // (interrupt request stays set as long as printer char is waiting for us)
+        if (! waitpr && ! armed) {
+            z11p->intfdarm ();
+            armed = true;
+        }
+
+        // wait for something to happen
+        // only read more from stdin when we have passed all the previous chars to pdp
+        struct pollfd polls[2];
+        memset (polls, 0, sizeof polls);
+        polls[0].fd     = intfd;
+        polls[0].events = POLLIN;
+        polls[1].fd     = STDIN_FILENO;
+        polls[1].events = POLLIN;
+        int npolls = (nokb || (inpos < inlen)) ? 1 : 2;
+        struct timespec timeout, *timeoutp = NULL;
+        if (wakens != 0xFFFFFFFFFFFFFFFFULL) {
+            uint64_t delns = (wakens > nowns) ? wakens - nowns : 0;
+            timeout.tv_sec  = delns / 1000000000;
+            timeout.tv_nsec = delns % 1000000000;
+            timeoutp = &timeout;
+        }
+        int rc = ppoll (polls, npolls, timeoutp, NULL);
+        if (rc < 0) {
+            if (errno == EINTR) continue;
+            ABORT ();
+        }
+
+        // fpga interrupted, pdp has something to print
+        if ((polls[0].revents & POLLIN) && z11p->intfdread ()) armed = false;
+
+        // stdin chars ready, read and pass along to pdp
+        // but exit if it is a ctrl-backslash
+        if ((npolls > 1) && (polls[1].revents & (POLLIN | POLLHUP | POLLERR))) {
+            rc = read (STDIN_FILENO, inbuf, sizeof inbuf);
+            if ((rc == 0) && ! stdintty) break;
+            if (rc <= 0) ABORT ();
+            inpos = 0;
+            inlen = 0;
+            for (int i = 0; i < rc; i ++) {
+                uint8_t kbchar = inbuf[i];
+                if ((kbchar == '\\' - '@') && stdintty) {
+                    ctrlcflag = true;
+                    break;
+                }
+                if (upcase && (kbchar >= 'a') && (kbchar <= 'z')) kbchar -= 'a' - 'A';
+                inbuf[inlen++] = kbchar;
+            }
         }
     }
 
+    flushoutput ();
+
     if (stdintty && ! nokb) {
         tcsetattr (STDIN_FILENO, TCSADRAIN, &term_original);
     }
@@ -309,6 +392,28 @@ int main (int argc, char **argv)
     return 0;
 }
 
+// write all printer chars collected so far to stdout and log file
+static void flushoutput ()
+{
+    for (int done = 0; done < outlen;) {
+        int rc = write (STDOUT_FILENO, outbuf + done, outlen - done);
+        if (rc <= 0) {
+            if ((rc < 0) && (errno == EINTR)) continue;
+            ABORT ();
+        }
+        done += rc;
+    }
+    outlen = 0;
+    if (logfile != NULL) fflush (logfile);
+}
+
+static uint64_t getnowns ()
+{
+    struct timespec nowts;
+    if (clock_gettime (CLOCK_MONOTONIC, &nowts) < 0) ABORT ();
+    return nowts.tv_sec * 1000000000ULL + nowts.tv_nsec;
+}
+
 static bool finddl (void *param, uint32_t volatile *dlat)
 {
     int port = *(int *) param;
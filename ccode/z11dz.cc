@@ -20,18 +20,34 @@
 
 // Performs TTY I/O (DZ-11) for the PDP-11 Zynq I/O board
 
+// one line to the tty it is being run from:
+//  ./z11dz <linenum>
+// all 8 lines (or those listed) via telnet, line n on tcp port 2300+n:
+//  ./z11dz -tcp 2300 [<linenum>...]
+
+// single process for all the lines, sleeping in epoll_wait() until:
+//  - the fpga interrupts saying the pdp has a char to print on some line
+//  - a char is due to be printed or passed to pdp at the -cps rate
+//  - a tty/socket has input or room for more output
+//  - a telnet client connects
+
 #include <errno.h>
 #include <fcntl.h>
-#include <poll.h>
+#include <netinet/in.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "shmstats.h"
 #include "z11defs.h"
 #include "z11util.h"
 
@@ -44,6 +60,8 @@
 
 #define DZ2_CSR    0x0000FFFFU
 
+#define DZ3_SILOCTR 0x0001F000U
+
 #define DZ4_KBFUL0 0x00008000U
 #define DZ4_PRFUL0 0x00004000U
 #define DZ4_KBSET0 0x00002000U
@@ -51,19 +69,69 @@
 #define DZ4_PRBUF0 0x000000FFU
 #define DZ4_KBBUF0 0x000000FFU
 
+#define NLINES 8
+#define SILOSIZE 16
+
+#define EV_INTR   0     // epoll event tags (<< 8 | line number)
+#define EV_TIMER  1
+#define EV_LISTEN 2
+#define EV_CLIENT 3
+
+#define TN_IAC  255     // telnet protocol bytes
+#define TN_DONT 254
+#define TN_WILL 251
+#define TN_SB   250
+#define TN_SE   240
+#define TN_ECHO 1
+#define TN_SGA  3
+
+struct DZLine {
+    int line;                   // line number 0..7
+    int bn;                     // bit number of line's 16 bits in register
+    uint32_t volatile *regat;   // points to DZ4..DZ7 register for the line
+    FILE *logfile;              // log output here (or NULL)
+    int listenfd;               // telnet listening socket (or -1 if stdio)
+    int infd;                   // read keyboard chars from here (or -1 if disconnected)
+    int outfd;                  // write printer chars here (or -1 if disconnected)
+    uint32_t pollevs;           // events infd/outfd are currently registered for
+    bool pollable;              // infd/outfd can be used with epoll (false for plain files)
+    bool telnet;                // infd/outfd are a telnet connection
+    bool intty, outtty;         // infd/outfd are a tty
+    uint8_t telstate;           // telnet input protocol state
+    uint64_t nextkbns;          // don't pass another keyboard char to pdp before this time
+    uint64_t nextprns;          // don't take another printer char from pdp before this time
+    int inpos, inlen;           // inbuf[inpos..inlen-1] waiting to be passed to pdp
+    int outlen;                 // outbuf[0..outlen-1] waiting to be written to outfd
+    uint8_t inbuf[256];
+    uint8_t outbuf[4096];
+};
+
+static bool nokb;
+static bool upcase;
 static bool volatile ctrlcflag;
+static DZLine *dzlines[NLINES];
+static int epfd;
 static struct termios term_original;
 static uint32_t cps = 960;
+static uint64_t periodns;
+static Z11Page *z11p;
 
+static void service (DZLine *dzline, uint64_t nowns, uint32_t &siloctr, uint64_t &wakens, bool &sawpr, bool &waitpr);
+static void gotconnect (DZLine *dzline);
+static bool gotinput (DZLine *dzline);
+static bool flushoutput (DZLine *dzline);
+static void disconnect (DZLine *dzline);
+static void setpollevs (DZLine *dzline);
+static uint64_t getnowns ();
 static void sigrunhand (int signum);
 
 int main (int argc, char **argv)
 {
     bool killit = false;
-    bool nokb = false;
-    bool upcase = false;
     char const *logname = NULL;
-    int port = -1;
+    int nports = 0;
+    int ports[NLINES];
+    int tcpport = -1;
     char *p;
 
     for (int i = 0; ++ i < argc;) {
@@ -72,12 +140,15 @@ int main (int argc, char **argv)
             puts ("     Access DZ-11 serial line multiplexor");
             puts ("");
             puts ("  ./z11dz [-cps <charspersec>] [-killit] [-log <filename>] [-nokb] [-upcase] <linenum>");
+            puts ("  ./z11dz [-cps <charspersec>] [-killit] [-log <filename>] [-nokb] [-upcase] -tcp <port> [<linenum>...]");
             puts ("     -cps    : set chars per second, default 960");
             puts ("     -killit : kill other process that is processing this port");
-            puts ("     -log    : log output to given file");
+            puts ("     -log    : log output to given file (.<linenum> appended if more than one line)");
             puts ("     -nokb   : do not pass stdin keyboard to pdp");
+            puts ("     -tcp    : accept telnet connections, line n on tcp port <port>+n");
             puts ("     -upcase : convert all keyboard to upper case");
             puts ("   <linenum> : line number 0..7");
+            puts ("               -tcp defaults to all lines, else exactly one line uses stdin/stdout");
             puts ("");
             return 0;
         }
@@ -87,8 +158,8 @@ int main (int argc, char **argv)
                 return 1;
             }
             cps = strtoul (argv[i], &p, 0);
-            if ((*p != 0) || (cps == 0) || (cps > 1000)) {
-                fprintf (stderr, "-cps value %s must be integer in range 1..1000\n", argv[i]);
+            if ((*p != 0) || (cps == 0) || (cps > 100000)) {
+                fprintf (stderr, "-cps value %s must be integer in range 1..100000\n", argv[i]);
                 return 1;
             }
             continue;
@@ -109,6 +180,18 @@ int main (int argc, char **argv)
             nokb = true;
             continue;
         }
+        if (strcasecmp (argv[i], "-tcp") == 0) {
+            if ((++ i >= argc) || (argv[i][0] == '-')) {
+                fprintf (stderr, "missing port number for -tcp\n");
+                return 1;
+            }
+            tcpport = strtoul (argv[i], &p, 0);
+            if ((*p != 0) || (tcpport <= 0) || (tcpport > 65535 - NLINES)) {
+                fprintf (stderr, "-tcp port number %s must be integer in range 1..%d\n", argv[i], 65535 - NLINES);
+                return 1;
+            }
+            continue;
+        }
         if (strcasecmp (argv[i], "-upcase") == 0) {
             upcase = true;
             continue;
@@ -117,34 +200,85 @@ int main (int argc, char **argv)
             fprintf (stderr, "unknown option %s\n", argv[i]);
             return 1;
         }
-        if (port >= 0) {
-            fprintf (stderr, "unknown argument %s\n", argv[1]);
-            return 1;
-        }
-        port = strtoul (argv[i], &p, 8);
+        int port = strtoul (argv[i], &p, 8);
         if ((*p != 0) || (port < 0) || (port > 7)) {
             fprintf (stderr, "port number %s must be octal integer 0..7\n", argv[i]);
             return 1;
         }
+        for (int j = 0; j < nports; j ++) {
+            if (ports[j] == port) {
+                fprintf (stderr, "duplicate port number %s\n", argv[i]);
+                return 1;
+            }
+        }
+        if (nports == NLINES) ABORT ();
+        ports[nports++] = port;
     }
 
-    if (port < 0) {
-        fprintf (stderr, "missing linenum argument\n");
-        return 1;
+    if (tcpport < 0) {
+        if (nports == 0) {
+            fprintf (stderr, "missing linenum argument\n");
+            return 1;
+        }
+        if (nports > 1) {
+            fprintf (stderr, "only one linenum can use stdin/stdout, use -tcp for more\n");
+            return 1;
+        }
+    } else if (nports == 0) {
+        for (int j = 0; j < NLINES; j ++) ports[nports++] = j;
     }
 
-    FILE *logfile = NULL;
-    if (logname != NULL) {
-        logfile = fopen (logname, "w");
-        if (logfile == NULL) {
-            fprintf (stderr, "error creating %s: %m\n", logname);
-            return 1;
+    periodns = 1000000000 / cps;
+
+    epfd = epoll_create1 (EPOLL_CLOEXEC);
+    if (epfd < 0) ABORT ();
+
+    // set up line structs, opening log files and telnet listeners
+    for (int j = 0; j < nports; j ++) {
+        DZLine *dzline = new DZLine ();
+        dzline->line     = ports[j];
+        dzline->listenfd = -1;
+        dzline->infd     = -1;
+        dzline->outfd    = -1;
+        dzline->pollable = true;
+        dzlines[ports[j]] = dzline;
+
+        if (logname != NULL) {
+            char lognamen[strlen(logname)+4];
+            sprintf (lognamen, ((nports > 1) ? "%s.%o" : "%s"), logname, dzline->line);
+            dzline->logfile = fopen (lognamen, "w");
+            if (dzline->logfile == NULL) {
+                fprintf (stderr, "error creating %s: %m\n", lognamen);
+                return 1;
+            }
+            setlinebuf (dzline->logfile);
+        }
+
+        if (tcpport >= 0) {
+            dzline->listenfd = socket (AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (dzline->listenfd < 0) ABORT ();
+            int one = 1;
+            if (setsockopt (dzline->listenfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one) < 0) ABORT ();
+            struct sockaddr_in sin;
+            memset (&sin, 0, sizeof sin);
+            sin.sin_family = AF_INET;
+            sin.sin_port   = htons (tcpport + dzline->line);
+            if (bind (dzline->listenfd, (struct sockaddr *) &sin, sizeof sin) < 0) {
+                fprintf (stderr, "error binding to tcp port %d: %m\n", tcpport + dzline->line);
+                return 1;
+            }
+            if (listen (dzline->listenfd, 1) < 0) ABORT ();
+            struct epoll_event epev;
+            memset (&epev, 0, sizeof epev);
+            epev.events   = EPOLLIN;
+            epev.data.u32 = (EV_LISTEN << 8) | dzline->line;
+            if (epoll_ctl (epfd, EPOLL_CTL_ADD, dzline->listenfd, &epev) < 0) ABORT ();
+            fprintf (stderr, "z11dz: line %o on tcp port %d\n", dzline->line, tcpport + dzline->line);
         }
-        setlinebuf (logfile);
     }
 
     // access fpga page
-    // point to DZ-11 register for this line
+    // point to DZ-11 register for each line
     // each register contains bits for an even/odd pair of lines, 16 bits each
     //   DZ4:  <line-1> <line-0>
     //   DZ5:  <line-3> <line-2>
@@ -152,20 +286,42 @@ int main (int argc, char **argv)
     //   DZ7:  <line-7> <line-6>
     // locking happens on one of the 8 32-bit registers, not really related to the 16-bit subregister
     // design of 16-bits per line is such that two processes can access same 32-bit register at same time
-    Z11Page z11p;
-    uint32_t volatile *dzat = z11p.findev ("DZ", NULL, NULL, false, false);
-    z11p.locksubdev (&dzat[port], 1, killit);
+    z11p = new Z11Page ();
+    uint32_t volatile *dzat = z11p->findev ("DZ", NULL, NULL, false, false);
+    shmstats_init (SHMSTATS_DZ);
+    for (int j = 0; j < nports; j ++) {
+        DZLine *dzline = dzlines[ports[j]];
+        z11p->locksubdev (&dzat[dzline->line], 1, killit);
+        dzline->regat = dzat + 4 + dzline->line / 2;
+        dzline->bn    = (dzline->line & 1) * 16;
+    }
     ZWR(dzat[1], DZ1_ENABLE |
         (INTVEC * (DZ1_INTVEC & - DZ1_INTVEC)) |
         (ADDRES * (DZ1_ADDRES & - DZ1_ADDRES)));
-    dzat += 4 + port / 2;
-    int bn = (port & 1) * 16;
+
+    // single line not using telnet uses stdin/stdout
+    DZLine *stdioline = (tcpport < 0) ? dzlines[ports[0]] : NULL;
+    if (stdioline != NULL) {
+        stdioline->infd   = nokb ? -1 : STDIN_FILENO;
+        stdioline->outfd  = STDOUT_FILENO;
+        stdioline->intty  = isatty (STDIN_FILENO) > 0;
+        stdioline->outtty = isatty (STDOUT_FILENO) > 0;
+
+        // plain files can't be polled but can always be read
+        // stdout is written with blocking writes so it never needs polling
+        struct epoll_event epev;
+        memset (&epev, 0, sizeof epev);
+        epev.data.u32 = (EV_CLIENT << 8) | stdioline->line;
+        if ((stdioline->infd >= 0) && (epoll_ctl (epfd, EPOLL_CTL_ADD, stdioline->infd, &epev) < 0)) {
+            if (errno != EPERM) ABORT ();
+            stdioline->pollable = false;
+        }
+    }
 
     struct termios term_modified;
-    bool stdintty = isatty (STDIN_FILENO) > 0;
-    if (stdintty && ! nokb) {
+    if ((stdioline != NULL) && stdioline->intty && ! nokb) {
         // stdin is a tty, set it to raw mode
-        fprintf (stderr, "z11dl: use control-\\ for stop char\n");
+        fprintf (stderr, "z11dz: use control-\\ for stop char\n");
         if (tcgetattr (STDIN_FILENO, &term_original) < 0) ABORT ();
         if (signal (SIGHUP,  sigrunhand) != SIG_DFL) ABORT ();
         if (signal (SIGTERM, sigrunhand) != SIG_DFL) ABORT ();
@@ -178,84 +334,364 @@ int main (int argc, char **argv)
         if (signal (SIGINT,  sigrunhand) != SIG_DFL) ABORT ();
         if (signal (SIGQUIT, sigrunhand) != SIG_DFL) ABORT ();
     }
+    if (signal (SIGPIPE, SIG_IGN) == SIG_ERR) ABORT ();
 
-    bool stdoutty = isatty (STDOUT_FILENO) > 0;
-
-    uint64_t nowus;
-    uint64_t readnextkbat;
-    uint64_t readnextprat;
-
-    struct timeval nowtv;
-    if (gettimeofday (&nowtv, NULL) < 0) ABORT ();
-    nowus = nowtv.tv_sec * 1000000ULL + nowtv.tv_usec;
+    // intfd becomes readable on fpga interrupt after we arm it, signals still interrupt epoll_wait() below
+    int intfd = z11p->intfdinit (ZGINT_DZ);
+    int timerfd = timerfd_create (CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (timerfd < 0) ABORT ();
+    struct epoll_event epev;
+    memset (&epev, 0, sizeof epev);
+    epev.events   = EPOLLIN;
+    epev.data.u32 = EV_INTR << 8;
+    if (epoll_ctl (epfd, EPOLL_CTL_ADD, intfd, &epev) < 0) ABORT ();
+    epev.data.u32 = EV_TIMER << 8;
+    if (epoll_ctl (epfd, EPOLL_CTL_ADD, timerfd, &epev) < 0) ABORT ();
 
-    readnextprat = nowus + 1111111 / cps;
-    readnextkbat = nokb ? 0xFFFFFFFFFFFFFFFFULL : readnextprat;
+    bool armed = false;
+    bool gotintr = false;
 
     // keep processing until control-backslash
     // control-C is recognized only if -nokb mode
     while (! ctrlcflag) {
-        if (gettimeofday (&nowtv, NULL) < 0) ABORT ();
-        nowus = nowtv.tv_sec * 1000000ULL + nowtv.tv_usec;
-        usleep (1000 - nowus % 1000);
-        if (gettimeofday (&nowtv, NULL) < 0) ABORT ();
-        nowus = nowtv.tv_sec * 1000000ULL + nowtv.tv_usec;
 
-        // read register
-        uint32_t reg = ZRD(*dzat) >> bn;
-
-        // maybe see if PDP has a character to print
-        if ((nowus >= readnextprat) && (reg & DZ4_PRFUL0)) {
-
-            // tell PDP it can print another char
-            ZWR(*dzat, DZ4_PRCLR0 << bn);
+        // pass chars between pdp and ttys/sockets for all lines
+        // see when we next need to wake up for something and if we are waiting for a printer char
+        uint64_t nowns  = getnowns ();
+        uint64_t wakens = 0xFFFFFFFFFFFFFFFFULL;
+        uint32_t siloctr = (ZRD(dzat[3]) & DZ3_SILOCTR) / (DZ3_SILOCTR & - DZ3_SILOCTR);
+        bool sawpr  = false;
+        bool waitpr = false;
+        for (int j = 0; j < nports; j ++) {
+            DZLine *dzline = dzlines[ports[j]];
+            service (dzline, nowns, siloctr, wakens, sawpr, waitpr);
+            if ((dzline == stdioline) && (dzline->infd < 0) && ! nokb) goto done;
+        }
 
-            // print character to stdout
-            uint8_t prchar = (reg & DZ4_PRBUF0) / (DZ4_PRBUF0 & - DZ4_PRBUF0);
-            if ((prchar == 7) && stdoutty) {
-                int rc = write (STDOUT_FILENO, "<BEL>", 5);
-                if (rc < 5) ABORT ();
+        // if no printer chars being held off, have fpga wake us when the pdp prints something
+        // (interrupt request stays set as long as any printer char is waiting for us)
+        // if interrupted for a line we aren't serving, it will stay set, so check back in a millisecond
+        if (! waitpr && ! armed) {
+            if (gotintr && ! sawpr) {
+                if (wakens > nowns + 1000000) wakens = nowns + 1000000;
             } else {
-                int rc = write (STDOUT_FILENO, &prchar, 1);
-                if (rc <= 0) ABORT ();
+                z11p->intfdarm ();
+                armed = true;
             }
-            if (logfile != NULL) fputc (prchar, logfile);
+        }
+        gotintr = false;
 
-            // check for another char to print after 1000000/cps usec
-            readnextprat = nowus + 1000000 / cps;
+        // set timer to wake us when the next char is due
+        struct itimerspec its;
+        memset (&its, 0, sizeof its);
+        if (wakens != 0xFFFFFFFFFFFFFFFFULL) {
+            its.it_value.tv_sec  = wakens / 1000000000;
+            its.it_value.tv_nsec = wakens % 1000000000;
         }
+        if (timerfd_settime (timerfd, TFD_TIMER_ABSTIME, &its, NULL) < 0) ABORT ();
 
-        // maybe there is a character from keyboard to pass to PDP
-        if (nowus >= readnextkbat) {
-            struct pollfd polls[1] = { STDIN_FILENO, POLLIN, 0 };
-            int rc = nokb ? 0 : poll (polls, 1, 0);
-            if ((rc < 0) && (errno != EINTR)) ABORT ();
-            if ((rc > 0) && (polls[0].revents & POLLIN)) {
-
-                // stdin char ready, read and pass along to pdp
-                // but exit if it is a ctrl-backslash
-                uint8_t kbchar;
-                rc = read (STDIN_FILENO, &kbchar, 1);
-                if ((rc == 0) && ! stdintty) break;
-                if (rc <= 0) ABORT ();
-                if ((kbchar == '\\' - '@') && stdintty) break;
-                if (upcase && (kbchar >= 'a') && (kbchar <= 'z')) kbchar -= 'a' - 'A';
-                ZWR(*dzat, (DZ4_KBSET0 | (DZ4_KBBUF0 & - DZ4_KBBUF0) * kbchar) << bn);
-                readnextkbat = nowus + 1000000 / cps;
+        // wait for something to happen
+        struct epoll_event epevs[NLINES*2+2];
+        int nevs = epoll_wait (epfd, epevs, NLINES*2+2, -1);
+        if (nevs < 0) {
+            if (errno == EINTR) continue;
+            ABORT ();
+        }
+
+        for (int i = 0; i < nevs; i ++) {
+            uint64_t junk;
+            DZLine *dzline = dzlines[epevs[i].data.u32&7];
+            switch (epevs[i].data.u32 >> 8) {
+
+                // fpga interrupted, pdp has something to print
+                case EV_INTR: {
+                    if (z11p->intfdread ()) armed = false;
+                    gotintr = true;
+                    break;
+                }
+
+                // a char is due
+                case EV_TIMER: {
+                    if ((read (timerfd, &junk, sizeof junk) < 0) && (errno != EAGAIN)) ABORT ();
+                    break;
+                }
+
+                // telnet client connecting
+                case EV_LISTEN: {
+                    gotconnect (dzline);
+                    break;
+                }
+
+                // keyboard input or room for printer output
+                case EV_CLIENT: {
+                    if (epevs[i].events & (EPOLLHUP | EPOLLERR)) disconnect (dzline);
+                    else if ((epevs[i].events & EPOLLIN) && ! gotinput (dzline)) disconnect (dzline);
+                    break;
+                }
             }
         }
     }
+done:;
 
-    if (stdintty && ! nokb) {
+    if ((stdioline != NULL) && stdioline->intty && ! nokb) {
         tcsetattr (STDIN_FILENO, TCSADRAIN, &term_original);
     }
     fprintf (stderr, "\n");
 
-    if (logfile != NULL) fclose (logfile);
+    for (int j = 0; j < nports; j ++) {
+        DZLine *dzline = dzlines[ports[j]];
+        if (dzline->logfile != NULL) fclose (dzline->logfile);
+    }
 
     return 0;
 }
 
+// pass characters between pdp and the line's tty/socket
+//  input:
+//   nowns = current time
+//   siloctr = number of keyboard chars in fpga waiting for pdp to read
+//  output:
+//   siloctr = incremented if keyboard char passed to pdp
+//   wakens  = lowered to when this line next has a char due
+//   sawpr   = set if pdp has a printer char for this line
+//   waitpr  = set if pdp has a printer char that we are holding off
+static void service (DZLine *dzline, uint64_t nowns, uint32_t &siloctr, uint64_t &wakens, bool &sawpr, bool &waitpr)
+{
+    uint32_t reg = ZRD(*dzline->regat) >> dzline->bn;
+
+    // maybe see if PDP has a character to print
+    // if nothing connected, chars get printed to nowhere at the normal rate
+    if (reg & DZ4_PRFUL0) {
+        sawpr = true;
+        if (nowns < dzline->nextprns) {
+            if (wakens > dzline->nextprns) wakens = dzline->nextprns;
+            waitpr = true;
+        } else if (dzline->outlen > (int) sizeof dzline->outbuf - 5) {
+            waitpr = true;
+        } else {
+
+            // tell PDP it can print another char
+            ZWR(*dzline->regat, DZ4_PRCLR0 << dzline->bn);
+
+            // queue character for output
+            uint8_t prchar = (reg & DZ4_PRBUF0) / (DZ4_PRBUF0 & - DZ4_PRBUF0);
+            if (dzline->outfd >= 0) {
+                if ((prchar == 7) && dzline->outtty) {
+                    memcpy (dzline->outbuf + dzline->outlen, "<BEL>", 5);
+                    dzline->outlen += 5;
+                } else {
+                    if ((prchar == TN_IAC) && dzline->telnet) dzline->outbuf[dzline->outlen++] = TN_IAC;
+                    dzline->outbuf[dzline->outlen++] = prchar;
+                }
+            }
+            if (dzline->logfile != NULL) fputc (prchar, dzline->logfile);
+            shmstats_bytes (0, 1);
+
+            // check for another char to print after 1000000000/cps nsec
+            // allow catching up if we woke a little late
+            if (nowns - dzline->nextprns > periodns) dzline->nextprns = nowns;
+            dzline->nextprns += periodns;
+        }
+    }
+
+    // maybe there is a character from keyboard to pass to PDP
+    // hold it if the silo is full so it doesn't get tossed
+    if ((dzline->inpos >= dzline->inlen) && (dzline->infd >= 0) && ! dzline->pollable) {
+        if (! gotinput (dzline)) disconnect (dzline);
+    }
+    if (dzline->inpos < dzline->inlen) {
+        if (nowns < dzline->nextkbns) {
+            if (wakens > dzline->nextkbns) wakens = dzline->nextkbns;
+        } else if (siloctr >= SILOSIZE) {
+            dzline->nextkbns = nowns + periodns;
+            if (wakens > dzline->nextkbns) wakens = dzline->nextkbns;
+        } else {
+            uint8_t kbchar = dzline->inbuf[dzline->inpos++];
+            ZWR(*dzline->regat, (DZ4_KBSET0 | (DZ4_KBBUF0 & - DZ4_KBBUF0) * kbchar) << dzline->bn);
+            shmstats_bytes (1, 0);
+            siloctr ++;
+            if (nowns - dzline->nextkbns > periodns) dzline->nextkbns = nowns;
+            dzline->nextkbns += periodns;
+            if ((dzline->inpos < dzline->inlen) && (wakens > dzline->nextkbns)) wakens = dzline->nextkbns;
+        }
+    }
+
+    // plain files can't be polled so just read more when the next char is due
+    if ((dzline->infd >= 0) && ! dzline->pollable && (wakens > dzline->nextkbns)) wakens = dzline->nextkbns;
+
+    // write out whatever we can of the printer chars
+    if (! flushoutput (dzline)) disconnect (dzline);
+
+    // poll for keyboard chars if we have room for them, poll for output if some is stuck
+    setpollevs (dzline);
+}
+
+// accept telnet connection for line
+// put client in character-at-a-time mode with us doing the echoing
+static void gotconnect (DZLine *dzline)
+{
+    int fd = accept4 (dzline->listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+        if ((errno != EAGAIN) && (errno != EINTR)) fprintf (stderr, "z11dz: error accepting line %o: %m\n", dzline->line);
+        return;
+    }
+    if (dzline->outfd >= 0) {
+        static char const busymsg[] = "\r\nz11dz: line busy\r\n";
+        if (write (fd, busymsg, sizeof busymsg - 1) < 0) { }
+        close (fd);
+        return;
+    }
+
+    static uint8_t const negot[] = { TN_IAC, TN_WILL, TN_ECHO, TN_IAC, TN_WILL, TN_SGA };
+    memcpy (dzline->outbuf, negot, sizeof negot);
+    dzline->outlen   = sizeof negot;
+    dzline->infd     = nokb ? -1 : fd;
+    dzline->outfd    = fd;
+    dzline->pollevs  = 0;
+    dzline->telnet   = true;
+    dzline->telstate = 0;
+    dzline->inpos    = 0;
+    dzline->inlen    = 0;
+
+    struct epoll_event epev;
+    memset (&epev, 0, sizeof epev);
+    epev.data.u32 = (EV_CLIENT << 8) | dzline->line;
+    if (epoll_ctl (epfd, EPOLL_CTL_ADD, fd, &epev) < 0) ABORT ();
+    fprintf (stderr, "z11dz: line %o connected\n", dzline->line);
+}
+
+// read keyboard chars for line into its inbuf
+// strips out telnet protocol
+//  returns false: end of file or error, disconnect
+//           true: successful (maybe nothing read)
+static bool gotinput (DZLine *dzline)
+{
+    if ((dzline->infd < 0) || (dzline->inpos < dzline->inlen)) return true;
+
+    uint8_t rawbuf[sizeof dzline->inbuf];
+    int rc = read (dzline->infd, rawbuf, sizeof rawbuf);
+    if (rc < 0) {
+        if ((errno == EAGAIN) || (errno == EINTR)) return true;
+        if (dzline->telnet) return false;
+        ABORT ();
+    }
+    if (rc == 0) return false;
+
+    dzline->inpos = 0;
+    dzline->inlen = 0;
+    for (int i = 0; i < rc; i ++) {
+        uint8_t kbchar = rawbuf[i];
+        if (dzline->telnet) {
+            switch (dzline->telstate) {
+                case 0: {                                   // data
+                    if (kbchar == TN_IAC) { dzline->telstate = 1; continue; }
+                    if (kbchar == '\r') dzline->telstate = 5;
+                    break;
+                }
+                case 1: {                                   // got IAC
+                    dzline->telstate = 0;
+                    if (kbchar == TN_IAC) break;
+                    if ((kbchar >= TN_WILL) && (kbchar <= TN_DONT)) dzline->telstate = 2;
+                    if (kbchar == TN_SB) dzline->telstate = 3;
+                    continue;
+                }
+                case 2: {                                   // got IAC WILL/WONT/DO/DONT
+                    dzline->telstate = 0;
+                    continue;
+                }
+                case 3: {                                   // in IAC SB ... IAC SE
+                    if (kbchar == TN_IAC) dzline->telstate = 4;
+                    continue;
+                }
+                case 4: {
+                    dzline->telstate = (kbchar == TN_SE) ? 0 : 3;
+                    continue;
+                }
+                case 5: {                                   // got CR, toss following LF or NUL
+                    dzline->telstate = 0;
+                    if ((kbchar == '\n') || (kbchar == 0)) continue;
+                    if (kbchar == TN_IAC) { dzline->telstate = 1; continue; }
+                    if (kbchar == '\r') dzline->telstate = 5;
+                    break;
+                }
+            }
+        } else if ((kbchar == '\\' - '@') && dzline->intty) {
+            ctrlcflag = true;
+            break;
+        }
+        if (upcase && (kbchar >= 'a') && (kbchar <= 'z')) kbchar -= 'a' - 'A';
+        dzline->inbuf[dzline->inlen++] = kbchar;
+    }
+    return true;
+}
+
+// write as much of line's outbuf as we can
+//  returns false: error, disconnect
+//           true: successful (maybe nothing written)
+static bool flushoutput (DZLine *dzline)
+{
+    if (dzline->outfd < 0) {
+        dzline->outlen = 0;
+        return true;
+    }
+    int done = 0;
+    while (done < dzline->outlen) {
+        int rc = write (dzline->outfd, dzline->outbuf + done, dzline->outlen - done);
+        if (rc <= 0) {
+            if ((rc < 0) && (errno == EINTR)) continue;
+            if ((rc < 0) && (errno == EAGAIN)) break;
+            if (dzline->telnet) return false;
+            ABORT ();
+        }
+        done += rc;
+    }
+    dzline->outlen -= done;
+    memmove (dzline->outbuf, dzline->outbuf + done, dzline->outlen);
+    return true;
+}
+
+// telnet client disconnected, or end of stdin
+static void disconnect (DZLine *dzline)
+{
+    if (dzline->telnet) {
+        fprintf (stderr, "z11dz: line %o disconnected\n", dzline->line);
+        close (dzline->outfd);
+        dzline->outfd  = -1;
+        dzline->telnet = false;
+    }
+    dzline->infd    = -1;
+    dzline->inpos   = 0;
+    dzline->inlen   = 0;
+    dzline->outlen  = 0;
+    dzline->pollevs = 0;
+}
+
+// update what we are polling the line's tty/socket for
+static void setpollevs (DZLine *dzline)
+{
+    if (! dzline->pollable) return;
+    int fd = dzline->telnet ? dzline->outfd : dzline->infd;
+    if (fd < 0) return;
+    uint32_t pollevs = 0;
+    if ((dzline->infd >= 0) && (dzline->inpos >= dzline->inlen)) pollevs |= EPOLLIN;
+    if (dzline->telnet && (dzline->outlen > 0)) pollevs |= EPOLLOUT;
+    if (dzline->pollevs != pollevs) {
+        struct epoll_event epev;
+        memset (&epev, 0, sizeof epev);
+        epev.events   = pollevs;
+        epev.data.u32 = (EV_CLIENT << 8) | dzline->line;
+        if (epoll_ctl (epfd, EPOLL_CTL_MOD, fd, &epev) < 0) ABORT ();
+        dzline->pollevs = pollevs;
+    }
+}
+
+static uint64_t getnowns ()
+{
+    struct timespec nowts;
+    if (clock_gettime (CLOCK_MONOTONIC, &nowts) < 0) ABORT ();
+    return nowts.tv_sec * 1000000000ULL + nowts.tv_nsec;
+}
+
 static void sigrunhand (int signum)
 {
     if (signum == SIGQUIT) {
@@ -266,6 +702,6 @@ static void sigrunhand (int signum)
     } else {
         tcsetattr (STDIN_FILENO, TCSADRAIN, &term_original);
     }
-    dprintf (STDERR_FILENO, "\nz11dl: terminated by signal %d\n", signum);
+    dprintf (STDERR_FILENO, "\nz11dz: terminated by signal %d\n", signum);
     exit (1);
 }
@@ -0,0 +1,45 @@
+//    Copyright (C) Mike Rieker, Beverly, MA USA
+//    www.outerworldapps.com
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; version 2 of the License.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    EXPECT it to FAIL when someone's HeALTh or PROpeRTy is at RISk.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    http://www.gnu.org/licenses/gpl-2.0.html
+
+#ifndef _Z11INST_H
+#define _Z11INST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// name of shared memory, lock file, etc for this simulated machine
+// ...so several verimains and their z11 programs can run on one host
+// envar Z11INSTANCE selects the machine, unset for the original names
+//  input:
+//   name = base name, eg, "/shm_verisim"
+//  output:
+//   returns name_instance (malloced) or just name
+static inline char const *z11instname (char const *name)
+{
+    char const *inst = getenv ("Z11INSTANCE");
+    if ((inst == NULL) || (inst[0] == 0)) return name;
+    char *buf = (char *) malloc (strlen (name) + strlen (inst) + 2);
+    if (buf == NULL) abort ();
+    sprintf (buf, "%s_%s", name, inst);
+    return buf;
+}
+
+#endif
@@ -20,6 +20,9 @@
 
 // Performs paper tape reader and punch I/O for the PDP-11 Zynq I/O board
 
+// waits for fpga interrupt saying the pdp wants another reader byte or has punched a byte
+// reads and writes the tape image file in big chunks
+
 #include <errno.h>
 #include <fcntl.h>
 #include <signal.h>
@@ -28,8 +31,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "shmstats.h"
 #include "z11defs.h"
 #include "z11util.h"
 
@@ -44,12 +49,19 @@
 
 #define PC3_ENAB  0x80000000U
 
+#define BUFSIZE   65536         // bytes read from or written to file at a time
+#define FLUSHWAIT 10            // flush punch file after this many ZGWFITO_MS waits with nothing punched
+#define PROGRESSNS 250000000    // update progress message this often
+
 static bool volatile ctrlcflag;
 
+static void pace (uint64_t &nextns, int32_t cps);
+static uint64_t getnowns ();
 static void sighand (int signum);
 
 int main (int argc, char **argv)
 {
+    bool fast = false;
     bool inscr = false;
     bool killit = false;
     bool quiet = false;
@@ -57,20 +69,24 @@ int main (int argc, char **argv)
     char const *filename = NULL;
     int mode = -1;
     int32_t cps = 0;
+    uint8_t mask = 0377;
     for (int i = 0; ++ i < argc;) {
         if (strcmp (argv[i], "-?") == 0) {
             puts ("");
             puts ("     Access paper tape reader and punch");
             puts ("");
-            puts ("  ./z11pc reader [-cps <charspersec>] [-inscr] [-killit] [-quiet] [-remnull] <filename>");
+            puts ("  ./z11pc reader [-cps <charspersec>] [-fast] [-inscr] [-killit] [-quiet] <filename>");
             puts ("     -cps    : set chars per second, default 300");
+            puts ("     -fast   : pass chars as fast as the pdp takes them");
             puts ("     -inscr  : insert <CR> before <LF>");
             puts ("     -killit : kill other process that is processing paper tape reader");
             puts ("     -quiet  : don't print progress message");
             puts ("   filename can be - for stdin");
             puts ("");
-            puts ("  ./z11pc punch [-7bit] [-cps <charspersec>] [-remcr] [-killit] [-quiet] <filename>");
+            puts ("  ./z11pc punch [-7bit] [-cps <charspersec>] [-fast] [-remcr] [-killit] [-quiet] <filename>");
+            puts ("     -7bit   : clear top bit of each char");
             puts ("     -cps    : set chars per second, default 50");
+            puts ("     -fast   : accept chars as fast as the pdp punches them");
             puts ("     -remcr  : remove <CR> before <LF>");
             puts ("     -killit : kill other process that is processing paper tape punch");
             puts ("     -quiet  : don't print progress message");
@@ -79,6 +95,10 @@ int main (int argc, char **argv)
             puts ("");
             return 0;
         }
+        if (strcasecmp (argv[i], "-7bit") == 0) {
+            mask = 0177;
+            continue;
+        }
         if (strcasecmp (argv[i], "-cps") == 0) {
             if ((++ i >= argc) || (argv[i][0] == '-')) {
                 fprintf (stderr, "missing value for -cps\n");
@@ -92,6 +112,10 @@ int main (int argc, char **argv)
             }
             continue;
         }
+        if (strcasecmp (argv[i], "-fast") == 0) {
+            fast = true;
+            continue;
+        }
         if (strcasecmp (argv[i], "-inscr") == 0) {
             inscr = true;
             continue;
@@ -100,6 +124,14 @@ int main (int argc, char **argv)
             killit = true;
             continue;
         }
+        if (strcasecmp (argv[i], "-quiet") == 0) {
+            quiet = true;
+            continue;
+        }
+        if (strcasecmp (argv[i], "-remcr") == 0) {
+            remcr = true;
+            continue;
+        }
         if ((argv[i][0] == '-') && (argv[i][1] != 0)) {
             fprintf (stderr, "unknown option %s\n", argv[i]);
             return 1;
@@ -126,166 +158,215 @@ int main (int argc, char **argv)
         return 1;
     }
 
+    static uint8_t buf[BUFSIZE];
+    uint64_t nextns = getnowns ();
+    uint64_t progns = 0;
+
     if (mode) {
 
         // punch mode
 
-        FILE *file = (strcmp (filename, "-") == 0) ? stdout : fopen (filename, "w");
-        if (file == NULL) {
+        int fd = (strcmp (filename, "-") == 0) ? STDOUT_FILENO : open (filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fd < 0) {
             fprintf (stderr, "error creating %s: %m\n", filename);
             return 1;
         }
 
-        struct stat statbuf;
-        if (fstat (fileno (file), &statbuf) < 0) ABORT ();
-        if (! S_ISREG (statbuf.st_mode)) setlinebuf (file);
-
         Z11Page z11p;
         uint32_t volatile *pcat = z11p.findev ("PC", NULL, NULL, false, false);
         z11p.locksubdev (&pcat[2], 1, killit);
-        pcat[3] = PC3_ENAB;
+        ZWR(pcat[3], PC3_ENAB);
+        shmstats_init (SHMSTATS_PC);
 
         if (signal (SIGINT,  sighand) == SIG_ERR) ABORT ();
         if (signal (SIGTERM, sighand) == SIG_ERR) ABORT ();
 
-        if (pcat[2] & PC2_ERROR) {  // see if previously reporting 'out of tape'
-            pcat[2] = 0;            // two separate steps to trigger interrupt
-            pcat[2] = PC2_EMPTY;    // ok, now we are ready to accept bytes
+        if (ZRD(pcat[2]) & PC2_ERROR) { // see if previously reporting 'out of tape'
+            ZWR(pcat[2], 0);            // two separate steps to trigger interrupt
+            ZWR(pcat[2], PC2_EMPTY);    // ok, now we are ready to accept bytes
         }
 
         bool lastcr = false;
-        int32_t  idlect = 0;
-        uint32_t fbytes = 0;
+        int buflen = 0;
         uint32_t nbytes = 0;
         if (cps == 0) cps = 50;
         while (true) {
-            if (! quiet) {
+            uint64_t nowns = getnowns ();
+            if (! quiet && (nowns >= progns)) {
                 fprintf (stderr, "\r%u byte%s so far ", nbytes, ((nbytes == 1) ? "" : "s"));
                 fflush (stderr);
+                progns = nowns + PROGRESSNS;
             }
 
+            // wait for pdp to punch something
+            // if it doesn't punch anything for a little while, write buffer to file
+            // then wait for as long as it takes
             uint32_t pc2;
-            do {
-                usleep (1000000 / cps);
-
-                // flush buffer to file if idle for a second or have been terminated
-                if ((++ idlect >= cps) || ctrlcflag) {
-
-                    // write buffer to file
-                    if ((fbytes < nbytes) && (fflush (file) < 0)) {
-                        pcat[2] = PC2_ERROR;
+            for (int waits = 0; ((pc2 = ZRD(pcat[2])) & PC2_EMPTY) && ! ctrlcflag; waits ++) {
+                if (waits < FLUSHWAIT) {
+                    z11p.waitint (ZGINT_PP, true);
+                    continue;
+                }
+                if (buflen > 0) {
+                    if (write (fd, buf, buflen) != buflen) {
+                        ZWR(pcat[2], PC2_ERROR);
                         fprintf (stderr, "error writing %s: %m\n", filename);
                         return 1;
                     }
-                    fbytes = nbytes;
-
-                    // if terminated, close and exit
-                    if (ctrlcflag) {
-                        pcat[2] = PC2_ERROR;
-                        if (! quiet) fputc ('\n', stderr);
-                        if ((file != stdout) && (fclose (file) < 0)) {
-                            fprintf (stderr, "error closing %s: %m\n", filename);
-                            return 1;
-                        }
-                        return 0;
-                    }
+                    buflen = 0;
+                }
+                if (! quiet) {
+                    fprintf (stderr, "\r%u byte%s so far ", nbytes, ((nbytes == 1) ? "" : "s"));
+                    fflush (stderr);
+                }
+                z11p.waitint (ZGINT_PP);
+            }
 
-                    // don't need to flush again until another byte is punched
-                    idlect = -999999999;
+            // if terminated, write buffer, close and exit
+            if (ctrlcflag) {
+                ZWR(pcat[2], PC2_ERROR);
+                if (! quiet) fprintf (stderr, "\r%u byte%s total\n", nbytes, ((nbytes == 1) ? "" : "s"));
+                if ((buflen > 0) && (write (fd, buf, buflen) != buflen)) {
+                    fprintf (stderr, "error writing %s: %m\n", filename);
+                    return 1;
                 }
+                if ((fd != STDOUT_FILENO) && (close (fd) < 0)) {
+                    fprintf (stderr, "error closing %s: %m\n", filename);
+                    return 1;
+                }
+                return 0;
+            }
 
-                // keep waiting if nothing to punch
-            } while ((pc2 = pcat[2]) & PC2_EMPTY);
-            idlect = 0;
+            // punch at no more than cps
+            if (! fast) pace (nextns, cps);
 
             // tell pdp it is ok to punch another byte now
-            pcat[2] = PC2_EMPTY;
+            ZWR(pcat[2], PC2_EMPTY);
+            shmstats_bytes (0, 1);
 
             // get byte being punched
-            uint8_t wrbyte = (pc2 & PC2_BUFFR) / (PC2_BUFFR & - PC2_BUFFR);
+            uint8_t wrbyte = ((pc2 & PC2_BUFFR) / (PC2_BUFFR & - PC2_BUFFR)) & mask;
 
             // if we skipped a CR last time and this is not an LF, punch the CR
             if (lastcr && ((wrbyte & 0177) != '\n')) {
-                if (fputc ('\r', file) < 0) {
-                    pcat[2] = PC2_ERROR;
-                    fprintf (stderr, "error writing %s: %m\n", filename);
-                    return 1;
-                }
+                buf[buflen++] = '\r';
                 ++ nbytes;
             }
 
             // if -remcr and this is a CR, hold off on punching it
             lastcr = (remcr && ((wrbyte & 0177) == '\r'));
             if (! lastcr) {
-                if (fputc (wrbyte, file) < 0) {
-                    pcat[2] = PC2_ERROR;
+                buf[buflen++] = wrbyte;
+                ++ nbytes;
+            }
+
+            // write buffer to file when it fills
+            if (buflen >= BUFSIZE - 1) {
+                if (write (fd, buf, buflen) != buflen) {
+                    ZWR(pcat[2], PC2_ERROR);
                     fprintf (stderr, "error writing %s: %m\n", filename);
                     return 1;
                 }
-                ++ nbytes;
+                buflen = 0;
             }
         }
     } else {
 
         // reader mode
 
-        FILE *file = (strcmp (filename, "-") == 0) ? stdin : fopen (filename, "r");
-        if (file == NULL) {
+        int fd = (strcmp (filename, "-") == 0) ? STDIN_FILENO : open (filename, O_RDONLY);
+        if (fd < 0) {
             fprintf (stderr, "error opening %s: %m\n", filename);
             return 1;
         }
 
         struct stat statbuf;
-        if (fstat (fileno (file), &statbuf) < 0) ABORT ();
+        if (fstat (fd, &statbuf) < 0) ABORT ();
         uint32_t fsize = statbuf.st_size;
 
         Z11Page z11p;
         uint32_t volatile *pcat = z11p.findev ("PC", NULL, NULL, false, false);
         z11p.locksubdev (&pcat[1], 1, killit);
-        pcat[3] = PC3_ENAB;
+        ZWR(pcat[3], PC3_ENAB);
+        shmstats_init (SHMSTATS_PC);
 
-        if (pcat[1] & PC1_RERR) {   // see if was reporting no tape in reader
-            pcat[1] = 0;            // ok say we have a tape now
+        if (ZRD(pcat[1]) & PC1_RERR) {  // see if was reporting no tape in reader
+            ZWR(pcat[1], 0);            // ok say we have a tape now
         }
 
         bool lastcr = false;
+        int bufpos = 0;
+        int buflen = 0;
         uint32_t nbytes = 0;
         if (cps == 0) cps = 300;
         while (true) {
-            if (! quiet) {
+            uint64_t nowns = getnowns ();
+            if (! quiet && (nowns >= progns)) {
                 if (fsize == 0) fprintf (stderr, "\r%u byte%s so far ", nbytes, ((nbytes == 1) ? "" : "s"));
                  else fprintf (stderr, "\r%u/%u byte%s so far ", nbytes, fsize, ((nbytes == 1) ? "" : "s"));
                 fflush (stderr);
+                progns = nowns + PROGRESSNS;
             }
 
-            do usleep (1000000 / cps);
-            while (! (pcat[1] & PC1_STEP));
-
-            int rc = fgetc (file);
-            if (rc < 0) {
-                pcat[1] = PC1_RERR;
-                if (ferror (file)) {
-                    fprintf (stderr, "error reading %s: %m\n", filename);
-                    return 1;
+            // get next byte from file
+            if (bufpos >= buflen) {
+                int rc = read (fd, buf, sizeof buf);
+                if (rc <= 0) {
+                    if ((rc < 0) && (errno == EINTR)) continue;
+                    ZWR(pcat[1], PC1_RERR);
+                    if (rc < 0) {
+                        fprintf (stderr, "error reading %s: %m\n", filename);
+                        return 1;
+                    }
+                    if (! quiet) fprintf (stderr, "\r%u byte%s read\nend of file reached\n", nbytes, ((nbytes == 1) ? "" : "s"));
+                    return 0;
                 }
-                if (! quiet) fprintf (stderr, "\nend of file reached\n");
-                return 0;
+                bufpos = 0;
+                buflen = rc;
             }
+            uint8_t rc = buf[bufpos++];
             ++ nbytes;
 
+            // wait for pdp to ask for a byte then pass it along
             if (((rc & 0177) == '\n') && inscr && ! lastcr) {
-                pcat[1] = PC1_RRDY | (rc - '\n' + '\r') * PC1_RBUF0;
-                do usleep (1000000 / cps);
-                while (! (pcat[1] & PC1_STEP));
+                if (! fast) pace (nextns, cps);
+                while (! (ZRD(pcat[1]) & PC1_STEP)) z11p.waitint (ZGINT_PR);
+                ZWR(pcat[1], PC1_RRDY | (rc - '\n' + '\r') * PC1_RBUF0);
             }
 
             lastcr = (rc & 0177) == '\r';
 
-            pcat[1] = PC1_RRDY | rc * PC1_RBUF0;
+            if (! fast) pace (nextns, cps);
+            while (! (ZRD(pcat[1]) & PC1_STEP)) z11p.waitint (ZGINT_PR);
+            ZWR(pcat[1], PC1_RRDY | rc * PC1_RBUF0);
+            shmstats_bytes (1, 0);
         }
     }
 }
 
+// wait until the next char can be passed at the given chars per second
+// allow catching up if we are a little late
+static void pace (uint64_t &nextns, int32_t cps)
+{
+    uint64_t nowns = getnowns ();
+    if (nowns < nextns) {
+        struct timespec waitts;
+        waitts.tv_sec  = nextns / 1000000000;
+        waitts.tv_nsec = nextns % 1000000000;
+        while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &waitts, NULL) == EINTR) { }
+    } else if (nowns - nextns > 1000000000ULL / cps) {
+        nextns = nowns;
+    }
+    nextns += 1000000000ULL / cps;
+}
+
+static uint64_t getnowns ()
+{
+    struct timespec nowts;
+    if (clock_gettime (CLOCK_MONOTONIC, &nowts) < 0) ABORT ();
+    return nowts.tv_sec * 1000000000ULL + nowts.tv_nsec;
+}
+
 static void sighand (int signum)
 {
     ctrlcflag = true;
@@ -24,6 +24,14 @@
 
 //  ./z11rh [-reset]
 
+//  envar z11rh_mmap=<seconds> maps image files into memory instead of reading and writing them
+//  ...writing modified pages is started every <seconds>, waited for when synced or unloaded
+//  envar z11rh_wbcache=<kilobytes> caches up to that much written data per drive
+//  ...pdp sees writes complete when cached, a flusher thread writes them to the file
+//  ...unloading or z11ctrl sync command waits for them to be written
+
+//  image files created with z11ctrl 'rhload -overlay <base>' are copy-on-write overlays of <base>
+
 // page references rjp04 disk subsystem maint, feb 75
 
 #include <errno.h>
@@ -33,12 +41,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <unistd.h>
 
+#include "asyncio.h"
+#include "diskcache.h"
+#include "diskovly.h"
 #include "futex.h"
 #include "shmms.h"
+#include "shmstats.h"
 #include "z11defs.h"
 #include "z11util.h"
 
@@ -52,6 +65,7 @@
 #define TRKPERCYL 19
 #define NSECS (NCYLS*TRKPERCYL*SECPERTRK)
 #define WRDPERSEC 256       // words per sector
+#define PIPEWORDS 8192      // words per chunk of file i/o overlapped with dma
 
 #define USPERCYL ((100000-15000)/(NCYLS-1))     // usec per cyl = (full seek - one seek) / (num cyls - 1)
 #define SEEKONEUS 7333                          // seek one cylinder
@@ -63,24 +77,40 @@
 #define NSPERDMA 2350
 #define USLEEPOV 72
 
+static bool mapdirty[8];
+static bool mapasync[8];                // MS_ASYNC done since last MS_SYNC
+static DiskCache *caches[8];
+static DiskOverlay *ovlys[8];
 static char fns[8][SHMMS_FNSIZE];
 static int debug;
 static int fds[8];
+static int mmapsecs;
+static uint16_t *maps[8];
+static uint32_t mapsizes[8];
 
 #define LOCKIT shmms_svr_mutexlock(shmms)
 #define UNLKIT shmms_svr_mutexunlk(shmms)
 
+static AsyncIO *aio;
 static ShmMS *shmms;
 static uint16_t wrdbuf[65536];
 static uint32_t volatile *rhat;
 
 static void *rhiothread (void *dummy);
+static void *flushthread (void *dummy);
+static void flushmap (int drsel, bool wait = true);
 static void dotransfer (uint32_t rh3);
+static int readimage (int drsel, void *buf, uint32_t size, uint64_t off);
+static int writeimage (int drsel, void const *buf, uint32_t size, uint64_t off);
+static void startimage (int drsel, AIOReq *req, void *buf, uint32_t size, uint64_t off, bool write);
+static int aioimage (AIOReq *req);
+static bool finishio (int drsel, AIOReq *req);
 static int setdrivetype (void *param, int drsel);
 static int fileloaded (void *param, int drsel, int fd);
 static int writebadblocks (ShmMSDrive *dr, int fd);
 static void unloadfile (void *param, int drsel);
 static void unloadfileata (int drsel, uint16_t ata);
+static int syncfiles (void *param);
 static void upddrivestats (uint32_t rh1);
 static void wrreg (int index, uint32_t value);
 
@@ -96,15 +126,18 @@ int main (int argc, char **argv)
     // access fpga register set for the RH-11 controller
     // lock it so we are only process accessing it
     z11page = new Z11Page ();
+    z11page->bigmemdma (true);
     rhat = z11page->findev ("RH", NULL, NULL, true, false);
 
     // initialize shared memory - contains filenames and load/unload info
-    shmms = shmms_svr_initialize (resetit, SHMMS_NAME_RH, "z11rh");
+    bool resume;
+    shmms = shmms_svr_initialize (resetit, SHMMS_NAME_RH, "z11rh", &resume);
     shmms->ndrives = 8;
 
     // ...and no drives are ready
+    // ...unless restoring a checkpoint, the restored fpga has the volume valids as they were
     uint32_t fastio = ZRD(rhat[4]) & RH4_FAST;
-    wrreg (1, RH1_VVS);
+    if (! resume) wrreg (1, RH1_VVS);
 
     // enable board to process io instructions
     wrreg (4, RH4_ENAB | fastio);
@@ -114,11 +147,30 @@ int main (int argc, char **argv)
     char const *dbgenv = getenv ("z11rh_debug");
     if (dbgenv != NULL) debug = atoi (dbgenv);
 
+    mmapsecs = 0;
+    char const *mmapenv = getenv ("z11rh_mmap");
+    if (mmapenv != NULL) mmapsecs = atoi (mmapenv);
+
+    char const *wbcenv = getenv ("z11rh_wbcache");
+    int wbckb = (wbcenv == NULL) ? 0 : atoi (wbcenv);
+    if (wbckb > 0) {
+        for (int drsel = 0; drsel < 8; drsel ++) {
+            caches[drsel] = new DiskCache ("z11rh", drsel, WRDPERSEC * 2, wbckb * 1024);
+        }
+    }
+
+    shmstats_init (SHMSTATS_RH);
+    aio = new AsyncIO ("z11rh");
+
     pthread_t rhtid;
     int rc = pthread_create (&rhtid, NULL, rhiothread, NULL);
     if (rc != 0) ABORT ();
+    if (mmapsecs > 0) {
+        rc = pthread_create (&rhtid, NULL, flushthread, NULL);
+        if (rc != 0) ABORT ();
+    }
 
-    shmms_svr_proccmds (shmms, "z11rh", setdrivetype, fileloaded, unloadfile, NULL);
+    shmms_svr_proccmds (shmms, "z11rh", setdrivetype, fileloaded, unloadfile, NULL, syncfiles);
 
     return 0;
 }
@@ -126,10 +178,13 @@ int main (int argc, char **argv)
 // do the disk file I/O
 static void *rhiothread (void *dummy)
 {
+    z11page->setdmaprio (DMAPRI_DISK);
+
     while (true) {
 
         // wait for pdp to start a transfer or set rpcs2[05] (CLR)
         z11page->waitint (ZGINT_RH);
+        uint64_t startns = shmstats_nowns ();
 
         // block disk from being unloaded from under us
         LOCKIT;
@@ -156,12 +211,40 @@ static void *rhiothread (void *dummy)
         // the fpga has aleeady delayed for the implied seek at the beginning
         else if (rh3 & RH3_XGO) {
             dotransfer (rh3);
+            shmstats_since (SHMSTATS_CMDNS, startns);
         }
 
         UNLKIT;
     }
 }
 
+// periodically write modified mapped image pages to the files
+static void *flushthread (void *dummy)
+{
+    while (true) {
+        sleep (mmapsecs);
+        LOCKIT;
+        for (int drsel = 0; drsel < 8; drsel ++) flushmap (drsel, false);
+        UNLKIT;
+    }
+}
+
+// write modified pages of a mapped image to its file
+// - call with shmms locked
+//  input:
+//   wait = false: just start writing them (periodic flush, doesn't hold lock for long)
+//           true: wait for them to be written (sync and unload)
+static void flushmap (int drsel, bool wait)
+{
+    if (mapdirty[drsel] || (wait && mapasync[drsel])) {
+        if (msync (maps[drsel], mapsizes[drsel], wait ? MS_SYNC : MS_ASYNC) < 0) {
+            fprintf (stderr, "z11rh: [%d] error flushing %s: %m\n", drsel, fns[drsel]);
+        }
+        mapdirty[drsel] = false;
+        mapasync[drsel] = ! wait;
+    }
+}
+
 // do transfer for the given drive
 //  input:
 //   RH2_WRT = 1: write data
@@ -196,9 +279,12 @@ static void dotransfer (uint32_t rh3)
     uint32_t blocksleft = (NSECS >= blknum) ? NSECS - blknum : 0;
     uint32_t wordsleft  = blocksleft * WRDPERSEC;
 
+    // transfer directly to/from image file if it is mapped
+    uint16_t *bufbeg = (maps[drsel] != NULL) ? maps[drsel] + blknum * WRDPERSEC : wrdbuf;
+
     uint16_t  rpwc   = (rh3 & RH3_WCT) / RH3_WCT0;
     uint32_t  wrdcnt = 65536 - rpwc;
-    uint16_t *wrdpnt = wrdbuf;
+    uint16_t *wrdpnt = bufbeg;
 
     if (wrdcnt > wordsleft) wrdcnt = wordsleft;
 
@@ -211,80 +297,138 @@ static void dotransfer (uint32_t rh3)
     bool fer = false;
     bool wce = false;
 
+    // file i/o is done in chunks so the next chunk can be read or written whilst dma'ing the current one
+    AIOReq reqs[2];
+    AIOReq *pending = NULL;
+    int cur = 0;
+
     if (rh2 & RH2_WRT) {
 
         // WRITE
 
-        // read pdp memory into buffer
-        for (uint32_t wc = wrdcnt; wc != 0; -- wc) {
-            if (z11page->dmaread (rpba, (wrdpnt ++)) != 0) {
+        if ((maps[drsel] != NULL) && dr->readonly) {
+            fprintf (stderr, "z11rh: [%d] writing read-only file at %u\n", drsel, blknum);
+            fer = true;
+            goto done;
+        }
+
+        // mapped image gets pdp memory directly and gets flushed later
+        // ...mark it dirty before dma as a failed dma may have written some of it
+        if (maps[drsel] != NULL) mapdirty[drsel] = true;
+        uint32_t chunk = (maps[drsel] != NULL) ? wrdcnt : PIPEWORDS;
+        for (uint32_t wdone = 0; wdone < wrdcnt;) {
+
+            // read pdp memory into buffer
+            uint32_t nwds = (wrdcnt - wdone < chunk) ? wrdcnt - wdone : chunk;
+            uint32_t ncnk = nwds;
+            uint32_t rd = z11page->dmareadblock (rpba, nwds, wrdpnt, rpbi != 0);
+            wrdpnt += nwds;
+            rpba   += rpbi * nwds;
+            rpwc   += nwds;
+
+            // previous chunk should be written to file by now
+            if ((pending != NULL) && ! finishio (drsel, pending)) fer = true;
+            pending = NULL;
+            if (rd != 0) {
                 nxm = true; // or per = true
                 goto done;
             }
-            rpba += rpbi;
-            if (++ rpwc == 0) break;
-        }
-
-        // zero fill any partial sector
-        if (wrdcnt % WRDPERSEC != 0) {
-            memset (&wrdbuf[wrdcnt], 0, (WRDPERSEC - wrdcnt % WRDPERSEC) * 2);
-            wrdcnt += WRDPERSEC - wrdcnt % WRDPERSEC;
-        }
-
-        // write buffer to disk file
-        int rc = pwrite (fds[drsel], wrdbuf, wrdcnt * 2, blknum * WRDPERSEC * 2);
-        if (rc != (int) wrdcnt * 2) {
-            if (rc < 0) {
-                fprintf (stderr, "z11rh: [%d] error writing at %u: %m\n", drsel, blknum);
-            } else {
-                fprintf (stderr, "z11rh: [%d] only wrote %d bytes of %u at %u\n", drsel, rc, wrdcnt * 2, blknum);
+            if (fer) goto done;
+
+            // zero fill any partial sector
+            uint16_t *cnkbeg = &bufbeg[wdone];
+            wdone += ncnk;
+            if (ncnk % WRDPERSEC != 0) {
+                memset (&cnkbeg[ncnk], 0, (WRDPERSEC - ncnk % WRDPERSEC) * 2);
+                ncnk += WRDPERSEC - ncnk % WRDPERSEC;
             }
-            fer = true;
-        }
-    } else {
 
-        // read disk file to buffer
-        int rc = pread (fds[drsel], wrdbuf, wrdcnt * 2, blknum * WRDPERSEC * 2);
-        if (rc != (int) wrdcnt * 2) {
-            if (rc < 0) {
-                fprintf (stderr, "z11rh: [%d] error reading at %u: %m\n", drsel, blknum);
-            } else {
-                fprintf (stderr, "z11rh: [%d] only read %d bytes of %u at %u\n", drsel, rc, wrdcnt * 2, blknum);
+            // start writing buffer to disk file
+            if (maps[drsel] == NULL) {
+                pending = &reqs[cur];
+                startimage (drsel, pending, cnkbeg, ncnk * 2, ((uint64_t) blknum * WRDPERSEC + (cnkbeg - bufbeg)) * 2, true);
+                cur ^= 1;
             }
-            fer = true;
         }
+    } else {
 
-        else if (rh3 & RH3_WCE) {
+        // read disk file to buffer unless mapped
+        uint32_t chunk = (maps[drsel] != NULL) ? wrdcnt : PIPEWORDS;
+        for (uint32_t rdone = 0; rdone < wrdcnt;) {
+            uint32_t ncnk = (wrdcnt - rdone < chunk) ? wrdcnt - rdone : chunk;
 
-            // WRITE CHECK - compare buffer with pdp memory
-            for (; wrdcnt > 0; -- wrdcnt) {
-                uint16_t word;
-                if (z11page->dmaread (rpba, &word) != 0) {
-                    nxm = true;
-                    break;
+            if (maps[drsel] == NULL) {
+                if (pending == NULL) {
+                    startimage (drsel, &reqs[cur], &bufbeg[rdone], ncnk * 2, ((uint64_t) blknum * WRDPERSEC + rdone) * 2, false);
                 }
-                if (word != *(wrdpnt ++)) {
-                    wce = true;
-                    break;
+                pending = NULL;
+                if (! finishio (drsel, &reqs[cur])) {
+                    fer = true;
+                    goto done;
                 }
-                rpba += rpbi;
-                if (++ rpwc == 0) break;
+
+                // start reading next chunk
+                uint32_t nextwds = wrdcnt - rdone - ncnk;
+                if (nextwds > 0) {
+                    if (nextwds > chunk) nextwds = chunk;
+                    pending = &reqs[cur^1];
+                    startimage (drsel, pending, &bufbeg[rdone+ncnk], nextwds * 2, ((uint64_t) blknum * WRDPERSEC + rdone + ncnk) * 2, false);
+                }
+                cur ^= 1;
             }
-        } else {
+            rdone += ncnk;
+
+            if (rh3 & RH3_WCE) {
+
+                // WRITE CHECK - compare buffer with pdp memory
+                while (ncnk > 0) {
+                    uint16_t words[KY_BFIFOSIZE];
+                    uint32_t nwds = (ncnk < KY_BFIFOSIZE) ? ncnk : KY_BFIFOSIZE;
+                    uint32_t rd = z11page->dmareadblock (rpba, nwds, words, rpbi != 0);
+                    for (uint32_t i = 0; i < nwds; i ++) {
+                        if (words[i] != *(wrdpnt ++)) {
+                            wce = true;
+                            goto done;
+                        }
+                        rpba += rpbi;
+                        rpwc ++;
+                    }
+                    if (rd != 0) {
+                        nxm = true;
+                        goto done;
+                    }
+                    ncnk -= nwds;
+                }
+            } else {
 
-            // READ - copy buffer to pdp memory
-            for (; wrdcnt > 0; -- wrdcnt) {
-                if (! z11page->dmawrite (rpba, *(wrdpnt ++))) {
+                // READ - copy buffer to pdp memory
+                uint32_t nwds = ncnk;
+                if (z11page->dmawriteblock (rpba, nwds, wrdpnt, rpbi != 0) != 0) {
                     nxm = true;
-                    break;
                 }
-                rpba += rpbi;
-                if (++ rpwc == 0) break;
+                wrdpnt += nwds;
+                rpba   += rpbi * nwds;
+                rpwc   += nwds;
+                if (nxm) goto done;
             }
         }
     }
 done:;
-    blknum += (wrdpnt - wrdbuf + WRDPERSEC - 1) / WRDPERSEC;
+
+    // finish any file i/o still in progress
+    // errors only matter for writes, a read ahead error doesn't affect anything
+    if (pending != NULL) {
+        if (pending->write) {
+            if (! finishio (drsel, pending)) fer = true;
+        } else {
+            aio->wait (pending);
+        }
+    }
+
+    if (rh2 & RH2_WRT) shmstats_bytes (0, (wrdpnt - bufbeg) * 2);
+    else if (! (rh3 & RH3_WCE)) shmstats_bytes ((wrdpnt - bufbeg) * 2, 0);
+
+    blknum += (wrdpnt - bufbeg + WRDPERSEC - 1) / WRDPERSEC;
     sector  = blknum % SECPERTRK;
     track   = blknum / SECPERTRK % TRKPERCYL;
     cylndr  = blknum / SECPERTRK / TRKPERCYL;
@@ -305,6 +449,68 @@ done:;
                 (rpwc * RH3_WCT0));     // ending word count
 }
 
+// read from image file, through write-back cache and overlay if any
+//  returns same as pread()
+static int readimage (int drsel, void *buf, uint32_t size, uint64_t off)
+{
+    if (caches[drsel] != NULL) return caches[drsel]->pread (buf, size, off);
+    if (ovlys[drsel] != NULL) return ovlys[drsel]->pread (buf, size, off);
+    return pread (fds[drsel], buf, size, off);
+}
+
+// write to image file, through write-back cache and overlay if any
+//  returns same as pwrite()
+static int writeimage (int drsel, void const *buf, uint32_t size, uint64_t off)
+{
+    // cache would accept the write then lose it when flushing to the read-only file
+    if (shmms->drives[drsel].readonly) {
+        errno = EBADF;
+        return -1;
+    }
+    if (caches[drsel] != NULL) return caches[drsel]->pwrite (buf, size, off);
+    if (ovlys[drsel] != NULL) return ovlys[drsel]->pwrite (buf, size, off);
+    return pwrite (fds[drsel], buf, size, off);
+}
+
+// start reading or writing image file in background
+static void startimage (int drsel, AIOReq *req, void *buf, uint32_t size, uint64_t off, bool write)
+{
+    req->fd    = fds[drsel];
+    req->write = write;
+    req->buf   = buf;
+    req->size  = size;
+    req->off   = off;
+    req->func  = ((caches[drsel] != NULL) || (ovlys[drsel] != NULL)) ? aioimage : NULL;
+    req->param = (void *) (long) drsel;
+    aio->submit (req);
+}
+
+// background i/o through write-back cache or overlay
+static int aioimage (AIOReq *req)
+{
+    int drsel = (long) req->param;
+    return req->write ?
+        writeimage (drsel, req->buf, req->size, req->off) :
+        readimage (drsel, req->buf, req->size, req->off);
+}
+
+// wait for background read or write to complete
+//  output:
+//   returns true: all bytes transferred
+//          false: error, message output
+static bool finishio (int drsel, AIOReq *req)
+{
+    int rc = aio->wait (req);
+    if (rc == (int) req->size) return true;
+    uint32_t blknum = req->off / (WRDPERSEC * 2);
+    if (rc < 0) {
+        fprintf (stderr, "z11rh: [%d] error %s at %u: %m\n", drsel, req->write ? "writing" : "reading", blknum);
+    } else {
+        fprintf (stderr, "z11rh: [%d] only %s %d bytes of %u at %u\n", drsel, req->write ? "wrote" : "read", rc, req->size, blknum);
+    }
+    return false;
+}
+
 // about to load a file, set drive type according to file characteristics
 static int setdrivetype (void *param, int drsel)
 {
@@ -327,7 +533,18 @@ static int setdrivetype (void *param, int drsel)
 static int fileloaded (void *param, int drsel, int fd)
 {
     ShmMSDrive *dr = &shmms->drives[drsel];
-    if (! dr->readonly) {
+
+    // overlay files get extended to full size but are otherwise left as is
+    int rc = DiskOverlay::attach ("z11rh", fd, dr->readonly, &ovlys[drsel]);
+    if (rc < 0) return rc;
+    if (ovlys[drsel] != NULL) {
+        rc = ovlys[drsel]->setsize (NSECS * WRDPERSEC * 2);
+        if (rc < 0) {
+            delete ovlys[drsel];
+            ovlys[drsel] = NULL;
+            return rc;
+        }
+    } else if (! dr->readonly) {
         struct stat statbuf;
         if (fstat (fd, &statbuf) < 0) return -1;
         if (ftruncate (fd, NSECS * WRDPERSEC * 2) < 0) return -1;
@@ -336,6 +553,29 @@ static int fileloaded (void *param, int drsel, int fd)
         }
     }
     fds[drsel] = fd;
+    if (caches[drsel] != NULL) caches[drsel]->setfd (fd, ovlys[drsel]);
+
+    // maybe map whole image into memory
+    // ...leave it unmapped if file is short (read-only files don't get extended)
+    if ((mmapsecs > 0) && (ovlys[drsel] == NULL)) {
+        struct stat statbuf;
+        uint32_t size = NSECS * WRDPERSEC * 2;
+        if ((fstat (fd, &statbuf) >= 0) && S_ISREG (statbuf.st_mode) && (statbuf.st_size >= size)) {
+            void *ptr = mmap (NULL, size, PROT_READ | (dr->readonly ? 0 : PROT_WRITE), MAP_SHARED, fd, 0);
+            if (ptr == MAP_FAILED) {
+                fprintf (stderr, "z11rh: [%d] error mapping %s: %m\n", drsel, dr->filename);
+            } else {
+                maps[drsel]     = (uint16_t *) ptr;
+                mapsizes[drsel] = size;
+                mapdirty[drsel] = false;
+                mapasync[drsel] = false;
+            }
+        }
+    }
+
+    // restoring a checkpoint puts the same volume back without the pdp noticing
+    if (dr->resume) strcpy (fns[drsel], dr->filename);
+
     uint32_t clrvv = 0;
     if (strcmp (fns[drsel], dr->filename) != 0) {
         strcpy (fns[drsel], dr->filename);
@@ -345,7 +585,7 @@ static int fileloaded (void *param, int drsel, int fd)
 
     // update RPDS then set ATA - attention active
     upddrivestats (clrvv);
-    ZWR(rhat[5], RH5_ATAS0 << drsel);
+    if (! dr->resume) ZWR(rhat[5], RH5_ATAS0 << drsel);
 
     return 0;
 }
@@ -394,6 +634,20 @@ static void unloadfile (void *param, int drsel)
 
 static void unloadfileata (int drsel, uint16_t ata)
 {
+    if (maps[drsel] != NULL) {
+        flushmap (drsel);
+        munmap (maps[drsel], mapsizes[drsel]);
+        maps[drsel] = NULL;
+    }
+    if (caches[drsel] != NULL) {
+        caches[drsel]->flush ();
+        caches[drsel]->setfd (-1);
+    }
+    if (ovlys[drsel] != NULL) {
+        ovlys[drsel]->sync ();
+        delete ovlys[drsel];
+        ovlys[drsel] = NULL;
+    }
     fns[drsel][0] = 0;
     close (fds[drsel]);
     fds[drsel] = -1;
@@ -403,6 +657,27 @@ static void unloadfileata (int drsel, uint16_t ata)
     ZWR(rhat[5], RH5_ATAS0 << drsel);
 }
 
+// write all cached data and modified mapped pages to the files
+//  returns < 0: errno from some failed write
+//          else: successful
+static int syncfiles (void *param)
+{
+    int rc = 0;
+    for (int drsel = 0; drsel < 8; drsel ++) {
+        if (caches[drsel] != NULL) {
+            int rcc = caches[drsel]->flush ();
+            if (rcc < 0) rc = rcc;
+        }
+    }
+    LOCKIT;
+    for (int drsel = 0; drsel < 8; drsel ++) {
+        flushmap (drsel);
+        if ((caches[drsel] == NULL) && (ovlys[drsel] != NULL) && (ovlys[drsel]->sync () < 0)) rc = - errno;
+    }
+    UNLKIT;
+    return rc;
+}
+
 // update mols,wrls,dts bits for all drives
 static void upddrivestats (uint32_t rh1)
 {
@@ -24,6 +24,14 @@
 
 //  ./z11rl [-reset]
 
+//  envar z11rl_mmap=<seconds> maps image files into memory instead of reading and writing them
+//  ...writing modified pages is started every <seconds>, waited for when synced or unloaded
+//  envar z11rl_wbcache=<kilobytes> caches up to that much written data per drive
+//  ...pdp sees writes complete when cached, a flusher thread writes them to the file
+//  ...unloading or z11ctrl sync command waits for them to be written
+
+//  image files created with z11ctrl 'rlload -overlay <base>' are copy-on-write overlays of <base>
+
 // page references rl01/rl02 user guide sep 81
 
 #include <errno.h>
@@ -33,12 +41,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <unistd.h>
 
+#include "asyncio.h"
+#include "diskcache.h"
+#include "diskovly.h"
 #include "futex.h"
 #include "shmms.h"
+#include "shmstats.h"
 #include "z11defs.h"
 #include "z11util.h"
 
@@ -66,25 +79,41 @@
 
 #define RFLD(n,m) ((ZRD(rlat[n]) & m) / (m & - m))
 
+static bool mapdirty[4];
+static bool mapasync[4];                // MS_ASYNC done since last MS_SYNC
+static DiskCache *caches[4];
+static DiskOverlay *ovlys[4];
 static char fns[4][SHMMS_FNSIZE];
 static int debug;
 static int fds[4];
+static int mmapsecs;
+static uint16_t *maps[4];
+static uint32_t mapsizes[4];
 static uint64_t seekdoneats[4];
 
 #define LOCKIT shmms_svr_mutexlock(shmms)
 #define UNLKIT shmms_svr_mutexunlk(shmms)
 
+static AsyncIO *aio;
 static ShmMS *shmms;
 static uint32_t volatile *rlat;
 static Z11Page *z11p;
 
 static void *rliothread (void *dummy);
+static void *flushthread (void *dummy);
+static void flushmap (int drivesel, bool wait = true);
 static uint64_t getnowus ();
+static int readimage (int drivesel, void *buf, uint32_t size, uint64_t off);
+static int writeimage (int drivesel, void const *buf, uint32_t size, uint64_t off);
+static void startimage (int drivesel, AIOReq *req, void *buf, uint32_t size, uint64_t off, bool write);
+static int aioimage (AIOReq *req);
+static bool waitwrite (int drivesel, AIOReq *req);
 static int setdrivetype (void *param, int drivesel);
 static int fileloaded (void *param, int drivesel, int fd);
 static int writebadblocks (ShmMSDrive *dr, int fd);
 static void *timerthread (void *dsptr);
 static void unloadfile (void *param, int drivesel);
+static int syncfiles (void *param);
 static uint16_t headercrc (uint16_t accum, uint16_t dword);
 static void dumpbuf (uint16_t drivesel, uint16_t const *buf, uint32_t off, uint32_t xba, char const *func);
 
@@ -97,14 +126,17 @@ int main (int argc, char **argv)
     // access fpga register set for the RL-11 controller
     // lock it so we are only process accessing it
     z11p = new Z11Page ();
+    z11p->bigmemdma (true);
     rlat = z11p->findev ("RL", NULL, NULL, true, false);
 
     // initialize shared memory - contains filenames and load/unload info
-    shmms = shmms_svr_initialize (resetit, SHMMS_NAME_RL, "z11rl");
+    bool resume;
+    shmms = shmms_svr_initialize (resetit, SHMMS_NAME_RL, "z11rl", &resume);
     shmms->ndrives = 4;
 
     // ...and no drives are ready or faulted
-    ZWR(rlat[4], 0);
+    // ...unless restoring a checkpoint, the restored fpga has the drive status as it was
+    if (! resume) ZWR(rlat[4], 0);
     UNLKIT;
 
     // enable board to process io instructions
@@ -114,15 +146,34 @@ int main (int argc, char **argv)
     char const *dbgenv = getenv ("z11rl_debug");
     if (dbgenv != NULL) debug = atoi (dbgenv);
 
+    mmapsecs = 0;
+    char const *mmapenv = getenv ("z11rl_mmap");
+    if (mmapenv != NULL) mmapsecs = atoi (mmapenv);
+
+    char const *wbcenv = getenv ("z11rl_wbcache");
+    int wbckb = (wbcenv == NULL) ? 0 : atoi (wbcenv);
+    if (wbckb > 0) {
+        for (int drivesel = 0; drivesel < 4; drivesel ++) {
+            caches[drivesel] = new DiskCache ("z11rl", drivesel, WRDPERSEC * 2, wbckb * 1024);
+        }
+    }
+
+    shmstats_init (SHMSTATS_RL);
+    aio = new AsyncIO ("z11rl");
+
     pthread_t rltid;
     int rc = pthread_create (&rltid, NULL, rliothread, NULL);
     if (rc != 0) ABORT ();
+    if (mmapsecs > 0) {
+        rc = pthread_create (&rltid, NULL, flushthread, NULL);
+        if (rc != 0) ABORT ();
+    }
     for (int i = 0; i < 4; i ++) {
         rc = pthread_create (&rltid, NULL, timerthread, (void *)(long)i);
         if (rc != 0) ABORT ();
     }
 
-    shmms_svr_proccmds (shmms, "z11rl", setdrivetype, fileloaded, unloadfile, NULL);
+    shmms_svr_proccmds (shmms, "z11rl", setdrivetype, fileloaded, unloadfile, NULL, syncfiles);
 
     return 0;
 }
@@ -134,6 +185,8 @@ int main (int argc, char **argv)
 // do the disk file I/O
 static void *rliothread (void *dummy)
 {
+    z11p->setdmaprio (DMAPRI_DISK);
+
     if (debug > 1) fprintf (stderr, "z11rl: thread started\n");
 
     int logrlfd = (debug < 0) ? open ("/tmp/logrl.bin", O_WRONLY | O_CREAT, 0666) : -1;
@@ -142,6 +195,7 @@ static void *rliothread (void *dummy)
 
         // wait for pdp to clear rlcs[07]
         z11p->waitint (ZGINT_RL);
+        uint64_t startns = shmstats_nowns ();
 
         // block disk from being unloaded from under us
         LOCKIT;
@@ -157,6 +211,7 @@ static void *rliothread (void *dummy)
             if (debug > 0) fprintf (stderr, "z11rl: start RLCS=%06o RLBA=%06o RLDA=%06o RLMP=%06o\n", rlcs, rlba, rlda, rlmp);
 
             uint32_t rlxba = ((rlcs & 0x30) << 12) + rlba;
+            uint16_t rlmpstart = rlmp;
 
             rlcs &= 0xC3FFU;                                            // clear error bits<13:10> in RLCS
                                                                         // rl11.v should have cleared them but do it here too
@@ -205,33 +260,33 @@ static void *rliothread (void *dummy)
 
                         uint16_t buf[WRDPERSEC];
                         uint32_t off = (((uint32_t) cyl * TRKPERCYL + trk) * SECPERTRK + sec) * sizeof buf;
-                        int rc = pread (fd, buf, sizeof buf, off);
-                        if (rc < 0) {
-                            fprintf (stderr, "z11rl: [%u] error reading at %u: %m\n", drivesel, off);
-                            goto opierr;
-                        }
-                        if (rc < (int) sizeof buf) {
-                            fprintf (stderr, "z11rl: [%u] only read %d of %d bytes at %u\n", drivesel, rc, (int) sizeof buf, off);
-                            goto opierr;
+                        uint16_t const *sbuf = buf;
+                        if (maps[drivesel] != NULL) sbuf = maps[drivesel] + off / 2;
+                        else {
+                            int rc = readimage (drivesel, buf, sizeof buf, off);
+                            if (rc < 0) {
+                                fprintf (stderr, "z11rl: [%u] error reading at %u: %m\n", drivesel, off);
+                                goto opierr;
+                            }
+                            if (rc < (int) sizeof buf) {
+                                fprintf (stderr, "z11rl: [%u] only read %d of %d bytes at %u\n", drivesel, rc, (int) sizeof buf, off);
+                                goto opierr;
+                            }
                         }
                         rlda ++;
 
-                        z11p->dmalock ();
-                        uint32_t rd = 0;
-                        int i;
-                        for (i = 0; i < WRDPERSEC; i ++) {
-                            uint16_t memword;
-                            rd = z11p->dmareadlocked (rlxba, &memword);
-                            if (rd != 0) break;
-                            if (memword != buf[i]) break;
+                        uint16_t memwords[WRDPERSEC];
+                        uint32_t nwds = 65536 - rlmp;
+                        if (nwds > WRDPERSEC) nwds = WRDPERSEC;
+                        uint32_t rd = z11p->dmareadblock (rlxba, nwds, memwords);
+                        for (uint32_t i = 0; i < nwds; i ++) {
+                            if (memwords[i] != sbuf[i]) goto wckerr;
                             rlxba = (rlxba + 2) & 0x3FFFE;
-                            if (++ rlmp == 0) break;
+                            rlmp ++;
                         }
-                        z11p->dmaunlk ();
                         if (rd & KY3_DMATIMO) goto nxmerr;
                         if (rd & KY3_DMAPERR) goto mperr;
                         if (rd != 0) ABORT ();
-                        if ((i < WRDPERSEC) && (rlmp != 0)) goto wckerr;
                     } while (rlmp != 0);
                     break;
                 }
@@ -295,59 +350,71 @@ static void *rliothread (void *dummy)
                     uint16_t trk = (rlda >> 6) & 1;
                     uint16_t cyl =  rlda >> 7;
 
+                    // double buffered so next sector can be dma'd whilst writing current one
+                    AIOReq reqs[2];
+                    uint16_t bufs[2][WRDPERSEC];
+                    AIOReq *writing = NULL;
+                    int cur = 0;
+
                     do {
                         uint16_t sec = rlda & 63;
                         if (sec >= SECPERTRK) {
                             if (debug > 0) fprintf (stderr, "z11rl: [%u]       sec=%02o\n", drivesel, sec);
+                            if (! waitwrite (drivesel, writing)) goto opierr;
                             goto hnferr;
                         }
 
-                        z11p->dmalock ();
+                        // dma directly into image file if it is mapped
                         uint32_t xbasave = rlxba;
-                        uint16_t buf[WRDPERSEC];
-                        uint32_t rd = 0;
-                        for (int i = 0; i < WRDPERSEC; i ++) {
-                            rd = z11p->dmareadlocked (rlxba, &buf[i]);
-                            if (rd != 0) break;
-                            rlxba = (rlxba + 2) & 0x3FFFE;
-                            if (++ rlmp == 0) {
-                                memset (&buf[i+1], 0, (WRDPERSEC - i - 1) * sizeof buf[0]);
-                                break;
-                            }
+                        uint16_t *buf = bufs[cur];
+                        uint32_t off = (((uint32_t) cyl * TRKPERCYL + trk) * SECPERTRK + sec) * sizeof bufs[cur];
+                        uint16_t *sbuf = buf;
+                        if (maps[drivesel] != NULL) {
+                            if (dr->readonly) goto opierr;
+                            sbuf = maps[drivesel] + off / 2;
+                            mapdirty[drivesel] = true;
                         }
-                        z11p->dmaunlk ();
+
+                        uint32_t nwds = 65536 - rlmp;
+                        if (nwds > WRDPERSEC) nwds = WRDPERSEC;
+                        uint32_t rd = z11p->dmareadblock (rlxba, nwds, sbuf);
+                        rlxba = (rlxba + nwds * 2) & 0x3FFFE;
+                        rlmp += nwds;
+
+                        // previous sector should be written by now
+                        bool wok = waitwrite (drivesel, writing);
+                        writing = NULL;
                         if (rd & KY3_DMATIMO) goto nxmerr;
                         if (rd & KY3_DMAPERR) goto mperr;
                         if (rd != 0) ABORT ();
+                        if (! wok) goto opierr;
+                        memset (&sbuf[nwds], 0, (WRDPERSEC - nwds) * sizeof sbuf[0]);
 
-                        uint32_t off = (((uint32_t) cyl * TRKPERCYL + trk) * SECPERTRK + sec) * sizeof buf;
-                        int rc = pwrite (fd, buf, sizeof buf, off);
-                        if (rc < 0) {
-                            fprintf (stderr, "z11rl: [%u] error writing at %u: %m\n", drivesel, off);
-                            goto opierr;
+                        // start writing this sector, finish it when next sector is dma'd
+                        if (sbuf == buf) {
+                            writing = &reqs[cur];
+                            startimage (drivesel, writing, buf, sizeof bufs[cur], off, true);
                         }
-                        if (rc < (int) sizeof buf) {
-                            fprintf (stderr, "z11rl: [%u] only wrote %d of %d bytes at %u\n", drivesel, rc, (int) sizeof buf, off);
-                            goto opierr;
-                        }
-                        if (debug > 2) dumpbuf (drivesel, buf, off, xbasave, "write");
+                        if (debug > 2) dumpbuf (drivesel, sbuf, off, xbasave, "write");
 
                         if (logrlfd >= 0) {
                             uint16_t hdr[] = { (uint16_t) (('W' << 8) + '0' + drivesel), rlda, (uint16_t) off, (uint16_t) (off >> 16) };
-                            rc = write (logrlfd, hdr, sizeof hdr);
+                            int rc = write (logrlfd, hdr, sizeof hdr);
                             if (rc < (int) sizeof hdr) {
                                 fprintf (stderr, "z11rl: [%u] only wrote %d of %d bytes to logrl\n", drivesel, rc, (int) sizeof hdr);
                                 ABORT ();
                             }
-                            rc = write (logrlfd, buf, sizeof buf);
-                            if (rc < (int) sizeof buf) {
-                                fprintf (stderr, "z11rl: [%u] only wrote %d of %d bytes to logrl\n", drivesel, rc, (int) sizeof buf);
+                            rc = write (logrlfd, sbuf, sizeof bufs[cur]);
+                            if (rc < (int) sizeof bufs[cur]) {
+                                fprintf (stderr, "z11rl: [%u] only wrote %d of %d bytes to logrl\n", drivesel, rc, (int) sizeof bufs[cur]);
                                 ABORT ();
                             }
                         }
 
                         rlda ++;
+                        cur ^= 1;
                     } while (rlmp != 0);
+                    if (! waitwrite (drivesel, writing)) goto opierr;
                     break;
                 }
 
@@ -384,6 +451,12 @@ static void *rliothread (void *dummy)
                     uint16_t trk = (rdda >> 6) & 1;
                     uint16_t cyl =  rdda >> 7;
 
+                    // double buffered so next sector can be read whilst dma'ing current one
+                    AIOReq reqs[2];
+                    uint16_t bufs[2][WRDPERSEC];
+                    bool readahead = false;
+                    int cur = 0;
+
                     do {
                         uint16_t sec = rdda & 63;
                         if (sec >= SECPERTRK) {
@@ -391,29 +464,35 @@ static void *rliothread (void *dummy)
                             goto hnferr;
                         }
 
-                        uint16_t buf[WRDPERSEC];
-                        uint32_t off = (((uint32_t) cyl * TRKPERCYL + trk) * SECPERTRK + sec) * sizeof buf;
-                        int rc = pread (fd, buf, sizeof buf, off);
-                        if (rc < 0) {
-                            fprintf (stderr, "z11rl: [%u] error reading at %u: %m\n", drivesel, off);
-                            goto opierr;
-                        }
-                        if (rc < (int) sizeof buf) {
-                            fprintf (stderr, "z11rl: [%u] only read %d of %d bytes at %u\n", drivesel, rc, (int) sizeof buf, off);
-                            goto opierr;
+                        // dma directly from image file if it is mapped
+                        uint16_t *buf = bufs[cur];
+                        uint32_t off = (((uint32_t) cyl * TRKPERCYL + trk) * SECPERTRK + sec) * sizeof bufs[cur];
+                        uint16_t const *sbuf = buf;
+                        if (maps[drivesel] != NULL) sbuf = maps[drivesel] + off / 2;
+                        else {
+                            if (! readahead) startimage (drivesel, &reqs[cur], buf, sizeof bufs[cur], off, false);
+                            int rc = aio->wait (&reqs[cur]);
+                            if (rc < 0) {
+                                fprintf (stderr, "z11rl: [%u] error reading at %u: %m\n", drivesel, off);
+                                goto opierr;
+                            }
+                            if (rc < (int) sizeof bufs[cur]) {
+                                fprintf (stderr, "z11rl: [%u] only read %d of %d bytes at %u\n", drivesel, rc, (int) sizeof bufs[cur], off);
+                                goto opierr;
+                            }
                         }
-                        if (debug > 2) dumpbuf (drivesel, buf, off, rlxba, "read");
+                        if (debug > 2) dumpbuf (drivesel, sbuf, off, rlxba, "read");
 
                         if (logrlfd >= 0) {
                             uint16_t hdr[] = { (uint16_t) (('R' << 8) + '0' + drivesel), rdda, (uint16_t) off, (uint16_t) (off >> 16) };
-                            rc = write (logrlfd, hdr, sizeof hdr);
+                            int rc = write (logrlfd, hdr, sizeof hdr);
                             if (rc < (int) sizeof hdr) {
                                 fprintf (stderr, "z11rl: [%u] only wrote %d of %d bytes to logrl\n", drivesel, rc, (int) sizeof hdr);
                                 ABORT ();
                             }
-                            rc = write (logrlfd, buf, sizeof buf);
-                            if (rc < (int) sizeof buf) {
-                                fprintf (stderr, "z11rl: [%u] only wrote %d of %d bytes to logrl\n", drivesel, rc, (int) sizeof buf);
+                            rc = write (logrlfd, sbuf, sizeof bufs[cur]);
+                            if (rc < (int) sizeof bufs[cur]) {
+                                fprintf (stderr, "z11rl: [%u] only wrote %d of %d bytes to logrl\n", drivesel, rc, (int) sizeof bufs[cur]);
                                 ABORT ();
                             }
                         }
@@ -421,16 +500,21 @@ static void *rliothread (void *dummy)
                         rdda ++;
                         rlda ++;
 
-                        z11p->dmalock ();
-                        bool ok = true;
-                        for (int i = 0; i < WRDPERSEC; i ++) {
-                            ok = z11p->dmawritelocked (rlxba, buf[i]);
-                            if (! ok) break;
-                            rlxba = (rlxba + 2) & 0x3FFFE;
-                            if (++ rlmp == 0) break;
+                        uint32_t nwds = 65536 - rlmp;
+                        if (nwds > WRDPERSEC) nwds = WRDPERSEC;
+
+                        // start reading next sector into other buffer
+                        readahead = (maps[drivesel] == NULL) && ((uint16_t) (rlmp + nwds) != 0) && ((rdda & 63) < SECPERTRK);
+                        if (readahead) startimage (drivesel, &reqs[cur^1], bufs[cur^1], sizeof bufs[cur^1], off + sizeof bufs[cur], false);
+
+                        uint32_t rd = z11p->dmawriteblock (rlxba, nwds, sbuf);
+                        rlxba = (rlxba + nwds * 2) & 0x3FFFE;
+                        rlmp += nwds;
+                        if (rd != 0) {
+                            if (readahead) aio->wait (&reqs[cur^1]);
+                            goto nxmerr;
                         }
-                        z11p->dmaunlk ();
-                        if (! ok) goto nxmerr;
+                        cur ^= 1;
                     } while (rlmp != 0);
                     break;
                 }
@@ -452,6 +536,10 @@ static void *rliothread (void *dummy)
         mperr:;
             rlcs |= 9U << 10;                       // memory parity error
         alldone:;
+            switch ((rlcs >> 1) & 7) {
+                case 5: shmstats_bytes (0, (uint16_t) (rlmp - rlmpstart) * 2); break;
+                case 6: case 7: shmstats_bytes ((uint16_t) (rlmp - rlmpstart) * 2, 0); break;
+            }
             rlmp3 = rlmp2 = rlmp;
         rhddone:;
 
@@ -469,11 +557,105 @@ static void *rliothread (void *dummy)
             ZWR(rlat[1], ((uint32_t) rlxba << 16) | rlcs);
             if (debug > 0) fprintf (stderr, "z11rl: [%u]  done RLCS=%06o RLxBA=%06o RLDA=%06o RLMP=%06o %06o %06o\n",
                     drivesel, rlcs, rlxba, rlda, rlmp, rlmp2, rlmp3);
+            shmstats_since (SHMSTATS_CMDNS, startns);
         }
         UNLKIT;
     }
 }
 
+// periodically write modified mapped image pages to the files
+static void *flushthread (void *dummy)
+{
+    while (true) {
+        sleep (mmapsecs);
+        LOCKIT;
+        for (int drivesel = 0; drivesel < 4; drivesel ++) flushmap (drivesel, false);
+        UNLKIT;
+    }
+}
+
+// write modified pages of a mapped image to its file
+// - call with shmms locked
+//  input:
+//   wait = false: just start writing them (periodic flush, doesn't hold lock for long)
+//           true: wait for them to be written (sync and unload)
+static void flushmap (int drivesel, bool wait)
+{
+    if (mapdirty[drivesel] || (wait && mapasync[drivesel])) {
+        if (msync (maps[drivesel], mapsizes[drivesel], wait ? MS_SYNC : MS_ASYNC) < 0) {
+            fprintf (stderr, "z11rl: [%d] error flushing %s: %m\n", drivesel, fns[drivesel]);
+        }
+        mapdirty[drivesel] = false;
+        mapasync[drivesel] = ! wait;
+    }
+}
+
+// read from image file, through write-back cache and overlay if any
+//  returns same as pread()
+static int readimage (int drivesel, void *buf, uint32_t size, uint64_t off)
+{
+    if (caches[drivesel] != NULL) return caches[drivesel]->pread (buf, size, off);
+    if (ovlys[drivesel] != NULL) return ovlys[drivesel]->pread (buf, size, off);
+    return pread (fds[drivesel], buf, size, off);
+}
+
+// write to image file, through write-back cache and overlay if any
+//  returns same as pwrite()
+static int writeimage (int drivesel, void const *buf, uint32_t size, uint64_t off)
+{
+    // cache would accept the write then lose it when flushing to the read-only file
+    if (shmms->drives[drivesel].readonly) {
+        errno = EBADF;
+        return -1;
+    }
+    if (caches[drivesel] != NULL) return caches[drivesel]->pwrite (buf, size, off);
+    if (ovlys[drivesel] != NULL) return ovlys[drivesel]->pwrite (buf, size, off);
+    return pwrite (fds[drivesel], buf, size, off);
+}
+
+// start reading or writing image file in background
+static void startimage (int drivesel, AIOReq *req, void *buf, uint32_t size, uint64_t off, bool write)
+{
+    req->fd    = fds[drivesel];
+    req->write = write;
+    req->buf   = buf;
+    req->size  = size;
+    req->off   = off;
+    req->func  = ((caches[drivesel] != NULL) || (ovlys[drivesel] != NULL)) ? aioimage : NULL;
+    req->param = (void *) (long) drivesel;
+    aio->submit (req);
+}
+
+// background i/o through write-back cache or overlay
+static int aioimage (AIOReq *req)
+{
+    int drivesel = (long) req->param;
+    return req->write ?
+        writeimage (drivesel, req->buf, req->size, req->off) :
+        readimage (drivesel, req->buf, req->size, req->off);
+}
+
+// wait for background write of a sector to complete
+//  input:
+//   req = write request (or NULL if none)
+//  output:
+//   returns true: write successful
+//          false: write failed
+static bool waitwrite (int drivesel, AIOReq *req)
+{
+    if (req == NULL) return true;
+    int rc = aio->wait (req);
+    if (rc < 0) {
+        fprintf (stderr, "z11rl: [%u] error writing at %llu: %m\n", drivesel, (unsigned long long) req->off);
+        return false;
+    }
+    if (rc < (int) req->size) {
+        fprintf (stderr, "z11rl: [%u] only wrote %d of %u bytes at %llu\n", drivesel, rc, req->size, (unsigned long long) req->off);
+        return false;
+    }
+    return true;
+}
+
 // get current microsecond time
 static uint64_t getnowus ()
 {
@@ -545,7 +727,18 @@ static int setdrivetype (void *param, int drivesel)
 static int fileloaded (void *param, int drivesel, int fd)
 {
     ShmMSDrive *dr = &shmms->drives[drivesel];
-    if (! dr->readonly) {
+
+    // overlay files get extended to full size but are otherwise left as is
+    int rc = DiskOverlay::attach ("z11rl", fd, dr->readonly, &ovlys[drivesel]);
+    if (rc < 0) return rc;
+    if (ovlys[drivesel] != NULL) {
+        rc = ovlys[drivesel]->setsize (NSECS * WRDPERSEC * 2);
+        if (rc < 0) {
+            delete ovlys[drivesel];
+            ovlys[drivesel] = NULL;
+            return rc;
+        }
+    } else if (! dr->readonly) {
         struct stat statbuf;
         if (fstat (fd, &statbuf) < 0) return -1;
         if (ftruncate (fd, NSECS * WRDPERSEC * 2) < 0) return -1;
@@ -554,6 +747,25 @@ static int fileloaded (void *param, int drivesel, int fd)
         }
     }
     fds[drivesel] = fd;
+    if (caches[drivesel] != NULL) caches[drivesel]->setfd (fd, ovlys[drivesel]);
+
+    // maybe map whole image into memory
+    // ...leave it unmapped if file is short (read-only files don't get extended)
+    if ((mmapsecs > 0) && (ovlys[drivesel] == NULL)) {
+        struct stat statbuf;
+        uint32_t size = NSECS * WRDPERSEC * 2;
+        if ((fstat (fd, &statbuf) >= 0) && S_ISREG (statbuf.st_mode) && (statbuf.st_size >= size)) {
+            void *ptr = mmap (NULL, size, PROT_READ | (dr->readonly ? 0 : PROT_WRITE), MAP_SHARED, fd, 0);
+            if (ptr == MAP_FAILED) {
+                fprintf (stderr, "z11rl: [%d] error mapping %s: %m\n", drivesel, dr->filename);
+            } else {
+                maps[drivesel]     = (uint16_t *) ptr;
+                mapsizes[drivesel] = size;
+                mapdirty[drivesel] = false;
+                mapasync[drivesel] = false;
+            }
+        }
+    }
 
     uint32_t rl4 = ZRD(rlat[4]);
     rl4 |=    RL4_DRDY0  << drivesel;                   // ready to accept a command
@@ -562,6 +774,7 @@ static int fileloaded (void *param, int drivesel, int fd)
     if (dr->rl01) rl4 &= ~ (RL4_DTYPE0 << drivesel);    // drive is RL01
              else rl4 |=    RL4_DTYPE0 << drivesel;     // drive is RL02
 
+    if (dr->resume) strcpy (fns[drivesel], dr->filename);  // checkpoint restore, same volume
     if (strcmp (fns[drivesel], dr->filename) != 0) {
         strcpy (fns[drivesel], dr->filename);
         rl4 |= RL4_VOLCK0 << drivesel;                  // volume check
@@ -614,12 +827,47 @@ static int writebadblocks (ShmMSDrive *dr, int fd)
 // mark drive offline
 static void unloadfile (void *param, int drivesel)
 {
+    if (maps[drivesel] != NULL) {
+        flushmap (drivesel);
+        munmap (maps[drivesel], mapsizes[drivesel]);
+        maps[drivesel] = NULL;
+    }
+    if (caches[drivesel] != NULL) {
+        caches[drivesel]->flush ();
+        caches[drivesel]->setfd (-1);
+    }
+    if (ovlys[drivesel] != NULL) {
+        ovlys[drivesel]->sync ();
+        delete ovlys[drivesel];
+        ovlys[drivesel] = NULL;
+    }
     fns[drivesel][0] = 0;
     ZWR(rlat[4], ZRD(rlat[4]) & ~ ((RL4_DRDY0 | RL4_DRONL0) << drivesel));
     close (fds[drivesel]);
     fds[drivesel] = -1;
 }
 
+// write all cached data and modified mapped pages to the files
+//  returns < 0: errno from some failed write
+//          else: successful
+static int syncfiles (void *param)
+{
+    int rc = 0;
+    for (int drivesel = 0; drivesel < 4; drivesel ++) {
+        if (caches[drivesel] != NULL) {
+            int rcc = caches[drivesel]->flush ();
+            if (rcc < 0) rc = rcc;
+        }
+    }
+    LOCKIT;
+    for (int drivesel = 0; drivesel < 4; drivesel ++) {
+        flushmap (drivesel);
+        if ((caches[drivesel] == NULL) && (ovlys[drivesel] != NULL) && (ovlys[drivesel]->sync () < 0)) rc = - errno;
+    }
+    UNLKIT;
+    return rc;
+}
+
 // accumulate header crc word
 // - adapted from ZRLGC0 SIMBCC
 static uint16_t headercrc (uint16_t accum, uint16_t dword)
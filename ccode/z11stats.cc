@@ -0,0 +1,96 @@
+//    Copyright (C) Mike Rieker, Beverly, MA USA
+//    www.outerworldapps.com
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; version 2 of the License.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    EXPECT it to FAIL when someone's HeALTh or PROpeRTy is at RISk.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    http://www.gnu.org/licenses/gpl-2.0.html
+
+// Print timing statistics published by the device daemons
+// Only reads shared memory so does not disturb the daemons
+
+//  ./z11stats [-reset] [-repeat <seconds>] [<device>...]
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "shmstats.h"
+#include "strprintf.h"
+
+int main (int argc, char **argv)
+{
+    bool devs[SHMSTATS_NDEVS];
+    bool gotdev = false;
+    bool reset = false;
+    int repeat = 0;
+    memset (devs, 0, sizeof devs);
+    for (int i = 0; ++ i < argc;) {
+        if (strcmp (argv[i], "-?") == 0) {
+            puts ("");
+            puts ("     Print device daemon timing statistics");
+            puts ("");
+            puts ("  ./z11stats [-repeat <seconds>] [-reset] [<device>...]");
+            puts ("     -repeat : print every <seconds> until control-C");
+            puts ("      -reset : zero the statistics after printing them");
+            puts ("    <device> : dl, dz, pc, rh, rl, tm, xe (default all that have run)");
+            puts ("");
+            puts ("     command  : pdp starting command to completion");
+            puts ("     dma/word : dma block transfer time per word");
+            puts ("     file i/o : image file or network i/o");
+            puts ("     dma lock : waiting for access to dma controller");
+            puts ("");
+            return 0;
+        }
+        if (strcasecmp (argv[i], "-repeat") == 0) {
+            if ((++ i >= argc) || ((repeat = atoi (argv[i])) <= 0)) {
+                fprintf (stderr, "missing or bad <seconds> for -repeat option\n");
+                return 1;
+            }
+            continue;
+        }
+        if (strcasecmp (argv[i], "-reset") == 0) {
+            reset = true;
+            continue;
+        }
+        int devidx = shmstats_lookup (argv[i]);
+        if (devidx < 0) {
+            fprintf (stderr, "unknown device %s\n", argv[i]);
+            return 1;
+        }
+        devs[devidx] = true;
+        gotdev = true;
+    }
+
+    ShmStats *shmstats = shmstats_map ();
+    while (true) {
+        std::string str;
+        for (int devidx = 0; devidx < SHMSTATS_NDEVS; devidx ++) {
+            if (gotdev ? devs[devidx] : (shmstats->devs[devidx].pid != 0)) {
+                shmstats_format (&str, devidx);
+                if (reset) shmstats_reset (devidx);
+            }
+        }
+        fputs (str.c_str (), stdout);
+        if (repeat == 0) break;
+        putchar ('\n');
+        fflush (stdout);
+        sleep (repeat);
+    }
+    return 0;
+}
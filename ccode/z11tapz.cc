@@ -0,0 +1,191 @@
+//    Copyright (C) Mike Rieker, Beverly, MA USA
+//    www.outerworldapps.com
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; version 2 of the License.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    EXPECT it to FAIL when someone's HeALTh or PROpeRTy is at RISk.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    http://www.gnu.org/licenses/gpl-2.0.html
+
+//  Compress, expand or compact TAP-format tape files
+
+//    ./z11tapz [-level <n>] <input.tap> <output.tap>
+//    ./z11tapz -expand <input.tap> <output.tap>
+//    ./z11tapz -compact <tape.tap>
+
+//  input can be plain or compressed, compressed ones include any write journal (<input.tap>.jnl)
+//  -compact folds the journal of a compressed tape back into the compressed file
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "tapezip.h"
+
+static int infd;
+static TapeZip *intz;
+
+static int readinput (void *param, void *buf, uint32_t size, uint64_t off);
+
+int main (int argc, char **argv)
+{
+    bool compact = false;
+    bool expand  = false;
+    char const *inname  = NULL;
+    char const *outname = NULL;
+    int level = Z_DEFAULT_COMPRESSION;
+    for (int i = 0; ++ i < argc;) {
+        if (strcmp (argv[i], "-?") == 0) {
+            puts ("");
+            puts ("     Compress, expand or compact TAP-format tape files");
+            puts ("");
+            puts ("  ./z11tapz [-level <n>] <input.tap> <output.tap>");
+            puts ("     compress plain or compressed input to compressed output");
+            puts ("");
+            puts ("  ./z11tapz -expand <input.tap> <output.tap>");
+            puts ("     expand plain or compressed input to plain output");
+            puts ("");
+            puts ("  ./z11tapz -compact <tape.tap>");
+            puts ("     fold the write journal <tape.tap>.jnl back into compressed <tape.tap>");
+            puts ("");
+            puts ("  compressed input includes any changes in its write journal");
+            puts ("  tape must not be loaded in a drive");
+            puts ("");
+            return 0;
+        }
+        if (strcasecmp (argv[i], "-compact") == 0) {
+            compact = true;
+            continue;
+        }
+        if (strcasecmp (argv[i], "-expand") == 0) {
+            expand = true;
+            continue;
+        }
+        if (strcasecmp (argv[i], "-level") == 0) {
+            if ((++ i >= argc) || ((level = atoi (argv[i])) < 1) || (level > 9)) {
+                fprintf (stderr, "missing or bad <n> for -level option, must be 1..9\n");
+                return 1;
+            }
+            continue;
+        }
+        if (argv[i][0] == '-') {
+            fprintf (stderr, "unknown option %s\n", argv[i]);
+            return 1;
+        }
+        if (inname == NULL) {
+            inname = argv[i];
+            continue;
+        }
+        if (outname == NULL) {
+            outname = argv[i];
+            continue;
+        }
+        fprintf (stderr, "unknown argument %s\n", argv[i]);
+        return 1;
+    }
+    if ((inname == NULL) || ((outname == NULL) != compact) || (compact && expand)) {
+        fprintf (stderr, "bad arguments, use -? for help\n");
+        return 1;
+    }
+
+    // open input and lock it so it can't be loaded in a drive meanwhile
+    infd = open (inname, O_RDONLY);
+    if (infd < 0) {
+        fprintf (stderr, "error opening %s: %m\n", inname);
+        return 1;
+    }
+    struct flock flockit;
+    memset (&flockit, 0, sizeof flockit);
+    flockit.l_type   = F_RDLCK;
+    flockit.l_whence = SEEK_SET;
+    flockit.l_len    = 4096;
+    if (fcntl (infd, F_OFD_SETLK, &flockit) < 0) {
+        fprintf (stderr, "error locking %s: %m\n", inname);
+        return 1;
+    }
+    if (TapeZip::attach ("z11tapz", inname, infd, true, &intz) < 0) return 1;
+    if (compact && (intz == NULL)) {
+        fprintf (stderr, "%s is not compressed\n", inname);
+        return 1;
+    }
+
+    // compacting writes a temp file then renames it over the original
+    char *tmpname = NULL;
+    if (compact) {
+        tmpname = (char *) malloc (strlen (inname) + 5);
+        if (tmpname == NULL) abort ();
+        sprintf (tmpname, "%s.tmp", inname);
+        outname = tmpname;
+    }
+    int outfd = open (outname, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (outfd < 0) {
+        fprintf (stderr, "error creating %s: %m\n", outname);
+        return 1;
+    }
+
+    int64_t nbytes = 0;
+    if (expand) {
+        uint8_t buf[TZ_BLKSIZE];
+        int rc;
+        while ((rc = readinput (NULL, buf, sizeof buf, nbytes)) > 0) {
+            if (pwrite (outfd, buf, rc, nbytes) != rc) {
+                fprintf (stderr, "error writing %s: %m\n", outname);
+                return 1;
+            }
+            nbytes += rc;
+        }
+        if (rc < 0) nbytes = - errno;
+    } else {
+        nbytes = TapeZip::compress (outfd, readinput, NULL, level);
+    }
+    if (nbytes < 0) {
+        fprintf (stderr, "error converting %s to %s: %s\n", inname, outname, strerror (- nbytes));
+        unlink (outname);
+        return 1;
+    }
+    if (fsync (outfd) < 0) {
+        fprintf (stderr, "error writing %s: %m\n", outname);
+        return 1;
+    }
+    off_t outsize = lseek (outfd, 0, SEEK_END);
+    close (outfd);
+
+    if (compact) {
+        if (rename (tmpname, inname) < 0) {
+            fprintf (stderr, "error renaming %s to %s: %m\n", tmpname, inname);
+            return 1;
+        }
+        char jnlname[strlen(inname)+5];
+        sprintf (jnlname, "%s.jnl", inname);
+        if ((unlink (jnlname) < 0) && (errno != ENOENT)) {
+            fprintf (stderr, "error deleting %s: %m\n", jnlname);
+            return 1;
+        }
+    }
+
+    printf ("%lld tape bytes, %lld file bytes\n", (long long) nbytes, (long long) outsize);
+    return 0;
+}
+
+// read plain tape contents from input file
+static int readinput (void *param, void *buf, uint32_t size, uint64_t off)
+{
+    return (intz != NULL) ? intz->pread (buf, size, off) : pread (infd, buf, size, off);
+}
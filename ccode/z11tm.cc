@@ -30,6 +30,7 @@
 #include <string.h>
 
 #include "shmms.h"
+#include "shmstats.h"
 #include "tapelib.h"
 #include "z11defs.h"
 #include "z11util.h"
@@ -68,11 +69,13 @@ int main (int argc, char **argv)
     // access fpga register set for the TM-11 controller
     // lock it so we are only process accessing it
     z11page = new Z11Page ();
+    z11page->bigmemdma (true);
     uint32_t volatile *tmat = z11page->findev ("TM", NULL, NULL, true, killit);
 
     // open shared memory, create if not there
     ShmMS *shmms = shmms_svr_initialize (resetit, SHMMS_NAME_TM, "z11tm");
     shmms_svr_mutexunlk (shmms);
+    shmstats_init (SHMSTATS_TM);
 
     // enable tm11.v to process io instructions from pdp
     ZWR(tmat[4], (ZRD(tmat[4]) & TM4_FAST) | TM4_ENAB);
@@ -111,6 +114,7 @@ void MSTapeCtrlr::iothread ()
         if (debug > 2) fprintf (stderr, "z11tm: waiting\n");
         z11page->waitint (ZGINT_TM);
         if (debug > 2) fprintf (stderr, "z11tm: woken\n");
+        uint64_t startns = shmstats_nowns ();
 
         // block tape from being unloaded from under us
         this->lockit ();
@@ -214,19 +218,17 @@ void MSTapeCtrlr::iothread ()
                 case 4: {
                     if (debug > 1) fprintf (stderr, "z11tm: [%u] space fwd beg rc=%u pos=%u\n", drivesel, 65536 - mtbrc, dr->curposn);
                     do {
-                        int rc = td->skipfwd ();
+                        int rc = td->skipfwd (mtbrc);
                         if (debug > 1) fprintf (stderr, "z11tm: [%u] space fwd end rc=%d pos=%u\n", drivesel, rc, dr->curposn);
                         switch (rc) {
                             case -1: goto crcerror;     // read error
-                            case  0: break;             // record skipped
+                            case  0: break;             // record(s) skipped
                             case  1: {
                                 mtcmts |= 0x4000;       // tape mark
-                                mtbrc ++;               // count includes tape mark
                                 goto done;
                             }
                             default: ABORT ();
                         }
-                        mtbrc ++;
                         ZWR(tmat[2], ((uint32_t) mtcma << 16) | mtbrc);
                     } while (mtbrc != 0);
                     break;
@@ -236,20 +238,18 @@ void MSTapeCtrlr::iothread ()
                 case 5: {
                     if (debug > 1) fprintf (stderr, "z11tm: [%u] space rev beg rc=%u pos=%u\n", drivesel, 65536 - mtbrc, dr->curposn);
                     do {
-                        int rc = td->skiprev ();
+                        int rc = td->skiprev (mtbrc);
                         if (debug > 1) fprintf (stderr, "z11tm: [%u] space rev end rc=%d pos=%u\n", drivesel, rc, dr->curposn);
                         switch (rc) {
                             case -1: goto crcerror;     // read error
-                            case  0: break;             // record skipped
+                            case  0: break;             // record(s) skipped
                             case  1: {
                                 mtcmts |= 0x4000;       // tape mark
-                                mtbrc ++;               // count includes tape mark
                                 goto done;
                             }
                             case  2: goto done;         // beginning of tape
                             default: ABORT ();
                         }
-                        mtbrc ++;
                         ZWR(tmat[2], ((uint32_t) mtcma << 16) | mtbrc);
                     } while (mtbrc != 0);
                     break;
@@ -291,6 +291,7 @@ void MSTapeCtrlr::iothread ()
             ZWR(tmat[2], ((uint32_t) mtcma << 16) | mtbrc);
 
             ZWR(tmat[1], mtcmts);
+            shmstats_since (SHMSTATS_CMDNS, startns);
         }
 
         this->unlkit ();
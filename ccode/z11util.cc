@@ -26,19 +26,48 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "futex.h"
+#include "shmstats.h"
 #include "z11defs.h"
+#include "z11inst.h"
 #include "z11util.h"
 
+#define KYSPINS 1000        // polls of a single dma cycle before sleeping
+#define KYBSPINS 20         // polls of a burst without progress before sleeping
+#define KYSPINWORDS 8       // bursts with no more than this many words left count as single
+#define KYSLEEPS 100        // sleeps of ZGWFITO_MS with no progress before giving up
+
+#define DMAARB_NAME "/shm_zturn11_dma"
+#define DMAARB_NSLOTS 32
+
+// shared by all processes doing dma
+// lists processes waiting for the ky11.v dma lock so it can be handed out by priority
+// kyat[5] is still what actually locks the dma circuit
+struct DMAArb {
+    int wakeseq;                // incremented whenever the lock is released
+    int nextticket;             // next ticket to hand out, first-come-first-served within priority
+    struct {
+        int pid;                // 0: free; <0: being filled in; >0: waiting process
+        int prio;               // DMAPRI_* priority
+        int ticket;             // ticket number
+    } slots[DMAARB_NSLOTS];
+};
+
 Z11Page *z11page;
 
 static __thread bool dmalocked;
+static __thread int dmaprio;
 static pthread_mutex_t dmamutex = PTHREAD_MUTEX_INITIALIZER;
 static uint32_t mypid;
+static DMAArb *dmaarb;
+
+static bool dmaarbahead (int slot, bool checkdead);
 
 Z11Page::Z11Page ()
 {
@@ -47,12 +76,17 @@ Z11Page::Z11Page ()
 
     kyat = NULL;
 
+    intarmfd  = -1;
+    intpollfd = -1;
+    intfdmask = 0;
+
 #if defined VERISIM
 
     zynqpage = verisim_init ();
-    zynqfd = open ("/tmp/zynqpdp11", O_RDWR | O_CREAT, 0666);
+    char const *lockname = z11instname ("/tmp/zynqpdp11");
+    zynqfd = open (lockname, O_RDWR | O_CREAT, 0666);
     if (zynqfd < 0) {       // need temp file so flock() will work
-        fprintf (stderr, "Z11Page::Z11Page: error creating /tmp/zynqpdp11: %m\n");
+        fprintf (stderr, "Z11Page::Z11Page: error creating %s: %m\n", lockname);
         ABORT ();
     }
 
@@ -82,19 +116,43 @@ Z11Page::Z11Page ()
     z11page = this;
 
     mypid = getpid ();
+
+    // open dma arbitration shared memory, create if not there
+    char const *arbname = z11instname (DMAARB_NAME);
+    int arbfd = shm_open (arbname, O_RDWR | O_CREAT, 0666);
+    if (arbfd < 0) {
+        fprintf (stderr, "Z11Page::Z11Page: error opening %s: %m\n", arbname);
+        ABORT ();
+    }
+    if (ftruncate (arbfd, sizeof *dmaarb) < 0) {
+        fprintf (stderr, "Z11Page::Z11Page: error extending %s: %m\n", arbname);
+        ABORT ();
+    }
+    dmaarb = (DMAArb *) mmap (NULL, sizeof *dmaarb, PROT_READ | PROT_WRITE, MAP_SHARED, arbfd, 0);
+    if (dmaarb == MAP_FAILED) {
+        fprintf (stderr, "Z11Page::Z11Page: error mmapping %s: %m\n", arbname);
+        ABORT ();
+    }
+    close (arbfd);
+
     pdpat = findev ("11", NULL, NULL, false);
+    bmat  = findev ("BM", NULL, NULL, false);
     kyat  = findev ("KY", NULL, NULL, false);
+    bmfast = false;
 }
 
 Z11Page::~Z11Page ()
 {
     if (zynqptr != NULL) munmap (zynqptr, 4096);
+    if (dmaarb != NULL) munmap (dmaarb, sizeof *dmaarb);
     close (zynqfd);
+    dmaarb   = NULL;
     z11page  = NULL;
     zynqpage = NULL;
     zynqptr  = NULL;
     zynqfd   = -1;
     pdpat    = NULL;
+    bmat     = NULL;
     kyat     = NULL;
 }
 
@@ -241,10 +299,40 @@ uint32_t Z11Page::dmareadlocked (uint32_t xba, uint16_t *data)
 {
     ASSERT (dmalocked);
     ASSERT (ZRD(kyat[5]) == mypid);
+    if (bmfast && bmowns (xba)) {
+#if defined VERISIM
+        VeriCmd cmds[3];
+        verisim_cmd (&cmds[0], VERISIM_CMD_WRITE, &bmat[3], BM3_ARMFUNC0 * 4 | BM3_ARMADDR0 * xba);
+        verisim_cmd (&cmds[1], VERISIM_CMD_POLLEQ, &bmat[3], 0, BM3_ARMFUNC, 100000);
+        verisim_cmd (&cmds[2], VERISIM_CMD_READ, &bmat[4]);
+        if (verisim_batch (cmds, 3) < 3) throw Z11DMAException ("Z11Page::dmaread: bigmem stuck");
+        uint32_t bm4 = cmds[2].data;
+#else
+        ZWR(bmat[3], BM3_ARMFUNC0 * 4 | BM3_ARMADDR0 * xba);
+        bmidle ("Z11Page::dmaread: bigmem stuck");
+        uint32_t bm4 = ZRD(bmat[4]);
+#endif
+        *data = (bm4 & BM4_ARMDATA) / BM4_ARMDATA0;
+        return (bm4 & BM4_ARMPERR) ? KY3_DMAPERR : 0;
+    }
+#if defined VERISIM
+    // start cycle, wait for it and get the data in one round trip to verimain
+    // if it takes longer, fall back to polling with sleeps
+    VeriCmd cmds[3];
+    verisim_cmd (&cmds[0], VERISIM_CMD_WRITE, &kyat[3], KY3_DMASTATE0 | KY3_DMAADDR0 * xba);
+    verisim_cmd (&cmds[1], VERISIM_CMD_POLLEQ, &kyat[3], 0, KY3_DMASTATE, KYSPINS);
+    verisim_cmd (&cmds[2], VERISIM_CMD_READ, &kyat[4]);
+    if (verisim_batch (cmds, 3) == 3) {
+        *data = (cmds[2].data & KY4_DMADATA) / KY4_DMADATA0;
+        return cmds[1].data & (KY3_DMATIMO | KY3_DMAPERR);
+    }
+#else
     ZWR(kyat[3], KY3_DMASTATE0 | KY3_DMAADDR0 * xba);
+#endif
     uint32_t rc;
+    int sleeps = 0;
     for (int i = 0; ((rc = ZRD(kyat[3])) & KY3_DMASTATE) != 0; i ++) {
-        if (i > 100000) {
+        if ((i > KYSPINS) && ! kysleep (sleeps)) {
             throw Z11DMAException ("Z11Page::dmaread: dma stuck");
         }
     }
@@ -271,10 +359,33 @@ bool Z11Page::dmawbytelocked (uint32_t xba, uint8_t data)
 {
     ASSERT (dmalocked);
     ASSERT (ZRD(kyat[5]) == mypid);
+    if (bmfast && bmowns (xba)) {
+#if defined VERISIM
+        VeriCmd cmds[3];
+        verisim_cmd (&cmds[0], VERISIM_CMD_WRITE, &bmat[4], BM4_ARMDATA0 * 0401 * data);
+        verisim_cmd (&cmds[1], VERISIM_CMD_WRITE, &bmat[3], BM3_ARMFUNC0 * ((xba & 1) ? 2 : 1) | BM3_ARMADDR0 * xba);
+        verisim_cmd (&cmds[2], VERISIM_CMD_POLLEQ, &bmat[3], 0, BM3_ARMFUNC, 100000);
+        if (verisim_batch (cmds, 3) < 3) throw Z11DMAException ("Z11Page::dmawbyte: bigmem stuck");
+#else
+        ZWR(bmat[4], BM4_ARMDATA0 * 0401 * data);
+        ZWR(bmat[3], BM3_ARMFUNC0 * ((xba & 1) ? 2 : 1) | BM3_ARMADDR0 * xba);
+        bmidle ("Z11Page::dmawbyte: bigmem stuck");
+#endif
+        return true;
+    }
+#if defined VERISIM
+    VeriCmd cmds[3];
+    verisim_cmd (&cmds[0], VERISIM_CMD_WRITE, &kyat[4], KY4_DMADATA0 * 0401 * data);
+    verisim_cmd (&cmds[1], VERISIM_CMD_WRITE, &kyat[3], KY3_DMASTATE0 | KY3_DMACTRL0 * 3 | KY3_DMAADDR0 * xba);
+    verisim_cmd (&cmds[2], VERISIM_CMD_POLLEQ, &kyat[3], 0, KY3_DMASTATE, KYSPINS);
+    if (verisim_batch (cmds, 3) == 3) return ! (cmds[2].data & KY3_DMATIMO);
+#else
     ZWR(kyat[4], KY4_DMADATA0 * 0401 * data);
     ZWR(kyat[3], KY3_DMASTATE0 | KY3_DMACTRL0 * 3 | KY3_DMAADDR0 * xba);
+#endif
+    int sleeps = 0;
     for (int i = 0; (ZRD(kyat[3]) & KY3_DMASTATE) != 0; i ++) {
-        if (i > 100000) {
+        if ((i > KYSPINS) && ! kysleep (sleeps)) {
             throw Z11DMAException ("Z11Page::dmawbyte: dma stuck");
         }
     }
@@ -300,41 +411,451 @@ bool Z11Page::dmawritelocked (uint32_t xba, uint16_t data)
 {
     ASSERT (dmalocked);
     ASSERT (ZRD(kyat[5]) == mypid);
+    if (bmfast && bmowns (xba)) {
+#if defined VERISIM
+        VeriCmd cmds[3];
+        verisim_cmd (&cmds[0], VERISIM_CMD_WRITE, &bmat[4], BM4_ARMDATA0 * data);
+        verisim_cmd (&cmds[1], VERISIM_CMD_WRITE, &bmat[3], BM3_ARMFUNC0 * 3 | BM3_ARMADDR0 * xba);
+        verisim_cmd (&cmds[2], VERISIM_CMD_POLLEQ, &bmat[3], 0, BM3_ARMFUNC, 100000);
+        if (verisim_batch (cmds, 3) < 3) throw Z11DMAException ("Z11Page::dmawrite: bigmem stuck");
+#else
+        ZWR(bmat[4], BM4_ARMDATA0 * data);
+        ZWR(bmat[3], BM3_ARMFUNC0 * 3 | BM3_ARMADDR0 * xba);
+        bmidle ("Z11Page::dmawrite: bigmem stuck");
+#endif
+        return true;
+    }
+#if defined VERISIM
+    VeriCmd cmds[3];
+    verisim_cmd (&cmds[0], VERISIM_CMD_WRITE, &kyat[4], KY4_DMADATA0 * data);
+    verisim_cmd (&cmds[1], VERISIM_CMD_WRITE, &kyat[3], KY3_DMASTATE0 | KY3_DMACTRL0 * 2 | KY3_DMAADDR0 * xba);
+    verisim_cmd (&cmds[2], VERISIM_CMD_POLLEQ, &kyat[3], 0, KY3_DMASTATE, KYSPINS);
+    if (verisim_batch (cmds, 3) == 3) return ! (cmds[2].data & KY3_DMATIMO);
+#else
     ZWR(kyat[4], KY4_DMADATA0 * data);
     ZWR(kyat[3], KY3_DMASTATE0 | KY3_DMACTRL0 * 2 | KY3_DMAADDR0 * xba);
+#endif
+    int sleeps = 0;
     for (int i = 0; (ZRD(kyat[3]) & KY3_DMASTATE) != 0; i ++) {
-        if (i > 100000) {
+        if ((i > KYSPINS) && ! kysleep (sleeps)) {
             throw Z11DMAException ("Z11Page::dmawrite: dma stuck");
         }
     }
     return ! (ZRD(kyat[3]) & KY3_DMATIMO);
 }
 
+// read a block of words from unibus via dma
+// uses ky11.v burst circuit so it works even when 11/34 is halted
+//  input:
+//   xba = starting unibus address
+//   count = number of words to read
+//   incaddr = true: increment address for each word
+//            false: read all words from the same address
+//  output:
+//   returns 0: all words read
+//        else: KY3_DMATIMO and/or KY3_DMAPERR for word following the last one read
+//   count = number of words successfully read
+//   buf = filled in with words read
+uint32_t Z11Page::dmareadblock (uint32_t xba, uint32_t &count, uint16_t *buf, bool incaddr)
+{
+    uint32_t total = count;
+    count = 0;
+
+    // do it in fifo-sized chunks so we don't hog the dma circuit
+    while (count < total) {
+        uint32_t chunk = total - count;
+        if (chunk > KY_BFIFOSIZE) chunk = KY_BFIFOSIZE;
+        dmalock ();
+        uint32_t rc;
+        try {
+            uint64_t startns = shmstats_nowns ();
+            rc = dmareadblocklocked (xba, chunk, buf + count, incaddr);
+            if (chunk > 0) shmstats_value (SHMSTATS_DMANS, (shmstats_nowns () - startns) / chunk);
+            dmaunlk ();
+        } catch (...) {
+            dmaunlk ();
+            throw;
+        }
+        count += chunk;
+        if (rc != 0) return rc;
+        if (incaddr) xba = (xba + chunk * 2) & 0777777;
+    }
+    return 0;
+}
+
+uint32_t Z11Page::dmareadblocklocked (uint32_t xba, uint32_t &count, uint16_t *buf, bool incaddr)
+{
+    ASSERT (dmalocked);
+    ASSERT (ZRD(kyat[5]) == mypid);
+    if (! bmfast || ! incaddr) return kyreadblocklocked (xba, count, buf, incaddr);
+
+    // split at 4KB boundaries as each has its own bigmem enable bit
+    uint32_t total = count;
+    count = 0;
+    while (count < total) {
+        uint32_t seg = (4096 - (xba & 4095)) / 2;
+        if (seg > total - count) seg = total - count;
+        uint32_t rc = bmowns (xba) ? bmreadblocklocked (xba, seg, buf + count) : kyreadblocklocked (xba, seg, buf + count, true);
+        count += seg;
+        if (rc != 0) return rc;
+        xba = (xba + seg * 2) & 0777777;
+    }
+    return 0;
+}
+
+// read block of words from bigmem.v block ram via its arm port
+// each read of register 7 starts reading the next word
+uint32_t Z11Page::bmreadblocklocked (uint32_t xba, uint32_t &count, uint16_t *buf)
+{
+    uint32_t total = count;
+    count = 0;
+    if (total == 0) return 0;
+
+    ZWR(bmat[3], BM3_ARMFUNC0 * 4 | BM3_ARMAINC | BM3_ARMADDR0 * xba);
+    uint32_t rc = 0;
+    for (int i = 0; count < total;) {
+        uint32_t bm7 = ZRD(bmat[7]);
+        if (bm7 & BM7_ARMBUSY) {
+            if (++ i > 100000) {
+                throw Z11DMAException ("Z11Page::dmareadblock: bigmem stuck");
+            }
+            continue;
+        }
+        if (bm7 & BM7_ARMPERR) {
+            rc = KY3_DMAPERR;
+            break;
+        }
+        buf[count++] = (bm7 & BM7_ARMDATA) / BM7_ARMDATA0;
+        i = 0;
+    }
+
+    // last read of register 7 started reading the word after the last one
+    // ...so wait for that to finish before turning off auto-increment
+    bmidle ("Z11Page::dmareadblock: bigmem stuck");
+    ZWR(bmat[3], 0);
+    return rc;
+}
+
+// read block of words via ky11.v burst circuit
+uint32_t Z11Page::kyreadblocklocked (uint32_t xba, uint32_t &count, uint16_t *buf, bool incaddr)
+{
+    ASSERT (count <= KY6_BCOUNT);
+
+    uint32_t total = count;
+    count = 0;
+    if (total == 0) return 0;
+
+    // start ky11.v doing DATI cycles into the fifo
+    ZWR(kyat[3], KY3_DMAADDR0 * xba);
+    ZWR(kyat[6], KY6_BBUSY | (incaddr ? 0 : KY6_BNOINC) | KY6_BCOUNT0 * total);
+
+    // pop words from fifo as they arrive
+    // register 7 says how many were in fifo before the pop, so zero means the data is not valid
+    int sleeps = 0;
+    for (int i = 0; count < total;) {
+#if defined VERISIM
+        // pop the rest of the words in one round trip to verimain
+        // each pop polls until a word is in the fifo
+        VeriCmd cmds[VERISIM_MAXCMDS];
+        int ncmds = (total - count < VERISIM_MAXCMDS) ? total - count : VERISIM_MAXCMDS;
+        for (int j = 0; j < ncmds; j ++) {
+            verisim_cmd (&cmds[j], VERISIM_CMD_POLLNE, &kyat[7], 0, KY7_BFILL, KYSPINS);
+        }
+        int ndone = verisim_batch (cmds, ncmds);
+        for (int j = 0; j < ndone; j ++) {
+            buf[count++] = (cmds[j].data & KY7_BDATA) / KY7_BDATA0;
+        }
+        if (ndone > 0) {
+            i = 0;
+            sleeps = 0;
+            continue;
+        }
+        uint32_t ky7 = cmds[0].data;
+#else
+        uint32_t ky7 = ZRD(kyat[7]);
+#endif
+        if (ky7 & KY7_BFILL) {
+            buf[count++] = (ky7 & KY7_BDATA) / KY7_BDATA0;
+            i = 0;
+            sleeps = 0;
+            continue;
+        }
+
+        // fifo empty, see if burst stopped because of an error
+        uint32_t ky6 = ZRD(kyat[6]);
+        if (! (ky6 & (KY6_BBUSY | KY6_BFILL))) {
+            if (! (ky6 & (KY6_BTIMO | KY6_BPERR))) {
+                throw Z11DMAException ("Z11Page::dmareadblock: burst aborted");
+            }
+            return ((ky6 & KY6_BTIMO) ? KY3_DMATIMO : 0) | ((ky6 & KY6_BPERR) ? KY3_DMAPERR : 0);
+        }
+
+        // still going, spin a little then sleep until burst completes
+        // burst doesn't need us to pop anything to complete as fifo is empty
+        if (++ i > ((total - count > KYSPINWORDS) ? KYBSPINS : KYSPINS)) {
+            i = 0;
+            if (! kysleep (sleeps)) {
+                ZWR(kyat[6], 0);
+                throw Z11DMAException ("Z11Page::dmareadblock: dma stuck");
+            }
+        }
+    }
+    return 0;
+}
+
+// write a block of words to unibus via dma
+// uses ky11.v burst circuit so it works even when 11/34 is halted
+//  input:
+//   xba = starting unibus address
+//   count = number of words to write
+//   buf = words to write
+//   incaddr = true: increment address for each word
+//            false: write all words to the same address
+//  output:
+//   returns 0: all words written
+//        else: KY3_DMATIMO for word following the last one written
+//   count = number of words successfully written
+uint32_t Z11Page::dmawriteblock (uint32_t xba, uint32_t &count, uint16_t const *buf, bool incaddr)
+{
+    uint32_t total = count;
+    count = 0;
+
+    // do it in fifo-sized chunks so we don't hog the dma circuit
+    while (count < total) {
+        uint32_t chunk = total - count;
+        if (chunk > KY_BFIFOSIZE) chunk = KY_BFIFOSIZE;
+        dmalock ();
+        uint32_t rc;
+        try {
+            uint64_t startns = shmstats_nowns ();
+            rc = dmawriteblocklocked (xba, chunk, buf + count, incaddr);
+            if (chunk > 0) shmstats_value (SHMSTATS_DMANS, (shmstats_nowns () - startns) / chunk);
+            dmaunlk ();
+        } catch (...) {
+            dmaunlk ();
+            throw;
+        }
+        count += chunk;
+        if (rc != 0) return rc;
+        if (incaddr) xba = (xba + chunk * 2) & 0777777;
+    }
+    return 0;
+}
+
+uint32_t Z11Page::dmawriteblocklocked (uint32_t xba, uint32_t &count, uint16_t const *buf, bool incaddr)
+{
+    ASSERT (dmalocked);
+    ASSERT (ZRD(kyat[5]) == mypid);
+    if (! bmfast || ! incaddr) return kywriteblocklocked (xba, count, buf, incaddr);
+
+    // split at 4KB boundaries as each has its own bigmem enable bit
+    uint32_t total = count;
+    count = 0;
+    while (count < total) {
+        uint32_t seg = (4096 - (xba & 4095)) / 2;
+        if (seg > total - count) seg = total - count;
+        uint32_t rc = bmowns (xba) ? bmwriteblocklocked (xba, seg, buf + count) : kywriteblocklocked (xba, seg, buf + count, true);
+        count += seg;
+        if (rc != 0) return rc;
+        xba = (xba + seg * 2) & 0777777;
+    }
+    return 0;
+}
+
+// write block of words to bigmem.v block ram via its arm port
+// each write of register 7 writes a word then increments the address
+uint32_t Z11Page::bmwriteblocklocked (uint32_t xba, uint32_t &count, uint16_t const *buf)
+{
+    uint32_t total = count;
+    if (total == 0) return 0;
+
+    ZWR(bmat[3], BM3_ARMAINC | BM3_ARMADDR0 * xba);
+#if defined VERISIM
+    // queue up the word writes and idle polls so each batch is one round trip to verimain
+    VeriCmd cmds[VERISIM_MAXCMDS];
+    for (count = 0; count < total;) {
+        int ncmds = 0;
+        while ((count < total) && (ncmds + 2 <= VERISIM_MAXCMDS)) {
+            verisim_cmd (&cmds[ncmds++], VERISIM_CMD_WRITE, &bmat[7], BM7_ARMDATA0 * buf[count++]);
+            verisim_cmd (&cmds[ncmds++], VERISIM_CMD_POLLEQ, &bmat[3], 0, BM3_ARMFUNC, 100000);
+        }
+        if (verisim_batch (cmds, ncmds) < ncmds) {
+            throw Z11DMAException ("Z11Page::dmawriteblock: bigmem stuck");
+        }
+    }
+#else
+    for (count = 0; count < total; count ++) {
+        ZWR(bmat[7], BM7_ARMDATA0 * buf[count]);
+        bmidle ("Z11Page::dmawriteblock: bigmem stuck");
+    }
+#endif
+    ZWR(bmat[3], 0);
+    return 0;
+}
+
+// write block of words via ky11.v burst circuit
+uint32_t Z11Page::kywriteblocklocked (uint32_t xba, uint32_t &count, uint16_t const *buf, bool incaddr)
+{
+    ASSERT (count <= KY6_BCOUNT);
+
+    uint32_t total = count;
+    count = 0;
+    if (total == 0) return 0;
+
+    // start ky11.v doing DATO cycles from the fifo
+    ZWR(kyat[3], KY3_DMAADDR0 * xba);
+    ZWR(kyat[6], KY6_BBUSY | KY6_BWRITE | (incaddr ? 0 : KY6_BNOINC) | KY6_BCOUNT0 * total);
+
+    uint32_t lastleft = total + 1;
+    uint32_t sent = 0;
+    int sleeps = 0;
+    for (int i = 0;; i ++) {
+
+        // see how many words are still to be written to unibus and how much is in fifo
+        uint32_t ky6  = ZRD(kyat[6]);
+        uint32_t left = (ky6 & KY6_BCOUNT) / KY6_BCOUNT0;
+        if (! (ky6 & KY6_BBUSY)) {
+            count = total - left;
+            if (left == 0) return 0;
+            if (! (ky6 & KY6_BTIMO)) {
+                throw Z11DMAException ("Z11Page::dmawriteblock: burst aborted");
+            }
+            return KY3_DMATIMO;
+        }
+        if (left != lastleft) {
+            lastleft = left;
+            i = 0;
+            sleeps = 0;
+        } else if (i > ((left > KYSPINWORDS) ? KYBSPINS : KYSPINS)) {
+
+            // everything is in fifo, sleep until burst completes
+            // otherwise keep spinning so we can top up fifo
+            if (sent == total) i = 0;
+            if ((i > 100000) || ((i == 0) && ! kysleep (sleeps))) {
+                ZWR(kyat[6], 0);
+                throw Z11DMAException ("Z11Page::dmawriteblock: dma stuck");
+            }
+        }
+
+        // top up the fifo
+        // fill can only go down between reading it and writing the words so we can't overflow it
+        uint32_t fill = (ky6 & KY6_BFILL) / KY6_BFILL0;
+#if defined VERISIM
+        VeriCmd cmds[KY_BFIFOSIZE];
+        int ncmds = 0;
+        while ((sent < total) && (fill < KY_BFIFOSIZE)) {
+            verisim_cmd (&cmds[ncmds++], VERISIM_CMD_WRITE, &kyat[7], KY7_BDATA0 * buf[sent++]);
+            fill ++;
+        }
+        verisim_batch (cmds, ncmds);
+#else
+        while ((sent < total) && (fill < KY_BFIFOSIZE)) {
+            ZWR(kyat[7], KY7_BDATA0 * buf[sent++]);
+            fill ++;
+        }
+#endif
+    }
+}
+
+// enable accessing bigmem.v block ram directly via its arm port
+// ...for addresses it is enabled for instead of doing unibus cycles
+// doesn't use unibus cycles so doesn't interfere with processor
+// can be disabled with envar z11nobmdma for testing unibus path
+void Z11Page::bigmemdma (bool enab)
+{
+    bmfast = enab && (getenv ("z11nobmdma") == NULL);
+}
+
+// see if bigmem.v responds to the given unibus address
+bool Z11Page::bmowns (uint32_t xba)
+{
+    uint32_t page = (xba >> 12) & 63;
+    uint32_t enab = ZRD(bmat[(page < 32)?1:2]);
+    return (enab >> (page & 31)) & 1;
+}
+
+// wait for bigmem.v arm port to finish access
+// bigmem.v accesses are serialized by the dma lock
+void Z11Page::bmidle (char const *msg)
+{
+    for (int i = 0; ZRD(bmat[3]) & BM3_ARMFUNC; i ++) {
+        if (i > 100000) {
+            throw Z11DMAException (msg);
+        }
+    }
+}
+
+// set dma priority for the calling thread
+//  input:
+//   prio = DMAPRI_NET: network
+//          DMAPRI_DISK: disk and tape
+//          DMAPRI_CONS: console, gui, scripting (default)
+void Z11Page::setdmaprio (int prio)
+{
+    ASSERT ((prio >= DMAPRI_CONS) && (prio <= DMAPRI_NET));
+    dmaprio = prio;
+}
+
 // acquire exclusive access to dma controller
+// waiters are granted the lock highest priority first, then in order of arrival
+// ...threads of this process get in line the same as other processes,
+//    dmamutex just keeps them off each other as they share one pid in kyat[5]
 // don't timeout in case being used by TCL scripting
 void Z11Page::dmalock ()
 {
     ASSERT (! dmalocked);
     dmalocked = true;
-    if (pthread_mutex_lock (&dmamutex) != 0) ABORT ();
     ASSERT (KY5_DMALOCK == 0xFFFFFFFFU);
-    ASSERT (ZRD(kyat[5]) != mypid);
-    uint32_t nus = 10;
+    uint64_t startns = shmstats_nowns ();
+    int slot = -1;
+    bool checkdead = false;
     while (true) {
-        ZWR(kyat[5], mypid);
-        uint32_t lkpid = ZRD(kyat[5]);
-        if (lkpid == mypid) break;
-        if ((lkpid != 0) && (kill (lkpid, 0) < 0) && (errno == ESRCH)) {
-            fprintf (stderr, "Z11Page::dmalock: unlocking from dead %u\n", lkpid);
-            ZWR(kyat[5], lkpid);
+        int seq = __atomic_load_n (&dmaarb->wakeseq, __ATOMIC_SEQ_CST);
+
+        // try to lock if no one is waiting ahead of us
+        if (! dmaarbahead (slot, checkdead) && (pthread_mutex_trylock (&dmamutex) == 0)) {
+            ASSERT (ZRD(kyat[5]) != mypid);
+            ZWR(kyat[5], mypid);
+            uint32_t lkpid = ZRD(kyat[5]);
+            if (lkpid == mypid) break;
+            if (pthread_mutex_unlock (&dmamutex) != 0) ABORT ();
+            if ((lkpid != 0) && (kill (lkpid, 0) < 0) && (errno == ESRCH)) {
+                fprintf (stderr, "Z11Page::dmalock: unlocking from dead %u\n", lkpid);
+                ZWR(kyat[5], lkpid);
+                continue;
+            }
         }
-        if (nus < 1000) nus += nus / 2;
-        usleep (nus);
+
+        // get in line if not already
+        // if all slots are full, just keep trying without a slot
+        if (slot < 0) {
+            for (int i = 0; i < DMAARB_NSLOTS; i ++) {
+                int zero = 0;
+                if (atomic_compare_exchange (&dmaarb->slots[i].pid, &zero, - mypid)) {
+                    dmaarb->slots[i].prio   = dmaprio;
+                    dmaarb->slots[i].ticket = __atomic_fetch_add (&dmaarb->nextticket, 1, __ATOMIC_SEQ_CST);
+                    __atomic_store_n (&dmaarb->slots[i].pid, mypid, __ATOMIC_SEQ_CST);
+                    slot = i;
+                    break;
+                }
+            }
+            if (slot >= 0) continue;
+        }
+
+        // wait for someone to release the lock
+        // time out in case owner died or someone locks without going through here
+        struct timespec timeout = { 0, 1000000 };
+        int rc = futex (&dmaarb->wakeseq, FUTEX_WAIT, seq, &timeout, NULL, 0);
+        if ((rc < 0) && (errno != EAGAIN) && (errno != EINTR) && (errno != ETIMEDOUT)) ABORT ();
+        checkdead = (rc < 0) && (errno == ETIMEDOUT);
     }
+    if (slot >= 0) __atomic_store_n (&dmaarb->slots[slot].pid, 0, __ATOMIC_SEQ_CST);
     ASSERT (ZRD(kyat[5]) == mypid);
+    shmstats_since (SHMSTATS_LOKNS, startns);
 }
 
 // release exclusive access to dma controller
+// wake anyone waiting so they can see who is next
 void Z11Page::dmaunlk ()
 {
     ASSERT (dmalocked);
@@ -343,6 +864,42 @@ void Z11Page::dmaunlk ()
     ASSERT (ZRD(kyat[5]) != mypid);
     if (pthread_mutex_unlock (&dmamutex) != 0) ABORT ();
     dmalocked = false;
+    __atomic_add_fetch (&dmaarb->wakeseq, 1, __ATOMIC_SEQ_CST);
+    for (int i = 0; i < DMAARB_NSLOTS; i ++) {
+        if (__atomic_load_n (&dmaarb->slots[i].pid, __ATOMIC_SEQ_CST) != 0) {
+            if (futex (&dmaarb->wakeseq, FUTEX_WAKE, 1000000000, NULL, NULL, 0) < 0) ABORT ();
+            break;
+        }
+    }
+}
+
+// see if someone else is waiting for the dma lock that should get it before us
+//  input:
+//   slot = our slot in dmaarb->slots, -1 if we don't have one
+//   checkdead = check for dead waiters and remove them
+//  output:
+//   returns true: someone else should go first
+//          false: we can try to lock it
+static bool dmaarbahead (int slot, bool checkdead)
+{
+    int myprio   = dmaprio;
+    int myticket = (slot < 0) ? 0 : dmaarb->slots[slot].ticket;
+    bool ahead   = false;
+    for (int i = 0; i < DMAARB_NSLOTS; i ++) {
+        if (i == slot) continue;
+        int pid = __atomic_load_n (&dmaarb->slots[i].pid, __ATOMIC_SEQ_CST);
+        if (pid == 0) continue;
+        if (checkdead && (kill ((pid < 0) ? - pid : pid, 0) < 0) && (errno == ESRCH)) {
+            fprintf (stderr, "Z11Page::dmalock: removing dead waiter %d\n", (pid < 0) ? - pid : pid);
+            atomic_compare_exchange (&dmaarb->slots[i].pid, &pid, 0);
+            continue;
+        }
+        if (pid < 0) continue;
+        int prio = dmaarb->slots[i].prio;
+        if (prio > myprio) ahead = true;
+        if ((prio == myprio) && ((slot < 0) || ((int) ((unsigned) dmaarb->slots[i].ticket - (unsigned) myticket) < 0))) ahead = true;
+    }
+    return ahead;
 }
 
 void Z11Page::dmacheck (bool locked)
@@ -350,6 +907,20 @@ void Z11Page::dmacheck (bool locked)
     ASSERT (dmalocked == locked);
 }
 
+// sleep waiting for ky11.v dma cycle or burst to complete
+// used after spinning a while so long transfers don't hog the cpu
+//  input:
+//   sleeps = number of times slept without progress
+//  output:
+//   returns false: slept too many times, dma is stuck
+//            true: woke up, check dma status again
+bool Z11Page::kysleep (int &sleeps)
+{
+    if (++ sleeps > KYSLEEPS) return false;
+    waitint (ZGINT_KY, true);
+    return true;
+}
+
 // wait for interrupt(s) given in mask
 // checks for bit(s) set in regarmintreq
 // if not already set,
@@ -358,12 +929,16 @@ void Z11Page::dmacheck (bool locked)
 //   clears the bits from regarmintena
 //     (unless something else waiting for them)
 // caller should do whatever to device to clear bits in regarmintreq before calling again
-void Z11Page::waitint (uint32_t mask)
+//  input:
+//   timeout = false: wait indefinitely
+//              true: also return after ZGWFITO_MS
+void Z11Page::waitint (uint32_t mask, bool timeout)
 {
 #if defined VERISIM
-    verisim_wfi (mask);
+    if (timeout) verisim_wfito (mask);
+            else verisim_wfi (mask);
 #else
-    int rc = ioctl (zynqfd, ZGIOCTL_WFI, mask);
+    int rc = ioctl (zynqfd, timeout ? ZGIOCTL_WFITO : ZGIOCTL_WFI, mask);
     if ((rc < 0) && (errno != EINTR)) {
         fprintf (stderr, "Z11Page::waitint: error waiting for interrupt: %m\n");
         ABORT ();
@@ -371,6 +946,64 @@ void Z11Page::waitint (uint32_t mask)
 #endif
 }
 
+// set up to wait for interrupt(s) given in mask along with other fds in poll() or epoll_wait()
+// starts a thread that does waitint() each time intfdarm() is called
+// ...then makes the returned fd readable
+// the thread blocks all signals so they interrupt the caller's poll()
+//  returns fd to poll for POLLIN/EPOLLIN, then call intfdread()
+int Z11Page::intfdinit (uint32_t mask)
+{
+    if (intpollfd >= 0) ABORT ();
+    intfdmask = mask;
+    intarmfd  = eventfd (0, EFD_CLOEXEC);
+    intpollfd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if ((intarmfd < 0) || (intpollfd < 0)) ABORT ();
+
+    sigset_t allsigs, oldsigs;
+    sigfillset (&allsigs);
+    if (pthread_sigmask (SIG_SETMASK, &allsigs, &oldsigs) != 0) ABORT ();
+    pthread_t tid;
+    if (pthread_create (&tid, NULL, intfdwrap, this) != 0) ABORT ();
+    if (pthread_sigmask (SIG_SETMASK, &oldsigs, NULL) != 0) ABORT ();
+    return intpollfd;
+}
+
+// have thread wait for the next interrupt
+// caller should do whatever to device to clear bits in regarmintreq before calling again
+void Z11Page::intfdarm ()
+{
+    static uint64_t const one = 1;
+    if (write (intarmfd, &one, sizeof one) != sizeof one) ABORT ();
+}
+
+// see if interrupt happened since intfdarm() was called, clear fd readable status if so
+//  returns true: interrupt happened, call intfdarm() to wait for another
+//         false: still waiting for interrupt
+bool Z11Page::intfdread ()
+{
+    uint64_t junk;
+    return read (intpollfd, &junk, sizeof junk) > 0;
+}
+
+void *Z11Page::intfdwrap (void *zhis)
+{
+    ((Z11Page *) zhis)->intfdthread ();
+    return NULL;
+}
+
+void Z11Page::intfdthread ()
+{
+    while (true) {
+        uint64_t value;
+        int rc = read (intarmfd, &value, sizeof value);
+        if ((rc < 0) && (errno == EINTR)) continue;
+        if (rc != sizeof value) ABORT ();
+        waitint (intfdmask);
+        value = 1;
+        if (write (intpollfd, &value, sizeof value) != sizeof value) ABORT ();
+    }
+}
+
 // read registers when processor is running
 // halts processor momentarily to read registers
 //  input:
@@ -39,6 +39,10 @@
 #define ZWR(a,d) do { a = d; } while (0)
 #endif
 
+#define DMAPRI_CONS 0   // console, gui, scripting
+#define DMAPRI_DISK 1   // disk and tape
+#define DMAPRI_NET  2   // network
+
 struct Z11DMAException : std::exception {
     Z11DMAException (char const *msg);
     virtual const char* what() const throw();
@@ -60,10 +64,19 @@ struct Z11Page {
     uint32_t dmareadlocked (uint32_t xba, uint16_t *data);
     bool dmawbytelocked (uint32_t xba, uint8_t data);
     bool dmawritelocked (uint32_t xba, uint16_t data);
+    uint32_t dmareadblock (uint32_t xba, uint32_t &count, uint16_t *buf, bool incaddr = true);
+    uint32_t dmawriteblock (uint32_t xba, uint32_t &count, uint16_t const *buf, bool incaddr = true);
+    uint32_t dmareadblocklocked (uint32_t xba, uint32_t &count, uint16_t *buf, bool incaddr = true);
+    uint32_t dmawriteblocklocked (uint32_t xba, uint32_t &count, uint16_t const *buf, bool incaddr = true);
+    void bigmemdma (bool enab);
+    void setdmaprio (int prio);
     void dmalock ();
     void dmaunlk ();
     void dmacheck (bool locked);
-    void waitint (uint32_t mask);
+    void waitint (uint32_t mask, bool timeout = false);
+    int intfdinit (uint32_t mask);
+    void intfdarm ();
+    bool intfdread ();
     int snapregs (uint32_t addr, int count, uint16_t *regs);
     void haltreq ();
     void stepreq ();
@@ -71,11 +84,26 @@ struct Z11Page {
     void resetit ();
 
 private:
+    bool bmfast;
+    int intarmfd;
+    int intpollfd;
     int zynqfd;
+    uint32_t intfdmask;
+    uint32_t volatile *bmat;
     uint32_t volatile *kyat;
     uint32_t volatile *pdpat;
     uint32_t volatile *zynqpage;
     void *zynqptr;
+
+    bool bmowns (uint32_t xba);
+    void bmidle (char const *msg);
+    bool kysleep (int &sleeps);
+    static void *intfdwrap (void *zhis);
+    void intfdthread ();
+    uint32_t bmreadblocklocked (uint32_t xba, uint32_t &count, uint16_t *buf);
+    uint32_t bmwriteblocklocked (uint32_t xba, uint32_t &count, uint16_t const *buf);
+    uint32_t kyreadblocklocked (uint32_t xba, uint32_t &count, uint16_t *buf, bool incaddr);
+    uint32_t kywriteblocklocked (uint32_t xba, uint32_t &count, uint16_t const *buf, bool incaddr);
 };
 
 extern Z11Page *z11page;
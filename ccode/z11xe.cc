@@ -29,29 +29,56 @@
 //  ./z11xe -daemon
 // run as command for debugging:
 //  ./z11xe
+// run connected to a tap device (eg, bridged to a veth pair):
+//  ./z11xe -tap xe0
+// run with packets replayed from a pcap file at 10000 per second, recording transmitted packets:
+//  ./z11xe -pcapin load.pcap -rate 10000 -loop -pcapout sent.pcap -mac 08:00:2B:12:34:56
 
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <linux/filter.h>
 #include <linux/if_packet.h>
+#include <linux/if_tun.h>
 #include <net/ethernet.h>
 #include <net/if.h>
+#include <poll.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "shmstats.h"
 #include "z11defs.h"
+#include "z11inst.h"
 #include "z11util.h"
 
 #define MINPKTLEN 64
 
+#define RXBLKSIZE 65536     // receive ring block size
+#define RXNBLOCKS 32        // receive ring number of blocks
+#define RXFRMSIZE 2048      // receive ring max bytes per packet
+#define RXBLKTOV  1         // receive ring ms to wait for block to fill before passing it along
+
+#define XMTBATCH 32         // max packets to transmit with one sendmmsg()
+#define XMTDESCS 64         // max transmit descriptors to give back to pdp after sendmmsg()
+
+#define PCAPMAGIC   0xA1B2C3D4U     // pcap file magic number, microsecond timestamps
+#define PCAPMAGICNS 0xA1B23C4DU     // pcap file magic number, nanosecond timestamps
+#define PCAPSWAPPED 0xD4C3B2A1U     // ...microsecond timestamps, byte swapped
+#define PCAPSWAPDNS 0x4D3CB2A1U     // ...nanosecond timestamps, byte swapped
+#define PCAPMAXREC  65535           // max packet length in pcap file we accept
+
 #define SERI 0x8000     // PCSR0 status error interrupt
 #define PCEI 0x4000     // PCSR0 port command error interrupt
 #define RXI  0x2000     // PCSR0 receive ring interrupt
@@ -129,16 +156,48 @@ struct RingFmt {
 
 union Packet { uint16_t w[757]; uint8_t b[1514]; };
 
+enum Backend {
+    BE_RAW,             // raw AF_PACKET socket on an ethernet device
+    BE_TAP,             // linux tap device
+    BE_PCAP             // replay received packets from pcap file, record transmitted packets to pcap file
+};
+
+struct PcapHdr {        // pcap file header
+    uint32_t magic;
+    uint16_t vermajor;
+    uint16_t verminor;
+    int32_t  thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+};
+
+struct PcapRec {        // pcap packet record header
+    uint32_t tssec;
+    uint32_t tsfrac;
+    uint32_t incllen;
+    uint32_t origlen;
+};
+
 static uint16_t const bdcastaddr[3] = { 0xFFFFU, 0xFFFFU, 0xFFFFU };
 static uint16_t defethaddr[3] = { 0x0008U, 0x002BU, 0 };
 
+static Backend backend;
+static bool pcapinnsec;                 // pcapin timestamps are in nanoseconds
+static bool pcapinswap;                 // pcapin file is opposite byte order
+static bool pcaploop;                   // restart pcapin file at end
 static bool rcbisetinh;
 static Counters counters;
+static FILE *pcapinfile;                // pcap file to replay as received packets
 static int debug;
-static int sockfd;
-static Packet rcvp, xmtp;
+static int pcapoutfd = -1;              // pcap file to record transmitted packets to
+static int pcaprate = -1;               // replay packets per second (0 = unthrottled, -1 = as captured)
+static int sockfd;                      // raw socket or tap device
+static int xmtlens[XMTBATCH];           // length of each packet in xmtps[]
+static Packet rcvp, xmtps[XMTBATCH];    // received packet needing padding, packets being transmitted
 static pthread_cond_t thecond = PTHREAD_COND_INITIALIZER;
 static pthread_mutex_t themutex = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t *rxring;                 // TPACKET_V3 receive ring, NULL if using read()
 static RingFmt ringfmt;
 static struct sockaddr_ll sendtoaddr;
 static time_t counterszeroed;
@@ -158,14 +217,24 @@ static void xeiothread_locked ();
 static void doreset ();
 static void getcommand_locked ();
 static void getcommand_dmalkd ();
+static void opentap (char const *tapdev);
+static void openpcapin (char const *filename);
+static void openpcapout (char const *filename);
+static bool setuprxring ();
 static void *receivethread (void *dummy);
+static void receivering ();
+static void receivepcap ();
 static void *transmithread (void *dummy);
 static void transmithread_locked ();
 static bool transmithread_dmalkd ();
-static void transmithread_dmaulk (int xmtlen);
-static void gotincoming_locked (int rc);
-static uint16_t gotincoming_dmalkd (uint16_t rcvlen);
+static void transmithread_dmaulk (int npkts);
+static void transmitraw (int npkts);
+static void transmittap (int npkts);
+static void transmitpcap (int npkts);
+static void gotincoming_locked (uint8_t const *rcvbyt, int rc);
+static uint16_t gotincoming_dmalkd (uint16_t const *rcvwrd, uint16_t rcvlen);
 static bool matchesincoming (uint16_t const *rcvwrd);
+static void updatefilter ();
 static void writepcsr0 (uint16_t pcsr0);
 static void lockit ();
 static void unlkit ();
@@ -204,19 +273,31 @@ int main (int argc, char **argv)
     int xgid = -1;
     int xuid = -1;
     char const *ethdev = defethdev;
+    char const *pcapin = NULL;
+    char const *pcapout = NULL;
+    char const *tapdev = NULL;
     for (int i = 0; ++ i < argc;) {
         if (strcmp (argv[i], "-?") == 0) {
             puts ("");
             puts ("  Handle DEUNA/DELUA ethernet I/O");
             puts ("");
             puts ("    sudo ./z11xe [-daemon] [-eth <device>] [-gid <gid>] [-killit] [-mac <address>] [-uid <uid>]");
+            puts ("                 [-tap <device>] [-pcapin <file> [-loop] [-rate <pps>]] [-pcapout <file>]");
+            puts ("");
+            puts ("      -daemon  = daemonize, redirect log to /tmp/z11xe.(time).log");
+            printf ("      -eth     = use given ethernet device (default %s)\n", defethdev);
+            puts ("      -gid     = set group id after opening ethernet");
+            puts ("      -killit  = kill other instance already running");
+            puts ("      -loop    = restart -pcapin file when it reaches the end");
+            puts ("      -mac     = use given mac address");
+            puts ("      -pcapin  = replay packets from pcap file instead of receiving from ethernet");
+            puts ("      -pcapout = record transmitted packets to pcap file instead of sending to ethernet");
+            puts ("      -rate    = replay -pcapin packets at given packets per second, 0 = as fast as possible");
+            puts ("                 (default is timing as captured)");
+            puts ("      -tap     = use given tap device (created if it doesn't exist) instead of ethernet");
+            puts ("      -uid     = set user id after opening ethernet");
             puts ("");
-            puts ("      -daemon = daemonize, redirect log to /tmp/z11xe.(time).log");
-            printf ("      -eth    = use given ethernet device (default %s)\n", defethdev);
-            puts ("      -gid    = set group id after opening ethernet");
-            puts ("      -killit = kill other instance already running");
-            puts ("      -mac    = use given mac address");
-            puts ("      -uid    = set user id after opening ethernet");
+            puts ("    -pcapin and -pcapout do not use any network device, -mac should be given to match the packets");
             puts ("");
             return 0;
         }
@@ -244,6 +325,10 @@ int main (int argc, char **argv)
             killit = true;
             continue;
         }
+        if (strcasecmp (argv[i], "-loop") == 0) {
+            pcaploop = true;
+            continue;
+        }
         if (strcasecmp (argv[i], "-mac") == 0) {
             if ((++ i >= argc) || (argv[i][0] == '-')) {
                 fprintf (stderr, "missing address after -mac\n");
@@ -267,6 +352,38 @@ int main (int argc, char **argv)
             macopt = true;
             continue;
         }
+        if (strcasecmp (argv[i], "-pcapin") == 0) {
+            if ((++ i >= argc) || (argv[i][0] == '-')) {
+                fprintf (stderr, "missing filename after -pcapin\n");
+                return 1;
+            }
+            pcapin = argv[i];
+            continue;
+        }
+        if (strcasecmp (argv[i], "-pcapout") == 0) {
+            if ((++ i >= argc) || (argv[i][0] == '-')) {
+                fprintf (stderr, "missing filename after -pcapout\n");
+                return 1;
+            }
+            pcapout = argv[i];
+            continue;
+        }
+        if (strcasecmp (argv[i], "-rate") == 0) {
+            char *p;
+            if ((++ i >= argc) || (argv[i][0] == '-') || ((pcaprate = strtol (argv[i], &p, 0)) < 0) || (*p != 0)) {
+                fprintf (stderr, "missing or bad packets per second after -rate\n");
+                return 1;
+            }
+            continue;
+        }
+        if (strcasecmp (argv[i], "-tap") == 0) {
+            if ((++ i >= argc) || (argv[i][0] == '-')) {
+                fprintf (stderr, "missing device after -tap\n");
+                return 1;
+            }
+            tapdev = argv[i];
+            continue;
+        }
         if (strcasecmp (argv[i], "-uid") == 0) {
             if ((++ i >= argc) || (argv[i][0] == '-')) {
                 fprintf (stderr, "missing user id after -uid\n");
@@ -279,8 +396,61 @@ int main (int argc, char **argv)
         return 1;
     }
 
-    // if -mac not given, use first xor last 3 bytes of hardware eth0 as last 3 bytes of DEUNA
-    if (! macopt) {
+    if ((pcapin != NULL) || (pcapout != NULL)) {
+        if (tapdev != NULL) {
+            fprintf (stderr, "z11xe: -tap cannot be used with -pcapin or -pcapout\n");
+            return 1;
+        }
+
+        // replay and/or record pcap files, no network device involved
+        backend = BE_PCAP;
+        if (pcapin  != NULL) openpcapin  (pcapin);
+        if (pcapout != NULL) openpcapout (pcapout);
+        ethdev = (pcapin != NULL) ? pcapin : pcapout;
+    } else if (tapdev != NULL) {
+
+        // create or attach to tap device, kernel gives us whole ethernet frames
+        backend = BE_TAP;
+        opentap (tapdev);
+        ethdev = tapdev;
+    } else {
+        backend = BE_RAW;
+
+        // set up to transmit out using the given ethernet device
+        sendtoaddr.sll_family = AF_PACKET;
+        sendtoaddr.sll_ifindex = if_nametoindex (ethdev);
+        if (sendtoaddr.sll_ifindex <= 0) {
+            fprintf (stderr, "z11xe: unknown ethernet device %s: %m\n", ethdev);
+            return 1;
+        }
+
+        // man 7 packet
+        sockfd = socket (AF_PACKET, SOCK_RAW, htons (ETH_P_ALL));
+        if (sockfd < 0) {
+            fprintf (stderr, "z11xe: error creating socket: %m\n");
+            ABORT ();
+        }
+
+        // set ethdev promiscuous mode so we will get packets for our mac address
+        struct packet_mreq packetmreq;
+        memset (&packetmreq, 0, sizeof packetmreq);
+        packetmreq.mr_ifindex = sendtoaddr.sll_ifindex;
+        packetmreq.mr_type    = PACKET_MR_PROMISC;
+        if (setsockopt (sockfd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &packetmreq, sizeof packetmreq) < 0) {
+            fprintf (stderr, "z11xe: error setting promiscuous mode: %m\n");
+            ABORT ();
+        }
+
+        // map receive ring so kernel can pass packets along without a syscall per packet
+        // - can be disabled with envar z11norxring
+        if (setuprxring ()) {
+            fprintf (stderr, "z11xe: using %u-byte receive ring\n", RXBLKSIZE * RXNBLOCKS);
+        }
+    }
+
+    // if -mac not given, use first xor last 3 bytes of hardware eth0 (or tap device) as last 3 bytes of DEUNA
+    // (pcap files have no device to get a mac address from)
+    if (! macopt && (backend != BE_PCAP)) {
 
         // get ethdev MAC address
         char macname[strlen(ethdev)+26];
@@ -307,31 +477,6 @@ int main (int argc, char **argv)
         ((uint8_t *)defethaddr)[5] = macaddr[5] ^ macaddr[2];
     }
 
-    // set up to transmit out using the given ethernet device
-    sendtoaddr.sll_family = AF_PACKET;
-    sendtoaddr.sll_ifindex = if_nametoindex (ethdev);
-    if (sendtoaddr.sll_ifindex <= 0) {
-        fprintf (stderr, "z11xe: unknown ethernet device %s: %m\n", ethdev);
-        return 1;
-    }
-
-    // man 7 packet
-    sockfd = socket (AF_PACKET, SOCK_RAW, htons (ETH_P_ALL));
-    if (sockfd < 0) {
-        fprintf (stderr, "z11xe: error creating socket: %m\n");
-        ABORT ();
-    }
-
-    // set ethdev promiscuous mode so we will get packets for our mac address
-    struct packet_mreq packetmreq;
-    memset (&packetmreq, 0, sizeof packetmreq);
-    packetmreq.mr_ifindex = sendtoaddr.sll_ifindex;
-    packetmreq.mr_type    = PACKET_MR_PROMISC;
-    if (setsockopt (sockfd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &packetmreq, sizeof packetmreq) < 0) {
-        fprintf (stderr, "z11xe: error setting promiscuous mode: %m\n");
-        ABORT ();
-    }
-
     // maybe set uid & gid now that we don't need root access any more
     if (((xgid >= 0) && (setresgid (xgid, xgid, xgid) < 0)) ||
         ((xuid >= 0) && (setresuid (xuid, xuid, xuid) < 0))) {
@@ -340,7 +485,9 @@ int main (int argc, char **argv)
     }
 
     // set up default mac address to be current mac address
+    // and have kernel pass along only packets sent to it
     memcpy (curethaddr, defethaddr, 6);
+    updatefilter ();
 
     fprintf (stderr, "z11xe: mac %02X:%02X:%02X:%02X:%02X:%02X on line %s\n",
         curethaddr[0] & 0xFF, curethaddr[0] >> 8, curethaddr[1] & 0xFF, curethaddr[1] >> 8,
@@ -357,10 +504,11 @@ int main (int argc, char **argv)
         int nulfd = open ("/dev/null", O_RDONLY);
         if (nulfd < 0) ABORT ();
 
-        char logname[84];
+        char const *loginst = z11instname ("/tmp/z11xe");
+        char logname[strlen(loginst)+84];
         time_t nowbin = time (NULL);
         struct tm nowtm = *gmtime (&nowbin);
-        sprintf (logname, "/tmp/z11xe.%04d%02d%02d%02d%02d%02d.log",
+        sprintf (logname, "%s.%04d%02d%02d%02d%02d%02d.log", loginst,
             nowtm.tm_year + 1900, nowtm.tm_mon + 1, nowtm.tm_mday,
             nowtm.tm_hour, nowtm.tm_min, nowtm.tm_sec);
         int logfd = open (logname, O_WRONLY | O_CREAT, 0666);
@@ -386,7 +534,9 @@ int main (int argc, char **argv)
     // access fpga register set for the DEUNA controller
     // lock it so we are only process accessing it
     z11page = new Z11Page ();
+    z11page->bigmemdma (true);
     xeat = z11page->findev ("XE", NULL, NULL, true, killit);
+    shmstats_init (SHMSTATS_XE);
 
     // enable board to process io instructions
     pcsr1 = DELU;   // 0=DEUNA - rsx4.5 decnet works with DELUA, not DEUNA (tries to upload mystery microcode)
@@ -496,6 +646,7 @@ static void doreset ()
     rcbisetinh = false;
     curmlt = 0;
     memcpy (curethaddr, defethaddr, 6);
+    updatefilter ();
 
     memset (&counters, 0, sizeof counters);
     counterszeroed = time (NULL);
@@ -556,6 +707,7 @@ static void getcommand_dmalkd ()
             curethaddr[0] &= 0xFFFEU;
             if (z11page->dmareadlocked (pcbaddr + 4, &curethaddr[1]) != 0) goto dmaerror;
             if (z11page->dmareadlocked (pcbaddr + 6, &curethaddr[2]) != 0) goto dmaerror;
+            updatefilter ();
             break;
         }
 
@@ -595,6 +747,7 @@ static void getcommand_dmalkd ()
                        mltaddrtable[i*3+2] & 0xFF, mltaddrtable[i*3+2] >> 8);
                 curmlt ++;
             }
+            updatefilter ();
             break;
         }
 
@@ -677,6 +830,7 @@ static void getcommand_dmalkd ()
             if (mode & 0x05F2) goto funceror;
             modebits = mode;
             if (debug > 1) fprintf (stderr, "getcommand:   modebits=%04X\n", modebits);
+            updatefilter ();
             break;
         }
 
@@ -710,6 +864,7 @@ funceror:;
 // wait for PDP to put buffers in ring then send out over ethernet
 static void *transmithread (void *dummy)
 {
+    z11page->setdmaprio (DMAPRI_NET);
     lockit ();
     transmithread_locked ();
     unlkit ();
@@ -734,101 +889,169 @@ static void transmithread_locked ()
         } else {
             if (debug > 0) fprintf (stderr, "transmithread: trlen=%u\n", ringfmt.trlen);
 
+            uint64_t startns = shmstats_nowns ();
             z11page->dmalock ();
             didsomething = transmithread_dmalkd ();
             z11page->dmaunlk ();
+            if (didsomething) shmstats_since (SHMSTATS_CMDNS, startns);
         }
     }
 }
 
 // process messages in transmit ring
+// gathers all the packets the pdp has ready (up to XMTBATCH) in one pass,
+// sends them all at once, then gives the descriptors back to the pdp
 // 'themutex' and 'dmamutex' locked on entry and exit
 // returns:
 //  false: queue was empty, nothing processed
 //   true: something was in queue, processed
 static bool transmithread_dmalkd ()
 {
+    int npkts  = 0;
+    int ndescs = 0;
     int xmtlen = -1;
-    uint16_t tdrb[4];
-    uint32_t segb;
-    uint32_t tdrpa;
-
-    // get descriptor
-    // p108
-    for (int i = 0; i < 4; i ++) {
-        if (z11page->dmareadlocked ((tdrca + i * 2) & 0777776, &tdrb[i]) != 0) goto dmaerror;
-    }
+    int stpdescs = 0;                   // ndescs at start of packet being gathered
+    uint32_t stpca = 0;                 // tdrca of its STP descriptor
+    uint32_t reldescs[XMTDESCS];        // descriptors to give back to pdp after sending
+    uint16_t relwords[XMTDESCS];        // ...and the word to write to give it back
+
+    // look at no more than one trip around the ring per pass
+    for (int nscanned = 0;; nscanned ++) {
+        uint16_t tdrb[4];
+        uint32_t segb;
+        uint32_t tdrpa;
+        Packet *xmtp = &xmtps[npkts];
+
+        // if ring exhausted in middle of a packet, leave the packet for next time
+        // back up to its STP descriptor and don't give any of its descriptors back
+        if ((nscanned >= ringfmt.trlen) && (xmtlen >= 0)) {
+            tdrca  = stpca;
+            ndescs = stpdescs;
+            xmtlen = -1;
+        }
+        if ((nscanned >= ringfmt.trlen) && (xmtlen < 0)) break;
 
-    // OWN - stop if owned by the PDP
-    if (! (tdrb[2] & OWN)) {
+        // get descriptor
+        // p108
+        for (int i = 0; i < 4; i ++) {
+            if (z11page->dmareadlocked ((tdrca + i * 2) & 0777776, &tdrb[i]) != 0) goto dmaerror;
+        }
 
-        // set TXI (transmit ring interrupt)
-        // p63/v4-7
-        writepcsr0 (TXI);       // transmitter going idle
-        return false;           // do the waittransmit() call above
-    }
+        // OWN - stop if owned by the PDP
+        if (! (tdrb[2] & OWN)) {
 
-    // increment to next ring entry, wrapping if necessary
-    tdrpa = tdrca;
-    tdrca = (tdrca + ringfmt.telen * 2) & 0777776;
-    if (((tdrca - ringfmt.tdrb) & 0777776) >= (ringfmt.trlen * ringfmt.telen * 2)) {
-        tdrca = ringfmt.tdrb;
-    }
+            // pdp hasn't finished filling in the packet, leave it for next time
+            if (xmtlen >= 0) {
+                tdrca  = stpca;
+                ndescs = stpdescs;
+                if ((npkts == 0) && (ndescs == 0)) return false;
+                break;
+            }
+            if ((npkts > 0) || (ndescs > 0)) break;
 
-    // see how many bytes in buffer and check for overflow
-    if (tdrb[2] & STP) xmtlen = 0;          // STP - start of buffer
+            // set TXI (transmit ring interrupt)
+            // p63/v4-7
+            writepcsr0 (TXI);       // transmitter going idle
+            return false;           // do the waittransmit() call above
+        }
 
-    if (xmtlen < 0) {                       // looking for start of buffer (STP)
-        if (! z11page->dmawritelocked (tdrpa + 6, tdrb[3] | BUFL)) goto dmaerror;
-        return true;                        // not found, set BUFL then check next descriptor
-    }
+        // increment to next ring entry, wrapping if necessary
+        tdrpa = tdrca;
+        tdrca = (tdrca + ringfmt.telen * 2) & 0777776;
+        if (((tdrca - ringfmt.tdrb) & 0777776) >= (ringfmt.trlen * ringfmt.telen * 2)) {
+            tdrca = ringfmt.tdrb;
+        }
 
-    if (xmtlen + tdrb[0] > (int) sizeof xmtp) { // see if message too int
-        if (! z11page->dmawritelocked (tdrpa + 6, tdrb[3] | BUFL)) goto dmaerror;
-        xmtlen = -1;                        // search for STP
-        return true;                        // if so, set BUFL then check next descriptor
-    }
+        // see how many bytes in buffer and check for overflow
+        if (tdrb[2] & STP) {                    // STP - start of buffer
+            xmtlen   = 0;
+            stpca    = tdrpa;
+            stpdescs = ndescs;
+        }
 
-    // transfer from unibus to xmtp.b
-    segb = ((uint32_t) tdrb[2] << 16) | tdrb[1];
-    while (tdrb[0] > 0) {
-        uint16_t word;
-        if (z11page->dmareadlocked (segb & 0777776, &word) != 0) {
-            if (! z11page->dmawritelocked (tdrpa + 6, tdrb[3] | UBTO)) goto dmaerror;
-            xmtlen = -1;                    // timeout reading memory, abandon this packet
-            goto relpacket;
-        }
-        if (segb & 1) {
-            xmtp.b[xmtlen++] = word >> 8;
-            segb ++;
-            tdrb[0] --;
-            continue;
+        if (xmtlen < 0) {                       // looking for start of buffer (STP)
+            if (! z11page->dmawritelocked (tdrpa + 6, tdrb[3] | BUFL)) goto dmaerror;
+            goto relpacket;                     // not found, set BUFL, give it back, check next descriptor
         }
-        if (tdrb[0] == 1) {
-            xmtp.b[xmtlen++] = word;
-            break;
+
+        if (xmtlen + tdrb[0] > (int) sizeof *xmtp) { // see if message too int
+            if (! z11page->dmawritelocked (tdrpa + 6, tdrb[3] | BUFL)) goto dmaerror;
+            xmtlen = -1;                        // search for STP
+            goto relpacket;                     // if so, set BUFL, give it back, check next descriptor
         }
-        xmtp.b[xmtlen++] = word;
-        xmtp.b[xmtlen++] = word >> 8;
-        segb += 2;
-        tdrb[0] -= 2;
-    }
 
-    // if ENP (end of packet), transmit packet
-    if (tdrb[2] & ENP) {
+        // transfer from unibus to xmtp->b
+        segb = ((uint32_t) tdrb[2] << 16) | tdrb[1];
+        while (tdrb[0] > 0) {
+            uint16_t word;
+            if (z11page->dmareadlocked (segb & 0777776, &word) != 0) {
+                if (! z11page->dmawritelocked (tdrpa + 6, tdrb[3] | UBTO)) goto dmaerror;
+                xmtlen = -1;                    // timeout reading memory, abandon this packet
+                goto relpacket;
+            }
+            if (segb & 1) {
+                xmtp->b[xmtlen++] = word >> 8;
+                segb ++;
+                tdrb[0] --;
+                continue;
+            }
+            if (tdrb[0] == 1) {
+                xmtp->b[xmtlen++] = word;
+                break;
+            }
+            xmtp->b[xmtlen++] = word;
+            xmtp->b[xmtlen++] = word >> 8;
+            segb += 2;
+            tdrb[0] -= 2;
+        }
+
+        // if ENP (end of packet), queue packet for transmission
+        if (tdrb[2] & ENP) {
+            xmtlens[npkts++] = xmtlen;
+
+            // looking for an STP (start of packet) flag for another packet to send
+            xmtlen = -1;
+        }
+
+        // about to use last descriptor slot with packet still incomplete
+        if ((xmtlen >= 0) && (ndescs == XMTDESCS - 1)) {
+            if (stpdescs > 0) {
+
+                // send what we have and re-do this packet next pass
+                tdrca  = stpca;
+                ndescs = stpdescs;
+                break;
+            }
+
+            // packet by itself needs more than XMTDESCS descriptors, treat as too long
+            // rest of its descriptors get BUFL next pass as they have no STP
+            if (! z11page->dmawritelocked (tdrpa + 6, tdrb[3] | BUFL)) goto dmaerror;
+            xmtlen = -1;
+        }
+
+        // mark packet owned by PDP once sent
+        // never give one back before then so pdp doesn't see completion of an unsent packet
+    relpacket:;
+        reldescs[ndescs] = tdrpa + 4;
+        relwords[ndescs] = tdrb[2] & ~ OWN;
+        ndescs ++;
+
+        // stop at end of packet if batch is full
+        if ((xmtlen < 0) && ((npkts == XMTBATCH) || (ndescs == XMTDESCS))) break;
+    }
 
-        // transmit xmtp (xmtlen bytes)
+    // transmit xmtps[0..npkts-1]
+    if (npkts > 0) {
         z11page->dmaunlk ();
-        transmithread_dmaulk (xmtlen);
+        transmithread_dmaulk (npkts);
         z11page->dmalock ();
-
-        // looking for an STP (start of packet) flag for another packet to send
-        xmtlen = -1;
     }
 
-    // mark packet owned by PDP
-relpacket:;
-    if (z11page->dmawritelocked (tdrpa + 4, tdrb[2] & ~ OWN)) return true;
+    // give descriptors back to pdp
+    for (int i = 0; i < ndescs; i ++) {
+        if (! z11page->dmawritelocked (reldescs[i], relwords[i])) goto dmaerror;
+    }
+    return true;
 
 dmaerror:;
     portst1 |= ERRS | TMOT | TRNG;  // transmit ring error (p96)
@@ -836,66 +1059,190 @@ dmaerror:;
     return true;
 }
 
-// send the packet out
+// send the packets out
 // 'themutex' locked on entry and exit
-static void transmithread_dmaulk (int xmtlen)
+static void transmithread_dmaulk (int npkts)
 {
-    // fill in source mac address
-    memcpy (xmtp.b + 6, curethaddr, 6);
+    for (int j = 0; j < npkts; j ++) {
+        Packet *xmtp = &xmtps[j];
+        int xmtlen = xmtlens[j];
 
-    // pad to minimum packet length
-    if ((xmtlen < MINPKTLEN) && (modebits & MODE_TPAD)) {
-        memset (xmtp.b + xmtlen, 0, MINPKTLEN - xmtlen);
-        xmtlen = MINPKTLEN;
-    }
+        // fill in source mac address
+        memcpy (xmtp->b + 6, curethaddr, 6);
+
+        // pad to minimum packet length
+        if ((xmtlen < MINPKTLEN) && (modebits & MODE_TPAD)) {
+            memset (xmtp->b + xmtlen, 0, MINPKTLEN - xmtlen);
+            xmtlens[j] = xmtlen = MINPKTLEN;
+        }
 
-    // maybe print out some bytes
-    if (debug > 1) {
-        fprintf (stderr, "transmithread: xmtlen=%d:", xmtlen);
-        for (int i = 0; (i < 20) && (i < xmtlen); i ++) {
-            fprintf (stderr, " %02X", xmtp.b[i]);
+        // maybe print out some bytes
+        if (debug > 1) {
+            fprintf (stderr, "transmithread: xmtlen=%d:", xmtlen);
+            for (int i = 0; (i < 20) && (i < xmtlen); i ++) {
+                fprintf (stderr, " %02X", xmtp->b[i]);
+            }
+            fputc ('\n', stderr);
+        }
+
+        // if loopback mode, just copy to receive queue
+        if (modebits & MODE_LOOP) {
+            gotincoming_locked (xmtp->b, xmtlen);
         }
-        fputc ('\n', stderr);
     }
 
-    // if loopback mode, just copy to receive queue
-    if (modebits & MODE_LOOP) {
-        memcpy (rcvp.b, xmtp.b, xmtlen);
-        gotincoming_locked (xmtlen);
-    } else {
+    if (! (modebits & MODE_LOOP)) {
 
-        // real transmit, releae 'themutex' (so receiver can run) while sending it
+        // real transmit, release 'themutex' (so receiver can run) while sending them
         unlkit ();
 
-        int rc = sendto (sockfd, xmtp.b, xmtlen, 0, (sockaddr const *) &sendtoaddr, sizeof sendtoaddr);
-        if (rc != xmtlen) {
-            if (rc < 0) {
-                fprintf (stderr, "z11xe: error transmitting: %m\n");
-            } else {
-                fprintf (stderr, "z11xe: only sent %d bytes of %d byte packet\n", rc, xmtlen);
-            }
-            ABORT ();
+        uint64_t startns = shmstats_nowns ();
+        switch (backend) {
+            case BE_RAW:  transmitraw  (npkts); break;
+            case BE_TAP:  transmittap  (npkts); break;
+            case BE_PCAP: transmitpcap (npkts); break;
         }
+        shmstats_since (SHMSTATS_FIONS, startns);
 
         lockit ();
     }
 
     // increment counters
-    uint32_t packetsxmtd   = counters.packetsxmtd   + 1;        // p89
-    uint32_t databytesxmtd = counters.databytesxmtd + xmtlen - 14;
-    if (packetsxmtd   < counters.packetsxmtd)   packetsxmtd   = 0xFFFFFFFFU;
-    if (databytesxmtd < counters.databytesxmtd) databytesxmtd = 0xFFFFFFFFU;
-    counters.packetsxmtd   = packetsxmtd;
-    counters.databytesxmtd = databytesxmtd;
+    for (int j = 0; j < npkts; j ++) {
+        int xmtlen = xmtlens[j];
+        shmstats_bytes (0, xmtlen);
+        uint32_t packetsxmtd   = counters.packetsxmtd   + 1;        // p89
+        uint32_t databytesxmtd = counters.databytesxmtd + xmtlen - 14;
+        if (packetsxmtd   < counters.packetsxmtd)   packetsxmtd   = 0xFFFFFFFFU;
+        if (databytesxmtd < counters.databytesxmtd) databytesxmtd = 0xFFFFFFFFU;
+        counters.packetsxmtd   = packetsxmtd;
+        counters.databytesxmtd = databytesxmtd;
+    }
+}
+
+// send packets out raw socket all with one system call
+// called with 'themutex' unlocked
+static void transmitraw (int npkts)
+{
+    struct iovec iovs[XMTBATCH];
+    struct mmsghdr msgs[XMTBATCH];
+    memset (msgs, 0, npkts * sizeof msgs[0]);
+    for (int j = 0; j < npkts; j ++) {
+        iovs[j].iov_base = xmtps[j].b;
+        iovs[j].iov_len  = xmtlens[j];
+        msgs[j].msg_hdr.msg_name    = &sendtoaddr;
+        msgs[j].msg_hdr.msg_namelen = sizeof sendtoaddr;
+        msgs[j].msg_hdr.msg_iov     = &iovs[j];
+        msgs[j].msg_hdr.msg_iovlen  = 1;
+    }
+    for (int j = 0; j < npkts;) {
+        int rc = sendmmsg (sockfd, &msgs[j], npkts - j, 0);
+        if (rc <= 0) {
+            if ((rc < 0) && (errno == EINTR)) continue;
+            fprintf (stderr, "z11xe: error transmitting: %m\n");
+            ABORT ();
+        }
+        for (int i = j; i < j + rc; i ++) {
+            if ((int) msgs[i].msg_len != xmtlens[i]) {
+                fprintf (stderr, "z11xe: only sent %u bytes of %d byte packet\n", msgs[i].msg_len, xmtlens[i]);
+                ABORT ();
+            }
+        }
+        j += rc;
+    }
+}
+
+// send packets out tap device, one write() per packet
+// called with 'themutex' unlocked
+static void transmittap (int npkts)
+{
+    for (int j = 0; j < npkts; j ++) {
+        int rc;
+        do rc = write (sockfd, xmtps[j].b, xmtlens[j]);
+        while ((rc < 0) && (errno == EINTR));
+        if (rc != xmtlens[j]) {
+            fprintf (stderr, "z11xe: error transmitting to tap: rc=%d of %d: %m\n", rc, xmtlens[j]);
+            ABORT ();
+        }
+    }
+}
+
+// record packets to pcap file all with one system call (or discard them if no -pcapout)
+// called with 'themutex' unlocked
+static void transmitpcap (int npkts)
+{
+    if (pcapoutfd < 0) return;
+
+    struct timespec nowts;
+    if (clock_gettime (CLOCK_REALTIME, &nowts) < 0) ABORT ();
+
+    PcapRec recs[XMTBATCH];
+    struct iovec iovs[XMTBATCH*2];
+    int total = 0;
+    for (int j = 0; j < npkts; j ++) {
+        recs[j].tssec   = nowts.tv_sec;
+        recs[j].tsfrac  = nowts.tv_nsec / 1000;
+        recs[j].incllen = xmtlens[j];
+        recs[j].origlen = xmtlens[j];
+        iovs[j*2+0].iov_base = &recs[j];
+        iovs[j*2+0].iov_len  = sizeof recs[j];
+        iovs[j*2+1].iov_base = xmtps[j].b;
+        iovs[j*2+1].iov_len  = xmtlens[j];
+        total += sizeof recs[j] + xmtlens[j];
+    }
+    int rc = writev (pcapoutfd, iovs, npkts * 2);
+    if (rc != total) {
+        fprintf (stderr, "z11xe: error writing pcap file: rc=%d of %d: %m\n", rc, total);
+        ABORT ();
+    }
 }
 
 //////////////////////
 //  RECEIVE THREAD  //
 //////////////////////
 
+// set up TPACKET_V3 receive ring
+//  returns false: not available, receive with read()
+//           true: ring mapped at rxring
+static bool setuprxring ()
+{
+    if (getenv ("z11norxring") != NULL) return false;
+
+    int version = TPACKET_V3;
+    if (setsockopt (sockfd, SOL_PACKET, PACKET_VERSION, &version, sizeof version) < 0) {
+        fprintf (stderr, "z11xe: error setting TPACKET_V3, receiving with read(): %m\n");
+        return false;
+    }
+
+    struct tpacket_req3 req;
+    memset (&req, 0, sizeof req);
+    req.tp_block_size = RXBLKSIZE;
+    req.tp_block_nr   = RXNBLOCKS;
+    req.tp_frame_size = RXFRMSIZE;
+    req.tp_frame_nr   = RXBLKSIZE / RXFRMSIZE * RXNBLOCKS;
+    req.tp_retire_blk_tov = RXBLKTOV;
+    if (setsockopt (sockfd, SOL_PACKET, PACKET_RX_RING, &req, sizeof req) < 0) {
+        fprintf (stderr, "z11xe: error creating receive ring, receiving with read(): %m\n");
+        return false;
+    }
+
+    void *ring = mmap (NULL, RXBLKSIZE * RXNBLOCKS, PROT_READ | PROT_WRITE, MAP_SHARED, sockfd, 0);
+    if (ring == MAP_FAILED) {
+        fprintf (stderr, "z11xe: error mapping receive ring: %m\n");
+        ABORT ();
+    }
+    rxring = (uint8_t *) ring;
+    return true;
+}
+
 // process incoming packets, passing them along to the PDP
 static void *receivethread (void *dummy)
 {
+    z11page->setdmaprio (DMAPRI_NET);
+
+    if (backend == BE_PCAP) receivepcap ();
+    if (rxring != NULL) receivering ();
+
     while (true) {
         int rc = read (sockfd, rcvp.b, sizeof rcvp.b);
         if (rc < 0) {
@@ -907,36 +1254,169 @@ static void *receivethread (void *dummy)
             continue;
         }
 
-        if (rc < MINPKTLEN) {
-            memset (rcvp.b + rc, 0, MINPKTLEN - rc);
-            rc = MINPKTLEN;
+        shmstats_bytes (rc, 0);
+
+        lockit ();
+        gotincoming_locked (rcvp.b, rc);
+        unlkit ();
+    }
+}
+
+// process incoming packets from the receive ring
+// kernel fills in a block with packets then hands it to us
+// we pass all its packets along to the pdp directly from the ring then give the block back
+static void receivering ()
+{
+    uint32_t blkidx = 0;
+    while (true) {
+        tpacket_block_desc *bd = (tpacket_block_desc *) (rxring + blkidx * RXBLKSIZE);
+
+        // wait for kernel to pass the block to us
+        while (! (__atomic_load_n (&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+            struct pollfd pfd;
+            memset (&pfd, 0, sizeof pfd);
+            pfd.fd     = sockfd;
+            pfd.events = POLLIN | POLLERR;
+            if ((poll (&pfd, 1, -1) < 0) && (errno != EINTR)) {
+                fprintf (stderr, "z11xe: error polling receive ring: %m\n");
+                ABORT ();
+            }
+        }
+
+        // process all the packets in the block with one lock
+        uint32_t npkts = bd->hdr.bh1.num_pkts;
+        uint8_t const *pkt = (uint8_t const *) bd + bd->hdr.bh1.offset_to_first_pkt;
+        lockit ();
+        for (uint32_t i = 0; i < npkts; i ++) {
+            tpacket3_hdr const *ph = (tpacket3_hdr const *) pkt;
+            int rc = ph->tp_snaplen;
+            if (rc < 14) {
+                fprintf (stderr, "z11xe: runt %d-byte packet received\n", rc);
+            } else {
+                if (rc > (int) sizeof rcvp.b) rc = sizeof rcvp.b;
+                shmstats_bytes (rc, 0);
+                gotincoming_locked (pkt + ph->tp_mac, rc);
+            }
+            pkt += ph->tp_next_offset;
         }
+        unlkit ();
+
+        // give block back to kernel
+        __atomic_store_n (&bd->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        blkidx = (blkidx + 1) % RXNBLOCKS;
+    }
+}
+
+// replay packets from pcap file as if they were received from the ethernet
+// paces them at -rate packets per second or as they were captured
+// starting when the pdp has started the port with a receive ring
+static void receivepcap ()
+{
+    static uint8_t recbuf[PCAPMAXREC];
 
+    if (pcapinfile != NULL) {
+
+        // don't start the clock until the pdp is ready to receive, else the first packets just get tossed
+        // start and polling demand commands do waketransmit()
         lockit ();
-        gotincoming_locked (rc);
+        while (! (pcsr1 & RUN) || (ringfmt.rrlen == 0)) waittransmit ();
         unlkit ();
+
+        long dataoffs = ftell (pcapinfile);
+        uint64_t npkts = 0;
+        int64_t firstns = -1;
+        struct timespec startts;
+        if (clock_gettime (CLOCK_MONOTONIC, &startts) < 0) ABORT ();
+
+        while (true) {
+            PcapRec rec;
+            if (fread (&rec, sizeof rec, 1, pcapinfile) != 1) {
+                if (ferror (pcapinfile)) {
+                    fprintf (stderr, "z11xe: error reading pcap file: %m\n");
+                    ABORT ();
+                }
+                fprintf (stderr, "z11xe: end of pcap file after %llu packets\n", (unsigned long long) npkts);
+                if (! pcaploop) break;
+                if (fseek (pcapinfile, dataoffs, SEEK_SET) < 0) ABORT ();
+                npkts   = 0;
+                firstns = -1;
+                if (clock_gettime (CLOCK_MONOTONIC, &startts) < 0) ABORT ();
+                continue;
+            }
+            if (pcapinswap) {
+                rec.tssec   = __builtin_bswap32 (rec.tssec);
+                rec.tsfrac  = __builtin_bswap32 (rec.tsfrac);
+                rec.incllen = __builtin_bswap32 (rec.incllen);
+            }
+            if ((rec.incllen > PCAPMAXREC) || (fread (recbuf, rec.incllen, 1, pcapinfile) != 1)) {
+                fprintf (stderr, "z11xe: bad or truncated pcap file record (%u bytes)\n", rec.incllen);
+                ABORT ();
+            }
+
+            // wait until it is time to inject this packet
+            int64_t delayns = 0;
+            if (pcaprate > 0) {
+                delayns = npkts * 1000000000ULL / pcaprate;
+            } else if (pcaprate < 0) {
+                int64_t recns = rec.tssec * 1000000000LL + rec.tsfrac * (pcapinnsec ? 1 : 1000);
+                if (firstns < 0) firstns = recns;
+                delayns = recns - firstns;
+            }
+            if (delayns > 0) {
+                struct timespec waitts;
+                int64_t waitns = startts.tv_nsec + delayns;
+                waitts.tv_sec  = startts.tv_sec + waitns / 1000000000;
+                waitts.tv_nsec = waitns % 1000000000;
+                while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &waitts, NULL) == EINTR) { }
+            }
+            npkts ++;
+
+            int rc = rec.incllen;
+            if (rc < 14) {
+                fprintf (stderr, "z11xe: runt %d-byte packet replayed\n", rc);
+                continue;
+            }
+            if (rc > (int) sizeof rcvp.b) rc = sizeof rcvp.b;
+
+            shmstats_bytes (rc, 0);
+
+            lockit ();
+            gotincoming_locked (recbuf, rc);
+            unlkit ();
+        }
     }
+
+    // nothing more will ever be received
+    while (true) pause ();
 }
 
 // got an incoming packet, copy to receive ring and possibly send interrupt to pdp
+// - packet can be in the kernel's receive ring so only copy it if padding is needed
 // 'themutex' locked on entry and exit
-static void gotincoming_locked (int rc)
+static void gotincoming_locked (uint8_t const *rcvbyt, int rc)
 {
     if (debug > 2) {
-        uint8_t *rcvbyt = rcvp.b;
         if (rcvbyt[12] != 0x08) {   // don't dump IPs and ARPs
             fprintf (stderr, "gotincoming: rc=%05d:", rc);
-            for (int i = 0; (i < 20) & (i < rc); i ++) fprintf (stderr, " %02X", ((uint8_t *)rcvbyt)[i]);
+            for (int i = 0; (i < 20) & (i < rc); i ++) fprintf (stderr, " %02X", rcvbyt[i]);
             fprintf (stderr, "\n");
         }
     }
 
-    if ((pcsr1 & RUN) && matchesincoming (rcvp.w)) {
+    uint16_t const *rcvwrd = (uint16_t const *) rcvbyt;
+    if ((pcsr1 & RUN) && matchesincoming (rcvwrd)) {
         if (ringfmt.rrlen == 0) {
             if (debug > 1) fprintf (stderr, "gotincoming: ring empty\n");
             if (! rcbisetinh) writepcsr0 (RCBI);
             rcbisetinh = true;  // don't set again until told to rescan ring
         } else {
+            if (rc < MINPKTLEN) {
+                memmove (rcvp.b, rcvbyt, rc);
+                memset (rcvp.b + rc, 0, MINPKTLEN - rc);
+                rcvwrd = rcvp.w;
+                rc = MINPKTLEN;
+            }
+
             uint32_t packetsrcvd   = counters.packetsrcvd   + 1;    // p89
             uint32_t databytesrcvd = counters.databytesrcvd + rc - 14;
             if (packetsrcvd   < counters.packetsrcvd)   packetsrcvd   = 0xFFFFFFFFU;
@@ -945,7 +1425,7 @@ static void gotincoming_locked (int rc)
             counters.databytesrcvd = databytesrcvd;
 
             z11page->dmalock ();
-            uint16_t status = gotincoming_dmalkd (rc);
+            uint16_t status = gotincoming_dmalkd (rcvwrd, rc);
             z11page->dmaunlk ();
 
             // set RXI (receive ring interrupt) or RCBI (receive buffer unavailable) plus INTR
@@ -957,7 +1437,7 @@ static void gotincoming_locked (int rc)
 
 // copy received packet to receive ring
 // 'themutex' and 'dmamutex' locked on entry and exit
-static uint16_t gotincoming_dmalkd (uint16_t rcvlen)
+static uint16_t gotincoming_dmalkd (uint16_t const *rcvwrd, uint16_t rcvlen)
 {
     uint16_t numbytestogo = rcvlen;
     uint16_t index  = 0;
@@ -995,7 +1475,7 @@ static uint16_t gotincoming_dmalkd (uint16_t rcvlen)
         uint16_t amountfits = (numbytestogo < (rdrb[0] & 0xFFFEU)) ? numbytestogo : (rdrb[0] & 0xFFFEU);
         uint32_t segb = (((uint32_t) rdrb[2] << 16) | rdrb[1]) & 0777776;
         for (uint16_t i = 0; i + 2 <= amountfits; i += 2) {
-            if (! z11page->dmawritelocked (segb, rcvp.w[index])) {
+            if (! z11page->dmawritelocked (segb, rcvwrd[index])) {
                 word6 |= UBTO;
                 goto badbuf;
             }
@@ -1004,7 +1484,7 @@ static uint16_t gotincoming_dmalkd (uint16_t rcvlen)
         }
         if (amountfits & 1) {
             ASSERT (amountfits == numbytestogo);
-            if (! z11page->dmawbytelocked (segb, rcvp.w[index])) {
+            if (! z11page->dmawbytelocked (segb, rcvwrd[index])) {
                 word6 |= UBTO;
             }
         }
@@ -1063,10 +1543,172 @@ static bool matchesincoming (uint16_t const *rcvwrd)
     return false;
 }
 
+// append bpf instructions that jump to accept if destination is the given mac address
+static void appendmaccheck (sock_filter *insts, int &ninsts, uint16_t const *macwrd)
+{
+    uint8_t const *macbyt = (uint8_t const *) macwrd;
+
+    // compare first 4 bytes, skip to next check if different
+    insts[ninsts++] = (sock_filter) BPF_STMT (BPF_LD | BPF_W | BPF_ABS, 0);
+    insts[ninsts++] = (sock_filter) BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K,
+        ((uint32_t) macbyt[0] << 24) | ((uint32_t) macbyt[1] << 16) | ((uint32_t) macbyt[2] << 8) | macbyt[3], 0, 2);
+
+    // compare last 2 bytes, jump to accept if same (filled in later)
+    insts[ninsts++] = (sock_filter) BPF_STMT (BPF_LD | BPF_H | BPF_ABS, 4);
+    insts[ninsts++] = (sock_filter) BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, ((uint32_t) macbyt[4] << 8) | macbyt[5], 0, 0);
+}
+
+// have kernel discard packets that matchesincoming() would reject
+// - done with a classic bpf filter on the socket so they never wake the receive thread
+// - matchesincoming() still checks in case a packet was queued before the filter changed
+// - can be disabled with envar z11nobpf
+// 'themutex' locked on entry and exit (or before threads start)
+static void updatefilter ()
+{
+    static bool disabled = getenv ("z11nobpf") != NULL;
+    if (disabled) return;
+
+    // pcap replay has no kernel to filter packets, matchesincoming() does it all
+    if (backend == BE_PCAP) return;
+
+    // max is 2 + 4 for unicast + 1 + 4 for broadcast + 4 per multicast + 2
+    sock_filter insts[13+4*MAXMLT];
+    int ninsts = 0;
+
+    if (modebits & MODE_PROM) {
+        insts[ninsts++] = (sock_filter) BPF_STMT (BPF_RET | BPF_K, 0xFFFFFFFFU);
+    } else {
+
+        // multicast bit is low bit of first byte
+        insts[ninsts++] = (sock_filter) BPF_STMT (BPF_LD | BPF_B | BPF_ABS, 0);
+        insts[ninsts++] = (sock_filter) BPF_JUMP (BPF_JMP | BPF_JSET | BPF_K, 1, 5, 0);
+
+        // unicast must be our address
+        appendmaccheck (insts, ninsts, curethaddr);
+        insts[ninsts++] = (sock_filter) BPF_STMT (BPF_RET | BPF_K, 0);
+
+        // multicast can be anything, broadcast or in table
+        if (modebits & MODE_ENAL) {
+            insts[ninsts++] = (sock_filter) BPF_STMT (BPF_RET | BPF_K, 0xFFFFFFFFU);
+        } else {
+            appendmaccheck (insts, ninsts, bdcastaddr);
+            for (uint8_t i = 0; i < curmlt; i ++) {
+                appendmaccheck (insts, ninsts, &mltaddrtable[i*3]);
+            }
+            insts[ninsts++] = (sock_filter) BPF_STMT (BPF_RET | BPF_K, 0);
+        }
+
+        // fill in jumps to accept
+        insts[ninsts] = (sock_filter) BPF_STMT (BPF_RET | BPF_K, 0xFFFFFFFFU);
+        for (int i = 0; i < ninsts; i ++) {
+            if ((insts[i].code == (BPF_JMP | BPF_JEQ | BPF_K)) && (insts[i].jf == 0)) {
+                insts[i].jt = ninsts - i - 1;
+            }
+        }
+        ninsts ++;
+    }
+    ASSERT (ninsts <= (int) (sizeof insts / sizeof insts[0]));
+
+    sock_fprog fprog;
+    fprog.len    = ninsts;
+    fprog.filter = insts;
+    if ((backend == BE_TAP) ? (ioctl (sockfd, TUNATTACHFILTER, &fprog) < 0) :
+            (setsockopt (sockfd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof fprog) < 0)) {
+        fprintf (stderr, "z11xe: error setting packet filter: %m\n");
+        disabled = true;
+    }
+}
+
 /////////////////
 //  UTILITIES  //
 /////////////////
 
+// create tap device (or attach to existing persistent one) and bring it up
+// kernel passes whole ethernet frames in each read() and write()
+static void opentap (char const *tapdev)
+{
+    sockfd = open ("/dev/net/tun", O_RDWR);
+    if (sockfd < 0) {
+        fprintf (stderr, "z11xe: error opening /dev/net/tun: %m\n");
+        ABORT ();
+    }
+
+    struct ifreq ifr;
+    memset (&ifr, 0, sizeof ifr);
+    ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+    strncpy (ifr.ifr_name, tapdev, IFNAMSIZ - 1);
+    if (ioctl (sockfd, TUNSETIFF, &ifr) < 0) {
+        fprintf (stderr, "z11xe: error attaching to tap device %s: %m\n", tapdev);
+        ABORT ();
+    }
+
+    // bring it up so kernel will send packets to us
+    // - might not have permission if persistent device owned by us, so just warn
+    int ctlfd = socket (AF_INET, SOCK_DGRAM, 0);
+    if ((ctlfd < 0) || (ioctl (ctlfd, SIOCGIFFLAGS, &ifr) < 0)) {
+        fprintf (stderr, "z11xe: error getting tap device %s flags: %m\n", tapdev);
+    } else if (! (ifr.ifr_flags & IFF_UP)) {
+        ifr.ifr_flags |= IFF_UP;
+        if (ioctl (ctlfd, SIOCSIFFLAGS, &ifr) < 0) {
+            fprintf (stderr, "z11xe: error bringing up tap device %s: %m\n", tapdev);
+        }
+    }
+    if (ctlfd >= 0) close (ctlfd);
+}
+
+// open pcap file to replay as received packets and read its header
+static void openpcapin (char const *filename)
+{
+    pcapinfile = fopen (filename, "r");
+    if (pcapinfile == NULL) {
+        fprintf (stderr, "z11xe: error opening %s: %m\n", filename);
+        ABORT ();
+    }
+
+    PcapHdr hdr;
+    if (fread (&hdr, sizeof hdr, 1, pcapinfile) != 1) {
+        fprintf (stderr, "z11xe: error reading %s header\n", filename);
+        ABORT ();
+    }
+    switch (hdr.magic) {
+        case PCAPMAGIC:   break;
+        case PCAPMAGICNS: pcapinnsec = true; break;
+        case PCAPSWAPPED: pcapinswap = true; break;
+        case PCAPSWAPDNS: pcapinswap = true; pcapinnsec = true; break;
+        default: {
+            fprintf (stderr, "z11xe: %s is not a pcap file\n", filename);
+            ABORT ();
+        }
+    }
+    if (pcapinswap) hdr.linktype = __builtin_bswap32 (hdr.linktype);
+    if (hdr.linktype != 1) {
+        fprintf (stderr, "z11xe: %s is not an ethernet pcap file (linktype %u)\n", filename, hdr.linktype);
+        ABORT ();
+    }
+}
+
+// create pcap file to record transmitted packets to and write its header
+static void openpcapout (char const *filename)
+{
+    pcapoutfd = open (filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (pcapoutfd < 0) {
+        fprintf (stderr, "z11xe: error creating %s: %m\n", filename);
+        ABORT ();
+    }
+
+    PcapHdr hdr;
+    memset (&hdr, 0, sizeof hdr);
+    hdr.magic    = PCAPMAGIC;
+    hdr.vermajor = 2;
+    hdr.verminor = 4;
+    hdr.snaplen  = PCAPMAXREC;
+    hdr.linktype = 1;
+    if (write (pcapoutfd, &hdr, sizeof hdr) != (int) sizeof hdr) {
+        fprintf (stderr, "z11xe: error writing %s header: %m\n", filename);
+        ABORT ();
+    }
+}
+
 static void writepcsr0 (uint16_t pcsr0)
 {
     ZWR(xeat[1], ((uint32_t) pcsr1 << 16) | pcsr0);
@@ -0,0 +1,2298 @@
+//    Copyright (C) Mike Rieker, Beverly, MA USA
+//    www.outerworldapps.com
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; version 2 of the License.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    EXPECT it to FAIL when someone's HeALTh or PROpeRTy is at RISk.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    http://www.gnu.org/licenses/gpl-2.0.html
+
+// native c++ version of zynq/sim1134.v for verimain
+// executes whole instructions between clock cycles instead of clocking sim1134.v state by state
+// ...follows sim1134.v exactly, including register update order, mmu aborts and fpu rounding quirks
+// memory enabled in bigmem.v with good parity is accessed directly in the memarray.v storage
+// everything else (i/o page, boot rom, parity errors, etc) is a real unibus cycle
+// ...through the MyBoard ncpu_* signals clocked by kerchunk()
+// between instructions, npr, br, halt requests and slave register accesses
+// ...are handled clock by clock just as sim1134.v does them
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "obj_dir/VMyBoard.h"
+
+#include "cpu1134.h"
+
+#define ABORT() do { fprintf (stderr, "ABORT %s %d\n", __FILE__, __LINE__); ::abort (); } while (0)
+
+typedef unsigned __int128 u128;
+
+// processor states between instructions
+#define ST_RUN   0      // executing instructions
+#define ST_HALT  1      // S_HALT
+#define ST_HALT2 2      // S_HALT2
+#define ST_NPG   3      // S_NPG
+#define ST_INTR  4      // S_INTR
+#define ST_WAIT  5      // S_EXWAIT
+
+#define T_CPUERR  0004
+#define T_ILLINST 0010
+#define T_BPTRACE 0014
+#define T_PWRFAIL 0024
+#define T_PARERR  0114
+#define T_FPUERR  0244
+#define T_MMUTRAP 0250
+
+#define YELSTKLIM 0400
+
+#define MF_RD 1     // do a DATI cycle
+#define MF_WR 2     // do a DATO[B] cycle
+#define MF_RM 3     // do a DATIP cycle
+
+#define FM_REAL 2   // zynq.v fpgamode connected to the unibus
+
+#define F_IDLE       0
+#define F_START      1
+#define F_GOT16REG   2
+#define F_GOT16ADR   3
+#define F_DID16ADR   4
+#define F_GOT32ADR   6
+#define F_DID32ADR   7
+#define F_DID32ADR2  8
+#define F_GOTFLTADR  9
+#define F_GETFLTMEM 10
+#define F_GETFLTME2 11
+#define F_GETFLTME3 12
+#define F_GETFLTME4 13
+#define F_GOTFLTVAL 14
+#define F_STCXJ     15
+#define F_STOINT16  16
+#define F_STOINT32  17
+#define F_STOINT32B 18
+#define F_GOTINTADR 19
+#define F_GOTINTMEM 20
+#define F_GOTINTME2 21
+#define F_MULSTEP   22
+#define F_MULDONE   23
+#define F_MODSTEP   24
+#define F_LDCJX     25
+#define F_MODNORM   26
+#define F_ASZER     27
+#define F_ASALN     28
+#define F_ADDEN     29
+#define F_SUBEN     30
+#define F_DIVSTEP   31
+#define F_DIVDONE   32
+#define F_STOFLTACC 33
+#define F_STOFLTMEM 34
+#define F_STOFLTME2 35
+#define F_STOFLTME3 36
+#define F_STOFLTME4 37
+
+#define FEC_ILLOP   2
+#define FEC_DIVBY0  4
+#define FEC_INTCNV  6
+#define FEC_OVERFL  8
+#define FEC_UNDRFL 10
+#define FEC_UNDVAR 12
+
+// 57-bit mantissas, [56]=hidden bit, [00]=rounding bit
+#define M57    ((1ULL << 57) - 1)
+#define B56_33 (M57 & ~ ((1ULL << 33) - 1))
+#define B32_01 ((1ULL << 33) - 2)
+#define FMASK(d) ((d) ? (M57 & ~ 1ULL) : B56_33)
+
+#define CURMODE (psw >> 14)
+#define PRVMODE ((psw >> 12) & 3)
+
+#define iHALT  (instreg == 0)
+#define iWAIT  (instreg == 1)
+#define iRTI   (instreg == 2)
+#define iBPT   (instreg == 3)
+#define iIOT   (instreg == 4)
+#define iRESET (instreg == 5)
+#define iRTT   (instreg == 6)
+#define iJMP   ((instreg & 0177700) == 0000100)
+#define iRTS   ((instreg & 0177770) == 0000200)
+#define iSWAB  ((instreg & 0177700) == 0000300)
+#define iJSR   ((instreg & 0177000) == 0004000)
+#define iCLRb  ((instreg &  077700) ==  005000)
+#define iCOMb  ((instreg &  077700) ==  005100)
+#define iINCb  ((instreg &  077700) ==  005200)
+#define iDECb  ((instreg &  077700) ==  005300)
+#define iNEGb  ((instreg &  077700) ==  005400)
+#define iADCb  ((instreg &  077700) ==  005500)
+#define iSBCb  ((instreg &  077700) ==  005600)
+#define iTSTb  ((instreg &  077700) ==  005700)
+#define iRORb  ((instreg &  077700) ==  006000)
+#define iROLb  ((instreg &  077700) ==  006100)
+#define iASRb  ((instreg &  077700) ==  006200)
+#define iASLb  ((instreg &  077700) ==  006300)
+#define iMARK  ((instreg & 0177700) == 0006400)
+#define iMTPS  ((instreg & 0177700) == 0106400)
+#define iMFPID ((instreg &  077700) ==  006500)
+#define iMTPID ((instreg &  077700) ==  006600)
+#define iSXT   ((instreg & 0177700) == 0006700)
+#define iMFPS  ((instreg & 0177700) == 0106700)
+#define iMOVb  ((instreg &  070000) ==  010000)
+#define iMOVB  ((instreg & 0170000) == 0110000)
+#define iCMPb  ((instreg &  070000) ==  020000)
+#define iBITb  ((instreg &  070000) ==  030000)
+#define iBICb  ((instreg &  070000) ==  040000)
+#define iBISb  ((instreg &  070000) ==  050000)
+#define iADD   ((instreg & 0170000) == 0060000)
+#define iSUB   ((instreg & 0170000) == 0160000)
+#define iFPU   ((instreg & 0170000) == 0170000)
+#define iMUL   ((instreg & 0177000) == 0070000)
+#define iDIV   ((instreg & 0177000) == 0071000)
+#define iASH   ((instreg & 0177000) == 0072000)
+#define iASHC  ((instreg & 0177000) == 0073000)
+#define iXOR   ((instreg & 0177000) == 0074000)
+#define iSOB   ((instreg & 0177000) == 0077000)
+#define iEMT   ((instreg & 0177400) == 0104000)
+#define iTRAP  ((instreg & 0177400) == 0104400)
+#define iBXX   (((instreg & 074000) == 0) && (((instreg >> 8) & 0207) != 0))
+#define iCCS   ((instreg & 0177740) == 0000240)
+
+#define NEEDTOREADDST  (! iMOVb && ! iCLRb && ! iMFPS && ! iSXT)
+#define NEEDTOWRITEDST (! iCMPb && ! iBITb && ! iTSTb && ! iMTPS && ! iMUL && ! iDIV && ! iASH && ! iASHC)
+#define BYTEINSTR      ((instreg & 0100000) && ! iSUB && ! iMFPID && ! iMTPID)
+
+// memory access aborted, trapvec has been set
+struct Cpu1134Abort { };
+
+// bus is being reset, abandon whatever we were doing
+struct Cpu1134Reset { };
+
+static int gprx (int mode, int regn)
+{
+    return ((regn == 6) && (mode & 2)) ? 016 : regn;
+}
+
+// odd parity bit for a byte as written by bigmem.v
+static uint32_t oddpar (uint32_t byte)
+{
+    return ~ __builtin_parity (byte) & 1;
+}
+
+// mmu page and mmr0..2 registers (sim1134.v mmpselected, mmrselected)
+static bool mmuregsel (uint32_t pa)
+{
+    return ((pa & 0777720) == 0772300) || ((pa & 0777720) == 0777600) ||
+        (((pa >> 3) == (0777570 >> 3)) && (((pa >> 1) & 3) != 0));
+}
+
+Cpu1134::Cpu1134 (VMyBoard *vmybd, uint32_t *memarray, void (*kerchunk) ())
+{
+    this->vmybd    = vmybd;
+    this->memarray = memarray;
+    this->kerchunk = kerchunk;
+
+    for (int i = 0; i < 16; i ++) {
+        gprs[i]    = 0;
+        mmupars[i] = 0;
+        mmupdrs[i] = 0;
+    }
+    mmr2      = 0;
+    instreg   = 0;
+    readdata  = 0;
+    virtaddr  = 0;
+    writedata = 0;
+    deferdinc = 0;
+    lastprx   = 0;
+    inrun     = false;
+    forcebus  = false;
+
+    memset (&f, 0, sizeof f);
+
+    bmenable  = 0;
+    bmpresent = false;
+    ctlenab   = false;
+    fpgamode  = 0;
+
+    doreset ();
+}
+
+// bigmem.v register 0 was found to be its 'BM' ident
+void Cpu1134::setbigmem (bool present)
+{
+    bmpresent = present;
+}
+
+// executing WAIT instruction
+bool Cpu1134::waiting ()
+{
+    return state == ST_WAIT;
+}
+
+// arm is writing a zynq register, track what affects direct memory access
+//  regctla[31:30] = fpgamode
+//  bigmem enable[61:00] = which 4KB pages bigmem.v answers for
+//  bigmem ctlenab = M7850 controller can force bad parity so do everything on the unibus
+void Cpu1134::armwrite (uint32_t index, uint32_t data)
+{
+    switch (index) {
+        case 1: {
+            fpgamode = data >> 30;
+            break;
+        }
+        case CPU1134_BMINDEX + 1: {
+            bmenable = (bmenable & 0x3FFFFFFF00000000ULL) | data;
+            break;
+        }
+        case CPU1134_BMINDEX + 2: {
+            bmenable = (bmenable & 0xFFFFFFFFULL) | ((uint64_t) (data & 0x3FFFFFFF) << 32);
+            break;
+        }
+        case CPU1134_BMINDEX + 5: {
+            if (data & 020) ctlenab = true;
+            break;
+        }
+    }
+}
+
+// execute up to quantum instructions then clock the fpga once
+// if not executing instructions (halted, waiting, granting, etc), just clock the fpga
+void Cpu1134::run (int quantum)
+{
+    if (state == ST_RUN) {
+        inrun = true;
+        try {
+            for (int i = 0; (i < quantum) && (state == ST_RUN) && service (); i ++) {
+                execute ();
+            }
+        } catch (Cpu1134Reset &cr) {
+        }
+        inrun = false;
+        if (resetreq) doreset ();
+    }
+    kerchunk ();
+}
+
+// fpga was just clocked
+// if between instructions, step the bus arbitration states like sim1134.v does each cycle
+void Cpu1134::clocked ()
+{
+    if (! vmybd->RESET_N || (! vmybd->bus_ac_lo_l && ! vmybd->bus_dc_lo_l)) {
+        if (inrun) resetreq = true;
+              else doreset ();
+        return;
+    }
+    if (inrun) return;
+
+    if (halted) slave ();
+
+    switch (state) {
+
+        // between quanta, take care of halt, dma and interrupt requests
+        case ST_RUN: {
+            busservice ();
+            break;
+        }
+
+        // assert hltgr to let front panel know we are halted
+        case ST_HALT: {
+            halted = true;
+            vmybd->ncpu_hltgr_h = 1;
+            if (! vmybd->bus_hltrq_l) state = ST_HALT2;
+            break;
+        }
+
+        // wait for front panel to negate hltrq
+        // if being jammed by our own hltrq, only resetting will recover
+        case ST_HALT2: {
+            if (! vmybd->bus_sack_l) {
+                vmybd->ncpu_hltgr_h = 0;
+            } else if (vmybd->bus_hltrq_l) {
+                vmybd->ncpu_hltgr_h = 0;
+                haltck = false;
+                halted = false;
+                state  = ST_RUN;
+            }
+            break;
+        }
+
+        // dma requested, stick around until dma finished
+        case ST_NPG: {
+            vmybd->ncpu_npg_h = ! vmybd->bus_npr_l;
+            if (vmybd->bus_bbsy_l && vmybd->bus_npr_l && vmybd->bus_sack_l) state = ST_RUN;
+            break;
+        }
+
+        // something is interrupting, grant has been sent
+        // get interrupt vector while waiting for cycle to complete
+        case ST_INTR: {
+            uint8_t bg = vmybd->ncpu_bg_h;
+            if (! vmybd->bus_sack_l) vmybd->ncpu_bg_h = 0;
+            if (vmybd->bus_intr_l) {
+                vmybd->ncpu_ssyn_l = 1;
+                intrdelay = 0;
+            } else if (intrdelay != 7) {
+                intrdelay ++;
+            } else if (vmybd->ncpu_ssyn_l) {
+                vmybd->ncpu_ssyn_l = 0;
+                intrdelay = 0;
+                trapvec   = ~ vmybd->bus_d_l;
+            }
+            if (vmybd->bus_bbsy_l && vmybd->bus_intr_l && vmybd->bus_sack_l && ((bg & ~ vmybd->bus_br_l & 15) == 0)) {
+                state = ST_RUN;
+            }
+            break;
+        }
+
+        // wait for interrupt or halt, process nprs meanwhile
+        case ST_WAIT: {
+            bool intrqst = false;
+            for (int lvl = 4; lvl <= 7; lvl ++) {
+                if (! ((vmybd->bus_br_l >> (lvl - 4)) & 1) && (((psw >> 5) & 7) < lvl)) intrqst = true;
+            }
+            if (((psw & 020) || intrqst) && ! vmybd->ncpu_npg_h) {
+                state = ST_RUN;
+            } else if (! vmybd->bus_hltrq_l && ! vmybd->ncpu_npg_h) {
+                gprs[7] -= 2;
+                state = ST_RUN;
+            } else {
+                vmybd->ncpu_npg_h = ! vmybd->bus_npr_l;
+            }
+            break;
+        }
+    }
+
+    // if AC power is good, arm to detect AC power failure
+    if (vmybd->bus_ac_lo_l) aclock = true;
+}
+
+// powering up or unibus power failed
+void Cpu1134::doreset ()
+{
+    vmybd->ncpu_a_l     = 0777777;
+    vmybd->ncpu_c_l     = 3;
+    vmybd->ncpu_d_l     = 0177777;
+    vmybd->ncpu_msyn_l  = 1;
+    vmybd->ncpu_ssyn_l  = 1;
+    vmybd->ncpu_bg_h    = 0;
+    vmybd->ncpu_bbsy_l  = 1;
+    vmybd->ncpu_init_l  = 0;
+    vmybd->ncpu_npg_h   = 0;
+    vmybd->ncpu_hltrq_l = 1;
+    vmybd->ncpu_hltgr_h = 0;
+
+    aclock     = false;         // don't check AC_LO when powering up
+    cpuerr     = 0;             // haven't had any trap 4s yet
+    f.fpust    = F_IDLE;        // fpu idle
+    haltck     = true;          // check for halt when we get going
+    halted     = false;         // starting out by reading power-up vector
+    intrdelay  = 0;             // set up to be ready to receive interrupt vector
+    mmr0       = 0;             // not using mmu to begin with
+    nopushpspc = true;          // don't push PC/PS when doing power-up trap
+    psw        = 0340;          // start in kernel mode with ints disabled
+    resetreq   = false;
+    state      = ST_RUN;        // start out doing power-up trap after releasing init
+    traceck    = true;          // check T-bit
+    trapping   = false;         // not currently doing a trap
+    trapvec    = T_PWRFAIL;     // start out doing power-up trap
+    yellowck   = false;         // don't check yellow stack
+}
+
+// end of instruction, figure out what to do next (S_SERVICE)
+// returns true: fetch next instruction
+//        false: state changed to something other than executing instructions
+bool Cpu1134::service ()
+{
+    while (true) {
+        vmybd->ncpu_init_l = 1;
+
+        // do traps caused by instruction before checking halt switch
+        if (trapvec != 0) {
+            yellowck = true;
+        } else if (yellowck && (CURMODE == 0) && (gprs[6] < YELSTKLIM)) {
+            cpuerr  |= 010;
+            trapvec  = T_CPUERR;
+            yellowck = false;
+        }
+
+        // maybe power just failed
+        else if (aclock && ! vmybd->bus_ac_lo_l) {
+            aclock   = false;
+            trapvec  = T_PWRFAIL;
+            yellowck = true;
+        }
+
+        // halt, dma, interrupt
+        else if (busservice ()) {
+            return false;
+        }
+
+        // check instruction trace
+        else if (traceck && (psw & 020)) {
+            trapvec  = T_BPTRACE;
+            yellowck = true;
+        }
+
+        // nothing special, fetch next instruction
+        else {
+            haltck  = true;
+            traceck = true;
+            if (vmybd->bus_ac_lo_l) aclock = true;
+            return true;
+        }
+
+        haltck  = true;
+        traceck = true;
+        if (vmybd->bus_ac_lo_l) aclock = true;
+
+        try {
+            dotrap ();
+        } catch (Cpu1134Abort &ca) {
+        }
+        if (state != ST_RUN) return false;
+    }
+}
+
+// check for halt, dma and interrupt requests
+// only if there is no trap pending, otherwise leave it for service()
+// returns true iff state changed
+bool Cpu1134::busservice ()
+{
+    if (trapvec != 0) return false;
+    if (yellowck && (CURMODE == 0) && (gprs[6] < YELSTKLIM)) return false;
+    if (aclock && ! vmybd->bus_ac_lo_l) return false;
+
+    // check halt switch
+    // suppressed first cycle after continuing from halt for single stepping
+    if (haltck && ! vmybd->bus_hltrq_l) {
+        state = ST_HALT;
+    }
+
+    // check dma
+    else if (vmybd->bus_sack_l && ! vmybd->bus_npr_l) {
+        state = ST_NPG;
+    }
+
+    // check interrupts
+    else {
+        if (! vmybd->bus_sack_l) return false;
+        int lvl;
+        for (lvl = 7; lvl >= 4; -- lvl) {
+            if (! ((vmybd->bus_br_l >> (lvl - 4)) & 1) && (((psw >> 5) & 7) < lvl)) break;
+        }
+        if (lvl < 4) return false;
+        vmybd->ncpu_bg_h = 1 << (lvl - 4);
+        state = ST_INTR;
+    }
+
+    haltck  = true;
+    traceck = true;
+    return true;
+}
+
+// do trap via trapvec (S_TRAP..S_TRAP5)
+// - trapping = 0 : wasn't doing a trap, so it's ok to do a trap
+//              1 : trapped while doing a trap (double-fault), halt
+void Cpu1134::dotrap ()
+{
+    if (trapping) {
+        state    = ST_HALT;
+        trapping = false;
+        trapvec  = 0;
+        return;
+    }
+
+    uint16_t vec = trapvec & 0374;
+    trapping = (trapvec == T_CPUERR) || (trapvec == T_MMUTRAP);
+    trapvec  = 0;
+
+    // power-up vector always goes out on the unibus so bigmem.v can jam the boot rom address
+    bool reloc = mmr0 & 1;
+    forcebus = nopushpspc;
+    uint16_t newpc, newps;
+    try {
+        newpc = memread (vec,     0, reloc, false, MF_RD);
+        newps = memread (vec | 2, 0, reloc, false, MF_RD);
+    } catch (...) {
+        forcebus = false;
+        throw;
+    }
+    forcebus = false;
+
+    if (nopushpspc) {
+        nopushpspc = false;
+        psw = newps;
+    } else {
+        int newmode = newps >> 14;
+        int spx = gprx (newmode, 6);
+        gprs[spx] -= 2;
+        trapping = newmode == 0;
+        memwrite (gprs[spx], newmode, reloc, false, psw);
+
+        // activate new PS even if the push PC causes a nested fault
+        gprs[spx] -= 2;
+        psw = (newps & 0140000) | ((psw >> 2) & 0030000) | (psw & 0007400) | (newps & 0000377);
+        memwrite (gprs[spx], newmode, reloc, false, gprs[7]);
+    }
+
+    gprs[7]  = newpc;
+    trapping = false;
+}
+
+// halted, answer unibus accesses to our registers
+void Cpu1134::slave ()
+{
+    uint32_t pa = ~ vmybd->bus_a_l & 0777777;
+    int cl = vmybd->bus_c_l;
+    if (! ownreg (pa, true)) return;
+    if (((pa >> 4) == (0777700 >> 4)) && (cl == 0)) return;
+
+    if (vmybd->bus_msyn_l) {
+        vmybd->ncpu_d_l    = 0177777;
+        vmybd->ncpu_ssyn_l = 1;
+    } else if (vmybd->ncpu_ssyn_l) {
+        if (cl & 2) {
+            vmybd->ncpu_d_l = ~ ownread (pa) & 0177777;
+        } else {
+            ownwrite (pa, ! (cl & 1), ~ vmybd->bus_d_l & 0177777);
+        }
+        vmybd->ncpu_ssyn_l = 0;
+    }
+}
+
+// registers this processor answers unibus accesses for
+// sim1134.v answers its own bus cycles to these so we process them internally
+bool Cpu1134::ownreg (uint32_t pa, bool halt)
+{
+    if (mmuregsel (pa)) return true;
+    if (halt && ((pa >> 4) == (0777700 >> 4))) return true;
+    return (pa >> 1) == (0777776 >> 1);
+}
+
+uint16_t Cpu1134::ownread (uint32_t pa)
+{
+    if (((pa & 0777720) == 0772300) || ((pa & 0777720) == 0777600)) {
+        int prbi = (((pa >> 6) & 1) ^ 1) << 3 | ((pa >> 1) & 7);
+        return (pa & 040) ? (mmupars[prbi] & 007777) : (mmupdrs[prbi] & 077516);
+    }
+    if ((pa >> 3) == (0777570 >> 3)) {
+        switch ((pa >> 1) & 3) {
+            case 1: return mmr0;
+            case 3: return mmr2;
+        }
+        return 0;
+    }
+    if ((pa >> 4) == (0777700 >> 4)) return gprs[pa&15];
+    return psw;
+}
+
+void Cpu1134::ownwrite (uint32_t pa, bool byte, uint16_t data)
+{
+    bool hi = ! byte ||   (pa & 1);
+    bool lo = ! byte || ! (pa & 1);
+
+    if (((pa & 0777720) == 0772300) || ((pa & 0777720) == 0777600)) {
+        int prbi = (((pa >> 6) & 1) ^ 1) << 3 | ((pa >> 1) & 7);
+        mmupdrs[prbi] &= ~ 0100;        // always clear W bit
+        if (pa & 040) {
+            if (hi) mmupars[prbi] = (mmupars[prbi] & ~ 007400) | (data & 007400);
+            if (lo) mmupars[prbi] = (mmupars[prbi] & ~ 000377) | (data & 000377);
+        } else {
+            if (hi) mmupdrs[prbi] = (mmupdrs[prbi] & ~ 077400) | (data & 077400);
+            if (lo) mmupdrs[prbi] = (mmupdrs[prbi] & ~ 000016) | (data & 000016);
+        }
+    } else if ((pa >> 3) == (0777570 >> 3)) {
+        if (((pa >> 1) & 3) == 1) {
+            if (hi) mmr0 = (mmr0 & 000377) | (data & 0160400);
+            if (lo) mmr0 = (mmr0 & ~ 1) | (data & 1);
+        }
+    } else if ((pa >> 4) == (0777700 >> 4)) {
+        gprs[pa&15] = data;
+    } else {
+        if (hi) psw = (psw & ~ 0170000) | (data & 0170000);
+        if (lo) psw = (psw & ~ 0000357) | (data & 0000357);
+    }
+}
+
+// fetch, decode and execute one instruction
+void Cpu1134::execute ()
+{
+    try {
+        yellowck = false;
+        uint16_t pc = gprs[7];
+        uint16_t opcode = memread (pc, CURMODE, mmr0 & 1, false, MF_RD);
+        if ((mmr0 & 0160000) == 0) mmr2 = pc;
+        gprs[7] = pc + 2;
+        instreg = opcode;
+
+        int cspx = gprx (CURMODE, 6);
+        int dstx = gprx (CURMODE, instreg & 7);
+        int srcx = gprx (CURMODE, (instreg >> 6) & 7);
+
+        // have both SS and DD fields
+        // pretend MTPI/D has an SS field of (SP)+
+        if (iMOVb || iCMPb || iBITb || iBICb || iBISb || iADD || iSUB || iMTPID) {
+            getsrc ();
+        }
+
+        // have DD field, may also have R field
+        else if (iCLRb  || iCOMb  || iINCb || iDECb || iNEGb || iADCb ||
+                 iSBCb  || iTSTb  || iROLb || iRORb || iASRb || iASLb ||
+                 iMFPID || iSXT   || iMUL  || iDIV  || iASH  || iASHC ||
+                 iXOR   || iJSR   || iJMP  || iSWAB || iMFPS || iMTPS) {
+            deferdinc = 0;
+            getdst (0);
+        }
+
+        // rts pc: pop => pc
+        //   else: rd  => pc
+        //         pop => rd
+        else if (iRTS) {
+            uint16_t rd = memread (gprs[cspx], CURMODE, mmr0 & 1, false, MF_RD);
+            uint16_t olddst = gprs[dstx];
+            if (cspx != dstx) gprs[cspx] += 2;
+            if ((instreg & 7) != 7) gprs[7] = olddst;
+            gprs[dstx] = rd;
+        }
+
+        else if (iEMT || iTRAP || iBPT || iIOT) {
+            trapvec = iBPT ? 0014 : iIOT ? 0020 : iEMT ? 0030 : 0034;
+        }
+
+        // if branch condition is true, add displacement to PC
+        else if (iBXX) {
+            bool brtemp = false;
+            switch (((instreg >> 13) & 4) | ((instreg >> 9) & 3)) {
+                case 0: brtemp = false; break;
+                case 1: brtemp = ! (psw & 4); break;                                    // BNE
+                case 2: brtemp = ! (((psw >> 3) ^ (psw >> 1)) & 1); break;              // BGE
+                case 3: brtemp = ! (((psw >> 3) ^ (psw >> 1)) & 1) && ! (psw & 4); break;  // BGT
+                case 4: brtemp = ! (psw & 8); break;                                    // BPL
+                case 5: brtemp = ! (psw & 4) && ! (psw & 1); break;                     // BHI
+                case 6: brtemp = ! (psw & 2); break;                                    // BVC
+                case 7: brtemp = ! (psw & 1); break;                                    // BCC/BHIS
+            }
+            if (brtemp ^ ((instreg >> 8) & 1)) gprs[7] += (uint16_t) ((int8_t) (instreg & 0377) * 2);
+        }
+
+        // RTI/RTT
+        else if (iRTI || iRTT) {
+            uint16_t sp = gprs[cspx];
+            uint16_t newpc = memread (sp, CURMODE, mmr0 & 1, false, MF_RD);
+            gprs[cspx] = sp + 2;
+            uint16_t newps = memread (sp + 2, CURMODE, mmr0 & 1, false, MF_RD);
+            gprs[cspx] += 2;
+            gprs[7] = newpc;
+            if (CURMODE == 0) psw = (psw & ~ 0170340) | (newps & 0170340);
+            psw = (psw & ~ 037) | (newps & 037);
+            traceck = ! (instreg & 4);
+        }
+
+        // subtract one and branch if non-zero
+        else if (iSOB) {
+            uint16_t oldsrc = gprs[srcx];
+            uint16_t oldpc  = gprs[7];
+            gprs[srcx] = oldsrc - 1;
+            if (oldsrc != 1) gprs[7] = oldpc - ((instreg & 077) << 1);
+        }
+
+        // marked stack return
+        else if (iMARK) {
+            uint16_t oldpc = gprs[7];
+            uint16_t nn2   = (instreg & 077) << 1;
+            gprs[7]    = gprs[5];
+            gprs[cspx] = oldpc + nn2 + 2;
+            gprs[5]    = memread (oldpc + nn2, CURMODE, mmr0 & 1, false, MF_RD);
+        }
+
+        // set or clear condition code(s)
+        else if (iCCS) {
+            if (instreg & 020) psw |= instreg & 017;
+                          else psw &= ~ (instreg & 017);
+        }
+
+        else if (iHALT) {
+            if (CURMODE == 0) {
+                vmybd->ncpu_hltrq_l = 0;
+                state = ST_HALT;
+            } else {
+                cpuerr |= 0200;
+                trapvec = T_ILLINST;
+            }
+        }
+
+        else if (iWAIT) {
+            state = ST_WAIT;
+        }
+
+        // reset bus for 100 cycles like sim1134.v does in turbo mode
+        else if (iRESET) {
+            if (CURMODE == 0) {
+                vmybd->ncpu_init_l = 0;
+                for (int i = 0; i < 100; i ++) buskerchunk ();
+                vmybd->ncpu_init_l = 1;
+                ldfps (f, 0);
+                mmr0 = 0;
+            }
+        }
+
+        else if (iFPU) {
+            f.fpust = F_START;
+            while (f.fpust != F_IDLE) {
+                if ((trapvec != 0) && (trapvec != T_FPUERR)) {
+                    f.fpust = F_IDLE;
+                } else {
+                    fpustep ();
+                }
+            }
+        }
+
+        // illegal opcode
+        else {
+            trapvec = T_ILLINST;
+        }
+    } catch (Cpu1134Abort &ca) {
+        f.fpust = F_IDLE;
+    }
+}
+
+// start getting source operand
+void Cpu1134::getsrc ()
+{
+    bool byte = BYTEINSTR;
+    int srcx  = gprx (CURMODE, (instreg >> 6) & 7);
+    uint16_t srcval;
+
+    deferdinc = 0;
+    if ((instreg & 07000) == 0) {
+        srcval = byte ? (gprs[srcx] & 0377) << 8 : gprs[srcx];
+    } else {
+        uint16_t va = getopaddr (iMTPID ? 026 : (instreg >> 6) & 077, (byte && ((instreg & 0600) != 0600)) ? 1 : 2);
+        uint16_t rd = memread (va, CURMODE, mmr0 & 1, byte, MF_RD);
+        gprs[srcx] += deferdinc;
+        srcval = byte ? (rd & 0377) << 8 : rd;
+    }
+
+    deferdinc = 0;
+    getdst (srcval);
+}
+
+// get destination operand then execute
+void Cpu1134::getdst (uint16_t srcval)
+{
+    bool byte = BYTEINSTR;
+    int dstx  = gprx (CURMODE, instreg & 7);
+    uint16_t dstval;
+
+    if ((instreg & 070) == 0) {
+        if (iJMP || iJSR) {
+            trapvec = T_CPUERR;
+            return;
+        }
+        if (iMFPID) {
+            exmfpi ();
+            return;
+        }
+        if (iMTPID) {
+            exmtpi (srcval);
+            return;
+        }
+        dstval = byte ? (gprs[dstx] & 0377) << 8 : gprs[dstx];
+    } else {
+        virtaddr = getopaddr (instreg & 077, (byte && ((instreg & 6) != 6)) ? 1 : 2);
+
+        // jump to destination address
+        if (iJMP) {
+            gprs[dstx] += deferdinc;
+            gprs[7] = virtaddr;
+            return;
+        }
+
+        // push register on stack, save return address and jump
+        if (iJSR) {
+            gprs[dstx] += deferdinc;
+            uint16_t target = virtaddr;
+            int cspx = gprx (CURMODE, 6);
+            int srcx = gprx (CURMODE, (instreg >> 6) & 7);
+            uint16_t oldsrc = gprs[srcx];
+            gprs[cspx] -= 2;
+            memwrite (gprs[cspx], CURMODE, mmr0 & 1, false, oldsrc);
+            if (((instreg >> 6) & 7) != 7) gprs[srcx] = gprs[7];
+            gprs[7] = target;
+            return;
+        }
+
+        if (iMFPID) {
+            exmfpi ();
+            return;
+        }
+        if (iMTPID) {
+            exmtpi (srcval);
+            return;
+        }
+
+        // write-only instructions leave dstval with whatever stale readdata there is
+        if (NEEDTOREADDST) {
+            memread (virtaddr, CURMODE, (mmr0 & 0401) != 0, byte, NEEDTOWRITEDST ? MF_RM : MF_RD);
+        }
+        dstval = byte ? (readdata & 0377) << 8 : readdata;
+    }
+
+    execdd (srcval, dstval);
+}
+
+// do arithmetic to compute new destination value then write it
+//    dstval = old dst value if any (byte value in top 8 bits, bottom 8 bits zero)
+//    srcval = src value if any (byte value in top 8 bits, bottom 8 bits zero)
+//  virtaddr = dst virtual address if any
+void Cpu1134::execdd (uint16_t srcval, uint16_t dstval)
+{
+    bool byte = BYTEINSTR;
+    int dstx  = gprx (CURMODE, instreg & 7);
+    int srcx  = gprx (CURMODE, (instreg >> 6) & 7);
+
+    if (iMUL || iDIV || iASH || iASHC || iMTPS) {
+        gprs[dstx] += deferdinc;
+        if (iMUL)  exmul (dstval);
+        if (iDIV)  exdiv (dstval);
+        if (iASH)  exash (dstval);
+        if (iASHC) exashc (dstval);
+        if (iMTPS) {
+            psw = (psw & ~ 017) | ((dstval >> 8) & 017);
+            if (CURMODE == 0) psw = (psw & ~ 0340) | ((dstval >> 8) & 0340);
+        }
+        return;
+    }
+
+    uint16_t oneval = byte ? 256 : 1;
+    bool c = psw & 1;
+    uint16_t result = 0;
+         if (iMOVb) result = srcval;
+    else if (iCMPb) result = srcval - dstval;
+    else if (iBITb) result = srcval & dstval;
+    else if (iBICb) result = dstval & ~ srcval;
+    else if (iBISb) result = dstval | srcval;
+    else if (iADD)  result = dstval + srcval;
+    else if (iSUB)  result = dstval - srcval;
+    else if (iCLRb) result = 0;
+    else if (iCOMb) result = (instreg & 0100000) ? (~ dstval & 0177400) : ~ dstval;
+    else if (iINCb) result = dstval + oneval;
+    else if (iDECb) result = dstval - oneval;
+    else if (iNEGb) result = - dstval;
+    else if (iADCb) result = dstval + (c ? oneval : 0);
+    else if (iSBCb) result = dstval - (c ? oneval : 0);
+    else if (iTSTb) result = dstval;
+    else if (iRORb) result = (c << 15) | ((instreg & 0100000) ? ((dstval >> 1) & 077400) : (dstval >> 1));
+    else if (iROLb) result = (instreg & 0100000) ? (((dstval << 1) & 0177000) | (c << 8)) : ((dstval << 1) | c);
+    else if (iASRb) result = (dstval & 0100000) | ((instreg & 0100000) ? ((dstval >> 1) & 077400) : (dstval >> 1));
+    else if (iASLb) result = dstval << 1;
+    else if (iSXT)  result = (psw & 010) ? 0177777 : 0;
+    else if (iXOR)  result = dstval ^ gprs[srcx];
+    else if (iSWAB) result = (dstval << 8) | (dstval >> 8);
+    else if (iMFPS) result = (psw & 0377) << 8;
+
+    // update condition codes
+    bool s15 = srcval >> 15;
+    bool d15 = dstval >> 15;
+    bool r15 = result >> 15;
+    if (iSWAB) {
+        psw = (psw & ~ 017) | ((result & 0200) ? 010 : 0) | (((result & 0377) == 0) ? 004 : 0);
+    } else {
+        psw = (psw & ~ 014) | (r15 << 3) | ((result == 0) << 2);
+        int vc = -1;
+        bool lo = (instreg & 0100000) ? ((dstval >> 8) & 1) : (dstval & 1);
+             if (iCMPb) vc = (((s15 ^ d15) & (! r15 ^ d15)) << 1) | (srcval < dstval);
+        else if (iADD)  vc = (((! s15 ^ d15) & (r15 ^ d15)) << 1) | (result < dstval);
+        else if (iSUB)  vc = (((s15 ^ d15) & (! r15 ^ s15)) << 1) | (srcval > dstval);
+        else if (iCLRb) vc = 0;
+        else if (iCOMb) vc = 1;
+        else if (iINCb) psw = (psw & ~ 2) | ((! d15 & r15) << 1);
+        else if (iDECb) psw = (psw & ~ 2) | ((d15 & ! r15) << 1);
+        else if (iNEGb) vc = ((d15 & r15) << 1) | (result != 0);
+        else if (iADCb) vc = ((! d15 & r15) << 1) | (d15 & ! r15);
+        else if (iSBCb) vc = ((d15 & ! r15) << 1) | (! d15 & r15);
+        else if (iTSTb) vc = 0;
+        else if (iRORb) vc = ((r15 ^ lo) << 1) | lo;
+        else if (iROLb) vc = ((r15 ^ d15) << 1) | d15;
+        else if (iASRb) vc = ((r15 ^ lo) << 1) | lo;
+        else if (iASLb) vc = ((r15 ^ d15) << 1) | d15;
+                   else psw &= ~ 2;
+        if (vc >= 0) psw = (psw & ~ 3) | vc;
+    }
+
+    // write dst register or start writing dst memory
+    // if writing to 777776 (psw), the result supercedes the condition codes
+    if (NEEDTOWRITEDST) {
+        if ((instreg & 070) == 0) {
+            if (iMOVB || iMFPS) {
+                gprs[dstx] = (uint16_t) (int16_t) (int8_t) (result >> 8);
+            } else if (byte) {
+                gprs[dstx] = (gprs[dstx] & 0177400) | (result >> 8);
+            } else {
+                gprs[dstx] = result;
+            }
+        } else {
+            memwrite (virtaddr, CURMODE, (mmr0 & 0401) != 0, byte, byte ? (result >> 8) : result);
+        }
+    }
+
+    // dst memory access complete, do deferred post increment
+    gprs[dstx] += deferdinc;
+}
+
+// move from previous address space
+//  virtaddr = address in previous space
+void Cpu1134::exmfpi ()
+{
+    int dstx = gprx (CURMODE, instreg & 7);
+    uint16_t rd;
+    if ((instreg & 070) == 0) {
+        rd = gprs[gprx(PRVMODE,instreg&7)];
+    } else {
+        rd = memread (virtaddr, PRVMODE, (mmr0 & 0401) != 0, false, MF_RD);
+    }
+    gprs[dstx] += deferdinc;
+    psw = (psw & ~ 016) | ((rd >> 12) & 010) | ((rd == 0) ? 004 : 0);
+    int cspx = gprx (CURMODE, 6);
+    gprs[cspx] -= 2;
+    yellowck = true;
+    memwrite (gprs[cspx], CURMODE, mmr0 & 1, false, rd);
+}
+
+// move from current stack to previous address space
+//  srcval = value popped from current stack
+//  virtaddr = address in previous space
+void Cpu1134::exmtpi (uint16_t srcval)
+{
+    psw = (psw & ~ 016) | ((srcval >> 12) & 010) | ((srcval == 0) ? 004 : 0);
+    if ((instreg & 070) == 0) {
+        gprs[gprx(PRVMODE,instreg&7)] = srcval;
+    } else {
+        memwrite (virtaddr, PRVMODE, (mmr0 & 0401) != 0, false, srcval);
+        gprs[gprx(CURMODE,instreg&7)] += deferdinc;
+    }
+}
+
+// MUL
+//  dstval = multiplier
+//  instreg[08:06] = multiplicand; destination register
+void Cpu1134::exmul (uint16_t dstval)
+{
+    int srcx  = gprx (CURMODE, (instreg >> 6) & 7);
+    int srcx1 = gprx (CURMODE, ((instreg >> 6) & 7) | 1);
+    uint16_t srcval = gprs[srcx];
+    uint32_t a = (dstval & 0100000) ? (uint16_t) - dstval : dstval;
+    uint32_t b = (srcval & 0100000) ? (uint16_t) - srcval : srcval;
+    uint32_t product = a * b;
+    if ((dstval ^ srcval) & 0100000) product = - product;
+    uint32_t top = product >> 15;
+    psw = (psw & ~ 017) | ((product >> 28) & 010) | ((product == 0) ? 004 : 0) | ((top != 0) && (top != 0377777));
+    if (! (instreg & 0100)) gprs[srcx] = product >> 16;
+    gprs[srcx1] = product;
+}
+
+// DIV
+//  dstval = divisor
+//  instreg[08:06] = dividend; destination register
+void Cpu1134::exdiv (uint16_t dstval)
+{
+    int srcx  = gprx (CURMODE, (instreg >> 6) & 7);
+    int srcx1 = gprx (CURMODE, ((instreg >> 6) & 7) | 1);
+
+    if (dstval == 0) {
+        psw = (psw & ~ 017) | 003;
+        return;
+    }
+
+    uint32_t product = ((uint32_t) gprs[srcx] << 16) | gprs[srcx1];
+    psw &= ~ 017;
+
+    bool dvdneg  = product >> 31;
+    bool signbit = dvdneg ^ (dstval >> 15);
+    uint32_t divisor = (dstval & 0100000) ? (uint16_t) - dstval : dstval;
+    if (dvdneg) product = - product;
+
+    // compare dividend[31:15] to 1'b0,divisor[15:00]
+    // shift in a 0 or 1 quotient bit
+    bool v = false;
+    for (int i = 0; i < 16; i ++) {
+        uint32_t divdiff = ((product >> 15) - divisor) & 0777777;
+        if (divdiff & 0400000) {
+            product <<= 1;
+        } else {
+            product = ((divdiff & 0177777) << 16) | ((product & 077777) << 1) | 1;
+            v |= (divdiff >> 16) & 1;
+        }
+    }
+
+    // product[31:16] = unsigned remainder
+    // product[15:00] = unsigned quotient
+    uint16_t quo = product;
+    uint16_t rem = product >> 16;
+    v |= (quo & 0100000) && (quo & 077777);
+    psw |= ((signbit && (quo != 0)) ? 010 : 0) | ((quo == 0) ? 004 : 0) | (v ? 002 : 0);
+    gprs[srcx]  = signbit ? - quo : quo;
+    gprs[srcx1] = dvdneg  ? - rem : rem;
+}
+
+// ASH
+//  dstval[5:0] = shift count
+//  instreg[08:06] = operand; destination register
+void Cpu1134::exash (uint16_t dstval)
+{
+    int srcx = gprx (CURMODE, (instreg >> 6) & 7);
+    uint32_t product = (uint32_t) gprs[srcx] << 16;
+    psw &= ~ 002;
+    int count = dstval & 077;
+    if (count & 040) {
+        for (int i = count & 037; i < 32; i ++) {
+            psw = (psw & ~ 1) | ((product >> 16) & 1);
+            product = (product & 0x80000000U) | ((product >> 1) & 0x7FFF0000U);
+        }
+    } else {
+        for (int i = count; i > 0; -- i) {
+            psw = (psw & ~ 1) | (product >> 31) | ((((product >> 31) ^ (product >> 30)) & 1) << 1);
+            product = (product << 1) & 0xFFFF0000U;
+        }
+    }
+    gprs[srcx] = product >> 16;
+    psw = (psw & ~ 014) | ((product >> 28) & 010) | (((product >> 16) == 0) ? 004 : 0);
+}
+
+// ASHC
+//  dstval[5:0] = shift count
+//  instreg[08:06] = operand; destination register
+void Cpu1134::exashc (uint16_t dstval)
+{
+    int srcx  = gprx (CURMODE, (instreg >> 6) & 7);
+    int srcx1 = gprx (CURMODE, ((instreg >> 6) & 7) | 1);
+    uint32_t product = ((uint32_t) gprs[srcx] << 16) | gprs[srcx1];
+    psw &= ~ 002;
+    int count = dstval & 077;
+    if (count & 040) {
+        for (int i = count & 037; i < 32; i ++) {
+            psw = (psw & ~ 1) | (product & 1);
+            product = (product & 0x80000000U) | (product >> 1);
+        }
+    } else {
+        for (int i = count; i > 0; -- i) {
+            psw = (psw & ~ 1) | (product >> 31) | ((((product >> 31) ^ (product >> 30)) & 1) << 1);
+            product <<= 1;
+        }
+    }
+    gprs[srcx]  = product >> 16;
+    gprs[srcx1] = product;
+    psw = (psw & ~ 014) | ((product >> 28) & 010) | ((product == 0) ? 004 : 0);
+}
+
+// get non-register operand address
+//  input:
+//   deferdinc = 0
+//   mode = 6-bit operand address mode & register
+//   inc  = amount to increment/decrement register by for modes 2,4
+//  output:
+//   deferdinc = 0 : no deferred register increment
+//            else : increment register by this much after memory access succeeds
+//   returns operand address
+uint16_t Cpu1134::getopaddr (int mode, uint16_t inc)
+{
+    int gx = gprx (CURMODE, mode & 7);
+    switch ((mode >> 3) & 7) {
+
+        // simple indirect - use registers contents as address
+        case 1: {
+            return gprs[gx];
+        }
+
+        // autoincrement possibly with indirect
+        case 2: case 3: {
+            uint16_t va = gprs[gx];
+            if (mode & 010) {
+                uint16_t rd = memread (va, CURMODE, mmr0 & 1, false, MF_RD);
+                gprs[gx] += 2;
+                return rd;
+            }
+            deferdinc = inc;
+            return va;
+        }
+
+        // autodecrement possibly with indirect
+        case 4: case 5: {
+            if (gx == 6) yellowck = true;  // KSP (not USP)
+            if (mode & 010) {
+                gprs[gx] -= 2;
+                return memread (gprs[gx], CURMODE, mmr0 & 1, false, MF_RD);
+            }
+            gprs[gx] -= inc;
+            return gprs[gx];
+        }
+
+        // indexed possibly with indirect
+        case 6: case 7: {
+            uint16_t rd = memread (gprs[7], CURMODE, mmr0 & 1, false, MF_RD);
+            uint16_t va = rd + gprs[gx] + ((gx == 7) ? 2 : 0);
+            gprs[7] += 2;
+            if (mode & 010) {
+                va = memread (va, CURMODE, mmr0 & 1, false, MF_RD);
+            }
+            return va;
+        }
+    }
+    ABORT ();
+}
+
+// read from memory or unibus
+//  returns readdata with the byte in [07:00] for odd byte addresses
+uint16_t Cpu1134::memread (uint16_t va, int mode, bool reloc, bool byte, int func)
+{
+    uint32_t pa = translate (va, mode, reloc, byte, func);
+    uint16_t data = unibus (pa, func, byte, 0);
+    if (pa & 1) data = (data << 8) | (data >> 8);
+    readdata = data;
+    return data;
+}
+
+// write to memory or unibus
+//  byte data is in [07:00]
+void Cpu1134::memwrite (uint16_t va, int mode, bool reloc, bool byte, uint16_t data)
+{
+    uint32_t pa = translate (va, mode, reloc, byte, MF_WR);
+    if (pa & 1) data = (data << 8) | (data >> 8);
+    unibus (pa, MF_WR, byte, data);
+    if (reloc && ! mmuregsel (pa)) mmupdrs[lastprx] |= 0100;
+}
+
+// check for odd address and do mmu translation
+uint32_t Cpu1134::translate (uint16_t va, int mode, bool reloc, bool byte, int func)
+{
+    // check for accessing word at an odd address
+    if (! byte && (va & 1)) {
+        cpuerr |= 0100;
+        abort (T_CPUERR);
+    }
+
+    // mmu disabled, top 8KB maps to i/o page
+    if (! reloc) {
+        return ((va & 0160000) == 0160000) ? (va | 0600000) : va;
+    }
+
+    int prx = ((mode & 2) << 2) | (va >> 13);
+    uint16_t parentry = mmupars[prx];
+    uint16_t pdrentry = mmupdrs[prx];
+    bool mmropen = (mmr0 & 0160000) == 0;
+
+    // update low mmr0 bits regardless of fault on this cycle
+    if (mmropen) mmr0 = (mmr0 & ~ 0156) | (mode << 5) | ((va >> 13) << 1);
+
+    // access codes 0,2 mean no access to the page
+    // also, we only do kernel and user modes
+    // check page length violation
+    // access code 1 means read-only access to the page
+    int blk = (va >> 6) & 0177;
+    int plf = (pdrentry >> 8) & 0177;
+    bool nonres = ! (pdrentry & 2) || (mode == 1) || (mode == 2);
+    bool pageln = (pdrentry & 010) ? (blk < plf) : (blk > plf);
+    bool rdonly = ! (pdrentry & 4) && (pdrentry & 2) && ((func == MF_RM) || (func == MF_WR));
+    if (nonres || pageln || rdonly) {
+        if (mmropen) mmr0 = (mmr0 & 017777) | (nonres << 15) | (pageln << 14) | (rdonly << 13);
+        abort (T_MMUTRAP);
+    }
+
+    lastprx = prx;
+    return ((((parentry & 07777) + blk) & 07777) << 6) | (va & 077);
+}
+
+// do unibus cycle
+//  data = word as it appears on the unibus data lines
+//  returns data lines for read cycles
+uint16_t Cpu1134::unibus (uint32_t pa, int func, bool byte, uint16_t data)
+{
+    // our own registers
+    if (ownreg (pa, false)) {
+        if (func != MF_WR) return ownread (pa);
+        ownwrite (pa, byte, data);
+        return data;
+    }
+
+    // memory enabled in bigmem.v, access memarray.v storage directly
+    // use unibus for bad parity so bigmem.v can log it and maybe assert PB
+    if (! forcebus && bmpresent && ! ctlenab && (fpgamode == FM_REAL) && (pa < 0760000) && ((bmenable >> (pa >> 12)) & 1)) {
+        uint32_t *wp = &memarray[pa>>1];
+        uint32_t word = *wp;
+        if (func == MF_WR) {
+            if (! byte ||   (pa & 1)) word = (word & 0000777) | (oddpar (data >> 8) << 17) | ((data & 0177400) << 1);
+            if (! byte || ! (pa & 1)) word = (word & 0777000) | (oddpar (data & 0377) << 8) | (data & 0377);
+            *wp = word;
+            return data;
+        }
+        if (__builtin_parity ((word >> 9) & 0777) && __builtin_parity (word & 0777)) {
+            return ((word >> 1) & 0177400) | (word & 0377);
+        }
+    }
+
+    // hold off if SSYN,BBSY (still busy from an old DMA)
+    while (! vmybd->bus_ssyn_l || ! vmybd->bus_bbsy_l) buskerchunk ();
+
+    // put address, function and data out on bus
+    // give a couple cycles for signals to be decoded then assert MSYN
+    bool wr = func == MF_WR;
+    vmybd->ncpu_a_l    = ~ pa & 0777777;
+    vmybd->ncpu_bbsy_l = 0;
+    vmybd->ncpu_c_l    = ~ ((wr ? 2 : 0) | ((wr ? byte : (func == MF_RM)) ? 1 : 0)) & 3;
+    if (wr) vmybd->ncpu_d_l = ~ data & 0177777;
+    buskerchunk ();
+    buskerchunk ();
+    vmybd->ncpu_msyn_l = 0;
+    buskerchunk ();
+
+    // wait up to 1000 cycles for SSYN meaning the slave did it
+    bool timedout = false;
+    for (int i = 0; vmybd->bus_ssyn_l; i ++) {
+        if (i == 1000) {
+            timedout = true;
+            break;
+        }
+        buskerchunk ();
+    }
+
+    // read data and parity error status
+    uint16_t rdata = 0;
+    bool parerr = false;
+    if (! timedout) {
+        buskerchunk ();
+        rdata  = ~ vmybd->bus_d_l & 0177777;
+        parerr = vmybd->bus_pa_l && ! vmybd->bus_pb_l;
+    }
+
+    // drop MSYN and wait for slave to drop SSYN
+    vmybd->ncpu_msyn_l = 1;
+    do buskerchunk ();
+    while (! vmybd->bus_ssyn_l);
+    vmybd->ncpu_a_l    = 0777777;
+    vmybd->ncpu_bbsy_l = 1;
+    vmybd->ncpu_c_l    = 3;
+    vmybd->ncpu_d_l    = 0177777;
+
+    if (timedout) {
+        cpuerr |= 020;
+        abort (T_CPUERR);
+    }
+    if (parerr) abort (T_PARERR);
+    return rdata;
+}
+
+// clock the fpga in the middle of an instruction
+void Cpu1134::buskerchunk ()
+{
+    kerchunk ();
+    if (resetreq) throw Cpu1134Reset ();
+}
+
+// abort instruction with the given trap
+void Cpu1134::abort (uint8_t vec)
+{
+    trapvec = vec;
+    throw Cpu1134Abort ();
+}
+
+///////////////////////////
+//  FLOATING POINT UNIT  //
+///////////////////////////
+
+// do one sim1134.v fputask() state
+// o = values at the beginning of the state (what nonblocking assignments see)
+// f = values at the end of the state
+// memory and operand address accesses are done after the state as sim1134.v starts them at the end of the state
+void Cpu1134::fpustep ()
+{
+    Fpu const o = f;
+
+    bool fCFCC   = (instreg & 07777) == 0;
+    bool fSETF   = (instreg & 07777) == 1;
+    bool fSETI   = (instreg & 07777) == 2;
+    bool fSETD   = (instreg & 07777) == 011;
+    bool fSETL   = (instreg & 07777) == 012;
+    bool fLDFPS  = (instreg & 07700) == 00100;
+    bool fSTFPS  = (instreg & 07700) == 00200;
+    bool fSTST   = (instreg & 07700) == 00300;
+    bool fCLRx   = (instreg & 07700) == 00400;
+    bool fTSTx   = (instreg & 07700) == 00500;
+    bool fABSx   = (instreg & 07700) == 00600;
+    bool fNEGx   = (instreg & 07700) == 00700;
+    bool fMULx   = (instreg & 07400) == 01000;
+    bool fMODx   = (instreg & 07400) == 01400;
+    bool fADDx   = (instreg & 07400) == 02000;
+    bool fLDx    = (instreg & 07400) == 02400;
+    bool fSUBx   = (instreg & 07400) == 03000;
+    bool fCMPx   = (instreg & 07400) == 03400;
+    bool fSTx    = (instreg & 07400) == 04000;
+    bool fDIVx   = (instreg & 07400) == 04400;
+    bool fSTEXPx = (instreg & 07400) == 05000;
+    bool fSTCxj  = (instreg & 07400) == 05400;
+    bool fSTCxy  = (instreg & 07400) == 06000;
+    bool fLDEXPx = (instreg & 07400) == 06400;
+    bool fLDCjx  = (instreg & 07400) == 07000;
+    bool fLDCyx  = (instreg & 07400) == 07400;
+
+    int fac   = (instreg >> 6) & 3;
+    int frr   = instreg & 7;
+    bool pcimm = (instreg & 077) == 027;
+    int dstx  = gprx (CURMODE, instreg & 7);
+
+    bool fmemzer = ! ((o.fmemman >> 56) & 1);
+    bool facczer = ! ((o.faccman >> 56) & 1);
+    bool fdmem   = o.fd ^ (fSTCxy || fLDCyx);
+
+    uint64_t fdivdiff = ((((uint64_t) o.fovf << 57) | o.faccman) - o.fmemman) & ((1ULL << 58) - 1);
+    bool fdivneg = (fdivdiff >> 57) & 1;
+    uint64_t fdivstep = o.fd ? (((o.ftmpman << 1) & M57) | ! fdivneg) :
+            ((((o.ftmpman >> 32) << 33) | ((uint64_t) ! fdivneg << 32)) & M57);
+
+    uint16_t fpsts = (o.fer << 15) | (o.fid << 14) | (o.fiuv << 11) | (o.fiu << 10) | (o.fiv << 9) | (o.fic << 8) |
+            (o.fd << 7) | (o.fl << 6) | (o.ft << 5) | (o.fn << 3) | (o.fz << 2) | (o.fv << 1) | o.fc;
+
+    // facc value rounded if enabled
+    //  faccrounded[65] = overflow
+    //          [64:57] = exponent
+    //             [56] = hidden bit
+    //          [55:33] = "F" mantissa
+    //          [55:01] = "D" mantissa
+    u128 faccrounded = ((u128) (o.faccexp & 0377) << 57) | o.faccman;
+    if (! o.ft) faccrounded += (o.fd ^ fSTCxy) ? (u128) 1 : ((u128) 1 << 32);
+    if (! facczer) faccrounded |= (u128) 1 << 56;
+    bool     frndovf = (faccrounded >> 65) & 1;
+    uint8_t  frndexp = faccrounded >> 57;
+    uint64_t frndman = faccrounded & M57;
+
+    int memfunc = 0;
+    bool getop = false;
+    uint16_t getopinc = 0;
+
+    switch (o.fpust) {
+
+        // floatingpoint opcode was just fetched and put in instreg
+        case F_START: {
+            f.fpc = gprs[7];
+            deferdinc = 0;
+
+            // copy fpu ccs to cpu ccs
+            if (fCFCC) {
+                psw = (psw & ~ 017) | (o.fn << 3) | (o.fz << 2) | (o.fv << 1) | o.fc;
+                f.fpust = F_IDLE;
+            }
+
+            else if (fSETF) { f.fd = false; f.fpust = F_IDLE; }
+            else if (fSETI) { f.fl = false; f.fpust = F_IDLE; }
+            else if (fSETD) { f.fd = true;  f.fpust = F_IDLE; }
+            else if (fSETL) { f.fl = true;  f.fpust = F_IDLE; }
+
+            // SRC16,DST16 - 16-bit integer
+            else if (fLDFPS || fSTFPS || fSTEXPx || fLDEXPx) {
+                if ((instreg & 070) == 0) {
+                    f.fpust  = F_GOT16REG;
+                    readdata = gprs[dstx];
+                } else {
+                    getop    = true;
+                    getopinc = 2;
+                    f.fpust  = F_GOT16ADR;
+                }
+            }
+
+            // DST32 - 32-bit integer
+            else if (fSTST) {
+                if ((instreg & 070) == 0) {
+                    gprs[dstx] = o.fec;
+                    f.fpust    = F_IDLE;
+                } else {
+                    getop    = true;
+                    getopinc = pcimm ? 2 : 4;
+                    f.fpust  = F_GOT32ADR;
+                }
+            }
+
+            // DST - 'fl'-bit integer
+            else if (fSTCxj) {
+                f.faccsgn = o.fsgns[fac];
+                f.faccexp = o.fexps[fac];
+                f.faccman = o.fmans[fac] & FMASK (o.fd);
+                if ((instreg & 070) != 0) {
+                    getop    = true;
+                    getopinc = (o.fl && ! pcimm) ? 4 : 2;
+                }
+                f.fpust = F_STCXJ;
+            }
+
+            // SRC - 'fl'-bit integer
+            else if (fLDCjx) {
+                f.fv = false;
+                f.faccexp = o.fl ? 128 + 32 : 128 + 16;
+                if ((instreg & 070) == 0) {
+                    uint16_t r = gprs[dstx];
+                    f.faccsgn = r >> 15;
+                    f.faccman = (uint64_t) (uint16_t) ((r & 0100000) ? - r : r) << 41;
+                    f.fpust   = F_LDCJX;
+                } else {
+                    getop    = true;
+                    getopinc = (o.fl && ! pcimm) ? 4 : 2;
+                    f.fpust  = F_GOTINTADR;
+                }
+            }
+
+            // FDST,FSRC - 'fd'-bit float - read operands into facc, fmem
+            else if (fCLRx || fTSTx || fABSx || fNEGx || fMULx || fMODx  || fADDx ||
+                     fLDx  || fSUBx || fCMPx || fSTx  || fDIVx || fSTCxy || fLDCyx) {
+                f.faccsgn = o.fsgns[fac];
+                f.faccexp = o.fexps[fac];
+                f.faccman = o.fmans[fac] & FMASK (o.fd);
+                if ((instreg & 070) != 0) {
+                    f.fmemsgn = false;
+                    f.fmemexp = 0;
+                    f.fmemman = 0;
+                    getop     = true;
+                    getopinc  = pcimm ? 2 : fdmem ? 8 : 4;
+                    f.fpust   = F_GOTFLTADR;
+                } else if (frr < 6) {
+                    f.fmemsgn = o.fsgns[frr];
+                    f.fmemexp = o.fexps[frr];
+                    f.fmemman = o.fmans[frr] & FMASK (fdmem);
+                    f.fpust   = F_GOTFLTVAL;
+                } else {
+                    f.fea   = o.fpc;
+                    f.fec   = FEC_ILLOP;
+                    f.fer   = true;
+                    f.fpust = F_IDLE;
+                    if (! o.fid) trapvec = T_FPUERR;
+                }
+            }
+
+            // illegal floatingpoint opcode
+            else {
+                f.fea   = o.fpc;
+                f.fec   = FEC_ILLOP;
+                f.fer   = true;
+                f.fpust = F_IDLE;
+                if (! o.fid) trapvec = T_FPUERR;
+            }
+            break;
+        }
+
+        // fLDFPS, fSTFPS, fSTEXPx, fLDEXPx - 16-bit cpu register
+        case F_GOT16REG: {
+            if (fLDFPS) ldfps (o, readdata);
+            if (fSTFPS) gprs[dstx] = fpsts;
+            if (fSTEXPx) gprs[dstx] = ((o.fexps[fac] & 0200) ? 0 : 0177600) | (o.fexps[fac] & 0177);
+            if (fLDEXPx) ldexp (o, readdata);
+            f.fpust = F_IDLE;
+            break;
+        }
+
+        // fLDFPS, fSTFPS, fSTEXPx, fLDEXPx - 16-bit memory location
+        case F_GOT16ADR: {
+            if (fLDFPS) memfunc = MF_RD;
+            if (fSTFPS) {
+                memfunc   = MF_WR;
+                writedata = fpsts;
+            }
+            if (fSTEXPx) {
+                memfunc   = MF_WR;
+                writedata = ((o.fexps[fac] & 0200) ? 0 : 0177600) | (o.fexps[fac] & 0177);
+            }
+            if (fLDEXPx) memfunc = MF_RD;
+            f.fpust = F_DID16ADR;
+            break;
+        }
+
+        case F_DID16ADR: {
+            gprs[dstx] += deferdinc;
+            if (fLDFPS) ldfps (o, readdata);
+            if (fLDEXPx) ldexp (o, readdata);
+            f.fpust = F_IDLE;
+            break;
+        }
+
+        // fSTST - 32-bit integer
+        case F_GOT32ADR: {
+            f.fpust   = F_DID32ADR;
+            memfunc   = MF_WR;
+            writedata = o.fec;
+            break;
+        }
+
+        case F_DID32ADR: {
+            if (pcimm) {
+                f.fpust = F_IDLE;
+                gprs[dstx] += deferdinc;
+            } else {
+                f.fpust   = F_DID32ADR2;
+                memfunc   = MF_WR;
+                virtaddr += 2;
+                writedata = o.fea;
+            }
+            break;
+        }
+
+        case F_DID32ADR2: {
+            f.fpust = F_IDLE;
+            gprs[dstx] += deferdinc;
+            break;
+        }
+
+        // got floatingpoint operand memory address
+        // read floatingpoint operand into fmem
+        case F_GOTFLTADR: {
+            gprs[dstx] += deferdinc;
+            if (fCLRx || fSTx || fSTCxy) {
+                f.fpust = F_GOTFLTVAL;
+            } else {
+                f.fpust = F_GETFLTMEM;
+                memfunc = MF_RD;
+            }
+            break;
+        }
+
+        case F_GETFLTMEM: {
+            // 'undefined variable' is reading neg zero from memory with FIUV
+            bool readnegzer = o.fiuv && (readdata & 0100000) && (((readdata >> 7) & 0377) == 0);
+            if (readnegzer) {
+                f.fea = o.fpc;
+                f.fec = FEC_UNDVAR;
+                f.fer = true;
+            }
+            if (readnegzer && ! o.fid) {
+                f.fpust = F_IDLE;
+                trapvec = T_FPUERR;
+            } else {
+                // save sign, exponent, hidden and mantissa bits we got
+                f.fmemsgn = readdata >> 15;
+                f.fmemexp = readdata >> 7;
+                f.fmemman = (o.fmemman & ~ (0377ULL << 49)) | ((uint64_t) (((readdata >> 7) & 0377) != 0) << 56) |
+                        ((uint64_t) (readdata & 0177) << 49);
+                if (pcimm) {
+                    // read from (PC)+, that's all we get, the rest of mantissa is zeroes
+                    f.fpust = F_GOTFLTVAL;
+                } else {
+                    // start reading second word
+                    f.fpust   = F_GETFLTME2;
+                    memfunc   = MF_RD;
+                    virtaddr += 2;
+                }
+            }
+            break;
+        }
+
+        case F_GETFLTME2: {
+            f.fmemman = (o.fmemman & ~ (0177777ULL << 33)) | ((uint64_t) readdata << 33);
+            if (fdmem) {
+                f.fpust   = F_GETFLTME3;
+                memfunc   = MF_RD;
+                virtaddr += 2;
+            } else {
+                f.fpust   = F_GOTFLTVAL;
+                virtaddr -= 2;
+            }
+            break;
+        }
+
+        case F_GETFLTME3: {
+            f.fmemman = (o.fmemman & ~ (0177777ULL << 17)) | ((uint64_t) readdata << 17);
+            f.fpust   = F_GETFLTME4;
+            memfunc   = MF_RD;
+            virtaddr += 2;
+            break;
+        }
+
+        case F_GETFLTME4: {
+            f.fmemman = (o.fmemman & ~ (0177777ULL << 1)) | ((uint64_t) readdata << 1);
+            f.fpust   = F_GOTFLTVAL;
+            virtaddr -= 6;
+            break;
+        }
+
+        // memory/register operand has been read into fmem if needed
+        // accumulator operand has been loaded into facc
+        // start processing the opcode
+        case F_GOTFLTVAL: {
+            if (fCLRx) {
+                f.faccsgn = false;
+                f.faccexp = 0;
+                f.faccman = 0;
+                f.fpust   = F_STOFLTMEM;
+            }
+
+            if (fTSTx) {
+                f.fn = o.fmemsgn;
+                f.fz = fmemzer;
+                f.fv = false;
+                f.fc = false;
+                f.fpust = F_IDLE;
+            }
+
+            if (fABSx) {
+                f.faccsgn = false;
+                f.faccexp = o.fmemexp;
+                f.faccman = fmemzer ? 0 : o.fmemman;
+                f.fpust   = F_STOFLTMEM;
+            }
+
+            if (fNEGx) {
+                f.faccsgn = ! fmemzer && ! o.fmemsgn;
+                f.faccexp = o.fmemexp;
+                f.faccman = fmemzer ? 0 : o.fmemman;
+                f.fpust   = F_STOFLTMEM;
+            }
+
+            if (fMULx || fMODx) {
+                f.fv = false;
+
+                // if either operand zero, result is zero
+                if (fmemzer || facczer) {
+                    if (instreg & 0400) stomodint (o, false, 0, 0);
+                    f.faccsgn = false;
+                    f.faccexp = 0;
+                    f.faccman = 0;
+                    f.fpust   = F_STOFLTACC;
+                }
+
+                // both operands non-zero, grind it out
+                else {
+                    f.fcount  = 0;
+                    f.ftmpman = 0;
+                    f.faccexp = (o.faccexp + o.fmemexp + 01577) & 01777;
+                    f.faccsgn = o.faccsgn ^ o.fmemsgn;
+                    f.fovf    = false;
+                    f.fpust   = F_MULSTEP;
+                }
+            }
+
+            if (fADDx || fSUBx) {
+
+                // if adding/subtracting zero, just set condition codes according to what is in facc
+                if (fmemzer) {
+                    f.fn = o.faccsgn;
+                    f.fz = facczer;
+                    f.fv = false;
+                    f.fc = false;
+                    if (facczer) f.fmans[fac] = 0;
+                    f.fpust = F_IDLE;
+                }
+
+                // flip fmemsgn if subtracting
+                // also check for zero facc
+                else {
+                    if (fSUBx) f.fmemsgn = ! o.fmemsgn;
+                    f.fpust = facczer ? F_ASZER : F_ASALN;
+                }
+            }
+
+            // preserve non-zero mantissa even when exponent is zero
+            if (fLDx || fLDCyx) {
+                f.faccsgn = o.fmemsgn;
+                f.faccexp = o.fmemexp;
+                f.faccman = o.fmemman;
+                f.fv      = false;
+                f.fpust   = F_STOFLTACC;
+            }
+
+            if (fCMPx) {
+                if (fmemzer && facczer) {
+                    // if both zero, consider them equal, even if signs are different
+                    f.fn = false;
+                    f.fz = true;
+                } else {
+                    bool fmagmemltmagacc = (o.fmemexp < (o.faccexp & 0377)) ||
+                            ((o.fmemexp == (o.faccexp & 0377)) && (o.fmemman < o.faccman));
+                    switch ((o.fmemsgn << 1) | o.faccsgn) {
+                        case 0: f.fn =   fmagmemltmagacc; break;
+                        case 1: f.fn =   false; break;
+                        case 2: f.fn =   true; break;
+                        case 3: f.fn = ! fmagmemltmagacc; break;
+                    }
+                    f.fz = (o.fmemsgn == o.faccsgn) && (o.fmemexp == (o.faccexp & 0377)) && (o.fmemman == o.faccman);
+                }
+                f.fv = false;
+                f.fc = false;
+                f.fpust = F_IDLE;
+            }
+
+            if (fSTx || fSTCxy) {
+                f.fpust = F_STOFLTMEM;
+            }
+
+            if (fDIVx) {
+                if (fmemzer) {
+                    f.fea   = o.fpc;
+                    f.fec   = FEC_DIVBY0;
+                    f.fer   = true;
+                    f.fpust = F_IDLE;
+                    if (! o.fid) trapvec = T_FPUERR;
+                } else if (facczer) {
+                    f.faccsgn = false;
+                    f.faccexp = 0;
+                    f.faccman = 0;
+                    f.fv      = false;
+                    f.fpust   = F_STOFLTACC;
+                } else {
+                    f.fcount  = 0;
+                    f.ftmpman = 0;
+                    f.faccexp = (o.faccexp - o.fmemexp + 0201) & 01777;
+                    f.faccsgn = o.faccsgn ^ o.fmemsgn;
+                    f.fovf    = false;
+                    f.fpust   = F_DIVSTEP;
+                }
+            }
+            break;
+        }
+
+        // facc = floatingpoint number
+        // convert it to integer
+        case F_STCXJ: {
+            gprs[dstx] += deferdinc;
+
+            int exp8 = o.faccexp & 0377;
+
+            // if no bits to left of decimal point, it's zero
+            if (exp8 <= 128) {
+                f.faccman = 0;
+                f.fn = false;
+                f.fz = true;
+                f.fv = false;
+                f.fc = false;
+                psw  = (psw & ~ 017) | 004;
+            }
+
+            // shift right to put decimal point to right of faccman[00]
+            else if ((exp8 <= (o.fl ? 159 : 143)) ||
+                     (  o.fl && o.faccsgn && (exp8 == 160) && (((o.faccman >> 25) & 0x7FFFFFFFULL) == 0)) ||
+                     (! o.fl && o.faccsgn && (exp8 == 144) && (((o.faccman >> 41) & 077777) == 0))) {
+                uint32_t stint = o.faccman >> (185 - exp8);
+                if (o.faccsgn) stint = - stint;
+                f.faccman = (o.faccman & ~ 0xFFFFFFFFULL) | stint;
+                f.fn = o.faccsgn;
+                f.fz = false;
+                f.fv = false;
+                f.fc = false;
+                psw  = (psw & ~ 017) | (o.faccsgn << 3);
+            }
+
+            // overflow - floatingpoint value won't fit in 16 or 32-bit signed integer
+            else {
+                f.faccman = 0;
+                f.fn = false;
+                f.fz = true;
+                f.fv = false;
+                f.fc = true;
+                psw  = (psw & ~ 017) | 005;
+                if (o.fic) {
+                    f.fea = o.fpc;
+                    f.fec = FEC_INTCNV;
+                    f.fer = true;
+                    if (! o.fid) trapvec = T_FPUERR;
+                }
+            }
+
+            f.fpust = o.fl ? F_STOINT32 : F_STOINT16;
+            break;
+        }
+
+        // write 16-bit integer to register or memory
+        case F_STOINT16: {
+            if ((instreg & 070) == 0) {
+                gprs[dstx] = o.faccman;
+            } else {
+                memfunc   = MF_WR;
+                writedata = o.faccman;
+            }
+            f.fpust = F_IDLE;
+            break;
+        }
+
+        // write top-half of 32-bit integer to register or memory
+        case F_STOINT32: {
+            if ((instreg & 070) == 0) {
+                gprs[dstx] = o.faccman >> 16;
+                f.fpust = F_IDLE;
+            } else {
+                memfunc   = MF_WR;
+                writedata = o.faccman >> 16;
+                f.fpust   = pcimm ? F_IDLE : F_STOINT32B;
+            }
+            break;
+        }
+
+        // write bottom-half of 32-bit integer to memory
+        case F_STOINT32B: {
+            memfunc   = MF_WR;
+            virtaddr += 2;
+            writedata = o.faccman;
+            f.fpust   = F_IDLE;
+            break;
+        }
+
+        // have virtual address of LDCjx integer operand
+        case F_GOTINTADR: {
+            gprs[dstx] += deferdinc;
+            memfunc = MF_RD;
+            f.fpust = F_GOTINTMEM;
+            break;
+        }
+
+        // just got 1st (or only) word of integer operand for LDCjx
+        case F_GOTINTMEM: {
+            f.faccsgn = readdata >> 15;
+            if (o.fl && ! pcimm) {
+                f.faccman = (uint64_t) readdata << 41;
+                memfunc   = MF_RD;
+                virtaddr += 2;
+                f.fpust   = F_GOTINTME2;
+            } else {
+                f.faccman = (uint64_t) (uint16_t) ((readdata & 0100000) ? - readdata : readdata) << 41;
+                f.fpust   = F_LDCJX;
+            }
+            break;
+        }
+
+        // just got 2nd word of integer operand for LDCjx
+        case F_GOTINTME2: {
+            if (o.faccsgn) {
+                uint32_t v = - ((uint32_t) ((o.faccman >> 41) << 16) | readdata);
+                f.faccman = (o.faccman & ((1ULL << 25) - 1)) | ((uint64_t) v << 25);
+            } else {
+                f.faccman = (o.faccman & ~ (0177777ULL << 25)) | ((uint64_t) readdata << 25);
+            }
+            f.fpust = F_LDCJX;
+            break;
+        }
+
+        // do multiplication step
+        case F_MULSTEP: {
+            uint64_t bit = (o.fmemman >> (o.fd ? 0 : 32)) & 1;
+            uint64_t sum = (((uint64_t) o.fovf << 56) | (o.ftmpman >> 1)) + (bit ? o.faccman : 0);
+            f.fovf    = (sum >> 57) & 1;
+            f.ftmpman = sum & M57;
+            f.fmemman = ((o.ftmpman & 1) << 56) | (o.fmemman >> 1);
+            if (o.fcount != (o.fd ? 56 : 24)) {
+                f.fcount = o.fcount + 1;
+            } else {
+                f.fpust = F_MULDONE;
+            }
+            break;
+        }
+
+        // normalize and finish up
+        case F_MULDONE: {
+            if (o.fovf) {
+                f.ftmpman = (1ULL << 56) | (o.ftmpman >> 1);
+                f.fmemman = ((o.ftmpman & 1) << 56) | (o.fmemman >> 1);
+                f.fovf    = false;
+                f.faccexp = (o.faccexp + 1) & 01777;
+            } else if (instreg & 0400) {
+                f.fpust = F_MODSTEP;
+            } else {
+                if ((o.faccexp & 01000) || ((o.faccexp & 0777) == 0)) {
+                    funderflow (o);
+                    if (o.fiu) f.faccman = o.ftmpman;
+                } else if (o.faccexp & 0400) {
+                    foverflow (o);
+                    if (o.fiv) {
+                        f.faccman = o.ftmpman;
+                    } else {
+                        f.faccexp = 0;
+                        f.faccman = 0;
+                    }
+                } else {
+                    f.faccman = o.ftmpman;
+                    f.fv = false;
+                }
+                f.fpust = F_STOFLTACC;
+            }
+            break;
+        }
+
+        // faccsgn = product sign
+        // faccexp = product exponent
+        // ftmpman[56:00] = product mantissa including hidden bit and rounding bit (normalized)
+        // fmemman[56:01] = extended mantissa bits (less significant than ftmpman)
+        case F_MODSTEP: {
+
+            // check for multiply underflow
+            if ((o.faccexp & 01000) || ((o.faccexp & 0777) == 0)) {
+                stomodint (o, o.faccsgn, 0, 0);
+                funderflow (o);
+                if (o.fiu) f.faccman = o.ftmpman;
+                f.fpust = F_STOFLTACC;
+                break;
+            }
+
+            int exp8 = o.faccexp & 0377;
+            if (o.faccexp <= 128) {
+                stomodint (o, false, 0, 0);
+                f.faccman = o.ftmpman;
+            }
+            if (o.faccexp == 129) {
+                stomodint (o, o.faccsgn, o.faccexp, o.ftmpman & (1ULL << 56));
+                f.faccexp = 128;
+                f.faccman = ((o.ftmpman << 1) & M57) | ((o.fmemman >> 56) & 1);
+            }
+            if ((o.faccexp >= 130) && (o.faccexp <= (o.fd ? 184 : 152))) {
+                int sh = 185 - exp8;
+                u128 both = ((u128) o.ftmpman << 57) | o.fmemman;
+                stomodint (o, o.faccsgn, o.faccexp, ((o.ftmpman >> sh) << sh) & M57);
+                f.faccexp = 128;
+                f.faccman = (uint64_t) (both >> sh) & M57;
+            }
+            if (o.fd && (o.faccexp >= 185)) {
+                stomodint (o, o.faccsgn, o.faccexp, o.ftmpman & ~ 1ULL);
+                f.faccsgn = false;
+                f.faccexp = 0;
+                f.faccman = 0;
+            }
+            if (! o.fd && (o.faccexp >= 153)) {
+                stomodint (o, o.faccsgn, o.faccexp, o.ftmpman & B56_33);
+                f.faccsgn = false;
+                f.faccexp = 0;
+                f.faccman = 0;
+            }
+
+            // normalize fraction part in facc
+            f.fpust = F_MODNORM;
+            break;
+        }
+
+        // normalize faccsgn, faccexp, faccman (LDCjx value or modulus fraction part)
+        case F_LDCJX:
+        case F_MODNORM: {
+
+            // we're done if hidden bit set
+            if ((o.faccman >> 56) & 1) {
+                if (o.faccexp & 0400) foverflow (o);
+                f.fpust = F_STOFLTACC;
+            }
+
+            // maybe the whole mantissa is zero
+            else if (o.faccman == 0) {
+                f.faccsgn = false;
+                f.faccexp = 0;
+                f.fpust   = F_STOFLTACC;
+            }
+
+            // need to shift more to normalize,
+            // check to see if exponent will underflow
+            else if (o.faccexp <= 1) {
+                funderflow (o);
+                f.fpust = F_STOFLTACC;
+            }
+
+            // shift mantissa left and decrement exponent
+            else {
+                f.faccexp = o.faccexp - 1;
+                f.faccman = (o.faccman << 1) & M57;
+            }
+            break;
+        }
+
+        // ADDx/SUBx - facc is zero so just put non-zero fmem in AC
+        case F_ASZER: {
+            f.faccsgn = o.fmemsgn;
+            f.faccexp = o.fmemexp;
+            f.faccman = o.fmemman;
+            f.fv      = false;
+            f.fpust   = F_STOFLTACC;
+            break;
+        }
+
+        // align add/subtract exponents then do addition/subtraction
+        case F_ASALN: {
+            if ((o.faccexp & 0377) < o.fmemexp) {
+                f.faccexp = (o.faccexp + 1) & 01777;
+                f.faccman = o.faccman >> 1;
+            } else if (o.fmemexp != (o.faccexp & 0377)) {
+                f.fmemexp = o.fmemexp + 1;
+                f.fmemman = o.fmemman >> 1;
+            } else if (o.fmemsgn == o.faccsgn) {
+                uint64_t sum = o.faccman + o.fmemman;
+                f.fovf    = (sum >> 57) & 1;
+                f.faccman = sum & M57;
+                f.fpust   = F_ADDEN;
+            } else {
+                uint64_t dif = o.faccman - o.fmemman;
+                f.fovf    = (dif >> 57) & 1;
+                f.faccman = dif & M57;
+                f.fpust   = F_SUBEN;
+            }
+            break;
+        }
+
+        // finish up addition
+        case F_ADDEN: {
+            if (o.fovf) {
+                f.faccexp = (o.faccexp + 1) & 01777;
+                f.faccman = (1ULL << 56) | (o.faccman >> 1);
+                if ((o.faccexp & 0377) == 0377) {
+                    foverflow (o);
+                } else {
+                    f.fv = false;
+                }
+            } else {
+                f.fv = false;
+            }
+            f.fpust = F_STOFLTACC;
+            break;
+        }
+
+        // finish up subtraction
+        case F_SUBEN: {
+            if (o.faccman == 0) {
+                f.faccsgn = false;
+                f.faccexp = 0;
+                f.fv      = false;
+                f.fpust   = F_STOFLTACC;
+            } else if (o.fovf) {
+                f.fovf    = false;
+                f.faccsgn = ! o.faccsgn;
+                f.faccman = (- o.faccman) & M57;
+            } else if ((o.faccman >> 56) & 1) {
+                f.fv    = false;
+                f.fpust = F_STOFLTACC;
+            } else if (((o.faccexp & 0377) == 1) && ! o.fiu) {
+                funderflow (o);
+                f.fpust = F_STOFLTACC;
+            } else {
+                if ((o.faccexp & 0377) == 1) funderflow (o);
+                f.faccexp = (o.faccexp - 1) & 01777;
+                f.faccman = (o.faccman << 1) & M57;
+            }
+            break;
+        }
+
+        // do division step
+        case F_DIVSTEP: {
+            uint64_t sel = fdivneg ? o.faccman : (fdivdiff & M57);
+            f.fovf    = (sel >> 56) & 1;
+            f.faccman = (sel << 1) & M57;
+            f.ftmpman = fdivstep;
+            if (o.fcount != (o.fd ? 56 : 24)) {
+                f.fcount = o.fcount + 1;
+            } else {
+                f.fpust = F_DIVDONE;
+            }
+            break;
+        }
+
+        case F_DIVDONE: {
+            if (! ((o.ftmpman >> 56) & 1)) {
+                f.ftmpman = fdivstep;
+                f.faccexp = (o.faccexp - 1) & 01777;
+            } else {
+                if (o.faccexp & 01000) {
+                    funderflow (o);
+                } else {
+                    f.faccman = o.ftmpman;
+                    if (o.faccexp & 0400) foverflow (o);
+                                     else f.fv = false;
+                }
+                f.fpust = F_STOFLTACC;
+            }
+            break;
+        }
+
+        // store (possibly rounded) facc in accumulator [07:06]
+        case F_STOFLTACC: {
+            f.fn = o.faccsgn;
+            f.fz = frndexp == 0;
+            f.fc = false;
+            if (frndovf) foverflow (o);
+            f.fsgns[fac] = o.faccsgn;
+            f.fexps[fac] = frndexp;
+            f.fmans[fac] = (f.fmans[fac] & ~ B56_33) | (frndman & B56_33);
+            if (o.fd) f.fmans[fac] = (f.fmans[fac] & ~ B32_01) | (frndman & B32_01);
+            f.fpust = F_IDLE;
+            break;
+        }
+
+        // store (possibly rounded) facc in memory or accumulator [02:00]
+        case F_STOFLTMEM: {
+            if (! fSTx) {
+                f.fn = o.faccsgn;
+                f.fz = frndexp == 0;
+                f.fv = false;
+                f.fc = false;
+                if (frndovf) foverflow (o);
+            }
+
+            if ((instreg & 070) == 0) {
+                f.fsgns[frr] = o.faccsgn;
+                f.fexps[frr] = frndexp;
+                f.fmans[frr] = (f.fmans[frr] & ~ B56_33) | (frndman & B56_33);
+                if (fdmem) f.fmans[frr] = (f.fmans[frr] & ~ B32_01) | (frndman & B32_01);
+                f.fpust = F_IDLE;
+            } else {
+                f.fpust   = pcimm ? F_IDLE : F_STOFLTME2;
+                memfunc   = MF_WR;
+                writedata = (o.faccsgn << 15) | (frndexp << 7) | ((frndman >> 49) & 0177);
+            }
+            break;
+        }
+
+        case F_STOFLTME2: {
+            f.fpust   = fdmem ? F_STOFLTME3 : F_IDLE;
+            memfunc   = MF_WR;
+            virtaddr += 2;
+            writedata = frndman >> 33;
+            break;
+        }
+
+        case F_STOFLTME3: {
+            f.fpust   = F_STOFLTME4;
+            memfunc   = MF_WR;
+            virtaddr += 2;
+            writedata = frndman >> 17;
+            break;
+        }
+
+        case F_STOFLTME4: {
+            f.fpust   = F_IDLE;
+            memfunc   = MF_WR;
+            virtaddr += 2;
+            writedata = frndman >> 1;
+            break;
+        }
+
+        default: ABORT ();
+    }
+
+    // start operand address calculation or memory access the state asked for
+    if (getop) virtaddr = getopaddr (instreg & 077, getopinc);
+    if (memfunc == MF_RD) memread (virtaddr, CURMODE, mmr0 & 1, false, MF_RD);
+    if (memfunc == MF_WR) memwrite (virtaddr, CURMODE, mmr0 & 1, false, writedata);
+}
+
+// load floatingpoint processor status register
+void Cpu1134::ldfps (Fpu const &o, uint16_t value)
+{
+    f.fer  = (value >> 15) & 1;
+    f.fid  = (value >> 14) & 1;
+    f.fiuv = (value >> 11) & 1;
+    f.fiu  = (value >> 10) & 1;
+    f.fiv  = (value >>  9) & 1;
+    f.fic  = (value >>  8) & 1;
+    f.fd   = (value >>  7) & 1;
+    f.fl   = (value >>  6) & 1;
+    f.ft   = (value >>  5) & 1;
+    f.fn   = (value >>  3) & 1;
+    f.fz   = (value >>  2) & 1;
+    f.fv   = (value >>  1) & 1;
+    f.fc   =  value        & 1;
+}
+
+// load exponent
+void Cpu1134::ldexp (Fpu const &o, uint16_t value)
+{
+    int fac = (instreg >> 6) & 3;
+    bool undflo =   (value & 0100000) && ((value & 077777) <= 077600);
+    bool ovrflo = ! (value & 0100000) && ((value & 077777) >= 000200);
+
+    // if underflow and underflow not enabled, return an exact zero
+    if (undflo && ! o.fiu) {
+        f.fsgns[fac] = false;
+        f.fexps[fac] = 0;
+        f.fmans[fac] = 0;
+        f.fn = false;
+        f.fz = true;
+        f.fv = false;
+        f.fc = false;
+    }
+
+    // if overflow and overflow not enabled, return an exact zero
+    else if (ovrflo && ! o.fiv) {
+        f.fsgns[fac] = false;
+        f.fexps[fac] = 0;
+        f.fmans[fac] = 0;
+        f.fn = false;
+        f.fz = true;
+        f.fv = true;
+        f.fc = false;
+    }
+
+    // otherwise, update exponent and set condition codes
+    else {
+        f.fexps[fac] = (value & 0377) ^ 0200;
+        f.fn = o.fsgns[fac];
+        f.fz = (value & 0377) == 0200;
+        f.fv = ovrflo;
+        f.fc = false;
+    }
+
+    if (undflo && o.fiu) {
+        f.fea = o.fpc;
+        f.fec = FEC_UNDRFL;
+        f.fer = true;
+        if (! o.fid) trapvec = T_FPUERR;
+    }
+
+    if (ovrflo && o.fiv) {
+        f.fea = o.fpc;
+        f.fec = FEC_OVERFL;
+        f.fer = true;
+        if (! o.fid) trapvec = T_FPUERR;
+    }
+}
+
+// arithmetic overflow
+//  always set fv
+//  if fiv, set fea,fec,fer
+//  if fiv & ~ fid, do trap
+void Cpu1134::foverflow (Fpu const &o)
+{
+    f.fv = true;
+    if (o.fiv) {
+        f.fea = o.fpc;
+        f.fec = FEC_OVERFL;
+        f.fer = true;
+        if (! o.fid) trapvec = T_FPUERR;
+    }
+}
+
+// arithmetic underflow
+//  always clear fv
+//  if fiu, set fea,fec,fer
+//  if fiu & ~ fid, do trap
+//  if ~ fiu, set up zero value (leave sign as is)
+void Cpu1134::funderflow (Fpu const &o)
+{
+    if (o.fiu) {
+        f.fea = o.fpc;
+        f.fec = FEC_UNDRFL;
+        f.fer = true;
+        if (! o.fid) trapvec = T_FPUERR;
+    } else {
+        f.faccexp = 0;
+        f.faccman = 0;
+    }
+    f.fv = false;
+}
+
+// store integer part of MODx in fac|1
+void Cpu1134::stomodint (Fpu const &o, bool isgn, uint16_t iexp, uint64_t iman)
+{
+    int fac1 = ((instreg >> 6) & 3) | 1;
+    f.fsgns[fac1] = isgn;
+    if (iexp & 0400) foverflow (o);
+    if (iexp > 256) {
+        f.fexps[fac1] = 0;
+        f.fmans[fac1] &= ~ B56_33;
+        if (o.fd) f.fmans[fac1] &= ~ B32_01;
+    } else {
+        f.fexps[fac1] = iexp;
+        f.fmans[fac1] = (f.fmans[fac1] & ~ B56_33) | (iman & B56_33);
+        if (o.fd) f.fmans[fac1] = (f.fmans[fac1] & ~ B32_01) | (iman & B32_01);
+    }
+}
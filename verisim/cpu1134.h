@@ -0,0 +1,113 @@
+//    Copyright (C) Mike Rieker, Beverly, MA USA
+//    www.outerworldapps.com
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; version 2 of the License.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    EXPECT it to FAIL when someone's HeALTh or PROpeRTy is at RISk.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    http://www.gnu.org/licenses/gpl-2.0.html
+
+#ifndef _CPU1134_H
+#define _CPU1134_H
+
+#include <stdint.h>
+
+class VMyBoard;
+
+// arm register index of bigmem.v registers (zynq.v bmarmwrite)
+#define CPU1134_BMINDEX 40
+
+// native instruction-level version of zynq/sim1134.v
+// plugs into the verilated unibus via the MyBoard ncpu_* signals
+struct Cpu1134 {
+    Cpu1134 (VMyBoard *vmybd, uint32_t *memarray, void (*kerchunk) ());
+    void run (int quantum);
+    void clocked ();
+    void armwrite (uint32_t index, uint32_t data);
+    void setbigmem (bool present);
+    bool waiting ();
+
+private:
+
+    // floatingpoint state, copied at the start of each step
+    // ...so a step reads the old values like sim1134.v nonblocking assignments
+    struct Fpu {
+        bool     fsgns[6];
+        uint8_t  fexps[6];
+        uint64_t fmans[6];
+        bool     fmemsgn, faccsgn, fovf;
+        uint8_t  fmemexp;
+        uint16_t faccexp;
+        uint64_t fmemman, faccman, ftmpman;
+        bool     fer, fid, fiuv, fiu, fiv, fic, fd, fl, ft, fn, fz, fv, fc;
+        int      fcount, fpust;
+        uint16_t fea, fpc;
+        uint8_t  fec;
+    };
+
+    VMyBoard *vmybd;
+    uint32_t *memarray;
+    void (*kerchunk) ();
+
+    int state;
+    bool inrun, resetreq;
+
+    uint16_t gprs[16], mmupars[16], mmupdrs[16];
+    uint16_t cpuerr, deferdinc, instreg, mmr0, mmr2, psw, readdata, virtaddr, writedata;
+    uint8_t trapvec;
+    int intrdelay, lastprx;
+    bool aclock, forcebus, haltck, halted, nopushpspc, traceck, trapping, yellowck;
+
+    Fpu f;
+
+    uint64_t bmenable;
+    int fpgamode;
+    bool bmpresent, ctlenab;
+
+    void doreset ();
+    bool service ();
+    bool busservice ();
+    void dotrap ();
+    void slave ();
+    void execute ();
+    void getsrc ();
+    void getdst (uint16_t srcval);
+    void execdd (uint16_t srcval, uint16_t dstval);
+    void exmfpi ();
+    void exmtpi (uint16_t srcval);
+    void exmul (uint16_t dstval);
+    void exdiv (uint16_t dstval);
+    void exash (uint16_t dstval);
+    void exashc (uint16_t dstval);
+    uint16_t getopaddr (int mode, uint16_t inc);
+
+    uint16_t memread (uint16_t va, int mode, bool reloc, bool byte, int func);
+    void memwrite (uint16_t va, int mode, bool reloc, bool byte, uint16_t data);
+    uint32_t translate (uint16_t va, int mode, bool reloc, bool byte, int func);
+    uint16_t unibus (uint32_t pa, int func, bool byte, uint16_t data);
+    bool ownreg (uint32_t pa, bool halt);
+    uint16_t ownread (uint32_t pa);
+    void ownwrite (uint32_t pa, bool byte, uint16_t data);
+    void buskerchunk ();
+    void abort (uint8_t vec);
+
+    void fpustep ();
+    void ldfps (Fpu const &o, uint16_t value);
+    void ldexp (Fpu const &o, uint16_t value);
+    void foverflow (Fpu const &o);
+    void funderflow (Fpu const &o);
+    void stomodint (Fpu const &o, bool isgn, uint16_t iexp, uint64_t iman);
+};
+
+#endif
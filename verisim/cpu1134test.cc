@@ -0,0 +1,263 @@
+//    Copyright (C) Mike Rieker, Beverly, MA USA
+//    www.outerworldapps.com
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; version 2 of the License.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    EXPECT it to FAIL when someone's HeALTh or PROpeRTy is at RISk.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    http://www.gnu.org/licenses/gpl-2.0.html
+
+// check cpu1134.cc instruction results without the rest of the verilated board
+// the unibus is answered here by a plain 128KW memory instead of clocking the verilog devices
+// runs a short program that stores its results in memory, then compares them to known answers
+//  ./cpu1134test.x86_64 [-v]
+//  exit status 0 if all match
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "obj_dir/VMyBoard.h"
+
+#include "cpu1134.h"
+
+#define MAXCYCLES 100000    // give up if not WAITing by then
+
+// program loaded at 1000, started by power-up vector at 24
+// ...power-up trap leaves SP at 0 so there is a yellow stack trap through 4 before it starts
+static uint16_t const program[] = {
+    0012706, 0001000,                   // MOV  #1000,SP
+
+    0012700, 0000173,                   // MOV  #123.,R0
+    0070027, 0000710,                   // MUL  #456.,R0
+    0013737, 0177776, 0002004,          // MOV  @#PSW,@#2004
+    0010037, 0002000,                   // MOV  R0,@#2000
+    0010137, 0002002,                   // MOV  R1,@#2002
+    0012703, 0177775,                   // MOV  #-3,R3
+    0070327, 0000007,                   // MUL  #7,R3
+    0010337, 0002006,                   // MOV  R3,@#2006
+
+    0005000,                            // CLR  R0
+    0012701, 0001750,                   // MOV  #1000.,R1
+    0071027, 0000007,                   // DIV  #7,R0
+    0010037, 0002010,                   // MOV  R0,@#2010
+    0010137, 0002012,                   // MOV  R1,@#2012
+    0012702, 0177777,                   // MOV  #-1,R2
+    0012703, 0177634,                   // MOV  #-100.,R3
+    0071227, 0000007,                   // DIV  #7,R2
+    0010237, 0002014,                   // MOV  R2,@#2014
+    0010337, 0002016,                   // MOV  R3,@#2016
+    0005004,                            // CLR  R4
+    0012705, 0000005,                   // MOV  #5,R5
+    0071427, 0000000,                   // DIV  #0,R4
+    0013737, 0177776, 0002020,          // MOV  @#PSW,@#2020
+
+    0012704, 0000001,                   // MOV  #1,R4
+    0072427, 0000005,                   // ASH  #5,R4
+    0010437, 0002022,                   // MOV  R4,@#2022
+    0012704, 0100000,                   // MOV  #100000,R4
+    0072427, 0000075,                   // ASH  #-3,R4
+    0010437, 0002024,                   // MOV  R4,@#2024
+    0005000,                            // CLR  R0
+    0012701, 0000001,                   // MOV  #1,R1
+    0073027, 0000020,                   // ASHC #16.,R0
+    0010037, 0002026,                   // MOV  R0,@#2026
+    0010137, 0002030,                   // MOV  R1,@#2030
+
+    0004737, 0001400,                   // JSR  PC,@#SUB1
+    0010537, 0002032,                   // MOV  R5,@#2032
+    0004537, 0001410,                   // JSR  R5,@#SUB2
+    0004321,                            // .WORD 4321
+    0010337, 0002034,                   // MOV  R3,@#2034
+    0010637, 0002036,                   // MOV  SP,@#2036
+
+    0012702, 0000012,                   // MOV  #10.,R2
+    0005003,                            // CLR  R3
+    0005203,                            // INC  R3
+    0077202,                            // SOB  R2,.-2
+    0010337, 0002040,                   // MOV  R3,@#2040
+
+    0170001,                            // SETF
+    0172427, 0040200,                   // LDF   #1.0,AC0
+    0172027, 0040400,                   // ADDF  #2.0,AC0
+    0171027, 0040400,                   // MULF  #2.0,AC0
+    0174427, 0040500,                   // DIVF  #3.0,AC0
+    0174037, 0002042,                   // STF   AC0,@#2042
+    0175401,                            // STCFI AC0,R1
+    0010137, 0002046,                   // MOV   R1,@#2046
+    0177127, 0177771,                   // LDCIF #-7,AC1
+    0174137, 0002050,                   // STF   AC1,@#2050
+    0173127, 0040200,                   // SUBF  #1.0,AC1
+    0174137, 0002054,                   // STF   AC1,@#2054
+    0175502,                            // STCFI AC1,R2
+    0010237, 0002060,                   // MOV   R2,@#2060
+
+    0000001,                            // WAIT
+    0000777,                            // BR    .
+};
+
+static uint16_t const sub1[] = {        // at 1400
+    0012705, 0001234,                   // MOV  #1234,R5
+    0000207,                            // RTS  PC
+};
+
+static uint16_t const sub2[] = {        // at 1410
+    0012503,                            // MOV  (R5)+,R3
+    0000205,                            // RTS  R5
+};
+
+// what the program should leave in memory
+struct Expect {
+    uint16_t addr;
+    uint16_t mask;
+    uint16_t data;
+    char const *desc;
+};
+
+static Expect const expects[] = {
+    { 002000, 0177777, 0000000, "MUL 123.*456. high" },
+    { 002002, 0177777, 0155430, "MUL 123.*456. low" },
+    { 002004, 0000017, 0000001, "MUL 123.*456. NZVC" },
+    { 002006, 0177777, 0177753, "MUL -3*7 odd register" },
+    { 002010, 0177777, 0000216, "DIV 1000./7 quotient" },
+    { 002012, 0177777, 0000006, "DIV 1000./7 remainder" },
+    { 002014, 0177777, 0177762, "DIV -100./7 quotient" },
+    { 002016, 0177777, 0177776, "DIV -100./7 remainder" },
+    { 002020, 0000003, 0000003, "DIV by zero VC" },
+    { 002022, 0177777, 0000040, "ASH 1 left 5" },
+    { 002024, 0177777, 0170000, "ASH 100000 right 3" },
+    { 002026, 0177777, 0000001, "ASHC 1 left 16. high" },
+    { 002030, 0177777, 0000000, "ASHC 1 left 16. low" },
+    { 002032, 0177777, 0001234, "JSR PC" },
+    { 002034, 0177777, 0004321, "JSR R5 inline argument" },
+    { 002036, 0177777, 0001000, "JSR/RTS stack" },
+    { 002040, 0177777, 0000012, "SOB 10. times" },
+    { 002042, 0177777, 0040400, "(1.0+2.0)*2.0/3.0 high" },
+    { 002044, 0177777, 0000000, "(1.0+2.0)*2.0/3.0 low" },
+    { 002046, 0177777, 0000002, "STCFI 2.0" },
+    { 002050, 0177777, 0140740, "LDCIF -7 high" },
+    { 002052, 0177777, 0000000, "LDCIF -7 low" },
+    { 002054, 0177777, 0141000, "-7.0-1.0 high" },
+    { 002056, 0177777, 0000000, "-7.0-1.0 low" },
+    { 002060, 0177777, 0177770, "STCFI -8.0" },
+};
+
+static Cpu1134 *cpu1134;
+static int verbose;
+static uint16_t memwords[131072];
+static uint32_t memarray[131072];
+static VMyBoard *vmybd;
+
+static void kerchunk ();
+
+int main (int argc, char **argv)
+{
+    for (int i = 0; ++ i < argc;) {
+        if (strcmp (argv[i], "-?") == 0) {
+            puts ("");
+            puts ("  ./cpu1134test [-v]");
+            puts ("     -v : print each unibus cycle");
+            puts ("");
+            return 0;
+        }
+        if (strcasecmp (argv[i], "-v") == 0) {
+            verbose = 1;
+            continue;
+        }
+        fprintf (stderr, "unknown option %s\n", argv[i]);
+        return 1;
+    }
+
+    memcpy (&memwords[01000/2], program, sizeof program);
+    memcpy (&memwords[01400/2], sub1, sizeof sub1);
+    memcpy (&memwords[01410/2], sub2, sizeof sub2);
+    memwords[004/2] = 01000;
+    memwords[006/2] = 0340;
+    memwords[024/2] = 01000;
+    memwords[026/2] = 0340;
+
+    // nothing else on the bus
+    vmybd = new VMyBoard ();
+    vmybd->RESET_N     = 1;
+    vmybd->bus_ac_lo_l = 1;
+    vmybd->bus_dc_lo_l = 1;
+    vmybd->bus_hltrq_l = 1;
+    vmybd->bus_sack_l  = 1;
+    vmybd->bus_npr_l   = 1;
+    vmybd->bus_intr_l  = 1;
+    vmybd->bus_pa_l    = 1;
+    vmybd->bus_pb_l    = 1;
+    vmybd->bus_br_l    = 15;
+    vmybd->bus_a_l     = 0777777;
+    vmybd->bus_c_l     = 3;
+    vmybd->bus_d_l     = 0177777;
+    vmybd->bus_bbsy_l  = 1;
+    vmybd->bus_init_l  = 1;
+    vmybd->bus_msyn_l  = 1;
+    vmybd->bus_ssyn_l  = 1;
+
+    // fpgamode stays 0 so all memory access is by unibus cycle
+    cpu1134 = new Cpu1134 (vmybd, memarray, kerchunk);
+    int ncycles;
+    for (ncycles = 0; ncycles < MAXCYCLES; ncycles ++) {
+        cpu1134->run (1);
+        if (cpu1134->waiting ()) break;
+    }
+    if (ncycles >= MAXCYCLES) {
+        fprintf (stderr, "cpu1134test: program did not reach WAIT\n");
+        return 1;
+    }
+
+    int nfails = 0;
+    for (unsigned i = 0; i < sizeof expects / sizeof expects[0]; i ++) {
+        Expect const *ex = &expects[i];
+        uint16_t data = memwords[ex->addr/2] & ex->mask;
+        bool ok = data == ex->data;
+        if (! ok) nfails ++;
+        if (verbose || ! ok) {
+            printf ("%-4s %06o  %06o  %06o  %s\n", (ok ? "ok" : "FAIL"), ex->addr, data, ex->data, ex->desc);
+        }
+    }
+    printf ("cpu1134test: %d of %d failed\n", nfails, (int) (sizeof expects / sizeof expects[0]));
+    return (nfails == 0) ? 0 : 1;
+}
+
+// loop processor bus outputs back to its inputs and answer cycles from memwords[]
+//  ~ bus_c_l = C1,C0: 0=DATI, 1=DATIP, 2=DATO, 3=DATOB
+static void kerchunk ()
+{
+    vmybd->bus_a_l    = vmybd->ncpu_a_l;
+    vmybd->bus_c_l    = vmybd->ncpu_c_l;
+    vmybd->bus_msyn_l = vmybd->ncpu_msyn_l;
+    vmybd->bus_bbsy_l = vmybd->ncpu_bbsy_l;
+    vmybd->bus_d_l    = vmybd->ncpu_d_l;
+
+    if (vmybd->bus_msyn_l) {
+        vmybd->bus_ssyn_l = 1;
+    } else {
+        uint32_t pa = ~ vmybd->bus_a_l & 0777777;
+        uint16_t *mw = &memwords[pa >> 1];
+        uint16_t data = ~ vmybd->ncpu_d_l;
+        switch (~ vmybd->bus_c_l & 3) {
+            case 0: case 1: vmybd->bus_d_l = ~ *mw; data = *mw; break;
+            case 2: *mw = data; break;
+            case 3: *mw = (pa & 1) ? (*mw & 0377) | (data & 0177400) : (*mw & 0177400) | (data & 0377); break;
+        }
+        if (verbose && vmybd->bus_ssyn_l) printf ("  %o %06o %06o\n", ~ vmybd->bus_c_l & 3, pa, data);
+        vmybd->bus_ssyn_l = 0;
+    }
+    cpu1134->clocked ();
+}
@@ -23,6 +23,10 @@
 // 2 cycle latency for reading
 // byte writeable
 // 1 parity bit per byte
+// the words themselves live in verimain.cc memarray[]
+// ...so the native processor (cpu1134.cc) can access them directly
+// ...and checkpoints save them along with the model
+// ...with or without -native, it is one DPI call per enabled cycle instead of a verilog array access
 
 module memarray (
   clka,
@@ -40,16 +44,18 @@ module memarray (
     input wire [17:0] dina;
     output reg [17:0] douta;
 
-    reg[8:0] arrayhi[131071:0];
-    reg[8:0] arraylo[131071:0];
+    import "DPI-C" function int memarray_read (input int addr);
+    import "DPI-C" function void memarray_write (input int addr, input int data, input int wena);
+
     reg[17:0] delay;
+    reg[31:0] word;
 
     always @(posedge clka) begin
         if (ena) begin
             douta <= delay;
-            delay <= { arrayhi[addra], arraylo[addra] };
-            if (wea[1]) arrayhi[addra] <= dina[17:09];
-            if (wea[0]) arraylo[addra] <= dina[08:00];
+            word   = memarray_read ({ 15'b0, addra });
+            delay <= word[17:0];
+            if (wea != 0) memarray_write ({ 15'b0, addra }, { 14'b0, dina }, { 30'b0, wea });
         end else begin
             douta <= 18'o615243;
             delay <= 18'o162534;
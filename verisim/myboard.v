@@ -45,26 +45,41 @@ module MyBoard (
     output reg    saxi_RVALID,
     input[31:00]  saxi_WDATA,
     output reg    saxi_WREADY,
-    input         saxi_WVALID
-);
+    input         saxi_WVALID,
+
+    // native c++ processor (cpu1134.cc) plugged into the unibus in place of sim1134 fakeinst
+    input         nativecpu,    // 1=native processor; 0=sim1134 fakeinst
+    input[17:00]  ncpu_a_l,
+    input[1:0]    ncpu_c_l,
+    input[15:00]  ncpu_d_l,
+    input         ncpu_bbsy_l,
+    input[7:4]    ncpu_bg_h,
+    input         ncpu_hltgr_h,
+    input         ncpu_hltrq_l,
+    input         ncpu_init_l,
+    input         ncpu_msyn_l,
+    input         ncpu_npg_h,
+    input         ncpu_ssyn_l,
+    output        waiting,      // sim1134 fakeinst doing WAIT instruction
 
     // unibus signals
-    wire[17:00] bus_a_l;
-    wire        bus_ac_lo_l;
-    wire        bus_bbsy_l;
-    wire[7:4]   bus_br_l;
-    wire[1:0]   bus_c_l;
-    wire[15:00] bus_d_l;
-    wire        bus_dc_lo_l;
-    wire        bus_hltrq_l;
-    wire        bus_init_l;
-    wire        bus_intr_l;
-    wire        bus_msyn_l;
-    wire        bus_npr_l;
-    wire        bus_pa_l;
-    wire        bus_pb_l;
-    wire        bus_sack_l;
-    wire        bus_ssyn_l;
+    output[17:00] bus_a_l,
+    output        bus_ac_lo_l,
+    output        bus_bbsy_l,
+    output[7:4]   bus_br_l,
+    output[1:0]   bus_c_l,
+    output[15:00] bus_d_l,
+    output        bus_dc_lo_l,
+    output        bus_hltrq_l,
+    output        bus_init_l,
+    output        bus_intr_l,
+    output        bus_msyn_l,
+    output        bus_npr_l,
+    output        bus_pa_l,
+    output        bus_pb_l,
+    output        bus_sack_l,
+    output        bus_ssyn_l
+);
 
     // signals output by our fillin for real pdp
     wire[17:00] fake_a_l;
@@ -79,6 +94,19 @@ module MyBoard (
     wire        fake_npg_h;
     wire        fake_ssyn_l;
 
+    // signals output by the native processor, negated unless it is selected
+    wire[17:00] nat_a_l     = nativecpu ? ncpu_a_l     : 18'o777777;
+    wire[1:0]   nat_c_l     = nativecpu ? ncpu_c_l     : 2'b11;
+    wire[15:00] nat_d_l     = nativecpu ? ncpu_d_l     : 16'o177777;
+    wire        nat_bbsy_l  = nativecpu ? ncpu_bbsy_l  : 1'b1;
+    wire[7:4]   nat_bg_h    = nativecpu ? ncpu_bg_h    : 4'b0000;
+    wire        nat_hltgr_h = nativecpu ? ncpu_hltgr_h : 1'b0;
+    wire        nat_hltrq_l = nativecpu ? ncpu_hltrq_l : 1'b1;
+    wire        nat_init_l  = nativecpu ? ncpu_init_l  : 1'b1;
+    wire        nat_msyn_l  = nativecpu ? ncpu_msyn_l  : 1'b1;
+    wire        nat_npg_h   = nativecpu ? ncpu_npg_h   : 1'b0;
+    wire        nat_ssyn_l  = nativecpu ? ncpu_ssyn_l  : 1'b1;
+
     // signals output by the zynq board
     wire rsel1_h;
     wire rsel2_h;
@@ -112,11 +140,13 @@ module MyBoard (
     wire[15:00] fake_r0out, fake_pcout, fake_psout;
     wire[5:0] fake_stout;
     wire fake_waiting, fake_stephalted;
+    assign waiting = fake_waiting;
 
     // fillin for the real pdp
+    // held in reset when the native processor is selected, its init output is ignored then
     sim1134 fakeinst (
         .CLOCK (CLOCK),
-        .RESET (~ RESET_N),
+        .RESET (~ RESET_N | nativecpu),
 
         .pcout (fake_pcout),                    //>> program counter
         .psout (fake_psout),                    //>> processor status
@@ -216,9 +246,9 @@ module MyBoard (
         .sack_out_h   (zynq_sack_h),
         .ssyn_out_h   (zynq_ssyn_h),
 
-        .bg_in_l      (~ fake_bg_h),
-        .hltgr_in_l   (~ fake_hltgr_h),
-        .npg_in_l     (~ fake_npg_h),
+        .bg_in_l      (~ (fake_bg_h | nat_bg_h)),
+        .hltgr_in_l   (~ (fake_hltgr_h | nat_hltgr_h)),
+        .npg_in_l     (~ (fake_npg_h | nat_npg_h)),
 
         .bg_out_l     (zynq_bg_l),
         .npg_out_l    (zynq_npg_l),
@@ -245,20 +275,20 @@ module MyBoard (
     );
 
     // plug the zynq and real pdp boards into the unibus by wire-anding the active-low outputs
-    assign bus_a_l     = fake_a_l     & ~ zynq_a_h;
-    assign bus_ac_lo_l =                ~ zynq_ac_lo_h;
-    assign bus_bbsy_l  = fake_bbsy_l  & ~ zynq_bbsy_h;
-    assign bus_br_l    =                ~ zynq_br_h;
-    assign bus_c_l     = fake_c_l     & ~ zynq_c_h;
-    assign bus_d_l     = fake_d_l     & ~ zynq_d_h;
-    assign bus_dc_lo_l =                ~ zynq_dc_lo_h;
-    assign bus_hltrq_l = fake_hltrq_l & ~ zynq_hltrq_h;
-    assign bus_init_l  = fake_init_l  & ~ zynq_init_h;
-    assign bus_intr_l  =                ~ zynq_intr_h;
-    assign bus_msyn_l  = fake_msyn_l  & ~ zynq_msyn_h;
-    assign bus_npr_l   =                ~ zynq_npr_h;
-    assign bus_pa_l    =                ~ zynq_pa_h;
-    assign bus_pb_l    =                ~ zynq_pb_h;
-    assign bus_sack_l  =                ~ zynq_sack_h;
-    assign bus_ssyn_l  = fake_ssyn_l  & ~ zynq_ssyn_h;
+    assign bus_a_l     = fake_a_l     & nat_a_l     & ~ zynq_a_h;
+    assign bus_ac_lo_l =                              ~ zynq_ac_lo_h;
+    assign bus_bbsy_l  = fake_bbsy_l  & nat_bbsy_l  & ~ zynq_bbsy_h;
+    assign bus_br_l    =                              ~ zynq_br_h;
+    assign bus_c_l     = fake_c_l     & nat_c_l     & ~ zynq_c_h;
+    assign bus_d_l     = fake_d_l     & nat_d_l     & ~ zynq_d_h;
+    assign bus_dc_lo_l =                              ~ zynq_dc_lo_h;
+    assign bus_hltrq_l = fake_hltrq_l & nat_hltrq_l & ~ zynq_hltrq_h;
+    assign bus_init_l  = (fake_init_l | nativecpu) & nat_init_l & ~ zynq_init_h;
+    assign bus_intr_l  =                              ~ zynq_intr_h;
+    assign bus_msyn_l  = fake_msyn_l  & nat_msyn_l  & ~ zynq_msyn_h;
+    assign bus_npr_l   =                              ~ zynq_npr_h;
+    assign bus_pa_l    =                              ~ zynq_pa_h;
+    assign bus_pb_l    =                              ~ zynq_pb_h;
+    assign bus_sack_l  =                              ~ zynq_sack_h;
+    assign bus_ssyn_l  = fake_ssyn_l  & nat_ssyn_l  & ~ zynq_ssyn_h;
 endmodule
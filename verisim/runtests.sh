@@ -0,0 +1,138 @@
+#!/bin/bash
+#
+#  Run z11ctrl test scripts in parallel, each on its own verimain
+#
+#    ./runtests.sh [-j <njobs>] [-logdir <dir>] [-timeout <seconds>] [-verimain "<options>"] <script.tcl> ...
+#
+#      -j        : number of scripts to run at once, default number of cores
+#      -logdir   : where to put the logs, default /tmp/runtests.<pid>
+#      -timeout  : kill script if it runs longer than this, default 3600
+#      -verimain : options to pass to verimain, such as "-native -idleskip"
+#      script    : path relative to ccode directory, run with ccode as current directory
+#
+#  Each script gets a unique Z11INSTANCE so its verimain, daemons and shared memory
+#  are separate from the others.  A script passes if z11ctrl exits with status 0.
+#
+cd `dirname $0`
+vsdir=`pwd`
+ccdir=`cd ../ccode ; pwd`
+mach=`uname -m`
+
+njobs=`nproc`
+logdir=/tmp/runtests.$$
+timeout=3600
+vmopts=
+scripts=()
+while [ "$1" != "" ]
+do
+    case "$1" in
+        -j)
+            njobs=$2
+            shift ; shift ;;
+        -logdir)
+            logdir=$2
+            shift ; shift ;;
+        -timeout)
+            timeout=$2
+            shift ; shift ;;
+        -verimain)
+            vmopts=$2
+            shift ; shift ;;
+        -*)
+            echo "unknown option $1" >&2
+            exit 1 ;;
+        *)
+            scripts+=("$1")
+            shift ;;
+    esac
+done
+if [ ${#scripts[@]} == 0 ]
+then
+    echo "no scripts given" >&2
+    exit 1
+fi
+if [ ! -x $vsdir/verimain.$mach ] || [ ! -x $ccdir/z11ctrl.$mach ]
+then
+    echo "build verisim and ccode first" >&2
+    exit 1
+fi
+mkdir -p $logdir
+
+# kill everything running as the given instance
+# - z11ctrl, verimain, daemons it spawned (z11rh, z11dl, etc)
+function killinst
+{
+    local inst=$1
+    for pe in /proc/[0-9]*/environ
+    do
+        if tr '\0' '\n' 2> /dev/null < $pe | grep -qx "Z11INSTANCE=$inst"
+        then
+            pid=${pe#/proc/}
+            kill -9 ${pid%/environ} 2> /dev/null
+        fi
+    done
+    rm -f /dev/shm/shm_*_$inst /tmp/zynqpdp11_$inst
+}
+
+# run one script on its own verimain
+#  $1 = index in scripts
+#  writes <script> <PASS|FAIL|TIMEOUT> <seconds> to $logdir/<index>.result
+function runone
+{
+    local idx=$1
+    local script=${scripts[$idx]}
+    local inst=rt$$-$idx
+    local log=$logdir/$idx.`basename $script .tcl`
+    export Z11INSTANCE=$inst
+
+    # start verimain (detached so it isn't one of our jobs) and wait for it to create its shared page
+    ( $vsdir/verimain.$mach $vmopts > $log.verimain.log 2>&1 < /dev/null & )
+    for ((i = 0 ; i < 100 ; i ++))
+    do
+        grep -qs 'verimain: pid' $log.verimain.log && break
+        sleep 0.1
+    done
+
+    # run script, stdin from /dev/null so it can't wait for a keyboard
+    local start=`date +%s.%N`
+    ( cd $ccdir ; exec timeout -k 10 $timeout ./z11ctrl -log $log.log $script ) > /dev/null 2>&1 < /dev/null
+    local rc=$?
+    local stop=`date +%s.%N`
+
+    local status=PASS
+    if [ $rc == 124 ] || [ $rc == 137 ]
+    then
+        status=TIMEOUT
+    elif [ $rc != 0 ]
+    then
+        status=FAIL
+    fi
+    unset Z11INSTANCE
+    killinst $inst
+    printf "%-40s %-7s %8.1f\n" $script $status `awk "BEGIN { print $stop - $start }"` > $logdir/$idx.result
+}
+
+# start up to njobs scripts at a time
+trap 'for ((i = 0 ; i < ${#scripts[@]} ; i ++)) ; do killinst rt$$-$i ; done ; exit 1' INT TERM
+running=0
+for ((idx = 0 ; idx < ${#scripts[@]} ; idx ++))
+do
+    if [ $running -ge $njobs ]
+    then
+        wait -n
+        running=$((running - 1))
+    fi
+    runone $idx &
+    running=$((running + 1))
+done
+wait
+
+# print results in order given
+nfail=0
+for ((idx = 0 ; idx < ${#scripts[@]} ; idx ++))
+do
+    cat $logdir/$idx.result
+    grep -q ' PASS ' $logdir/$idx.result || nfail=$((nfail + 1))
+done
+echo "${#scripts[@]} scripts, $nfail failed, logs in $logdir"
+[ $nfail == 0 ]
@@ -21,6 +21,9 @@
 // tcp daemon for verilator simulator
 // run on x86_64 as daemon - ./verimain.x86_64
 // then run z11ctrl, z11dump, z11ila on same x86_64
+// -native runs cpu1134.cc instead of clocking sim1134.v for the processor
+// -idleskip fast-forwards kw11.v to its next tick when the processor is idle
+// -restore resumes from a checkpoint saved by a client's verisim_save()
 
 #include <errno.h>
 #include <fcntl.h>
@@ -28,46 +31,126 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/file.h>
 #include <sys/mman.h>
+#include <time.h>
 #include <unistd.h>
 
 #define ABORT() do { fprintf (stderr, "ABORT %s %d\n", __FILE__, __LINE__); abort (); } while (0)
 
 #include "obj_dir/VMyBoard.h"
+#include "obj_dir/VMyBoard__Dpi.h"
+#include "verilated_save.h"
 
 #include "../ccode/futex.h"
+#include "../ccode/z11inst.h"
+#include "cpu1134.h"
 #include "verisim.h"
 
+// processor must be waiting this many cycles before skipping ahead
+// ...long enough for the previous line clock interrupt to have been taken
+#define IDLECLOCKS 1000
+
+// ...and no client activity for this much host time
+// ...so a daemon that was just woken for an i/o request has a chance to start processing it
+#define IDLEHOSTNS 20000000ULL
+
+static uint64_t gethostns ();
+
+static bool kw11skip;
+static bool simwaiting;
+static uint32_t fpgamode;
+static Cpu1134 *cpu1134;
+static int debug;
+static uint32_t memarray[131072];
 static VMyBoard *vmybd;
 
+static void runslot (VeriSlot *slot);
+static uint32_t savemodel (char const *filename);
+static uint32_t axiread (uint32_t index);
+static void axiwrite (uint32_t index, uint32_t data);
 static void kerchunk ();
 
 int main (int argc, char **argv)
 {
+    bool idleskip = false;
+    bool native = false;
+    char const *restorename = NULL;
+    int quantum = 1;
+    char *p;
+    for (int i = 0; ++ i < argc;) {
+        if (strcmp (argv[i], "-?") == 0) {
+            puts ("");
+            puts ("     Verilator simulator daemon");
+            puts ("");
+            puts ("  ./verimain [-idleskip] [-native] [-quantum <instructions>] [-restore <checkpointfile>]");
+            puts ("    -idleskip : skip ahead to next line clock tick when processor is idle");
+            puts ("     -native  : use native c++ processor instead of sim1134.v");
+            puts ("                direct memory access requires fpgamode 2 (real)");
+            puts ("     -quantum : instructions per clock cycle for -native, default 1");
+            puts ("     -restore : resume from checkpoint instead of resetting");
+            puts ("                not with -native, checkpoints are only taken of sim1134.v");
+            puts ("");
+            return 0;
+        }
+        if (strcasecmp (argv[i], "-idleskip") == 0) {
+            idleskip = true;
+            continue;
+        }
+        if (strcasecmp (argv[i], "-native") == 0) {
+            native = true;
+            continue;
+        }
+        if (strcasecmp (argv[i], "-restore") == 0) {
+            if ((++ i >= argc) || (argv[i][0] == '-')) {
+                fprintf (stderr, "missing filename for -restore\n");
+                return 1;
+            }
+            restorename = argv[i];
+            continue;
+        }
+        if (strcasecmp (argv[i], "-quantum") == 0) {
+            if ((++ i >= argc) || (argv[i][0] == '-')) {
+                fprintf (stderr, "missing value for -quantum\n");
+                return 1;
+            }
+            quantum = strtol (argv[i], &p, 0);
+            if ((*p != 0) || (quantum <= 0) || (quantum > 1000000)) {
+                fprintf (stderr, "-quantum value %s must be integer in range 1..1000000\n", argv[i]);
+                return 1;
+            }
+            continue;
+        }
+        fprintf (stderr, "unknown option %s\n", argv[i]);
+        return 1;
+    }
+
     setlinebuf (stdout);
 
-    int shmfd = shm_open (VERISIM_SHMNM, O_RDWR | O_CREAT, 0666);
+    // Z11INSTANCE envar gives each simulated machine its own page
+    char const *shmnm = z11instname (VERISIM_SHMNM);
+    int shmfd = shm_open (shmnm, O_RDWR | O_CREAT, 0666);
     if (shmfd < 0) {
-        fprintf (stderr, "verimain: error creating %s: %m\n", VERISIM_SHMNM);
+        fprintf (stderr, "verimain: error creating %s: %m\n", shmnm);
         ABORT ();
     }
 
     VeriPage *pageptr;
 
     if (ftruncate (shmfd, sizeof *pageptr) < 0) {
-        fprintf (stderr, "verimain: error truncating %s: %m\n", VERISIM_SHMNM);
+        fprintf (stderr, "verimain: error truncating %s: %m\n", shmnm);
         ABORT ();
     }
 
     if (flock (shmfd, LOCK_EX | LOCK_NB) < 0) {
-        fprintf (stderr, "verimain: error locking %s: %m\n", VERISIM_SHMNM);
+        fprintf (stderr, "verimain: error locking %s: %m\n", shmnm);
         ABORT ();
     }
 
     void *ptr = mmap (NULL, sizeof *pageptr, PROT_READ | PROT_WRITE, MAP_SHARED, shmfd, 0);
     if (ptr == MAP_FAILED) {
-        fprintf (stderr, "verimain: error mmapping %s: %m\n", VERISIM_SHMNM);
+        fprintf (stderr, "verimain: error mmapping %s: %m\n", shmnm);
         ABORT ();
     }
     pageptr = (VeriPage *) ptr;
@@ -78,89 +161,93 @@ int main (int argc, char **argv)
 
     VMyBoard vmyboard;
     vmybd = &vmyboard;
-    vmybd->RESET_N = 0;
-    for (int i = 0; i < 10; i ++) {
-        kerchunk ();
+    vmybd->nativecpu = native;
+    if (native) cpu1134 = new Cpu1134 (vmybd, memarray, kerchunk);
+
+    if ((restorename != NULL) && native) {
+        fprintf (stderr, "verimain: -restore not supported with -native\n");
+        return 1;
     }
-    vmybd->RESET_N = 1;
-    for (int i = 0; i < 10; i ++) {
-        kerchunk ();
+
+    if (restorename != NULL) {
+
+        // pick up where checkpoint left off, same order as savemodel() wrote it
+        VerilatedRestore os;
+        os.open (restorename);
+        if (! os.isOpen ()) {
+            fprintf (stderr, "verimain: error opening %s: %m\n", restorename);
+            return 1;
+        }
+        os >> vmyboard;
+        os.read (&fpgamode, sizeof fpgamode);
+        os.read (memarray, sizeof memarray);
+        os.close ();
+        fprintf (stderr, "verimain: restored %s\n", restorename);
+    } else {
+        vmybd->RESET_N = 0;
+        for (int i = 0; i < 10; i ++) {
+            kerchunk ();
+        }
+        vmybd->RESET_N = 1;
+        for (int i = 0; i < 10; i ++) {
+            kerchunk ();
+        }
+
+        // native processor accesses bigmem.v memory directly if bigmem.v is present
+        if (cpu1134 != NULL) {
+            cpu1134->setbigmem ((axiread (CPU1134_BMINDEX) >> 16) == 0x424D);
+        }
     }
 
     char const *env = getenv ("verimain_debug");
-    int debug = (env == NULL) ? 0 : atoi (env);
+    debug = (env == NULL) ? 0 : atoi (env);
 
+    int idleclocks = 0;
+    int lastslot = 0;
+    uint64_t lastactns = 0;     // host time of last client request or arm interrupt
     while (true) {
-        int state = pageptr->state;
-        switch (state) {
-
-            // some client wants to read one of the arm-side registers
-            case VERISIM_READ: {
-                uint32_t index = pageptr->indx;
-                if (index > 1023) ABORT ();
-
-                // send read address out over AXI bus and say we are ready to accept read data
-                vmybd->saxi_ARADDR  = index * sizeof pageptr->data;
-                vmybd->saxi_ARVALID = 1;
-                vmybd->saxi_RREADY  = 1;
-
-                // keep kerchunking until both transfers have completed
-                // capture read data on cycle where both RREADY and RVALID are set
-                for (int i = 0; vmybd->saxi_ARVALID | vmybd->saxi_RREADY; i ++) {
-                    if (i > 100) ABORT ();
-                    bool arready = vmybd->saxi_ARREADY;
-                    kerchunk ();
-                    if (arready) vmybd->saxi_ARVALID = 0;
-                    bool rvalid  = vmybd->saxi_RVALID;
-                    if (rvalid & vmybd->saxi_RREADY) {
-                        pageptr->data = vmybd->saxi_RDATA;
-                        vmybd->saxi_RREADY = 0;
-
-                        if (debug > 1) printf ("verimain:  read %03X > %08X\n", index, pageptr->data);
-
-                        if (! atomic_compare_exchange (&pageptr->state, &state, VERISIM_DONE)) ABORT ();
-                        if (futex (&pageptr->state, FUTEX_WAKE, 1000000000, NULL, NULL, 0) < 0) ABORT ();
-                    }
-                }
-                break;
-            }
 
-            // some client wants to write one of the arm-side registers
-            case VERISIM_WRITE: {
-                uint32_t index = pageptr->indx;
-                if (index > 1023) ABORT ();
-
-                // put address and write data on AXI bus
-                // say they are valid and also we are ready to accept write acknowledge
-                vmybd->saxi_AWADDR  = index * sizeof pageptr->data;
-                vmybd->saxi_AWVALID = 1;
-                vmybd->saxi_WDATA   = pageptr->data;
-                vmybd->saxi_WVALID  = 1;
-                vmybd->saxi_BREADY  = 1;
-
-                if (debug > 0) printf ("verimain: write %03X < %08X\n", index, pageptr->data);
-
-                if (! atomic_compare_exchange (&pageptr->state, &state, VERISIM_DONE)) ABORT ();
-                if (futex (&pageptr->state, FUTEX_WAKE, 1000000000, NULL, NULL, 0) < 0) ABORT ();
-
-                // keep kerchunking until all 3 transfers have completed
-                for (int i = 0; vmybd->saxi_AWVALID | vmybd->saxi_WVALID | vmybd->saxi_BREADY; i ++) {
-                    if (i > 100) ABORT ();
-                    bool awready = vmybd->saxi_AWREADY;
-                    bool wready  = vmybd->saxi_WREADY;
-                    kerchunk ();
-                    if (awready) vmybd->saxi_AWVALID = 0;
-                    if (wready)  vmybd->saxi_WVALID  = 0;
-                    bool bvalid  = vmybd->saxi_BVALID;
-                    if (bvalid)  vmybd->saxi_BREADY  = 0;
+        // if some client has queued a batch of commands, process them
+        // scan round-robin so one busy client can't starve the others
+        // otherwise just keep clocking processor
+        // ...or run instructions on the native processor
+        // ...or if it has been idle a while, have kw11.v jump to its next tick
+        VeriSlot *slot = NULL;
+        if (__atomic_load_n (&pageptr->pending, __ATOMIC_SEQ_CST) != 0) {
+            for (int i = 0; i < VERISIM_NSLOTS; i ++) {
+                lastslot = (lastslot + 1) % VERISIM_NSLOTS;
+                if (__atomic_load_n (&pageptr->slots[lastslot].state, __ATOMIC_SEQ_CST) == VERISIM_READY) {
+                    slot = &pageptr->slots[lastslot];
+                    break;
                 }
-                break;
             }
+        }
+        if (slot != NULL) {
+            runslot (slot);
+            __atomic_sub_fetch (&pageptr->pending, 1, __ATOMIC_SEQ_CST);
+        } else if (idleclocks >= IDLECLOCKS) {
+            kw11skip = true;
+            kerchunk ();
+            kw11skip = false;
+            idleclocks = 0;
+            if (debug > 0) printf ("verimain: idle skip\n");
+        } else if (cpu1134 != NULL) {
+            cpu1134->run (quantum);
+        } else {
+            kerchunk ();
+        }
 
-            // no client waiting for something, just keep clocking processor
-            default: {
-                kerchunk ();
-                break;
+        // processor is idle if doing WAIT instruction with no client requests and no dma or interrupts pending
+        // ...and no daemon has had anything to do for a while (it may have a command outstanding)
+        if (idleskip) {
+            bool waiting = (fpgamode == 1) ? simwaiting : (cpu1134 != NULL) ? cpu1134->waiting () : vmybd->waiting;
+            if (slot != NULL) lastactns = gethostns ();
+            if (waiting && (slot == NULL) && vmybd->bus_bbsy_l && vmybd->bus_npr_l && (vmybd->bus_br_l == 15)) {
+                if ((++ idleclocks >= IDLECLOCKS) && (gethostns () - lastactns < IDLEHOSTNS)) {
+                    idleclocks = IDLECLOCKS - 1;
+                }
+            } else {
+                idleclocks = 0;
             }
         }
 
@@ -169,10 +256,146 @@ int main (int argc, char **argv)
         uint32_t newirqmsk = vmybd->regarmintreq;
         pageptr->armintmsk = newirqmsk;
         if ((debug > 0) && (oldirqmsk != newirqmsk)) printf ("verimain: armirqmsk %08X\n", newirqmsk);
-        if ((newirqmsk & ~ oldirqmsk) &&
-                (futex ((int *) &pageptr->armintmsk, FUTEX_WAKE, 1000000000, NULL, NULL, 0) < 0)) {
-            ABORT ();
+        if (newirqmsk & ~ oldirqmsk) {
+            if (futex ((int *) &pageptr->armintmsk, FUTEX_WAKE, 1000000000, NULL, NULL, 0) < 0) ABORT ();
+            if (idleskip) lastactns = gethostns ();
+        }
+    }
+}
+
+// process the commands queued in a slot then tell the client they are done
+static void runslot (VeriSlot *slot)
+{
+    int ncmds = slot->ncmds;
+    if ((ncmds < 0) || (ncmds > VERISIM_MAXCMDS)) ABORT ();
+
+    int ndone;
+    for (ndone = 0; ndone < ncmds; ndone ++) {
+        VeriCmd *cmd = &slot->cmds[ndone];
+        uint32_t index = cmd->indx;
+        if (index > 1023) ABORT ();
+        switch (cmd->func) {
+            case VERISIM_CMD_READ: {
+                cmd->data = axiread (index);
+                continue;
+            }
+            case VERISIM_CMD_WRITE: {
+                axiwrite (index, cmd->data);
+                continue;
+            }
+
+            // each read does a few clock cycles so the fpga progresses while polling
+            case VERISIM_CMD_POLLEQ:
+            case VERISIM_CMD_POLLNE: {
+                bool eq = cmd->func == VERISIM_CMD_POLLEQ;
+                uint32_t data;
+                for (uint32_t i = 0;; i ++) {
+                    data = axiread (index);
+                    if (((data & cmd->mask) == cmd->data) == eq) break;
+                    if (i >= cmd->limit) break;
+                }
+                bool ok = ((data & cmd->mask) == cmd->data) == eq;
+                cmd->data = data;
+                if (ok) continue;
+                break;
+            }
+
+            // no clocking going on while saving so it is a consistent snapshot
+            case VERISIM_CMD_SAVE: {
+                slot->savename[VERISIM_SAVENMSZ-1] = 0;
+                cmd->data = savemodel (slot->savename);
+                continue;
+            }
+            default: ABORT ();
         }
+        break;
+    }
+
+    slot->ndone = ndone;
+    __atomic_store_n (&slot->state, VERISIM_DONE, __ATOMIC_SEQ_CST);
+    if (futex (&slot->state, FUTEX_WAKE, 1000000000, NULL, NULL, 0) < 0) ABORT ();
+}
+
+// save model state to checkpoint file for -restore
+//  returns 0 if successful, else errno
+// - native processor state isn't saved, ckpsave pauses sim1134.v so needs fpgamode 1 anyway
+static uint32_t savemodel (char const *filename)
+{
+    if (cpu1134 != NULL) {
+        fprintf (stderr, "verimain: can't save %s with -native\n", filename);
+        return ENOTSUP;
+    }
+
+    VerilatedSave os;
+    os.open (filename);
+    if (! os.isOpen ()) {
+        int rc = errno;
+        fprintf (stderr, "verimain: error creating %s: %m\n", filename);
+        return rc;
+    }
+    os << *vmybd;
+    os.write (&fpgamode, sizeof fpgamode);
+    os.write (memarray, sizeof memarray);
+    os.close ();
+    fprintf (stderr, "verimain: saved %s\n", filename);
+    return 0;
+}
+
+// read one of the arm-side registers
+static uint32_t axiread (uint32_t index)
+{
+    // send read address out over AXI bus and say we are ready to accept read data
+    vmybd->saxi_ARADDR  = index * sizeof (uint32_t);
+    vmybd->saxi_ARVALID = 1;
+    vmybd->saxi_RREADY  = 1;
+
+    // keep kerchunking until both transfers have completed
+    // capture read data on cycle where both RREADY and RVALID are set
+    // keep RREADY asserted through that clock so the fpga sees the handshake
+    // ...as registers like the ky11.v burst fifo pop on read acceptance
+    uint32_t data = 0;
+    for (int i = 0; vmybd->saxi_ARVALID | vmybd->saxi_RREADY; i ++) {
+        if (i > 100) ABORT ();
+        bool arready = vmybd->saxi_ARREADY;
+        bool rvalid  = vmybd->saxi_RVALID;
+        if (rvalid) data = vmybd->saxi_RDATA;
+        kerchunk ();
+        if (arready) vmybd->saxi_ARVALID = 0;
+        if (rvalid)  vmybd->saxi_RREADY  = 0;
+    }
+
+    if (debug > 1) printf ("verimain:  read %03X > %08X\n", index, data);
+    return data;
+}
+
+// write one of the arm-side registers
+static void axiwrite (uint32_t index, uint32_t data)
+{
+    // put address and write data on AXI bus
+    // say they are valid and also we are ready to accept write acknowledge
+    vmybd->saxi_AWADDR  = index * sizeof (uint32_t);
+    vmybd->saxi_AWVALID = 1;
+    vmybd->saxi_WDATA   = data;
+    vmybd->saxi_WVALID  = 1;
+    vmybd->saxi_BREADY  = 1;
+
+    if (debug > 0) printf ("verimain: write %03X < %08X\n", index, data);
+
+    // idle skip checks the processor selected by regctla[31:30] fpgamode
+    // native processor tracks fpgamode and bigmem enables
+    if (index == 1) fpgamode = data >> 30;
+    if (cpu1134 != NULL) cpu1134->armwrite (index, data);
+
+    // keep kerchunking until all 3 transfers have completed
+    for (int i = 0; vmybd->saxi_AWVALID | vmybd->saxi_WVALID | vmybd->saxi_BREADY; i ++) {
+        if (i > 100) ABORT ();
+        bool awready = vmybd->saxi_AWREADY;
+        bool wready  = vmybd->saxi_WREADY;
+        kerchunk ();
+        if (awready) vmybd->saxi_AWVALID = 0;
+        if (wready)  vmybd->saxi_WVALID  = 0;
+        bool bvalid  = vmybd->saxi_BVALID;
+        if (bvalid)  vmybd->saxi_BREADY  = 0;
     }
 }
 
@@ -184,4 +407,40 @@ static void kerchunk ()
     vmybd->CLOCK = 1;  // clock the state
     vmybd->eval ();    // let new state settle in
     vmybd->CLOCK = 0;  // get ready for more input changes
+    if (cpu1134 != NULL) cpu1134->clocked ();
+}
+
+// get host time in nanoseconds
+static uint64_t gethostns ()
+{
+    struct timespec nowts;
+    if (clock_gettime (CLOCK_MONOTONIC, &nowts) < 0) ABORT ();
+    return nowts.tv_sec * 1000000000ULL + nowts.tv_nsec;
+}
+
+// zynq.v sim1134 WAIT status, called every cycle
+void verimain_simwaiting (int waiting)
+{
+    simwaiting = waiting != 0;
+}
+
+// kw11.v asking if it should skip ahead to its next tick
+int verimain_kw11skip ()
+{
+    return kw11skip;
+}
+
+// memarray.v storage
+//  [17] = hi byte parity; [16:09] = hi byte
+//  [08] = lo byte parity; [07:00] = lo byte
+int memarray_read (int addr)
+{
+    return memarray[addr&131071];
+}
+
+void memarray_write (int addr, int data, int wena)
+{
+    uint32_t *wp = &memarray[addr&131071];
+    if (wena & 2) *wp = (*wp & 0000777) | (data & 0777000);
+    if (wena & 1) *wp = (*wp & 0777000) | (data & 0000777);
 }
@@ -20,6 +20,8 @@
 
 // Interface z11ctrl to verilated zynq code
 // Call verisim_read() and verisim_write() to access the Zynq-like register page
+// Call verisim_batch() to do a list of accesses in one round trip with verimain
+// Call verisim_save() to checkpoint the model
 
 #include <errno.h>
 #include <fcntl.h>
@@ -30,38 +32,46 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include <time.h>
 #include <unistd.h>
 
 #include "../ccode/futex.h"
+#include "../ccode/z11inst.h"
+#include "../ccode/km-zynqpdp11/zgintdefs.h"
 #include "verisim.h"
 
 #define ABORT() do { fprintf (stderr, "ABORT %s %d\n", __FILE__, __LINE__); abort (); } while (0)
 
-static int mypid, serverpid;
+static int serverpid;
 static uint32_t volatile *nullpage;
 static VeriPage *pageptr;
+static __thread int myslottid;
+static __thread VeriSlot *myslot;
 
-static void waitforidle ();
-static uint32_t waitfordone (int func);
+static VeriSlot *getslot ();
 static void futexwait (int *cell, int valu);
 
 // equivalent of opening /proc/zynqpdp11
 // set up access to shared page
 uint32_t volatile *verisim_init ()
 {
-    int shmfd = shm_open (VERISIM_SHMNM, O_RDWR, 0);
+    char const *shmnm = z11instname (VERISIM_SHMNM);
+    int shmfd = shm_open (shmnm, O_RDWR, 0);
     if (shmfd < 0) {
-        fprintf (stderr, "verisim_init: error opening %s: %m\n", VERISIM_SHMNM);
+        fprintf (stderr, "verisim_init: error opening %s: %m\n", shmnm);
         ABORT ();
     }
 
-    mypid = getpid ();
-
     void *ptr = mmap (NULL, sizeof *pageptr, PROT_READ | PROT_WRITE, MAP_SHARED, shmfd, 0);
     if (ptr == MAP_FAILED) ABORT ();
     pageptr = (VeriPage *) ptr;
 
+    if (pageptr->ident != VERISIM_IDENT) {
+        fprintf (stderr, "verisim_init: ident %08X should be %08X, rebuild verimain\n", pageptr->ident, VERISIM_IDENT);
+        ABORT ();
+    }
+
     serverpid = pageptr->serverpid;
     if ((serverpid <= 0) || (kill (serverpid, 0) < 0)) {
         fprintf (stderr, "verisim_init: server %d dead\n", serverpid);
@@ -77,22 +87,92 @@ uint32_t volatile *verisim_init ()
 // wrapper for all read accesses to fpga register page
 uint32_t verisim_read (uint32_t volatile *addr)
 {
-    waitforidle ();
-
-    pageptr->indx = addr - nullpage;
-
-    return waitfordone (VERISIM_READ);
+    VeriCmd cmd;
+    verisim_cmd (&cmd, VERISIM_CMD_READ, addr);
+    verisim_batch (&cmd, 1);
+    return cmd.data;
 }
 
 // wrapper for all write accesses to fpga register page
 void verisim_write (uint32_t volatile *addr, uint32_t data)
 {
-    waitforidle ();
+    VeriCmd cmd;
+    verisim_cmd (&cmd, VERISIM_CMD_WRITE, addr, data);
+    verisim_batch (&cmd, 1);
+}
 
-    pageptr->indx = addr - nullpage;
-    pageptr->data = data;
+// fill in a command for verisim_batch()
+//  input:
+//   func = VERISIM_CMD_*
+//   addr = register in page returned by verisim_init()
+//   data = write data or poll compare value
+//   mask = poll mask
+//   limit = poll gives up after this many reads
+void verisim_cmd (VeriCmd *cmd, int func, uint32_t volatile *addr, uint32_t data, uint32_t mask, uint32_t limit)
+{
+    uint32_t indx = addr - nullpage;
+    if (indx > 1023) ABORT ();
+    cmd->func  = func;
+    cmd->indx  = indx;
+    cmd->data  = data;
+    cmd->mask  = mask;
+    cmd->limit = limit;
+}
+
+// have verimain do a list of register accesses
+// each VERISIM_MAXCMDS of them takes one round trip
+//  input:
+//   cmds = filled in by verisim_cmd()
+//   ncmds = number of cmds
+//  output:
+//   returns number of cmds completed, less than ncmds if a poll timed out
+//   cmds[].data = filled in for reads and polls, including the poll that timed out
+int verisim_batch (VeriCmd *cmds, int ncmds)
+{
+    VeriSlot *slot = getslot ();
+
+    int done = 0;
+    while (done < ncmds) {
+        int n = ncmds - done;
+        if (n > VERISIM_MAXCMDS) n = VERISIM_MAXCMDS;
+        memcpy (slot->cmds, cmds + done, n * sizeof *cmds);
+        slot->ncmds = n;
+        slot->ndone = 0;
+
+        // hand slot to verimain, it scans slots whenever pending is non-zero
+        __atomic_store_n (&slot->state, VERISIM_READY, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch (&pageptr->pending, 1, __ATOMIC_SEQ_CST);
+
+        for (int state; (state = __atomic_load_n (&slot->state, __ATOMIC_SEQ_CST)) != VERISIM_DONE;) {
+            futexwait (&slot->state, state);
+        }
 
-    waitfordone (VERISIM_WRITE);
+        // copy results including the poll that timed out
+        int ndone = slot->ndone;
+        memcpy (cmds + done, slot->cmds, ((ndone < n) ? ndone + 1 : n) * sizeof *cmds);
+        slot->state = VERISIM_IDLE;
+        done += ndone;
+        if (ndone < n) break;
+    }
+    return done;
+}
+
+// have verimain save the model state to a file, restore with verimain -restore
+// done between register accesses so the state is at a clock boundary
+//  output:
+//   returns 0 if successful, else negative errno
+int verisim_save (char const *filename)
+{
+    if (strlen (filename) >= VERISIM_SAVENMSZ) return -ENAMETOOLONG;
+
+    VeriSlot *slot = getslot ();
+    strcpy (slot->savename, filename);
+
+    VeriCmd cmd;
+    memset (&cmd, 0, sizeof cmd);
+    cmd.func = VERISIM_CMD_SAVE;
+    verisim_batch (&cmd, 1);
+    return - (int) cmd.data;
 }
 
 // simulates the ioctl (ZGIOCTL_WFI) call
@@ -104,44 +184,44 @@ void verisim_wfi (uint32_t mask)
     }
 }
 
-// wait for the state to be IDLE
-// mark the struct in use by this client
-static void waitforidle ()
+// simulates the ioctl (ZGIOCTL_WFITO) call
+// - waits for (reg[ZG_INTFLAGS] & mask) != 0 or ZGWFITO_MS to elapse
+void verisim_wfito (uint32_t mask)
 {
-    while (true) {
-        int state = pageptr->state;
-        if (state != VERISIM_IDLE) {
-            futexwait (&pageptr->state, state);
-        } else {
-            if (atomic_compare_exchange (&pageptr->state, &state, VERISIM_BUSY)) break;
-        }
+    uint32_t armintmsk = pageptr->armintmsk;
+    if ((armintmsk & mask) == 0) {
+        struct timespec when;
+        memset (&when, 0, sizeof when);
+        when.tv_nsec = ZGWFITO_MS * 1000000;
+        if ((futex ((int *) &pageptr->armintmsk, FUTEX_WAIT, armintmsk, &when, NULL, 0) < 0) &&
+                (errno != EAGAIN) && (errno != EINTR) && (errno != ETIMEDOUT)) ABORT ();
     }
-    pageptr->clientpid = mypid;
 }
 
-// transition from BUSY to the given state
-// then wait for state to be DONE
-// grab the data returned therein
-// finally set state to IDLE
-static uint32_t waitfordone (int func)
+// get slot for the calling thread
+// claim a free one or one left over by an exited thread on first call
+// forked child gets its own as the tid changes
+static VeriSlot *getslot ()
 {
-    int busy = VERISIM_BUSY;
-    if (! atomic_compare_exchange (&pageptr->state, &busy, func)) ABORT ();
-    if (futex (&pageptr->state, FUTEX_WAKE, 1000000000, NULL, NULL, 0) < 0) ABORT ();
-
-    int state;
-    while (true) {
-        state = pageptr->state;
-        if (state == VERISIM_DONE) break;
-        futexwait (&pageptr->state, state);
+    int tid = syscall (SYS_gettid);
+    if ((myslot != NULL) && (myslottid == tid)) return myslot;
+
+    for (int pass = 0; pass < 2; pass ++) {
+        for (int i = 0; i < VERISIM_NSLOTS; i ++) {
+            VeriSlot *slot = &pageptr->slots[i];
+            int owner = slot->clienttid;
+            if ((owner != 0) && ((pass == 0) || (kill (owner, 0) == 0) || (errno != ESRCH))) continue;
+            if (atomic_compare_exchange (&slot->clienttid, &owner, tid)) {
+                slot->state = VERISIM_IDLE;
+                myslottid = tid;
+                myslot = slot;
+                return slot;
+            }
+        }
     }
 
-    uint32_t data = pageptr->data;
-
-    if (! atomic_compare_exchange (&pageptr->state, &state, VERISIM_IDLE)) ABORT ();
-    if (futex (&pageptr->state, FUTEX_WAKE, 1000000000, NULL, NULL, 0) < 0) ABORT ();
-
-    return data;
+    fprintf (stderr, "verisim getslot: all %d slots in use\n", VERISIM_NSLOTS);
+    ABORT ();
 }
 
 // wait for the cell to be something other than valu
@@ -24,27 +24,58 @@
 #include <stdint.h>
 
 #define VERISIM_SHMNM "/shm_verisim"
-#define VERISIM_IDENT (('V' << 24) | ('E' << 16) | 0x2001)
+#define VERISIM_IDENT (('V' << 24) | ('E' << 16) | 0x2003)
 
-#define VERISIM_IDLE  0
-#define VERISIM_BUSY  1
-#define VERISIM_READ  2
-#define VERISIM_WRITE 3
-#define VERISIM_DONE  4
+#define VERISIM_NSLOTS 32           // number of client threads that can have a batch in flight
+#define VERISIM_MAXCMDS 256         // max commands in a batch
+#define VERISIM_SAVENMSZ 480        // max length of checkpoint filename including null
+
+// slot states
+#define VERISIM_IDLE  0             // owned by a client, nothing queued
+#define VERISIM_READY 1             // client has filled in cmds, verimain to process them
+#define VERISIM_DONE  2             // verimain has processed them, client to fetch results
+
+// command functions
+#define VERISIM_CMD_READ   1        // data = register
+#define VERISIM_CMD_WRITE  2        // register = data
+#define VERISIM_CMD_POLLEQ 3        // read register until (register & mask) == data, data = last read
+#define VERISIM_CMD_POLLNE 4        // read register until (register & mask) != data, data = last read
+#define VERISIM_CMD_SAVE   5        // save model state to slot savename, data = 0 or errno
+
+struct VeriCmd {
+    uint16_t func;                  // VERISIM_CMD_*
+    uint16_t indx;                  // register index
+    uint32_t data;                  // write data, poll compare value; read data on return
+    uint32_t mask;                  // poll mask
+    uint32_t limit;                 // poll gives up after this many reads
+};
+
+// one per client thread
+// a poll hitting its limit ends the batch early
+struct VeriSlot {
+    int state;                      // VERISIM_IDLE,READY,DONE
+    int clienttid;                  // 0: free; else owning thread
+    int ncmds;                      // number of cmds queued
+    int ndone;                      // number completed, ncmds unless a poll timed out
+    VeriCmd cmds[VERISIM_MAXCMDS];
+    char savename[VERISIM_SAVENMSZ];
+};
 
 struct VeriPage {
     uint32_t ident;
-    int state;
     int serverpid;
-    int clientpid;
-    uint32_t data;
-    uint16_t indx;
     uint32_t armintmsk;
+    int pending;                    // number of slots possibly in READY state
+    VeriSlot slots[VERISIM_NSLOTS];
 };
 
 uint32_t volatile *verisim_init ();
 uint32_t verisim_read (uint32_t volatile *addr);
 void verisim_write (uint32_t volatile *addr, uint32_t data);
+void verisim_cmd (VeriCmd *cmd, int func, uint32_t volatile *addr, uint32_t data = 0, uint32_t mask = 0, uint32_t limit = 0);
+int verisim_batch (VeriCmd *cmds, int ncmds);
+int verisim_save (char const *filename);
 void verisim_wfi (uint32_t mask);
+void verisim_wfito (uint32_t mask);
 
 #endif
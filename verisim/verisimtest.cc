@@ -0,0 +1,259 @@
+//    Copyright (C) Mike Rieker, Beverly, MA USA
+//    www.outerworldapps.com
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; version 2 of the License.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    EXPECT it to FAIL when someone's HeALTh or PROpeRTy is at RISk.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    http://www.gnu.org/licenses/gpl-2.0.html
+
+// check verisim.cc client side of the verimain slot protocol without verilator
+// a thread here plays verimain, handling slots the same way but with a plain register array
+// ...register COUNTREG counts up by one each time it is read so polls have something to wait for
+//  ./verisimtest.x86_64
+//  exit status 0 if all checks pass
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "../ccode/futex.h"
+#include "../ccode/z11inst.h"
+#include "verisim.h"
+
+#define COUNTREG 7
+#define NTHREADS 8
+
+#define CHECK(cond) do { if (! (cond)) { fprintf (stderr, "verisimtest: line %d: %s failed\n", __LINE__, #cond); nfails ++; } } while (0)
+
+static bool volatile stopserver;
+static int nbatches;                    // number of slots processed by server
+static int nfails;
+static uint32_t regs[1024];
+static uint32_t volatile *zynqpage;
+static VeriPage *pageptr;
+
+static void *serverthread (void *dummy);
+static void runslot (VeriSlot *slot);
+static void *rwthread (void *zidx);
+static void *readthread (void *dummy);
+
+int main (int argc, char **argv)
+{
+    // make up an instance so we don't disturb a real verimain
+    char instname[32];
+    sprintf (instname, "verisimtest%d", (int) getpid ());
+    setenv ("Z11INSTANCE", instname, 1);
+
+    // set up shared page the way verimain does
+    char const *shmnm = z11instname (VERISIM_SHMNM);
+    int shmfd = shm_open (shmnm, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (shmfd < 0) {
+        fprintf (stderr, "verisimtest: error creating %s: %m\n", shmnm);
+        return 1;
+    }
+    if (ftruncate (shmfd, sizeof *pageptr) < 0) {
+        fprintf (stderr, "verisimtest: error setting %s size: %m\n", shmnm);
+        shm_unlink (shmnm);
+        return 1;
+    }
+    void *ptr = mmap (NULL, sizeof *pageptr, PROT_READ | PROT_WRITE, MAP_SHARED, shmfd, 0);
+    if (ptr == MAP_FAILED) abort ();
+    close (shmfd);
+    pageptr = (VeriPage *) ptr;
+    memset (pageptr, 0, sizeof *pageptr);
+    pageptr->ident = VERISIM_IDENT;
+    pageptr->serverpid = getpid ();
+
+    pthread_t svrtid;
+    if (pthread_create (&svrtid, NULL, serverthread, NULL) != 0) abort ();
+
+    zynqpage = verisim_init ();
+
+    // single read and write
+    verisim_write (&zynqpage[3], 0x12345678);
+    CHECK (regs[3] == 0x12345678);
+    CHECK (verisim_read (&zynqpage[3]) == 0x12345678);
+
+    // batch bigger than a slot gets split into round trips
+    {
+        static VeriCmd cmds[600];
+        for (int i = 0; i < 300; i ++) {
+            verisim_cmd (&cmds[i], VERISIM_CMD_WRITE, &zynqpage[100+i], i * 3 + 1);
+            verisim_cmd (&cmds[300+i], VERISIM_CMD_READ, &zynqpage[100+i]);
+        }
+        int before = __atomic_load_n (&nbatches, __ATOMIC_SEQ_CST);
+        CHECK (verisim_batch (cmds, 600) == 600);
+        CHECK (__atomic_load_n (&nbatches, __ATOMIC_SEQ_CST) - before == (600 + VERISIM_MAXCMDS - 1) / VERISIM_MAXCMDS);
+        int nbad = 0;
+        for (int i = 0; i < 300; i ++) {
+            if (cmds[300+i].data != (uint32_t) i * 3 + 1) nbad ++;
+        }
+        CHECK (nbad == 0);
+    }
+
+    // POLLEQ that succeeds goes on to the next command
+    {
+        VeriCmd cmds[3];
+        verisim_cmd (&cmds[0], VERISIM_CMD_POLLEQ, &zynqpage[COUNTREG], 5, 15, 100);
+        verisim_cmd (&cmds[1], VERISIM_CMD_WRITE, &zynqpage[4], 44);
+        verisim_cmd (&cmds[2], VERISIM_CMD_READ, &zynqpage[4]);
+        CHECK (verisim_batch (cmds, 3) == 3);
+        CHECK ((cmds[0].data & 15) == 5);
+        CHECK (cmds[2].data == 44);
+    }
+
+    // POLLNE that hits its limit ends the batch with the last value read
+    {
+        VeriCmd cmds[3];
+        verisim_cmd (&cmds[0], VERISIM_CMD_WRITE, &zynqpage[4], 55);
+        verisim_cmd (&cmds[1], VERISIM_CMD_POLLNE, &zynqpage[3], 0x5678, 0xFFFF, 10);
+        verisim_cmd (&cmds[2], VERISIM_CMD_WRITE, &zynqpage[4], 66);
+        CHECK (verisim_batch (cmds, 3) == 1);
+        CHECK (cmds[1].data == 0x12345678);
+        CHECK (regs[4] == 55);
+    }
+
+    // POLLNE that succeeds
+    {
+        VeriCmd cmd;
+        verisim_cmd (&cmd, VERISIM_CMD_POLLNE, &zynqpage[3], 0x5678, 0xFFFF0000, 10);
+        CHECK (verisim_batch (&cmd, 1) == 1);
+        CHECK (cmd.data == 0x12345678);
+    }
+
+    // several threads at once, each gets its own slot
+    {
+        pthread_t tids[NTHREADS];
+        for (long i = 0; i < NTHREADS; i ++) {
+            if (pthread_create (&tids[i], NULL, rwthread, (void *) i) != 0) abort ();
+        }
+        for (int i = 0; i < NTHREADS; i ++) {
+            void *nbad;
+            pthread_join (tids[i], &nbad);
+            CHECK (nbad == NULL);
+        }
+    }
+
+    // more threads than slots one after another, slots left by exited threads get reclaimed
+    for (int i = 0; i < VERISIM_NSLOTS * 3; i ++) {
+        pthread_t tid;
+        if (pthread_create (&tid, NULL, readthread, NULL) != 0) abort ();
+        pthread_join (tid, NULL);
+    }
+
+    stopserver = true;
+    pthread_join (svrtid, NULL);
+    shm_unlink (shmnm);
+
+    printf ("verisimtest: %d failed\n", nfails);
+    return (nfails == 0) ? 0 : 1;
+}
+
+// stand-in for verimain main loop
+static void *serverthread (void *dummy)
+{
+    int lastslot = 0;
+    while (! stopserver) {
+        VeriSlot *slot = NULL;
+        if (__atomic_load_n (&pageptr->pending, __ATOMIC_SEQ_CST) != 0) {
+            for (int i = 0; i < VERISIM_NSLOTS; i ++) {
+                lastslot = (lastslot + 1) % VERISIM_NSLOTS;
+                if (__atomic_load_n (&pageptr->slots[lastslot].state, __ATOMIC_SEQ_CST) == VERISIM_READY) {
+                    slot = &pageptr->slots[lastslot];
+                    break;
+                }
+            }
+        }
+        if (slot == NULL) {
+            usleep (10);
+        } else {
+            runslot (slot);
+            __atomic_sub_fetch (&pageptr->pending, 1, __ATOMIC_SEQ_CST);
+        }
+    }
+    return NULL;
+}
+
+// stand-in for verimain runslot()
+static void runslot (VeriSlot *slot)
+{
+    int ncmds = slot->ncmds;
+    if ((ncmds < 0) || (ncmds > VERISIM_MAXCMDS)) abort ();
+
+    int ndone;
+    for (ndone = 0; ndone < ncmds; ndone ++) {
+        VeriCmd *cmd = &slot->cmds[ndone];
+        uint32_t index = cmd->indx;
+        if (index > 1023) abort ();
+        switch (cmd->func) {
+            case VERISIM_CMD_READ: {
+                cmd->data = (index == COUNTREG) ? regs[index] ++ : regs[index];
+                continue;
+            }
+            case VERISIM_CMD_WRITE: {
+                regs[index] = cmd->data;
+                continue;
+            }
+            case VERISIM_CMD_POLLEQ:
+            case VERISIM_CMD_POLLNE: {
+                bool eq = cmd->func == VERISIM_CMD_POLLEQ;
+                uint32_t data;
+                for (uint32_t i = 0;; i ++) {
+                    data = (index == COUNTREG) ? regs[index] ++ : regs[index];
+                    if (((data & cmd->mask) == cmd->data) == eq) break;
+                    if (i >= cmd->limit) break;
+                }
+                bool ok = ((data & cmd->mask) == cmd->data) == eq;
+                cmd->data = data;
+                if (ok) continue;
+                break;
+            }
+            default: abort ();
+        }
+        break;
+    }
+
+    __atomic_add_fetch (&nbatches, 1, __ATOMIC_SEQ_CST);
+    slot->ndone = ndone;
+    __atomic_store_n (&slot->state, VERISIM_DONE, __ATOMIC_SEQ_CST);
+    if (futex (&slot->state, FUTEX_WAKE, 1000000000, NULL, NULL, 0) < 0) abort ();
+}
+
+// write and read back a register of our own many times
+//  returns NULL if all good
+static void *rwthread (void *zidx)
+{
+    long idx = (long) zidx;
+    long nbad = 0;
+    for (uint32_t i = 0; i < 1000; i ++) {
+        uint32_t data = (idx << 16) | i;
+        verisim_write (&zynqpage[200+idx], data);
+        if (verisim_read (&zynqpage[200+idx]) != data) nbad ++;
+    }
+    return (void *) nbad;
+}
+
+// just do one read, leaving our slot behind when we exit
+static void *readthread (void *dummy)
+{
+    verisim_read (&zynqpage[3]);
+    return NULL;
+}
@@ -27,6 +27,7 @@ module bigmem (
     input fpgaoff,  // powerup | (fpgamode == FM_OFF)
     input businit,  // fpgaoff | (unibus init)
 
+    input armread,
     input armwrite,
     input[2:0] armraddr, armwaddr,
     input[31:00] armwdata,
@@ -48,14 +49,14 @@ module bigmem (
     reg[3:0] armcount, brjama, ctladdr, delayline;
     reg[17:00] armaddr;
     reg[15:00] armdata, ctlreg, brenab;
-    reg armpehi, armpelo, brjamepc, brjameps, ctlenab;
+    reg armainc, armpehi, armpelo, armsread, brjamepc, brjameps, ctlenab;
 
-    assign armrdata = (armraddr == 0) ? 32'h424D2009 :          // [31:16] = 'BM'; [15:12] = (log2 nreg) - 1; [11:00] = version
+    assign armrdata = (armraddr == 0) ? 32'h424D200A :          // [31:16] = 'BM'; [15:12] = (log2 nreg) - 1; [11:00] = version
                       (armraddr == 1) ? { enable[31:00] } :     //00 rw enable unibus access for addresses 000000..377777
                       (armraddr == 2) ? { 2'b0,                 //30
                                           enable[61:32] } :     //00 rw enable unibus access for addresses 400000..757777
                       (armraddr == 3) ? { armfunc,              //29 rw 4=read; 3=write word; 2=write high byte; 1=write low byte (self clearing)
-                                          1'b0,                 //28
+                                          armainc,              //28 rw increment armaddr by 2 after each access
                                           armcount,             //24 ro number of arm cycles done (debug)
                                           6'b0,                 //18
                                           armaddr } :           //00 rw word being accessed (bit 00 ignored)
@@ -76,6 +77,13 @@ module bigmem (
                                           brjamepc | brjameps,  //20 boot rom jam enable
                                           brjama,               //16 boot rom jam addr bits
                                           brenab } :            //00 boot rom addr enables
+                      (armraddr == 7) ? { armfunc != 0,         //31 ro arm access in progress, armdata not valid
+                                          13'b0,                //18
+                                          armpehi,              //17 ro high byte parity error
+                                          armpelo,              //16 ro low byte parity error
+                                          armdata } :           //00 rw streaming data port
+                                                                //      reading: word from last read, starts reading next word if armainc & armfunc was 4
+                                                                //      writing: write word at armaddr
                       32'hDEADBEEF;
 
     reg[16:00]  extmemaddr;
@@ -108,8 +116,10 @@ module bigmem (
 
     always @(posedge CLOCK) begin
         if (powerup) begin
+            armainc    <= 0;
             armcount   <= 0;
             armfunc    <= 0;
+            armsread   <= 0;
             ctlenab    <= 0;
             enable     <= 0;
             brjamepc   <= 0;
@@ -140,8 +150,10 @@ module bigmem (
                     enable[61:32] <= armwdata[29:00];
                 end
                 3: begin
-                    armfunc <= armwdata[31:29];
-                    armaddr <= armwdata[17:00];
+                    armfunc  <= armwdata[31:29];
+                    armainc  <= armwdata[28];
+                    armaddr  <= armwdata[17:00];
+                    armsread <= (armwdata[31:29] == 4) & armwdata[28];
                 end
                 4: begin
                     armdata <= armwdata[15:00];
@@ -158,9 +170,22 @@ module bigmem (
                     brjama   <= armwdata[19:16]; // what a<12:09> get jammed to (a<17:13> get jammed to 11111)
                     brenab   <= armwdata[15:00]; // each 512-byte segment from 760000..777777 to enable
                 end
+                7: begin
+                    armdata  <= armwdata[15:00];
+                    armfunc  <= 3;
+                    armpelo  <= 0;
+                    armpehi  <= 0;
+                    armsread <= 0;
+                end
             endcase
         end
 
+        // arm processor just read the streaming data port
+        // if streaming reads, start reading the next word
+        if (~ powerup & armread & (armraddr == 7) & armsread & (armfunc == 0)) begin
+            armfunc <= 4;
+        end
+
         if (~ powerup & ~ armwrite) case (delayline)
 
             // wait for something to do
@@ -261,6 +286,7 @@ module bigmem (
                     armpehi <= perdinhi;
                     armpelo <= perdinlo;
                 end
+                if (armainc) armaddr <= armaddr + 2;
                 armcount   <= armcount + 1;
                 armfunc    <= 0;
                 delayline  <= 0;
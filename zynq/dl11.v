@@ -29,6 +29,7 @@ module dl11
     input[1:0] armraddr, armwaddr,
     input[31:00] armwdata,
     output[31:00] armrdata,
+    output armintrq,
 
     output intreq,
     output[7:0] irvec,
@@ -47,11 +48,14 @@ module dl11
     reg enable;
     reg[15:00] rcsr, rbuf, xcsr, xbuf;
 
-    assign armrdata = (armraddr == 0) ? 32'h444C1002 : // [31:16] = 'DL'; [15:12] = (log2 nreg) - 1; [11:00] = version
+    assign armrdata = (armraddr == 0) ? 32'h444C1003 : // [31:16] = 'DL'; [15:12] = (log2 nreg) - 1; [11:00] = version
                       (armraddr == 1) ? { rbuf, rcsr } :
                       (armraddr == 2) ? { xbuf, xcsr } :
                       { enable, 5'b0, INTVEC, ADDR };
 
+    // wake z11dl.cc when pdp has a character to print
+    assign armintrq = ~ xcsr[07];
+
     intreq dlintreq (
         .CLOCK    (CLOCK),
         .RESET    (init_in_h),
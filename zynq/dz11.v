@@ -27,6 +27,7 @@ module dz11 (
     input[2:0] armraddr, armwaddr,
     input[31:00] armwdata,
     output[31:00] armrdata,
+    output armintrq,
 
     output intreq,
     output[7:0] irvec,
@@ -78,7 +79,7 @@ module dz11 (
     // this alows two processes to write to their own 16-bit half of a 32-bit word without messing with thhe other's half
     // as they must set <13> or <12> on their half, always leaving them clear on the other half.
 
-    assign armrdata = (armraddr == 0) ? 32'h445A2005 : // [31:16] = 'DZ'; [15:12] = (log2 nreg) - 1; [11:00] = version
+    assign armrdata = (armraddr == 0) ? 32'h445A2006 : // [31:16] = 'DZ'; [15:12] = (log2 nreg) - 1; [11:00] = version
                       (armraddr == 1) ? { enable, 5'b0, intvec, addres } :
                       (armraddr == 2) ? { rbr, csr } :
                       (armraddr == 3) ? { txenab, 7'b0, siloctr, silorem, rxenab } :
@@ -105,6 +106,9 @@ module dz11 (
 
     assign rbr = { csr_07_rdone, 4'b0, rbuf };
 
+    // wake z11dz.cc when pdp has a character for any line to print
+    assign armintrq = prful != 0;
+
     wire[2:0] armevn = { armwaddr[1:0], 1'b0 };
     wire[2:0] armodd = { armwaddr[1:0], 1'b1 };
 
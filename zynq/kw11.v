@@ -50,6 +50,11 @@ module kw11 (
 
     assign irvec = 8'o100;
 
+`ifdef VERILATOR
+    // verimain.cc idle fast-forward, returns non-zero to skip ahead to next trigger toggle
+    import "DPI-C" function int verimain_kw11skip ();
+`endif
+
     always @(posedge CLOCK) begin
         if (RESET) begin
             counter <= 0;
@@ -70,12 +75,20 @@ module kw11 (
                 // 1E8/50 = 2E6
                 if (counter == 0) trigger <= ~ trigger;
                 counter <= (counter == 1999999) ? 0 : counter + 1;
+`ifdef VERILATOR
+                if ((counter != 0) && (verimain_kw11skip () != 0)) counter <= 0;
+`endif
             end else begin
 
                 // toggle trigger 60 times a second
                 // 1E8/60 = 1E7/6 = 5E6/3
                 if ((counter == 0) | (counter == 4999999/3) | (counter == 4999999*2/3)) trigger <= ~ trigger;
                 counter <= (counter == 4999999) ? 0 : counter + 1;
+`ifdef VERILATOR
+                if ((counter != 0) && (counter != 4999999/3) && (counter != 4999999*2/3) && (verimain_kw11skip () != 0)) begin
+                    counter <= (counter < 4999999/3) ? 4999999/3 : (counter < 4999999*2/3) ? 4999999*2/3 : 0;
+                end
+`endif
             end
         end
 
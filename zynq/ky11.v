@@ -25,14 +25,17 @@
 //   can also be used by arm devices for dma
 //   note dma functionality works regardless of whether processor is running or halted,
 //   ...reverting to examine/deposit when halted (ie, doesn't bother with npr/npg like real KY11)
+// * burst dma for block transfers
+//   arm streams words through a fifo (register 7) whilst ky11.v runs the bus cycles
 
 module ky11 (
     input CLOCK, powerup, fpgaoff,
 
-    input armwrite,
+    input armread, armwrite,
     input[2:0] armraddr, armwaddr,
     input[31:00] armwdata,
     output[31:00] armrdata,
+    output armintrq,
 
     input turbo,
 
@@ -80,10 +83,17 @@ module ky11 (
     reg[31:00] dmalock;
     reg[17:16] sr1716;
 
+    // burst dma
+    reg bbusy, bcycle, bnoinc, bperr, btimo, bwrite;
+    reg[7:0] bgetidx, bputidx;
+    reg[8:0] bfill;
+    reg[15:00] bfifo[255:0];
+    reg[16:00] bcount;
+
     reg[15:00] dma_d_out_h, swr_d_out_h;
     assign d_out_h = dma_d_out_h | swr_d_out_h;
 
-    assign armrdata = (armraddr == 0) ? 32'h4B592015 : // [31:16] = 'KY'; [15:12] = (log2 nreg) - 1; [11:00] = version
+    assign armrdata = (armraddr == 0) ? 32'h4B592017 : // [31:16] = 'KY'; [15:12] = (log2 nreg) - 1; [11:00] = version
                       (armraddr == 1) ? {
                             lights,         //16 ro 777570 light register
                             switches } :    //00 rw 777570 switch register
@@ -116,10 +126,29 @@ module ky11 (
                       (armraddr == 5) ? {
                             dmalock } :     //00 rw 0=dma circuitry not in use; else 32-bit pid of process using dma circuitry
                                             //      (see Z11Util::dmalock())
-                      32'hDEADBEEF;
+                      (armraddr == 6) ? {
+                            bbusy,          //31 rw arm sets to 1 to start burst, ky11.v clears when done; arm clears to abort
+                            bwrite,         //30 rw 0=DATI bus to fifo; 1=DATO fifo to bus
+                            bnoinc,         //29 rw 0=increment dmaaddr by 2 each word; 1=bus address inhibit
+                            btimo,          //28 ro burst stopped by dma cycle timeout
+                            bperr,          //27 ro burst stopped by dma read parity error
+                            bfill,          //18 ro number of words in fifo (0..256)
+                            1'b0,           //17
+                            bcount } :      //00 rw number of words remaining to be transferred on unibus
+                      { 7'b0,
+                            bfill,          //16 ro number of words in fifo before this read (0=data not valid)
+                            bfifo[bgetidx] }; //00 rw read: pop word from fifo (DATI); write: push word to fifo (DATO)
 
     assign npg_out_l = npr_out_h ? 1 : npg_in_l;
 
+    // wake Z11Page when dma cycle or burst is done
+    assign armintrq = ~ bbusy & (dmastate == 0);
+
+    // burst fifo push/pop
+    wire bcycok = bbusy & bcycle & (dmastate == 0) & ~ dmatimo & ~ dmaperr;
+    wire bpush  = bwrite ? (armwrite & (armwaddr == 7) & ~ bfill[8]) : bcycok;
+    wire bpop   = bwrite ? bcycok : (armread & (armraddr == 7) & (bfill != 0));
+
     always @(posedge CLOCK) begin
         if (init_in_h) begin
             if (fpgaoff) begin
@@ -335,6 +364,77 @@ module ky11 (
             end
         end
 
+        // burst dma
+        //  arm processor must:
+        //   1) use dmalock to lock dma so nothing else is using dma circuit
+        //   2) write dmaaddr with dmastate = 0 (register 3)
+        //   3) write bbusy = 1, bwrite, bnoinc, bcount (register 6)
+        //   4) DATI: read register 7 until bcount words received, each read is valid if bfill != 0
+        //      DATO: write register 7 with bcount words, keeping fifo from overflowing by checking bfill
+        //   5) wait for bbusy = 0, then check btimo, bperr and bcount for words remaining
+        //   6) release dmalock
+        //  ky11.v stops at the first dma cycle that times out or gets a parity error
+        if (init_in_h) begin
+            bbusy   <= 0;
+            bcycle  <= 0;
+            bfill   <= 0;
+            bgetidx <= 0;
+            bputidx <= 0;
+        end else begin
+
+            // push word onto fifo: arm writing register 7 for DATO or dma cycle completed for DATI
+            if (bpush) begin
+                bfifo[bputidx] <= bwrite ? armwdata[15:00] : dmadata;
+                bputidx <= bputidx + 1;
+            end
+
+            // pop word from fifo: arm read register 7 for DATI or dma cycle completed for DATO
+            if (bpop) begin
+                bgetidx <= bgetidx + 1;
+            end
+
+            bfill <= bfill + { 8'b0, bpush } - { 8'b0, bpop };
+
+            // dma cycle started by burst just finished
+            // stop burst on error, otherwise count the word and step address
+            if (bcycle & (dmastate == 0)) begin
+                bcycle <= 0;
+                if (bbusy) begin
+                    if (dmatimo | dmaperr) begin
+                        bbusy  <= 0;
+                        bperr  <= dmaperr;
+                        btimo  <= dmatimo;
+                    end else begin
+                        if (bcount == 1) bbusy <= 0;
+                        if (~ bnoinc) dmaaddr <= dmaaddr + 2;
+                        bcount <= bcount - 1;
+                    end
+                end
+            end
+
+            // start another dma cycle if there is room in fifo for DATI or data in fifo for DATO
+            else if (bbusy & ~ bcycle & (dmastate == 0) & (bcount != 0) & (bwrite ? (bfill != 0) : ~ bfill[8])) begin
+                bcycle   <= 1;
+                dmactrl  <= { bwrite, 1'b0 };
+                dmadata  <= bfifo[bgetidx];
+                dmastate <= 1;
+                dmatimo  <= 1;
+            end
+
+            // arm is starting or aborting a burst, reset fifo
+            if (armwrite & (armwaddr == 6)) begin
+                bbusy   <= armwdata[31] & (armwdata[16:00] != 0);
+                bwrite  <= armwdata[30];
+                bnoinc  <= armwdata[29];
+                bperr   <= 0;
+                btimo   <= 0;
+                bcount  <= armwdata[16:00];
+                bfill   <= 0;
+                bgetidx <= 0;
+                bputidx <= 0;
+            end
+        end
+
         // dma transaction initiated by arm processor
         if (~ init_in_h) case (dmastate)
 
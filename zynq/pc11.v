@@ -29,6 +29,8 @@ module pc11
     input[1:0] armraddr, armwaddr,
     input[31:00] armwdata,
     output[31:00] armrdata,
+    output armrintrq,   // wake z11pc.cc reader: pdp wants a byte
+    output armpintrq,   // wake z11pc.cc punch: pdp has punched a byte
 
     output intreq,      // interrupt being requested
     output[7:0] irvec,  // vector for the interrupt request
@@ -48,11 +50,14 @@ module pc11
     reg[15:00] rcsr, rbuf, xcsr, xbuf;
     wire pulserirq;
 
-    assign armrdata = (armraddr == 0) ? 32'h50431004 : // [31:16] = 'PC'; [15:12] = (log2 nreg) - 1; [11:00] = version
+    assign armrdata = (armraddr == 0) ? 32'h50431005 : // [31:16] = 'PC'; [15:12] = (log2 nreg) - 1; [11:00] = version
                       (armraddr == 1) ? { rbuf, rcsr } :
                       (armraddr == 2) ? { xbuf, xcsr } :
                       { enable, 5'b0, INTVEC, ADDR };
 
+    assign armrintrq = rcsr[00];
+    assign armpintrq = ~ xcsr[07];
+
     intreq pcintreq (
         .CLOCK    (CLOCK),
         .RESET    (init_in_h),
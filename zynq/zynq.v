@@ -114,7 +114,7 @@ module Zynq (
 );
 
     // [31:16] = '11'; [15:12] = (log2 len)-1; [11:00] = version
-    localparam VERSION = 32'h3131402A;
+    localparam VERSION = 32'h3131402D;
 
     // bus values that are constants
     assign saxi_BRESP = 0;  // A3.4.4/A10.3 transfer OK
@@ -365,6 +365,12 @@ module Zynq (
 
     wire sim_reset_h = fpgaoff | (fpgamode != FM_SIM);
 
+`ifdef VERILATOR
+    // let verimain.cc know when simulator is doing WAIT instruction so it can skip idle time
+    import "DPI-C" function void verimain_simwaiting (input int waiting);
+    always @(posedge CLOCK) verimain_simwaiting ({ 31'b0, sim_waiting });
+`endif
+
     sim1134 siminst (
         .CLOCK (CLOCK),
         .RESET (sim_reset_h),
@@ -560,8 +566,12 @@ module Zynq (
         (readaddr[11:03] ==  9'b000101110)  ? kwarmrdata   :
         32'hDEADBEEF;
 
+    wire armread  = saxi_RVALID & saxi_RREADY;              // arm is accepting read data (single fpga clock cycle)
     wire armwrite = ~ saxi_AWREADY & ~ saxi_WREADY;         // arm is writing a register (single fpga clock cycle)
 
+    wire bmarmread  = armread  & (readaddr[11:05]  == 7'b0000101);
+    wire kyarmread  = armread  & (readaddr[11:05]  == 7'b0000111);
+
     wire rharmwrite = armwrite & (writeaddr[11:05] == 7'b0000100);
     wire bmarmwrite = armwrite & (writeaddr[11:05] == 7'b0000101);
     wire rlarmwrite = armwrite & (writeaddr[11:05] == 7'b0000110);
@@ -672,7 +682,7 @@ module Zynq (
     wire irq4_intr_out_h, irq5_intr_out_h, irq6_intr_out_h, irq7_intr_out_h;
     wire[7:0] irq4_d70_out_h, irq5_d70_out_h, irq6_d70_out_h, irq7_d70_out_h;
 
-    assign regarmintreq[29:04] = 0;
+    assign regarmintreq[29:09] = 0;
 
     // big memory
     wire bm_pb_out_h, bm_ssyn_out_h;
@@ -689,6 +699,7 @@ module Zynq (
         .armrdata (bmarmrdata),
         .armwaddr (writeaddr[4:2]),
         .armwdata (writedata),
+        .armread  (bmarmread),
         .armwrite (bmarmwrite),
 
         .a_in_h (dev_a_h),
@@ -716,6 +727,8 @@ module Zynq (
         .armwaddr (writeaddr[3:2]),
         .armwdata (writedata),
         .armwrite (pcarmwrite),
+        .armrintrq (regarmintreq[07]),
+        .armpintrq (regarmintreq[08]),
 
         .intreq (pcintreq),
         .irvec  (pcintvec),
@@ -873,9 +886,11 @@ module Zynq (
 
         .armraddr (readaddr[4:2]),
         .armrdata (kyarmrdata),
+        .armread  (kyarmread),
         .armwaddr (writeaddr[4:2]),
         .armwdata (writedata),
         .armwrite (kyarmwrite),
+        .armintrq (regarmintreq[04]),
 
         .turbo (turbo),
 
@@ -926,6 +941,7 @@ module Zynq (
         .armwaddr (writeaddr[3:2]),
         .armwdata (writedata),
         .armwrite (dlarmwrite),
+        .armintrq (regarmintreq[06]),
 
         .intreq (dlintreq),
         .irvec  (dlintvec),
@@ -956,6 +972,7 @@ module Zynq (
         .armwaddr (writeaddr[4:2]),
         .armwdata (writedata),
         .armwrite (dzarmwrite),
+        .armintrq (regarmintreq[05]),
 
         .intreq (dzintreq),
         .irvec  (dzintvec),